@@ -0,0 +1,626 @@
+/*
+ * arrow.c: Apache Arrow IPC stream export of MTZ columns
+ *
+ * Copyright (c) 2017 Frank Buermann <fburmann@mrc-lmb.cam.ac.uk>
+ *
+ * jsonmtz is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ * This software makes use of the jansson library (http://www.digip.org/jansson/)
+ * licensed under the terms of the MIT license,
+ * and the CCP4io library (http://www.ccp4.ac.uk/) licensed under the
+ * Lesser GNU General Public License 3.0.
+ */
+
+/*
+ * The stream holds a Schema message, one RecordBatch message per
+ * ARROW_BATCH_ROWS reflections and the end-of-stream marker. Each message
+ * is a continuation marker, the metadata length, a flatbuffer padded to
+ * eight bytes, and the message body.
+ *
+ * Flatbuffers are built front to back. A table is preceded by its vtable,
+ * and objects referenced from a table are appended after it, so that
+ * all unsigned offsets point forward as the format requires.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "jsonmtz.h"
+
+/**
+ * Writes the reflection data of an MTZ struct as an Arrow IPC stream.
+ * Columns of integral types are int32 fields if all their values are
+ * integers in the int32 range, all other columns are float32 fields.
+ * Missing values are null. The json object produced by readMtz() without
+ * column data is stored in the schema metadata under the key jsonmtz.
+ * @param[in] mtzin The MTZ struct.
+ * @param[in] file_out The output file.
+ * @param[in] opts Options struct.
+ * @return 0 on success, -1 on failure.
+ */
+
+int8_t writeArrowStream(const MTZ *mtzin, const char *file_out, const options_mtz2json_t *opts)
+{
+    FILE *fp = NULL;
+    fb_builder_t fb = {NULL, 0, 0, false};
+    const MTZCOL **cols = NULL;
+    size_t ncol = 0;
+    size_t *nulls = NULL;
+    uint8_t *integral = NULL;
+    json_t *jsonmtz = NULL;
+    char *metadata = NULL;
+    int8_t ret = 0;
+
+    cols = malloc((MtzNumActiveCol(mtzin) + 1) * sizeof(MTZCOL *));
+    nulls = malloc((MtzNumActiveCol(mtzin) + 1) * sizeof(size_t));
+    integral = malloc(MtzNumActiveCol(mtzin) + 1);
+    fp = openOutput(file_out);
+
+    if (!cols || !nulls || !integral || !fp)
+    {
+        fp ? closeOutput(fp) : 0;
+        free(cols);
+        free(nulls);
+        free(integral);
+        return -1;
+    }
+
+    for (size_t i = 0; i < mtzin->nxtal; i++)
+    {
+        for (size_t j = 0; j < mtzin->xtal[i]->nset; j++)
+        {
+            for (size_t k = 0; k < mtzin->xtal[i]->set[j]->ncol; k++)
+            {
+                const MTZCOL *col = mtzin->xtal[i]->set[j]->col[k];
+
+                col->active ? cols[ncol++] = col : 0;
+            }
+        }
+    }
+
+    // The field types hold for all record batches
+    for (size_t i = 0; i < ncol; i++)
+    {
+        integral[i] = isInt32Column(mtzin, cols[i], mtzin->nref);
+    }
+
+    jsonmtz = readMtz(mtzin, opts);
+    metadata = json_dumps(jsonmtz, JSON_COMPACT);
+    json_decref(jsonmtz);
+
+    // Schema
+    buildArrowSchema(&fb, mtzin, cols, integral, ncol, metadata ? metadata : "{}");
+    ret = fb.failed ? -1 : writeArrowMessage(fp, &fb);
+    jsonFree(metadata);
+
+    // Record batches
+    for (size_t first = 0; first < (size_t)mtzin->nref && ret == 0; first += ARROW_BATCH_ROWS)
+    {
+        size_t nrows = mtzin->nref - first < ARROW_BATCH_ROWS ? mtzin->nref - first : ARROW_BATCH_ROWS;
+
+        for (size_t i = 0; i < ncol; i++)
+        {
+            nulls[i] = 0;
+            for (size_t r = first; r < first + nrows; r++)
+            {
+                ccp4_ismnf(mtzin, cols[i]->ref[r]) ? nulls[i]++ : 0;
+            }
+        }
+
+        fb.size = 0;
+        buildArrowRecordBatch(&fb, nrows, ncol, nulls);
+        ret = fb.failed ? -1 : writeArrowMessage(fp, &fb);
+
+        for (size_t i = 0; i < ncol && ret == 0; i++)
+        {
+            ret = writeArrowColumn(fp, mtzin, cols[i], integral[i], first, nrows, nulls[i]);
+        }
+    }
+
+    // End-of-stream marker
+    if (ret == 0)
+    {
+        unsigned char eos[8] = {0xff, 0xff, 0xff, 0xff, 0, 0, 0, 0};
+
+        fwrite(eos, 1, 8, fp) != 8 ? ret = -1 : 0;
+    }
+
+    free(fb.data);
+    free(cols);
+    free(nulls);
+    free(integral);
+
+    if (closeOutput(fp) != 0)
+    {
+        return -1;
+    }
+
+    return ret;
+}
+
+/**
+ * Builds the flatbuffer of the Schema message.
+ * @param[in] fb The flatbuffer builder.
+ * @param[in] mtzin The MTZ struct.
+ * @param[in] cols The exported columns.
+ * @param[in] integral Whether each column is an int32 field.
+ * @param[in] ncol The number of columns.
+ * @param[in] metadata The schema metadata json.
+ */
+
+void buildArrowSchema(fb_builder_t *fb, const MTZ *mtzin, const MTZCOL **cols, const uint8_t *integral, size_t ncol, const char *metadata)
+{
+    static const uint8_t message_fields[] = {2, 1, 4, 8};
+    static const uint8_t schema_fields[] = {2, 4, 4};
+    static const uint8_t field_fields[] = {4, 1, 1, 4, 0, 4, 4};
+    static const uint8_t int_fields[] = {4, 1};
+    static const uint8_t float_fields[] = {2};
+    size_t message[4];
+    size_t schema[3];
+    size_t root = fbAlloc(fb, 4, 4);
+    size_t fields;
+    size_t keyvalues;
+
+    fbSetOffset(fb, root, fbTable(fb, message_fields, 4, message));
+    fbWriteU16(fb, message[0], ARROW_METADATA_V5);
+    fbWriteU8(fb, message[1], ARROW_HEADER_SCHEMA);
+    fbWriteU64(fb, message[3], 0);
+
+    fbSetOffset(fb, message[2], fbTable(fb, schema_fields, 3, schema));
+    fbWriteU16(fb, schema[0], 0); // Little-endian
+
+    fields = fbVector(fb, ncol, 4, 4);
+    fbSetOffset(fb, schema[1], fields);
+
+    for (size_t i = 0; i < ncol; i++)
+    {
+        const MTZCOL *col = cols[i];
+        const MTZSET *set = MtzColSet(mtzin, col);
+        const MTZXTAL *xtal = MtzSetXtal(mtzin, set);
+        size_t field[7];
+        size_t type[2];
+        char id[24];
+
+        fbSetOffset(fb, fields + 4 + 4 * i, fbTable(fb, field_fields, 7, field));
+        fbSetOffset(fb, field[0], fbString(fb, col->label));
+        fbWriteU8(fb, field[1], 1); // Nullable
+
+        if (integral[i])
+        {
+            fbWriteU8(fb, field[2], ARROW_TYPE_INT);
+            fbSetOffset(fb, field[3], fbTable(fb, int_fields, 2, type));
+            fbWriteU32(fb, type[0], 32);
+            fbWriteU8(fb, type[1], 1); // Signed
+        }
+        else
+        {
+            fbWriteU8(fb, field[2], ARROW_TYPE_FLOATING_POINT);
+            fbSetOffset(fb, field[3], fbTable(fb, float_fields, 1, type));
+            fbWriteU16(fb, type[0], 1); // Single precision
+        }
+
+        fbSetOffset(fb, field[5], fbVector(fb, 0, 4, 4));
+
+        // Column metadata
+        snprintf(id, sizeof(id), "%d", col->source);
+        keyvalues = fbVector(fb, 4, 4, 4);
+        fbSetOffset(fb, field[6], keyvalues);
+        fbSetOffset(fb, keyvalues + 4, fbKeyValue(fb, "Type", col->type));
+        fbSetOffset(fb, keyvalues + 8, fbKeyValue(fb, "ColumnID", id));
+        fbSetOffset(fb, keyvalues + 12, fbKeyValue(fb, "CrystalName", xtal ? xtal->xname : ""));
+        fbSetOffset(fb, keyvalues + 16, fbKeyValue(fb, "DatasetName", set ? set->dname : ""));
+    }
+
+    keyvalues = fbVector(fb, 1, 4, 4);
+    fbSetOffset(fb, schema[2], keyvalues);
+    fbSetOffset(fb, keyvalues + 4, fbKeyValue(fb, "jsonmtz", metadata));
+}
+
+/**
+ * Builds the flatbuffer of a RecordBatch message. Each column has a
+ * validity bitmap, which is empty if there are no nulls, and a data buffer.
+ * @param[in] fb The flatbuffer builder.
+ * @param[in] nrows The number of rows.
+ * @param[in] ncol The number of columns.
+ * @param[in] nulls The number of nulls per column.
+ */
+
+void buildArrowRecordBatch(fb_builder_t *fb, size_t nrows, size_t ncol, const size_t *nulls)
+{
+    static const uint8_t message_fields[] = {2, 1, 4, 8};
+    static const uint8_t batch_fields[] = {8, 4, 4};
+    size_t message[4];
+    size_t batch[3];
+    size_t root = fbAlloc(fb, 4, 4);
+    size_t nodes;
+    size_t buffers;
+    size_t offset = 0;
+
+    fbSetOffset(fb, root, fbTable(fb, message_fields, 4, message));
+    fbWriteU16(fb, message[0], ARROW_METADATA_V5);
+    fbWriteU8(fb, message[1], ARROW_HEADER_RECORD_BATCH);
+
+    fbSetOffset(fb, message[2], fbTable(fb, batch_fields, 3, batch));
+    fbWriteU64(fb, batch[0], nrows);
+
+    // FieldNode structs
+    nodes = fbVector(fb, ncol, 16, 8);
+    fbSetOffset(fb, batch[1], nodes);
+
+    for (size_t i = 0; i < ncol; i++)
+    {
+        fbWriteU64(fb, nodes + 4 + 16 * i, nrows);
+        fbWriteU64(fb, nodes + 12 + 16 * i, nulls[i]);
+    }
+
+    // Buffer structs
+    buffers = fbVector(fb, 2 * ncol, 16, 8);
+    fbSetOffset(fb, batch[2], buffers);
+
+    for (size_t i = 0; i < ncol; i++)
+    {
+        size_t validity = nulls[i] ? arrowPadding((nrows + 7) / 8) : 0;
+        size_t values = arrowPadding(4 * nrows);
+
+        fbWriteU64(fb, buffers + 4 + 32 * i, offset);
+        fbWriteU64(fb, buffers + 12 + 32 * i, validity);
+        offset += validity;
+        fbWriteU64(fb, buffers + 20 + 32 * i, offset);
+        fbWriteU64(fb, buffers + 28 + 32 * i, values);
+        offset += values;
+    }
+
+    fbWriteU64(fb, message[3], offset);
+}
+
+/**
+ * Writes the body buffers of one column of a record batch.
+ * Float32 data are written straight from the column on little-endian hosts.
+ * @param[in] fp The output file.
+ * @param[in] mtzin The MTZ struct.
+ * @param[in] col The column.
+ * @param[in] integral Write int32 instead of float32 values.
+ * @param[in] first The first row.
+ * @param[in] nrows The number of rows.
+ * @param[in] nulls The number of nulls.
+ * @return 0 on success, -1 on failure.
+ */
+
+int8_t writeArrowColumn(FILE *fp, const MTZ *mtzin, const MTZCOL *col, uint8_t integral, size_t first, size_t nrows, size_t nulls)
+{
+    static const unsigned char padding[8] = {0};
+    unsigned char buffer[4096];
+    uint16_t probe = 1;
+    size_t length;
+
+    // Validity bitmap, least significant bit first
+    if (nulls)
+    {
+        length = (nrows + 7) / 8;
+
+        for (size_t byte = 0; byte < length; byte += sizeof(buffer))
+        {
+            size_t nbytes = length - byte < sizeof(buffer) ? length - byte : sizeof(buffer);
+
+            memset(buffer, 0, nbytes);
+            for (size_t r = 8 * byte; r < 8 * (byte + nbytes) && r < nrows; r++)
+            {
+                !ccp4_ismnf(mtzin, col->ref[first + r]) ? buffer[r / 8 - byte] |= 1 << (r % 8) : 0;
+            }
+
+            if (fwrite(buffer, 1, nbytes, fp) != nbytes)
+            {
+                return -1;
+            }
+        }
+
+        fwrite(padding, 1, arrowPadding(length) - length, fp);
+    }
+
+    // Values
+    if (!integral && *(unsigned char *)&probe == 1)
+    {
+        if (fwrite(col->ref + first, 4, nrows, fp) != nrows)
+        {
+            return -1;
+        }
+    }
+    else
+    {
+        for (size_t r = 0; r < nrows; r += sizeof(buffer) / 4)
+        {
+            size_t nblock = nrows - r < sizeof(buffer) / 4 ? nrows - r : sizeof(buffer) / 4;
+
+            for (size_t l = 0; l < nblock; l++)
+            {
+                float refl = col->ref[first + r + l];
+
+                if (integral)
+                {
+                    int32_t value = ccp4_ismnf(mtzin, refl) ? 0 : (int32_t)lrintf(refl);
+                    uint32_t bits = (uint32_t)value;
+
+                    buffer[4 * l] = bits & 0xff;
+                    buffer[4 * l + 1] = (bits >> 8) & 0xff;
+                    buffer[4 * l + 2] = (bits >> 16) & 0xff;
+                    buffer[4 * l + 3] = (bits >> 24) & 0xff;
+                }
+                else
+                {
+                    packFloat32LE(refl, buffer + 4 * l);
+                }
+            }
+
+            if (fwrite(buffer, 4, nblock, fp) != nblock)
+            {
+                return -1;
+            }
+        }
+    }
+
+    length = 4 * nrows;
+    fwrite(padding, 1, arrowPadding(length) - length, fp);
+
+    return ferror(fp) ? -1 : 0;
+}
+
+/**
+ * Writes an encapsulated IPC message header: the continuation marker,
+ * the metadata length and the flatbuffer padded to eight bytes.
+ * @param[in] fp The output file.
+ * @param[in] fb The flatbuffer builder holding the message.
+ * @return 0 on success, -1 on failure.
+ */
+
+int8_t writeArrowMessage(FILE *fp, const fb_builder_t *fb)
+{
+    static const unsigned char padding[8] = {0};
+    unsigned char prefix[8] = {0xff, 0xff, 0xff, 0xff};
+    size_t length = arrowPadding(fb->size);
+
+    prefix[4] = length & 0xff;
+    prefix[5] = (length >> 8) & 0xff;
+    prefix[6] = (length >> 16) & 0xff;
+    prefix[7] = (length >> 24) & 0xff;
+
+    if (fwrite(prefix, 1, 8, fp) != 8 || fwrite(fb->data, 1, fb->size, fp) != fb->size ||
+        fwrite(padding, 1, length - fb->size, fp) != length - fb->size)
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Rounds a buffer length up to the eight-byte alignment of Arrow buffers.
+ * @param[in] length The length.
+ * @return The padded length.
+ */
+
+size_t arrowPadding(size_t length)
+{
+    return (length + 7) & ~(size_t)7;
+}
+
+/**
+ * Appends zeroed bytes to a flatbuffer. If memory runs out, the builder is
+ * marked as failed and later writes to it are ignored.
+ * @param[in] fb The flatbuffer builder.
+ * @param[in] length The number of bytes.
+ * @param[in] align The alignment of the first byte.
+ * @return The position of the first byte, or 0 on failure.
+ */
+
+size_t fbAlloc(fb_builder_t *fb, size_t length, size_t align)
+{
+    size_t pos = (fb->size + align - 1) / align * align;
+
+    if (fb->failed)
+    {
+        return 0;
+    }
+
+    if (pos + length > fb->capacity)
+    {
+        size_t capacity = fb->capacity ? fb->capacity : 1024;
+        unsigned char *data = NULL;
+
+        while (pos + length > capacity)
+        {
+            capacity *= 2;
+        }
+
+        data = realloc(fb->data, capacity);
+        if (!data)
+        {
+            fb->failed = true;
+            return 0;
+        }
+
+        fb->data = data;
+        fb->capacity = capacity;
+    }
+
+    memset(fb->data + fb->size, 0, pos + length - fb->size);
+    fb->size = pos + length;
+
+    return pos;
+}
+
+/**
+ * Appends a table and its vtable to a flatbuffer.
+ * Fields are laid out in order, each aligned to its size.
+ * @param[in] fb The flatbuffer builder.
+ * @param[in] sizes The size of each field, 0 for absent fields.
+ * @param[in] nfields The number of fields.
+ * @param[out] fields The position of each field.
+ * @return The position of the table.
+ */
+
+size_t fbTable(fb_builder_t *fb, const uint8_t *sizes, size_t nfields, size_t *fields)
+{
+    size_t vtable = fbAlloc(fb, 4 + 2 * nfields, 2);
+    size_t layout = 4;
+    size_t table;
+
+    for (size_t i = 0; i < nfields; i++)
+    {
+        if (sizes[i])
+        {
+            layout = (layout + sizes[i] - 1) / sizes[i] * sizes[i];
+            fields[i] = layout;
+            layout += sizes[i];
+        }
+    }
+
+    table = fbAlloc(fb, layout, 8);
+
+    fbWriteU16(fb, vtable, 4 + 2 * nfields);
+    fbWriteU16(fb, vtable + 2, layout);
+    fbWriteU32(fb, table, table - vtable);
+
+    for (size_t i = 0; i < nfields; i++)
+    {
+        fbWriteU16(fb, vtable + 4 + 2 * i, sizes[i] ? fields[i] : 0);
+        fields[i] = sizes[i] ? table + fields[i] : 0;
+    }
+
+    return table;
+}
+
+/**
+ * Appends a vector to a flatbuffer. The elements are zeroed.
+ * @param[in] fb The flatbuffer builder.
+ * @param[in] count The number of elements.
+ * @param[in] size The size of each element.
+ * @param[in] align The alignment of the elements.
+ * @return The position of the vector. Elements start four bytes later.
+ */
+
+size_t fbVector(fb_builder_t *fb, size_t count, size_t size, size_t align)
+{
+    size_t pos;
+
+    // Align the elements rather than the length prefix
+    while (((fb->size + 4) % align != 0 || fb->size % 4 != 0) && !fb->failed)
+    {
+        fbAlloc(fb, 1, 1);
+    }
+
+    pos = fbAlloc(fb, 4 + count * size, 4);
+    fbWriteU32(fb, pos, count);
+
+    return pos;
+}
+
+/**
+ * Appends a null-terminated string to a flatbuffer.
+ * @param[in] fb The flatbuffer builder.
+ * @param[in] str The string.
+ * @return The position of the string.
+ */
+
+size_t fbString(fb_builder_t *fb, const char *str)
+{
+    size_t length = strlen(str);
+    size_t pos = fbAlloc(fb, 4 + length + 1, 4);
+
+    fbWriteU32(fb, pos, length);
+    !fb->failed ? memcpy(fb->data + pos + 4, str, length) : 0;
+
+    return pos;
+}
+
+/**
+ * Appends an Arrow KeyValue table to a flatbuffer.
+ * @param[in] fb The flatbuffer builder.
+ * @param[in] key The key.
+ * @param[in] value The value.
+ * @return The position of the table.
+ */
+
+size_t fbKeyValue(fb_builder_t *fb, const char *key, const char *value)
+{
+    static const uint8_t keyvalue_fields[] = {4, 4};
+    size_t fields[2];
+    size_t table = fbTable(fb, keyvalue_fields, 2, fields);
+
+    fbSetOffset(fb, fields[0], fbString(fb, key));
+    fbSetOffset(fb, fields[1], fbString(fb, value));
+
+    return table;
+}
+
+/**
+ * Sets a flatbuffer offset field to point to a later position.
+ * @param[in] fb The flatbuffer builder.
+ * @param[in] pos The position of the offset field.
+ * @param[in] target The position pointed to.
+ */
+
+void fbSetOffset(fb_builder_t *fb, size_t pos, size_t target)
+{
+    fbWriteU32(fb, pos, target - pos);
+}
+
+/**
+ * Writes a byte to a flatbuffer.
+ * @param[in] fb The flatbuffer builder.
+ * @param[in] pos The position.
+ * @param[in] value The value.
+ */
+
+void fbWriteU8(fb_builder_t *fb, size_t pos, uint8_t value)
+{
+    !fb->failed ? fb->data[pos] = value : 0;
+}
+
+/**
+ * Writes a little-endian 16 bit integer to a flatbuffer.
+ * @param[in] fb The flatbuffer builder.
+ * @param[in] pos The position.
+ * @param[in] value The value.
+ */
+
+void fbWriteU16(fb_builder_t *fb, size_t pos, uint16_t value)
+{
+    if (fb->failed)
+    {
+        return;
+    }
+
+    fb->data[pos] = value & 0xff;
+    fb->data[pos + 1] = value >> 8;
+}
+
+/**
+ * Writes a little-endian 32 bit integer to a flatbuffer.
+ * @param[in] fb The flatbuffer builder.
+ * @param[in] pos The position.
+ * @param[in] value The value.
+ */
+
+void fbWriteU32(fb_builder_t *fb, size_t pos, uint32_t value)
+{
+    for (size_t i = 0; i < 4 && !fb->failed; i++)
+    {
+        fb->data[pos + i] = (value >> (8 * i)) & 0xff;
+    }
+}
+
+/**
+ * Writes a little-endian 64 bit integer to a flatbuffer.
+ * @param[in] fb The flatbuffer builder.
+ * @param[in] pos The position.
+ * @param[in] value The value.
+ */
+
+void fbWriteU64(fb_builder_t *fb, size_t pos, uint64_t value)
+{
+    for (size_t i = 0; i < 8 && !fb->failed; i++)
+    {
+        fb->data[pos + i] = (value >> (8 * i)) & 0xff;
+    }
+}
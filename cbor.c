@@ -0,0 +1,492 @@
+/*
+ * cbor.c: CBOR encoding and decoding of jsonmtz documents
+ *
+ * Copyright (c) 2017 Frank Buermann <fburmann@mrc-lmb.cam.ac.uk>
+ *
+ * jsonmtz is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ * This software makes use of the jansson library (http://www.digip.org/jansson/)
+ * licensed under the terms of the MIT license,
+ * and the CCP4io library (http://www.ccp4.ac.uk/) licensed under the
+ * Lesser GNU General Public License 3.0.
+ */
+
+/*
+ * The CBOR document model is the json document model produced by readMtz().
+ * Column data with the f32le encoding are raw json strings holding
+ * little-endian float32 values. They are written as RFC 8746 typed arrays
+ * (tag 85), and typed arrays are read back into raw json strings.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "jsonmtz.h"
+
+/**
+ * Writes the CBOR representation of a json value to a file.
+ * @param[in] json The json value.
+ * @param[in] file_out The output file.
+ * @return 0 on success, -1 on failure.
+ */
+
+int8_t cborDumpFile(const json_t *json, const char *file_out)
+{
+    FILE *fp = openOutput(file_out);
+    int8_t ret;
+
+    if (!fp)
+    {
+        return -1;
+    }
+
+    // Self-described CBOR
+    cborWriteHead(fp, CBOR_TAG, CBOR_TAG_SELF_DESCRIBE);
+    ret = cborWriteValue(fp, json, 0);
+
+    if (closeOutput(fp) != 0)
+    {
+        return -1;
+    }
+
+    return ret;
+}
+
+/**
+ * Writes the initial bytes of a CBOR data item.
+ * @param[in] fp The output file.
+ * @param[in] major The major type.
+ * @param[in] value The argument.
+ */
+
+void cborWriteHead(FILE *fp, uint8_t major, uint64_t value)
+{
+    unsigned char head[9];
+    size_t len;
+
+    if (value < 24)
+    {
+        head[0] = major << 5 | value;
+        len = 1;
+    }
+    else if (value <= 0xff)
+    {
+        head[0] = major << 5 | 24;
+        len = 2;
+    }
+    else if (value <= 0xffff)
+    {
+        head[0] = major << 5 | 25;
+        len = 3;
+    }
+    else if (value <= 0xffffffff)
+    {
+        head[0] = major << 5 | 26;
+        len = 5;
+    }
+    else
+    {
+        head[0] = major << 5 | 27;
+        len = 9;
+    }
+
+    // Big-endian argument
+    for (size_t i = 1; i < len; i++)
+    {
+        head[i] = (value >> (8 * (len - 1 - i))) & 0xff;
+    }
+
+    fwrite(head, 1, len, fp);
+}
+
+/**
+ * Writes a json value as a CBOR data item.
+ * Reals are written as float32 where this is exact, and as float64 otherwise.
+ * @param[in] fp The output file.
+ * @param[in] json The json value.
+ * @param[in] typed Write a string as a float32 little-endian typed array.
+ * @return 0 on success, -1 on failure.
+ */
+
+int8_t cborWriteValue(FILE *fp, const json_t *json, uint8_t typed)
+{
+    const char *key;
+    json_t *value = NULL;
+    size_t index;
+    json_int_t integer;
+    double real;
+    unsigned char bytes[8];
+
+    switch (json_typeof(json))
+    {
+    case JSON_OBJECT:
+        cborWriteHead(fp, CBOR_MAP, json_object_size(json));
+        json_object_foreach((json_t *)json, key, value)
+        {
+            cborWriteHead(fp, CBOR_TEXT_STRING, strlen(key));
+            fwrite(key, 1, strlen(key), fp);
+
+            // Column data in the f32le encoding
+            typed = strcmp(key, "Data") == 0 && json_is_string(value) && columnDataEncoding(json) == COLUMN_F32LE;
+
+            if (cborWriteValue(fp, value, typed) != 0)
+            {
+                return -1;
+            }
+        }
+        break;
+
+    case JSON_ARRAY:
+        cborWriteHead(fp, CBOR_ARRAY, json_array_size(json));
+        json_array_foreach(json, index, value)
+        {
+            if (cborWriteValue(fp, value, 0) != 0)
+            {
+                return -1;
+            }
+        }
+        break;
+
+    case JSON_STRING:
+        if (typed)
+        {
+            cborWriteHead(fp, CBOR_TAG, CBOR_TAG_FLOAT32LE);
+            cborWriteHead(fp, CBOR_BYTE_STRING, json_string_length(json));
+        }
+        else
+        {
+            cborWriteHead(fp, CBOR_TEXT_STRING, json_string_length(json));
+        }
+        fwrite(json_string_value(json), 1, json_string_length(json), fp);
+        break;
+
+    case JSON_INTEGER:
+        integer = json_integer_value(json);
+        integer >= 0 ? cborWriteHead(fp, CBOR_UNSIGNED, integer) : cborWriteHead(fp, CBOR_NEGATIVE, -1 - integer);
+        break;
+
+    case JSON_REAL:
+        real = json_real_value(json);
+
+        if (isnan(real))
+        {
+            // Half-precision NaN
+            fputc(CBOR_SIMPLE << 5 | 25, fp);
+            fputc(0x7e, fp);
+            fputc(0x00, fp);
+        }
+        else if ((double)(float)real == real)
+        {
+            float single = (float)real;
+            uint32_t bits;
+
+            memcpy(&bits, &single, 4);
+            fputc(CBOR_SIMPLE << 5 | 26, fp);
+            for (size_t i = 0; i < 4; i++)
+            {
+                bytes[i] = (bits >> (24 - 8 * i)) & 0xff;
+            }
+            fwrite(bytes, 1, 4, fp);
+        }
+        else
+        {
+            uint64_t bits;
+
+            memcpy(&bits, &real, 8);
+            fputc(CBOR_SIMPLE << 5 | 27, fp);
+            for (size_t i = 0; i < 8; i++)
+            {
+                bytes[i] = (bits >> (56 - 8 * i)) & 0xff;
+            }
+            fwrite(bytes, 1, 8, fp);
+        }
+        break;
+
+    case JSON_TRUE:
+        cborWriteHead(fp, CBOR_SIMPLE, CBOR_SIMPLE_TRUE);
+        break;
+
+    case JSON_FALSE:
+        cborWriteHead(fp, CBOR_SIMPLE, CBOR_SIMPLE_FALSE);
+        break;
+
+    default:
+        cborWriteHead(fp, CBOR_SIMPLE, CBOR_SIMPLE_NULL);
+    }
+
+    return ferror(fp) ? -1 : 0;
+}
+
+/**
+ * Reads a json value from a CBOR file, or from stdin for "-".
+ * @param[in] file_in The input file.
+ * @return The json value, or NULL on failure.
+ */
+
+json_t *cborLoadFile(const char *file_in)
+{
+    const unsigned char *data = NULL;
+    size_t size = 0;
+    json_t *json = NULL;
+
+    if (strcmp(file_in, "-") == 0)
+    {
+        data = readStream(stdin, &size);
+        json = data ? cborLoadBuffer(data, size) : NULL;
+        free((void *)data);
+        return json;
+    }
+
+    data = mapFile(file_in, &size);
+    if (!data)
+    {
+        return NULL;
+    }
+
+    json = cborLoadBuffer(data, size);
+    unmapFile(data, size);
+
+    return json;
+}
+
+/**
+ * Reads a json value from CBOR data in memory.
+ * @param[in] data The CBOR data.
+ * @param[in] size The length of the data.
+ * @return The json value, or NULL on failure.
+ */
+
+json_t *cborLoadBuffer(const unsigned char *data, size_t size)
+{
+    cbor_reader_t reader;
+    json_t *json = NULL;
+
+    reader.data = data;
+    reader.size = size;
+    reader.pos = 0;
+
+    json = cborReadValue(&reader, 0);
+
+    // Trailing bytes are an error
+    if (json && reader.pos != reader.size)
+    {
+        json_decref(json);
+        json = NULL;
+    }
+
+    return json;
+}
+
+/**
+ * Reads the initial bytes of a CBOR data item.
+ * Indefinite lengths are not supported.
+ * @param[in] reader The reader.
+ * @param[out] major The major type.
+ * @param[out] info The additional information.
+ * @param[out] value The argument.
+ * @return 1 on success, 0 on failure.
+ */
+
+uint8_t cborReadHead(cbor_reader_t *reader, uint8_t *major, uint8_t *info, uint64_t *value)
+{
+    size_t len;
+
+    if (reader->pos >= reader->size)
+    {
+        return 0;
+    }
+
+    *major = reader->data[reader->pos] >> 5;
+    *info = reader->data[reader->pos] & 0x1f;
+    reader->pos++;
+
+    if (*info < 24)
+    {
+        *value = *info;
+        return 1;
+    }
+
+    if (*info > 27)
+    {
+        return 0;
+    }
+
+    len = (size_t)1 << (*info - 24);
+
+    if (reader->size - reader->pos < len)
+    {
+        return 0;
+    }
+
+    *value = 0;
+    for (size_t i = 0; i < len; i++)
+    {
+        *value = *value << 8 | reader->data[reader->pos++];
+    }
+
+    return 1;
+}
+
+/**
+ * Converts a half-precision float to double.
+ * @param[in] half The bits of the half-precision float.
+ * @return The value.
+ */
+
+double cborHalfToDouble(uint16_t half)
+{
+    int exponent = (half >> 10) & 0x1f;
+    int mantissa = half & 0x3ff;
+    double value;
+
+    if (exponent == 0)
+    {
+        value = ldexp(mantissa, -24);
+    }
+    else if (exponent != 31)
+    {
+        value = ldexp(mantissa + 1024, exponent - 25);
+    }
+    else
+    {
+        value = mantissa ? NAN : INFINITY;
+    }
+
+    return half & 0x8000 ? -value : value;
+}
+
+/**
+ * Reads a CBOR data item into a json value.
+ * Byte strings are read into raw json strings.
+ * @param[in] reader The reader.
+ * @param[in] depth The nesting depth.
+ * @return The json value, or NULL on failure.
+ */
+
+json_t *cborReadValue(cbor_reader_t *reader, size_t depth)
+{
+    uint8_t major;
+    uint8_t info;
+    uint64_t value;
+    json_t *json = NULL;
+    json_t *item = NULL;
+    char *key = NULL;
+    double real;
+
+    if (depth > CBOR_MAX_DEPTH || !cborReadHead(reader, &major, &info, &value))
+    {
+        return NULL;
+    }
+
+    switch (major)
+    {
+    case CBOR_UNSIGNED:
+        return value <= INT64_MAX ? json_integer(value) : NULL;
+
+    case CBOR_NEGATIVE:
+        return value <= INT64_MAX ? json_integer(-1 - (json_int_t)value) : NULL;
+
+    case CBOR_BYTE_STRING:
+    case CBOR_TEXT_STRING:
+        if (reader->size - reader->pos < value)
+        {
+            return NULL;
+        }
+
+        json = major == CBOR_TEXT_STRING ? json_stringn((const char *)reader->data + reader->pos, value)
+                                         : json_stringn_nocheck((const char *)reader->data + reader->pos, value);
+        reader->pos += value;
+        return json;
+
+    case CBOR_ARRAY:
+        // Every item takes at least one byte
+        if (reader->size - reader->pos < value)
+        {
+            return NULL;
+        }
+
+        json = json_array();
+        for (uint64_t i = 0; i < value; i++)
+        {
+            item = cborReadValue(reader, depth + 1);
+            if (!item || json_array_append_new(json, item) != 0)
+            {
+                json_decref(json);
+                return NULL;
+            }
+        }
+        return json;
+
+    case CBOR_MAP:
+        if ((reader->size - reader->pos) / 2 < value)
+        {
+            return NULL;
+        }
+
+        json = json_object();
+        for (uint64_t i = 0; i < value; i++)
+        {
+            uint64_t keylength;
+
+            // Keys are text strings without null characters
+            if (!cborReadHead(reader, &major, &info, &keylength) || major != CBOR_TEXT_STRING ||
+                reader->size - reader->pos < keylength ||
+                memchr(reader->data + reader->pos, 0, keylength))
+            {
+                json_decref(json);
+                return NULL;
+            }
+
+            key = malloc(keylength + 1);
+            memcpy(key, reader->data + reader->pos, keylength);
+            key[keylength] = '\0';
+            reader->pos += keylength;
+
+            item = cborReadValue(reader, depth + 1);
+            if (!item || json_object_set_new(json, key, item) != 0)
+            {
+                free(key);
+                json_decref(json);
+                return NULL;
+            }
+            free(key);
+        }
+        return json;
+
+    case CBOR_TAG:
+        // Only the payload of tags is used
+        return cborReadValue(reader, depth + 1);
+
+    default:
+        switch (info)
+        {
+        case CBOR_SIMPLE_FALSE:
+            return json_false();
+        case CBOR_SIMPLE_TRUE:
+            return json_true();
+        case CBOR_SIMPLE_NULL:
+        case CBOR_SIMPLE_UNDEFINED:
+            return json_null();
+        case 25:
+            real = cborHalfToDouble(value);
+            break;
+        case 26:
+        {
+            uint32_t bits = value;
+            float single;
+
+            memcpy(&single, &bits, 4);
+            real = single;
+            break;
+        }
+        case 27:
+            memcpy(&real, &value, 8);
+            break;
+        default:
+            return NULL;
+        }
+
+        return isnan(real) ? json_nan() : json_real(real);
+    }
+}
@@ -34,10 +34,10 @@ ccp4_ptr ccp4array_new_(ccp4_ptr *p)
   return *p;
 }
 
-ccp4_ptr ccp4array_new_size_(ccp4_ptr *p, const int size, const size_t reclen)
+ccp4_ptr ccp4array_new_size_(ccp4_ptr *p, const int64_t size, const size_t reclen)
 {
   ccp4array_base *v;
-  int capacity = (size * 12) / 10 + 2;
+  int64_t capacity = size + size / 5 + 2;
   v = (ccp4array_base *)malloc(sizeof(ccp4array_base) + capacity * reclen);
   v->size = size;
   v->capacity = capacity;
@@ -45,19 +45,19 @@ ccp4_ptr ccp4array_new_size_(ccp4_ptr *p, const int size, const size_t reclen)
   return *p;
 }
 
-void ccp4array_resize_(ccp4_ptr *p, const int size, const size_t reclen)
+void ccp4array_resize_(ccp4_ptr *p, const int64_t size, const size_t reclen)
 {
   ccp4array_base *v;
   v = (ccp4array_base *)((ccp4_byteptr)(*p)-sizeof(ccp4array_base));
   if (size > v->capacity) {
-    v->capacity = (size * 12) / 10 + 2;
+    v->capacity = size + size / 5 + 2;
     v = (ccp4array_base *)realloc(v, sizeof(ccp4array_base) + v->capacity * reclen);
     *p = (ccp4_ptr *)((ccp4_byteptr)(v)+sizeof(ccp4array_base));
   }
   v->size = size;
 }
 
-void ccp4array_reserve_(ccp4_ptr *p, const int size, const size_t reclen)
+void ccp4array_reserve_(ccp4_ptr *p, const int64_t size, const size_t reclen)
 {
   ccp4array_base *v;
   v = (ccp4array_base *)((ccp4_byteptr)(*p)-sizeof(ccp4array_base));
@@ -70,18 +70,18 @@ void ccp4array_reserve_(ccp4_ptr *p, const int size, const size_t reclen)
 void ccp4array_append_(ccp4_ptr *p, ccp4_constptr data, const size_t reclen)
 {
   ccp4array_base *v;
-  int osize;
+  int64_t osize;
   v = (ccp4array_base *)((ccp4_byteptr)(*p)-sizeof(ccp4array_base));
   osize = v->size;
   ccp4array_resize_(p, osize+1, reclen);
   memcpy((ccp4_byteptr)(*p)+osize*reclen, data, reclen);
 }
 
-void ccp4array_append_n_(ccp4_ptr *p, ccp4_constptr data, const int n, const size_t reclen)
+void ccp4array_append_n_(ccp4_ptr *p, ccp4_constptr data, const int64_t n, const size_t reclen)
 {
   ccp4array_base *v;
   ccp4_byteptr newdata;
-  int osize, i;
+  int64_t osize, i;
   v = (ccp4array_base *)((ccp4_byteptr)(*p)-sizeof(ccp4array_base));
   osize = v->size;
   ccp4array_resize_(p, osize+n, reclen);
@@ -92,20 +92,20 @@ void ccp4array_append_n_(ccp4_ptr *p, ccp4_constptr data, const int n, const siz
   }
 }
 
-void ccp4array_append_list_(ccp4_ptr *p, ccp4_constptr data, const int n, const size_t reclen)
+void ccp4array_append_list_(ccp4_ptr *p, ccp4_constptr data, const int64_t n, const size_t reclen)
 {
   ccp4array_base *v;
-  int osize;
+  int64_t osize;
   v = (ccp4array_base *)((ccp4_byteptr)(*p)-sizeof(ccp4array_base));
   osize = v->size;
   ccp4array_resize_(p, osize+n, reclen);
   memcpy((ccp4_byteptr)(*p)+osize*reclen, data, n * reclen);
 }
 
-void ccp4array_insert_(ccp4_ptr *p, const int i, ccp4_constptr data, const size_t reclen)
+void ccp4array_insert_(ccp4_ptr *p, const int64_t i, ccp4_constptr data, const size_t reclen)
 {
   ccp4array_base *v;
-  int osize;
+  int64_t osize;
   v = (ccp4array_base *)((ccp4_byteptr)(*p)-sizeof(ccp4array_base));
   osize = v->size;
   ccp4array_resize_(p, osize+1, reclen);
@@ -113,20 +113,20 @@ void ccp4array_insert_(ccp4_ptr *p, const int i, ccp4_constptr data, const size_
   memcpy((ccp4_byteptr)(*p)+i*reclen, data, reclen);  
 }
 
-void ccp4array_delete_ordered_(ccp4_ptr *p, const int i, const size_t reclen)
+void ccp4array_delete_ordered_(ccp4_ptr *p, const int64_t i, const size_t reclen)
 {
   ccp4array_base *v;
-  int nsize;
+  int64_t nsize;
   v = (ccp4array_base *)((ccp4_byteptr)(*p)-sizeof(ccp4array_base));
   nsize = v->size - 1;
   memmove((ccp4_byteptr)(*p)+i*reclen, (ccp4_byteptr)(*p)+(i+1)*reclen, (nsize-i)*reclen);
   v->size--; /* ccp4array_resize_(p, nsize, reclen); */
 }
 
-void ccp4array_delete_(ccp4_ptr *p, const int i, const size_t reclen)
+void ccp4array_delete_(ccp4_ptr *p, const int64_t i, const size_t reclen)
 {
   ccp4array_base *v;
-  int nsize;
+  int64_t nsize;
   v = (ccp4array_base *)((ccp4_byteptr)(*p)-sizeof(ccp4array_base));
   nsize = v->size - 1;
   memcpy((ccp4_byteptr)(*p)+i*reclen, (ccp4_byteptr)(*p)+nsize*reclen, reclen);
@@ -140,7 +140,7 @@ void ccp4array_delete_last_(ccp4_ptr *p, const size_t reclen)
   v->size--; /* ccp4array_resize_(p, v->size-1, reclen); */
 }
 
-int ccp4array_size_(ccp4_constptr *p)
+int64_t ccp4array_size_(ccp4_constptr *p)
 {
   ccp4array_base *v;
   v = (ccp4array_base *)((ccp4_byteptr)(*p)-sizeof(ccp4array_base));
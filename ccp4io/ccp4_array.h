@@ -74,6 +74,7 @@ extern "C" {
 
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 /* rcsidha[] = "$Id$" */
 
 /*! constant pointer type */
@@ -85,7 +86,7 @@ typedef void *ccp4_ptr;
 
 /*! struct definition for the array pre-header */
 typedef struct ccp4array_base_ {
-  int size, capacity;
+  int64_t size, capacity;
 } ccp4array_base;
 
 /*! Macro to allocate a new array.
@@ -198,15 +199,15 @@ ccp4_ptr ccp4array_new_(ccp4_ptr *p);
 /** 
  * See macro ccp4array_new_size 
 */
-ccp4_ptr ccp4array_new_size_(ccp4_ptr *p, const int size, const size_t reclen);
+ccp4_ptr ccp4array_new_size_(ccp4_ptr *p, const int64_t size, const size_t reclen);
 /** 
  * See macro ccp4array_resize 
 */
-void ccp4array_resize_(ccp4_ptr *p, const int size, const size_t reclen);
+void ccp4array_resize_(ccp4_ptr *p, const int64_t size, const size_t reclen);
 /** 
  * See macro ccp4array_reserve 
 */
-void ccp4array_reserve_(ccp4_ptr *p, const int size, const size_t reclen);
+void ccp4array_reserve_(ccp4_ptr *p, const int64_t size, const size_t reclen);
 /** 
  * See macro ccp4array_append 
 */
@@ -214,23 +215,23 @@ void ccp4array_append_(ccp4_ptr *p, ccp4_constptr data, const size_t reclen);
 /** 
  * See macro ccp4array_append_n 
 */
-void ccp4array_append_n_(ccp4_ptr *p, ccp4_constptr data, const int n, const size_t reclen);
+void ccp4array_append_n_(ccp4_ptr *p, ccp4_constptr data, const int64_t n, const size_t reclen);
 /** 
  * See macro ccp4array_append_list 
 */
-void ccp4array_append_list_(ccp4_ptr *p, ccp4_constptr data, const int n, const size_t reclen);
+void ccp4array_append_list_(ccp4_ptr *p, ccp4_constptr data, const int64_t n, const size_t reclen);
 /** 
  * See macro ccp4array_insert  
 */
-void ccp4array_insert_(ccp4_ptr *p, const int i, ccp4_constptr data, const size_t reclen);
+void ccp4array_insert_(ccp4_ptr *p, const int64_t i, ccp4_constptr data, const size_t reclen);
 /** 
  * See macro ccp4array_delete_ordered 
 */
-void ccp4array_delete_ordered_(ccp4_ptr *p, const int i, const size_t reclen);
+void ccp4array_delete_ordered_(ccp4_ptr *p, const int64_t i, const size_t reclen);
 /** 
  * See macro ccp4array_delete 
 */
-void ccp4array_delete_(ccp4_ptr *p, const int i, const size_t reclen);
+void ccp4array_delete_(ccp4_ptr *p, const int64_t i, const size_t reclen);
 /** 
  * See macro ccp4array_delete_last 
 */
@@ -238,7 +239,7 @@ void ccp4array_delete_last_(ccp4_ptr *p, const size_t reclen);
 /** 
  * See macro ccp4array_size 
 */
-int ccp4array_size_(ccp4_constptr *p);
+int64_t ccp4array_size_(ccp4_constptr *p);
 /** 
  * See macro ccp4array_free
 */
@@ -59,8 +59,15 @@
 
 #define CCP4_COUNT(x) sizeof(x)/sizeof(x[0])
 
-/** @global ccp4_errno: global variable that stores the error last error
- *           code from the ccp4 libraries 
+/* Storage class for per-thread library state */
+#if defined(_MSC_VER)
+#define CCP4_THREAD_LOCAL __declspec(thread)
+#else
+#define CCP4_THREAD_LOCAL __thread
+#endif
+
+/** @global ccp4_errno: thread-local variable that stores the last error
+ *           code from the ccp4 libraries in the calling thread
  * | 12 bits - library | 4 bits - level | 16 bits - code |
  *
  *  associated macros
@@ -91,7 +98,7 @@
 #ifdef __cplusplus
 extern "C" {
 #endif
-extern int ccp4_errno;
+extern CCP4_THREAD_LOCAL int ccp4_errno;
 #ifdef __cplusplus
 }
 #endif
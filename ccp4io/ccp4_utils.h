@@ -26,6 +26,7 @@
 #define __CCP4_UTILS
 
 #include <string.h>
+#include <time.h>
 #include "ccp4_types.h"
 #include "library_file.h"
 /* rcsidh[] = "$Id$" */
@@ -87,6 +88,8 @@ char *ccp4_utils_extension(const char *filename);
 
 char *ccp4_utils_joinfilenames(const char *dir, const char *file);
 
+struct tm *ccp4_utils_localtime (const time_t *, struct tm *);
+
 void ccp4_utils_idate (int *);
 
 char *ccp4_utils_date(char *);
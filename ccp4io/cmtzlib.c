@@ -24,6 +24,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include <math.h>
+#include <limits.h>
 #include "cmtzlib.h"
 #include "ccp4_types.h"
 #include "ccp4_array.h"
@@ -73,16 +74,47 @@ MTZ *MtzGet(const char *logname, int read_refs)
 
 MTZ *MtzGetUserCellTolerance(const char *logname, int read_refs, const double cell_tolerance)
 
+{ CCP4File *filein;
+  char *filename;
+  int debug=0;
+
+  if (debug) 
+    printf(" Entering MtzGet \n");
+
+  /* check input */
+  if (!logname) return NULL;
+
+  /* Open the mtz file: */
+  if (getenv(logname) != NULL) {
+    filename = strdup(getenv(logname));
+  } else {
+    filename = strdup(logname);
+  }
+
+  if (debug) 
+    printf(" Opening file %s \n",filename);
+
+  filein = ccp4_file_open(filename,O_RDONLY);
+  free(filename);
+  if (! filein ) {
+    ccp4_signal(CCP4_ERRLEVEL(3) | CMTZ_ERRNO(CMTZERR_CantOpenFile),"MtzGet",NULL);
+    return NULL;
+  }
+
+  return MtzGetFromFile(filein, read_refs, cell_tolerance);
+}
+
+MTZ *MtzGetFromFile(CCP4File *filein, int read_refs, const double cell_tolerance)
+
 { MTZ *mtz;
-  CCP4File *filein;
   int istat, newproj, cset_warn=0, length;
   MTZCOL *colin[MCOLUMNS], *newcol;
-  char *filename;
   char crysin[MXTALS][65],projin[MXTALS][65],crystal[65],project[65];
   double cellin[MXTALS][6],cell[6];
   int jxtalin[MSETS];
   char mkey[4], keyarg[76], hdrrec[MTZRECORDLENGTH+1], label[31], type[3];
-  int i, j, hdrst, ntotcol, nref, ntotset=0, nbat, nhist=0, icolin;
+  int i, j, hdrword, hdrwords[2], ntotcol, ntotset=0, nbat, nhist=0, icolin;
+  int64_t hdrst, nref, iref;
   int ixtal, jxtal, iset, iiset, icset, nxtal=0, nset[MXTALS]={0}, isym=0;
   int indhigh[3],indlow[3],isort[5],ind_xtal,ind_set,ind_col[3],debug=0;
   float min,max,totcell[6],minres,maxres;
@@ -110,28 +142,8 @@ MTZ *MtzGetUserCellTolerance(const char *logname, int read_refs, const double ce
       "NCOL","NDIF","CRYS","MTZH","MTZB","BH" };
   int n_known_headers = sizeof(known_headers)/sizeof(known_headers[0]);
 
-  if (debug) 
-    printf(" Entering MtzGet \n");
-
   /* check input */
-  if (!logname) return NULL;
-
-  /* Open the mtz file: */
-  if (getenv(logname) != NULL) {
-    filename = strdup(getenv(logname));
-  } else {
-    filename = strdup(logname);
-  }
-
-  if (debug) 
-    printf(" Opening file %s \n",filename);
-
-  filein = ccp4_file_open(filename,O_RDONLY);
-  if (! filein ) {
-    ccp4_signal(CCP4_ERRLEVEL(3) | CMTZ_ERRNO(CMTZERR_CantOpenFile),"MtzGet",NULL);
-    free(filename);
-    return NULL;
-  }
+  if (!filein) return NULL;
 
   if (debug) 
     printf(" File opened successfully \n");
@@ -148,7 +160,6 @@ MTZ *MtzGetUserCellTolerance(const char *logname, int read_refs, const double ce
   parser = ccp4_parse_start(20);
   if (parser == NULL) {
     ccp4_signal(CCP4_ERRLEVEL(3) | CMTZ_ERRNO(CMTZERR_ParserFail),"MtzGet",NULL);
-    free(filename);
     ccp4_file_close(filein);
     return NULL;
   }
@@ -166,7 +177,6 @@ MTZ *MtzGetUserCellTolerance(const char *logname, int read_refs, const double ce
     ccp4_signal(CCP4_ERRLEVEL(3) | CMTZ_ERRNO(CMTZERR_ReadFail),"MtzGet",NULL);
     ccp4_parse_end(parser);
     ccp4_file_close(filein);
-    free(filename);
     return NULL;
   }
   hdrrec[4] = '\0';
@@ -176,7 +186,6 @@ MTZ *MtzGetUserCellTolerance(const char *logname, int read_refs, const double ce
     ccp4_signal(CCP4_ERRLEVEL(3) | CMTZ_ERRNO(CMTZERR_NotMTZ),"MtzGet",NULL);
     ccp4_parse_end(parser);
     ccp4_file_close(filein);
-    free(filename);
     return(NULL);
   }
 
@@ -185,8 +194,16 @@ MTZ *MtzGetUserCellTolerance(const char *logname, int read_refs, const double ce
 
   /* set reading integers */
   ccp4_file_setmode(filein,6);
-  istat = ccp4_file_read(filein, (uint8 *) &hdrst, 1);
-  if (debug) printf(" hdrst read as %d \n",hdrst);
+  istat = ccp4_file_read(filein, (uint8 *) &hdrword, 1);
+  hdrst = hdrword;
+  /* -1 means the header starts beyond 2^31 words, and its 64-bit
+     position is in words HDRST64 and HDRST64+1, low word first */
+  if (hdrword == -1) {
+    ccp4_file_seek(filein, HDRST64, SEEK_SET);
+    istat = ccp4_file_read(filein, (uint8 *) hdrwords, 2);
+    hdrst = (int64_t) (uint32_t) hdrwords[0] | ((int64_t) hdrwords[1] << 32);
+  }
+  if (debug) printf(" hdrst read as %lld \n",(long long) hdrst);
 
   /* 1st Pass: Read ntotcol, nref, nbat and dataset info.  
      nxtal and nset are used to assign memory for MTZ structure.
@@ -196,7 +213,6 @@ MTZ *MtzGetUserCellTolerance(const char *logname, int read_refs, const double ce
     ccp4_signal(CCP4_ERRLEVEL(3) | CMTZ_ERRNO(CMTZERR_ReadFail),"MtzGet",NULL);
     ccp4_parse_end(parser);
     ccp4_file_close(filein);
-    free(filename);
     return NULL;
   }
 
@@ -222,7 +238,6 @@ MTZ *MtzGetUserCellTolerance(const char *logname, int read_refs, const double ce
     ccp4_signal(CCP4_ERRLEVEL(3) | CMTZ_ERRNO(CMTZERR_ReadFail),"MtzGet",NULL);
     ccp4_parse_end(parser);
     ccp4_file_close(filein);
-    free(filename);
     return NULL;
   }
 
@@ -233,7 +248,7 @@ MTZ *MtzGetUserCellTolerance(const char *logname, int read_refs, const double ce
     /* read total number of columns, reflections and batches */
     if (ccp4_keymatch(key, "NCOL")) {
       ntotcol = (int) token[1].value;
-      nref = (int) token[2].value;
+      nref = (int64_t) token[2].value;
       nbat = (int) token[3].value;
     }
 
@@ -252,7 +267,6 @@ MTZ *MtzGetUserCellTolerance(const char *logname, int read_refs, const double ce
           printf("MtzGet: Maximum number of datasets exceeded! \n");
         ccp4_parse_end(parser);
         ccp4_file_close(filein);
-        free(filename);
         return NULL;
       }
       strcpy(project,"dummy");
@@ -274,7 +288,6 @@ MTZ *MtzGetUserCellTolerance(const char *logname, int read_refs, const double ce
             printf("MtzGet: Maximum number of crystals exceeded! \n");
           ccp4_parse_end(parser);
           ccp4_file_close(filein);
-          free(filename);
           return NULL;
         }
         jxtalin[iiset]=nxtal-1;
@@ -306,7 +319,6 @@ MTZ *MtzGetUserCellTolerance(const char *logname, int read_refs, const double ce
               printf("MtzGet: Maximum number of crystals exceeded! \n");
             ccp4_parse_end(parser);
             ccp4_file_close(filein);
-            free(filename);
             return NULL;
           }
           jxtalin[iiset]=nxtal-1;
@@ -346,7 +358,6 @@ MTZ *MtzGetUserCellTolerance(const char *logname, int read_refs, const double ce
             printf("MtzGet: Maximum number of crystals exceeded! \n");
           ccp4_parse_end(parser);
           ccp4_file_close(filein);
-          free(filename);
           return NULL;
         }
         strcpy(projin[nxtal-1],project);
@@ -380,7 +391,6 @@ MTZ *MtzGetUserCellTolerance(const char *logname, int read_refs, const double ce
   if (! (mtz = MtzMalloc(nxtal, nset))) {
     ccp4_parse_end(parser);
     ccp4_file_close(filein);
-    free(filename);
     return NULL;
   }
   if (debug) 
@@ -438,7 +448,6 @@ MTZ *MtzGetUserCellTolerance(const char *logname, int read_refs, const double ce
                       CMTZ_ERRNO(CMTZERR_NullDataset),"MtzGet",NULL);
           ccp4_parse_end(parser);
           ccp4_file_close(filein);
-          free(filename);
           return NULL;
 	}
         mtz->xtal[jxtalin[iiset]]->set[nset[jxtalin[iiset]]]->setid = iset;
@@ -474,7 +483,6 @@ MTZ *MtzGetUserCellTolerance(const char *logname, int read_refs, const double ce
       ccp4_signal(CCP4_ERRLEVEL(3) | CMTZ_ERRNO(CMTZERR_ReadFail),"MtzGet",NULL);
       ccp4_parse_end(parser);
       ccp4_file_close(filein);
-      free(filename);
       return NULL;
     }
     hdrrec[MTZRECORDLENGTH] = '\0';
@@ -506,7 +514,6 @@ MTZ *MtzGetUserCellTolerance(const char *logname, int read_refs, const double ce
          ccp4_signal(CCP4_ERRLEVEL(3) | CMTZ_ERRNO(CMTZERR_BadVersion),"MtzGet",NULL);
          ccp4_parse_end(parser);
          ccp4_file_close(filein);
-         free(filename);
          return(NULL);
          }  
       if (atoi(hdrrec+12) != MTZ_MINOR_VERSN) {
@@ -548,7 +555,6 @@ MTZ *MtzGetUserCellTolerance(const char *logname, int read_refs, const double ce
                         "MtzGet", NULL);
         ccp4_parse_end(parser);
         ccp4_file_close(filein);
-        free(filename);
 	return(NULL);
       }
       mtz->mtzsymm.nsym = (int) token[1].value;
@@ -574,7 +580,6 @@ MTZ *MtzGetUserCellTolerance(const char *logname, int read_refs, const double ce
                         "MtzGet", NULL);
         ccp4_parse_end(parser);
         ccp4_file_close(filein);
-        free(filename);
 	return(NULL);
       }
       ++icolin;
@@ -583,7 +588,6 @@ MTZ *MtzGetUserCellTolerance(const char *logname, int read_refs, const double ce
           printf("MtzGet: Maximum number of columns exceeded! \n");
         ccp4_parse_end(parser);
         ccp4_file_close(filein);
-        free(filename);
         return NULL;
       }
       strcpy(label,token[1].fullstring);
@@ -687,7 +691,6 @@ MTZ *MtzGetUserCellTolerance(const char *logname, int read_refs, const double ce
 		    "MtzGet", NULL);
 	ccp4_parse_end(parser);
 	ccp4_file_close(filein);
-	free(filename);
 	return(NULL);
       }
       strncpy( newcol->colsource, token[2].fullstring, 36 );
@@ -716,7 +719,6 @@ MTZ *MtzGetUserCellTolerance(const char *logname, int read_refs, const double ce
 		    "MtzGet", NULL);
 	ccp4_parse_end(parser);
 	ccp4_file_close(filein);
-	free(filename);
 	return(NULL);
       }
       strncpy( newcol->grpname, token[2].fullstring, 30 );
@@ -789,7 +791,6 @@ MTZ *MtzGetUserCellTolerance(const char *logname, int read_refs, const double ce
                         "MtzGet", NULL);
           ccp4_parse_end(parser);
           ccp4_file_close(filein);
-          free(filename);
           return(NULL);
         }
 
@@ -866,10 +867,10 @@ MTZ *MtzGetUserCellTolerance(const char *logname, int read_refs, const double ce
 
     refldata = (float *) ccp4_utils_malloc(ntotcol*sizeof(float));
     /* Read all reflections into memory - make this optional? */
-    for (i = 0; i < mtz->nref_filein; ++i) {
+    for (iref = 0; iref < mtz->nref_filein; ++iref) {
       MtzRrefl(filein, ntotcol, refldata);
       for (j = 0; j < ntotcol; ++j)
-        colin[j]->ref[i] = refldata[j];
+        colin[j]->ref[iref] = refldata[j];
     }
     free(refldata);
 
@@ -880,10 +881,10 @@ MTZ *MtzGetUserCellTolerance(const char *logname, int read_refs, const double ce
 
     for (i = 0; i < mtz->nxtal; ++i) {
       MtzHklcoeffs(mtz->xtal[i]->cell, coefhkl);
-      for (j = 0; j < mtz->nref; ++j) {
-        indhigh[0] = (int) mtz->xtal[ind_xtal]->set[ind_set]->col[ind_col[0]]->ref[j];
-        indhigh[1] = (int) mtz->xtal[ind_xtal]->set[ind_set]->col[ind_col[1]]->ref[j];
-        indhigh[2] = (int) mtz->xtal[ind_xtal]->set[ind_set]->col[ind_col[2]]->ref[j];
+      for (iref = 0; iref < mtz->nref; ++iref) {
+        indhigh[0] = (int) mtz->xtal[ind_xtal]->set[ind_set]->col[ind_col[0]]->ref[iref];
+        indhigh[1] = (int) mtz->xtal[ind_xtal]->set[ind_set]->col[ind_col[1]]->ref[iref];
+        indhigh[2] = (int) mtz->xtal[ind_xtal]->set[ind_set]->col[ind_col[2]]->ref[iref];
         maxres = MtzInd2reso(indhigh, coefhkl);
         if (maxres > mtz->xtal[i]->resmax) mtz->xtal[i]->resmax = maxres;
         if (maxres < mtz->xtal[i]->resmin) mtz->xtal[i]->resmin = maxres;
@@ -895,8 +896,6 @@ MTZ *MtzGetUserCellTolerance(const char *logname, int read_refs, const double ce
     mtz->filein = NULL;
   }
 
-  free(filename); 
-
   return(mtz);}
 
 int MtzArrayToBatch(const int *intbuf, const float *fltbuf, MTZBAT *batch)
@@ -1484,7 +1483,7 @@ int ccp4_lridx(const MTZ *mtz, const MTZSET *set, char crystal_name[64],
 }
 
 /* Return MTZ record in file order */
-int ccp4_lrrefl(const MTZ *mtz, float *resol, float adata[], int logmss[], int iref) {
+int ccp4_lrrefl(const MTZ *mtz, float *resol, float adata[], int logmss[], int64_t iref) {
 
   int i,j,k;
   int ind[3],ixtal;
@@ -1548,7 +1547,7 @@ int ccp4_lrrefl(const MTZ *mtz, float *resol, float adata[], int logmss[], int i
 
 /* Return MTZ record in lookup order */
 int ccp4_lrreff(const MTZ *mtz, float *resol, float adata[], int logmss[],
-   const MTZCOL *lookup[], const int ncols, const int iref) {
+   const MTZCOL *lookup[], const int ncols, const int64_t iref) {
 
   int icol,l;
   int ind[3],ixtal,ind_xtal,ind_set,ind_col[3];
@@ -1692,7 +1691,7 @@ int ccp4_lhprt(const MTZ *mtz, int iprint) {
     }
   }
   printf("\n * Number of Columns = %d\n\n",MtzNumActiveCol(mtz));
-  printf(" * Number of Reflections = %d\n\n",mtz->nref);
+  printf(" * Number of Reflections = %lld\n\n",(long long) mtz->nref);
   if (strncmp (mtz->mnf.amnf,"NAN",3) == 0) {
    printf(" * Missing value set to NaN in input mtz file\n\n");
   } else {
@@ -1877,7 +1876,7 @@ int ccp4_lhprt_adv(const MTZ *mtz, int iprint) {
 
   printf("%s       %s\n",MTZTITLE,mtz->title);
   printf("%s       %d\n",MTZSPACEGROUP,mtz->mtzsymm.spcgrp);
-  printf("%s       %d\n",MTZNUMREFLS,mtz->nref);
+  printf("%s       %lld\n",MTZNUMREFLS,(long long) mtz->nref);
   if (strncmp (mtz->mnf.amnf,"NAN",3) == 0) {
    printf("%s       %s\n",MTZMNF,"NaN");
   } else {
@@ -2454,7 +2453,7 @@ int ccp4_lwbsetid(MTZ *mtz, MTZBAT *batch, const char xname[], const char dname[
   return 0;
 }
 
-int MtzDeleteRefl(MTZ *mtz, int iref)
+int MtzDeleteRefl(MTZ *mtz, int64_t iref)
 
 {
   int i,j,k;
@@ -2472,7 +2471,7 @@ int MtzDeleteRefl(MTZ *mtz, int iref)
 }
 
 int ccp4_lwrefl(MTZ *mtz, const float adata[], MTZCOL *lookup[], 
-           const int ncol, const int iref)
+           const int ncol, const int64_t iref)
 
 { int i,j,k,l,icol,ind[3],ind_xtal,ind_set,ind_col[3];
   float refldata[MCOLUMNS],res;
@@ -2579,7 +2578,8 @@ int MtzPut(MTZ *mtz, const char *logname)
 
 { char hdrrec[81],symline[81],spgname[MAXSPGNAMELENGTH+3];
  CCP4File *fileout;
- int i, j, k, l, hdrst, icol, numbat, isort[5], debug=0;
+ int i, j, k, icol, numbat, isort[5], debug=0;
+ int64_t l;
  int ind[3],ind_xtal,ind_set,ind_col[3],length,glob_cell_written=0;
  double coefhkl[6];
  float res,refldata[MCOLUMNS];
@@ -2665,7 +2665,7 @@ int MtzPut(MTZ *mtz, const char *logname)
  } else {
    numbat = MtzNbat(mtz) - mtz->n_orig_bat;
  }
- sprintf(hdrrec,"NCOL %8d %12d %8d",MtzNumActiveCol(mtz),mtz->nref,numbat);
+ sprintf(hdrrec,"NCOL %8d %12lld %8d",MtzNumActiveCol(mtz),(long long) mtz->nref,numbat);
  MtzWhdrLine(fileout,35,hdrrec);
  if (debug) printf(" MtzPut: NCOL just written \n");
 
@@ -2732,10 +2732,10 @@ int MtzPut(MTZ *mtz, const char *logname)
    mtz->xtal[i]->resmax = 0.0;
    mtz->xtal[i]->resmin = 100.0;
    MtzHklcoeffs(mtz->xtal[i]->cell, coefhkl);
-   for (j = 0; j < mtz->nref; ++j) {
-      ind[0] = (int) mtz->xtal[ind_xtal]->set[ind_set]->col[ind_col[0]]->ref[j];
-      ind[1] = (int) mtz->xtal[ind_xtal]->set[ind_set]->col[ind_col[1]]->ref[j];
-      ind[2] = (int) mtz->xtal[ind_xtal]->set[ind_set]->col[ind_col[2]]->ref[j];
+   for (l = 0; l < mtz->nref; ++l) {
+      ind[0] = (int) mtz->xtal[ind_xtal]->set[ind_set]->col[ind_col[0]]->ref[l];
+      ind[1] = (int) mtz->xtal[ind_xtal]->set[ind_set]->col[ind_col[1]]->ref[l];
+      ind[2] = (int) mtz->xtal[ind_xtal]->set[ind_set]->col[ind_col[2]]->ref[l];
       res = MtzInd2reso(ind, coefhkl);
       /* crystal limits */
       if (res > 0.0) {
@@ -2959,12 +2959,9 @@ int MtzPut(MTZ *mtz, const char *logname)
    ccp4_file_writechar(fileout,(const uint8 *)mtz->xml,strlen(mtz->xml));
  }
 
- /* go back and correct hdrst */
- ccp4_file_setmode(fileout,0);
- ccp4_file_seek(fileout, 4, SEEK_SET); 
- hdrst = mtz->nref * MtzNumActiveCol(mtz) + SIZE1 + 1;
- ccp4_file_setmode(fileout,2);
- ccp4_file_write(fileout,(uint8 *) &hdrst,1);
+ /* go back and correct hdrst, unless written sequentially by MtzPutStream */
+ if (fileout->direct)
+   MtzWhdrst(fileout, mtz->nref * MtzNumActiveCol(mtz) + SIZE1 + 1);
 
  /* And close the mtz file: */
  if (!mtz->fileout) 
@@ -3089,7 +3086,6 @@ CCP4File *MtzOpenForWrite(const char *logname)
 
 { CCP4File *fileout;
  int debug=0;
- int hdrst;
  char *filename;
 
  if (debug) printf(" MtzOpenForWrite: entering \n");
@@ -3100,12 +3096,24 @@ CCP4File *MtzOpenForWrite(const char *logname)
    filename = strdup(logname);
  }
  fileout = ccp4_file_open(filename,O_RDWR | O_TRUNC);
+ free(filename); 
  if (! fileout ) {
    ccp4_signal(CCP4_ERRLEVEL(3) | CMTZ_ERRNO(CMTZERR_CantOpenFile),"MtzOpenForWrite",NULL);
    return NULL;
  }
  if (debug) printf(" MtzOpenForWrite: file opened \n");
 
+ MtzInitForWrite(fileout);
+
+ if (debug) printf(" MtzOpenForWrite: bye bye \n");
+ return fileout;
+}
+
+void MtzInitForWrite(CCP4File *fileout)
+
+{ int debug=0;
+ int hdrst;
+
  /* Write initial info */
  ccp4_file_setmode(fileout,0);
  ccp4_file_writechar(fileout, (uint8 *) "MTZ ",4);
@@ -3116,16 +3124,80 @@ CCP4File *MtzOpenForWrite(const char *logname)
  ccp4_file_setstamp(fileout,2);
 /* Write architecture */
  ccp4_file_warch(fileout);
- if (debug) printf(" MtzOpenForWrite: stamp written \n");
+ if (debug) printf(" MtzInitForWrite: stamp written \n");
 
  /* Position at start of reflections - intervening gap should be filled
     with zeros */
  ccp4_file_seek(fileout, SIZE1, SEEK_SET); 
+}
 
- free(filename); 
+int MtzPutFile(MTZ *mtz, CCP4File *fileout)
 
- if (debug) printf(" MtzOpenForWrite: bye bye \n");
- return fileout;
+{ int istat;
+
+ if (mtz->fileout || !fileout) return 0;
+
+ MtzInitForWrite(fileout);
+ mtz->fileout = fileout;
+ istat = MtzPut(mtz, " ");
+ mtz->fileout = NULL;
+
+ return istat;
+}
+
+int MtzPutStream(MTZ *mtz, CCP4File *fileout)
+
+{ CCP4File *block;
+ char *data, prefix[SIZE1*4];
+ size_t length;
+ int istat;
+
+ if (mtz->fileout || !fileout) return 0;
+
+ /* The header position follows from the number of reflections, so the
+    pre-reflection block is assembled in memory in its final form */
+ if ( !(block = ccp4_file_open_memory(NULL, 0, O_RDWR | O_TRUNC)) ) return 0;
+ MtzInitForWrite(block);
+ MtzWhdrst(block, mtz->nref * MtzNumActiveCol(mtz) + SIZE1 + 1);
+ data = (char *) ccp4_file_take_memory(block, &length);
+ ccp4_file_close(block);
+ if (!data) return 0;
+
+ memset(prefix, 0, sizeof(prefix));
+ memcpy(prefix, data, length < sizeof(prefix) ? length : sizeof(prefix));
+ free(data);
+
+ if (ccp4_file_raw_write(fileout, prefix, sizeof(prefix)) != sizeof(prefix))
+   return 0;
+
+ /* No seeks from here on, also if fileout is a regular file */
+ fileout->direct = 0;
+ mtz->fileout = fileout;
+ istat = MtzPut(mtz, " ");
+ mtz->fileout = NULL;
+
+ return istat;
+}
+
+int MtzWhdrst(CCP4File *fileout, int64_t hdrst)
+
+{ int hdrword, hdrwords[2];
+
+ ccp4_file_setmode(fileout,0);
+ if (ccp4_file_seek(fileout, 4, SEEK_SET)) return 0;
+ hdrword = hdrst > INT_MAX ? -1 : (int) hdrst;
+ ccp4_file_setmode(fileout,2);
+ if (ccp4_file_write(fileout,(uint8 *) &hdrword,1) != 1) return 0;
+ /* Header start beyond 2^31 words: 64-bit position in the pre-reflection block */
+ if (hdrword == -1) {
+   hdrwords[0] = (int) (uint32_t) hdrst;
+   hdrwords[1] = (int) (hdrst >> 32);
+   ccp4_file_setmode(fileout,6);
+   if (ccp4_file_seek(fileout, HDRST64, SEEK_SET)) return 0;
+   if (ccp4_file_write(fileout,(uint8 *) hdrwords,2) != 2) return 0;
+ }
+
+ return 1;
 }
 
 int MtzBatchToArray(MTZBAT *batch, int *intbuf, float *fltbuf)
@@ -3389,7 +3461,7 @@ int MtzFreeBatch(MTZBAT *batch)
   return 1;
 }
 
-MTZCOL *MtzMallocCol(MTZ *mtz, int nref)
+MTZCOL *MtzMallocCol(MTZ *mtz, int64_t nref)
 
 { MTZCOL *col;
 
@@ -3523,7 +3595,7 @@ MTZCOL *MtzAddColumn(MTZ *mtz, MTZSET *set, const char *label,
                 const char *type)
 {
   /* add a new column to the dataset */
-  int i,nref;
+  int64_t i,nref;
   union float_uint_uchar uf;
   MTZCOL *col;
 
@@ -3758,7 +3830,7 @@ int MtzNumSourceCol(const MTZ *mtz)
   return icol;
 }
    
-int MtzNref(const MTZ *mtz)
+int64_t MtzNref(const MTZ *mtz)
 {
   /* get the number of reflections in the mtz */
 
@@ -141,6 +141,19 @@ MTZ *MtzGet(const char *logname, int read_refs);
  */
 MTZ *MtzGetUserCellTolerance(const char *logname, int read_refs, const double cell_tolerance);
 
+/** Reads the contents of an open MTZ file into an MTZ structure. As for
+ * function MtzGetUserCellTolerance except that the file has been opened
+ * by the caller, e.g. with ccp4_file_open_memory. The file is owned by
+ * the MTZ struct: it is closed on failure, after reading if read_refs
+ * is non-zero, and otherwise by MtzFree.
+ * @param filein (I) MTZ file opened for reading
+ * @param read_refs (I) Whether to read reflections into memory (non-zero) or
+ *        to read later from file (zero)
+ * @param cell_tolerance (I) User-defined tolerance for ccp4uc_cells_differ.
+ * @return Pointer to MTZ struct
+ */
+MTZ *MtzGetFromFile(CCP4File *filein, int read_refs, const double cell_tolerance);
+
 /** Reads reflection data from MTZ file.
  * @param filein pointer to input file
  * @param ncol number of columns to read
@@ -157,6 +170,24 @@ int MtzRrefl(CCP4File *filein, int ncol, float *refldata);
  */
 int MtzPut(MTZ *mtz, const char *logname);
 
+/** Writes an MTZ data structure to a file opened by the caller, e.g.
+ * with ccp4_file_open_memory. The file is left open.
+ * @param mtz pointer to MTZ struct, which must not have an output file.
+ * @param fileout file opened for writing.
+ * @return 1 on success, 0 on failure
+ */
+int MtzPutFile(MTZ *mtz, CCP4File *fileout);
+
+/** Writes an MTZ data structure to a sequential file such as stdout,
+ * without seeking. The pre-reflection block is written first with the
+ * final header position, then the reflections and the header follow.
+ * The file is left open.
+ * @param mtz pointer to MTZ struct, which must not have an output file.
+ * @param fileout file opened for writing.
+ * @return 1 on success, 0 on failure
+ */
+int MtzPutStream(MTZ *mtz, CCP4File *fileout);
+
 /** Opens a new MTZ file for writing. The output file can be specified
  * either with a true filename, or more likely as a logical name
  * corresponding to an environment variable or a CCP4 command line
@@ -166,6 +197,21 @@ int MtzPut(MTZ *mtz, const char *logname);
  */
 CCP4File *MtzOpenForWrite(const char *logname);
 
+/** Writes the initial information of an MTZ file and positions the file
+ * at the start of the reflections.
+ * @param fileout file opened for writing.
+ */
+void MtzInitForWrite(CCP4File *fileout);
+
+/** Writes the header position into the pre-reflection block. Positions
+ * beyond 2^31 words are stored as -1 with the 64-bit position in words
+ * HDRST64 and HDRST64+1.
+ * @param fileout Pointer to output file.
+ * @param hdrst Header position in words, counted from 1.
+ * @return 1 on success, 0 on failure
+ */
+int MtzWhdrst(CCP4File *fileout, int64_t hdrst);
+
 /** Write header record to fileout. Record is filled from
  * buffer and padded by blanks to a total length of MTZRECORDLENGTH.
  * @param fileout Pointer to output file.
@@ -190,7 +236,7 @@ int MtzWrefl(CCP4File *fileout, int ncol, float *refldata);
  * @param iref index of reflection
  * @return 0 if successful, 1 otherwise
  */
-int MtzDeleteRefl(MTZ *mtz, int iref);
+int MtzDeleteRefl(MTZ *mtz, int64_t iref);
 
 /** Position input file at start of reflections. Useful if you need
  * to read the reflections a second time.
@@ -225,7 +271,7 @@ int MtzFree(MTZ *mtz);
  * @param nref number of reflections in column.
  * @return pointer to MTZ column.
  */
-MTZCOL *MtzMallocCol(MTZ *mtz, int nref);
+MTZCOL *MtzMallocCol(MTZ *mtz, int64_t nref);
 
 /** Frees the memory reserved for 'col'
  * @param col pointer to MTZ column.
@@ -275,7 +321,7 @@ int MtzNbat(const MTZ *mtz);
  * @param mtz pointer to MTZ struct
  * @return Number of reflections.
  */
-int MtzNref(const MTZ *mtz);
+int64_t MtzNref(const MTZ *mtz);
 
 /** Get the spacegroup number (likely CCP4 convention).
  * @param mtz pointer to MTZ struct
@@ -786,7 +832,7 @@ int ccp4_lridx(const MTZ *mtz, const MTZSET *set, char crystal_name[64],
  * @param iref index of requested reflection (starting at 1).
  * @return 1 if past last reflection, else 0
  */
-int ccp4_lrrefl(const MTZ *mtz, float *resol, float adata[], int logmss[], int iref);
+int ccp4_lrrefl(const MTZ *mtz, float *resol, float adata[], int logmss[], int64_t iref);
 
 /** Returns iref'th reflection from file held in MTZ struct mtz. Returns
  * data for certain columns held in input file, as specified by the
@@ -805,7 +851,7 @@ int ccp4_lrrefl(const MTZ *mtz, float *resol, float adata[], int logmss[], int i
  * @return 1 if past last reflection, else 0
  */
 int ccp4_lrreff(const MTZ *mtz, float *resol, float adata[], int logmss[],
-		const MTZCOL *lookup[], const int ncols, const int iref);
+		const MTZCOL *lookup[], const int ncols, const int64_t iref);
 
 /** Checks whether a particular reflection value represents missing data.
  * @param mtz Pointer to the MTZ struct, which holds the value representing
@@ -973,7 +1019,7 @@ int ccp4_lwidx(MTZ *mtz, const char crystal_name[],  const char dataset_name[],
  * @return 1 on success, 0 on failure
  */
 int ccp4_lwrefl(MTZ *mtz, const float adata[], MTZCOL *lookup[], 
-		 const int ncol, const int iref);
+		 const int ncol, const int64_t iref);
 
 /** Write new batch information to 'batch' or if 'batch' is NULL create 
  * new batch header with batch number 'batno'. If you try to create more 
@@ -28,9 +28,9 @@
 #include "ccp4_errno.h"
 /* rcsid[] = "$Id$" */
 
-/** @global ccp4_errno: global to store data 
+/** @global ccp4_errno: thread-local to store data 
 */
-int ccp4_errno = 0;
+CCP4_THREAD_LOCAL int ccp4_errno = 0;
 
 /* error_levels: error level descriptions */
 static const char * const error_levels[] =
@@ -256,7 +256,8 @@ int CFile_Perror(const char *msg)
 }
 
 int ccp4_liberr_verbosity(int iverb) {
-  static int verbosity_level=1;
+  /* per thread, so that one converter cannot silence another */
+  static CCP4_THREAD_LOCAL int verbosity_level=1;
 
   if (iverb >= 0)
     verbosity_level = iverb;
@@ -291,26 +292,26 @@ void ccp4_signal(const int code, const char * const msg,
 
   if (system == 0) {
     if (msg) 
-      printf(sys_fmt,
+      fprintf(stderr, sys_fmt,
 	     errno,
 	     strerror(errno),
 	     error_levels[severity],
 	     msg);
     else 
-      printf(">>>>>> System signal %d:%s (%s) <<<<<<", 
+      fprintf(stderr, ">>>>>> System signal %d:%s (%s) <<<<<<", 
 	     errno, 
 	     strerror(errno), 
 	     error_levels[severity]);
     ccp4_errno = errno; }
   else 
     if (msg) 
-      printf(msg_fmt,
+      fprintf(stderr, msg_fmt,
 	     ccp4_errlist[system].system,
 	     ccp4_errlist[system].error_list[msg_no],
 	     error_levels[severity],
 	     msg);
     else
-      printf(">>>>>> CCP4 library signal %s:%s (%s) <<<<<<\n",
+      fprintf(stderr, ">>>>>> CCP4 library signal %s:%s (%s) <<<<<<\n",
 	     ccp4_errlist[system].system,
 	     ccp4_errlist[system].error_list[msg_no],
 	     error_levels[severity]);
@@ -31,6 +31,9 @@
 #include "library_file.h"
 #include "ccp4_errno.h"
 #include "ccp4_file_err.h"
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
 /* rcsid[] = "$Id: library_file.c,v 1.26 2012/08/20 12:21:16 gxg60988 Exp $" */
                                                         
 static uint16 nativeIT = NATIVEIT; /* machine integer type */ 
@@ -295,7 +298,17 @@ int ccp4_file_raw_read(CCP4File *cfile, char *buffer, size_t n_items)
 {
   int result;
   
-  if (cfile->buffered && cfile->stream) {
+  if (cfile->priv) {
+    /* memory-backed file, short count at end of data */
+    CCP4MemFile *mem = (CCP4MemFile *) cfile->priv;
+    result = (cfile->loc < cfile->length) ?
+      MIN(n_items, (size_t) (cfile->length - cfile->loc)) : 0;
+    memcpy(buffer, mem->data + cfile->loc, result);
+    if (n_items && result == 0) {
+      ccp4_signal(CCP4_ERRLEVEL(3) | CCP4_ERRNO(CIO_EOF), 
+		  "ccp4_file_raw_read", NULL); 
+      cfile->iostat = CIO_EOF; }
+  } else if (cfile->buffered && cfile->stream) {
     result = fread (buffer, (size_t) sizeof(char), n_items,
                     cfile->stream);
     if (result != n_items && feof(cfile->stream)) {
@@ -327,6 +340,41 @@ int ccp4_file_raw_read(CCP4File *cfile, char *buffer, size_t n_items)
   return result;
 }
 
+/**
+ * _memory_write:
+ * @param cfile  (CCP4File *) memory-backed file
+ * @param buffer (char *) output array
+ * @param n_items (size_t) number of items
+ *
+ * copies @n_items bytes from @buffer to the buffer of @cfile at
+ * @cfile->loc, growing the buffer as needed. A gap between the end
+ * of the data and @cfile->loc is filled with zeros.
+ * @return number of bytes written, 0 if the file is read-only.
+ */
+static int _memory_write(CCP4File *cfile, const char *buffer, size_t n_items)
+{
+  CCP4MemFile *mem = (CCP4MemFile *) cfile->priv;
+  size_t end = cfile->loc + n_items;
+  char *data;
+
+  if (!cfile->write || !mem->own)
+    return 0;
+
+  if (end > mem->capacity) {
+    size_t capacity = MAX(mem->capacity, (size_t) 65536);
+    while (capacity < end) capacity *= 2;
+    if (!(data = realloc(mem->data, capacity)))
+      return 0;
+    mem->data = data;
+    mem->capacity = capacity; }
+
+  if (cfile->loc > cfile->length)
+    memset(mem->data + cfile->length, 0, cfile->loc - cfile->length);
+  memcpy(mem->data + cfile->loc, buffer, n_items);
+
+  return (int) n_items;
+}
+
 /**
  * ccp4_file_raw_write:
  * @param cfile  (CCP4File *)
@@ -343,7 +391,9 @@ int ccp4_file_raw_write(CCP4File *cfile, const char *buffer, size_t n_items)
 {
   int result;
   
-  if (cfile->buffered && cfile->stream)
+  if (cfile->priv)
+    result = _memory_write(cfile, buffer, n_items);
+  else if (cfile->buffered && cfile->stream)
     result = fwrite (buffer, (size_t) sizeof(char), n_items,
                     cfile->stream);
   else 
@@ -371,31 +421,44 @@ int ccp4_file_raw_write(CCP4File *cfile, const char *buffer, size_t n_items)
 /**
  * ccp4_file_raw_seek:
  * @param cfile  (CCP4File *)
- * @param offset (long) offset in bytes
+ * @param offset (off_t) offset in bytes
  * @param whence (int) SEEK_SET, SEEK_CUR, or SEEK_END
  *
  * if the file is "seekable" (not stdin) the function
- * seeks on @cfile by offset bytes using fseek/ftell (@cfile->stream)
+ * seeks on @cfile by offset bytes using fseeko/ftello (@cfile->stream)
  * or lseek (@cfile->fd).  %SEEK_SET is relative
  * to start of file, %SEEK_CUR to current, %SEEK_END to
- * end.
- * @return offset in bytes on success, -1 on failure.
+ * end. The new offset is in @cfile->loc, as it may not fit the
+ * return value.
+ * @return 0 on success, -1 on failure.
  */
-int ccp4_file_raw_seek(CCP4File *cfile, long offset, int whence)
+int ccp4_file_raw_seek(CCP4File *cfile, off_t offset, int whence)
 {
-  int result = -1;
+  off_t result = -1;
       
   if (!cfile->direct)  {
     ccp4_signal(CCP4_ERRLEVEL(3) | CCP4_ERRNO(CIO_BadMode),
 		"ccp4_file_raw_seek", NULL);
     return result; }
   
-  if (cfile->buffered) {
+  if (cfile->priv) {
+    off_t base = (whence == SEEK_CUR) ? cfile->loc :
+      (whence == SEEK_END) ? cfile->length : 0;
+    /* writable buffers are zero-filled up to the new position */
+    if (base + offset >= 0 &&
+        (cfile->write || base + offset <= cfile->length))
+      result = base + offset;
+  } else if (cfile->buffered) {
 #if defined (__alpha) && defined (vms)
     (void) fflush (cfile->stream);
 #endif
+#if defined _MSC_VER
     if (!(result = (fseek (cfile->stream,offset,whence))))
       result = ftell(cfile->stream);   
+#else
+    if (!(result = (fseeko (cfile->stream,offset,whence))))
+      result = ftello(cfile->stream);   
+#endif
   } else {
 #if defined _MSC_VER
      result = _lseek(cfile->fd,offset,whence);
@@ -414,7 +477,7 @@ int ccp4_file_raw_seek(CCP4File *cfile, long offset, int whence)
     cfile->loc = result;
   cfile->getbuff = 0;
   
-  return (result);
+  return (result == -1 ? -1 : 0);
 }
 
 /**
@@ -510,7 +573,12 @@ static int _file_close (CCP4File *cfile)
 {
   int result = 0;
   
-  if(cfile->buffered && cfile->stream) {
+  if (cfile->priv) {
+    CCP4MemFile *mem = (CCP4MemFile *) cfile->priv;
+    if (mem->own) free(mem->data);
+    free(mem);
+    cfile->priv = NULL;
+  } else if(cfile->buffered && cfile->stream) {
     if (cfile->own)
       result = fclose (cfile->stream); 
     else
@@ -810,7 +878,11 @@ CCP4File *ccp4_file_open_file (const FILE *file, const int flag)
     cfile->length = st.st_size;
     cfile->direct = 1;
   }
+#if defined _MSC_VER
   cfile->loc = ftell( (FILE *)file);
+#else
+  cfile->loc = ftello( (FILE *)file);
+#endif
   
   return cfile;
 }
@@ -868,6 +940,255 @@ CCP4File *ccp4_file_open_fd (const int fd, const int flag)
   return cfile;
 }
 
+#ifdef HAVE_ZLIB
+/**
+ * _inflate_input:
+ * @param cfile (CCP4File *) file opened with fopen() or memory-backed
+ * @param in (unsigned char *) input array
+ * @param n (size_t) size of @in
+ *
+ * reads the next block of compressed data for ccp4_file_inflate().
+ * @return number of bytes read.
+ */
+static size_t _inflate_input(CCP4File *cfile, unsigned char *in, size_t n)
+{
+  CCP4MemFile *mem = (CCP4MemFile *) cfile->priv;
+  size_t nread;
+
+  if (!mem)
+    return fread(in, 1, n, cfile->stream);
+
+  nread = (cfile->loc < cfile->length) ?
+    MIN(n, (size_t) (cfile->length - cfile->loc)) : 0;
+  memcpy(in, mem->data + cfile->loc, nread);
+  cfile->loc += nread;
+
+  return nread;
+}
+#endif
+
+/**
+ * ccp4_file_inflate:
+ * @param cfile (CCP4File *) file opened read-only with fopen(), or
+ *        memory-backed file
+ *
+ * if @cfile is gzip-compressed, decompress it into memory and make
+ * @cfile memory-backed (see ccp4_file_open_memory()), so that it can be
+ * read and seeked like the uncompressed file. The MTZ header is at the
+ * end of the file, so the whole stream is decompressed in one pass
+ * before reading starts. Concatenated gzip members are read as one
+ * stream. The buffer is sized from the gzip trailer, which holds the
+ * length of the last member modulo 2^32, and grown as needed.
+ * Other files, and all files without zlib support, are left unchanged.
+ * @return 0 on success, -1 on failure.
+ */
+int ccp4_file_inflate(CCP4File *cfile)
+{
+#ifdef HAVE_ZLIB
+  CCP4MemFile *mem = (CCP4MemFile *) cfile->priv;
+  unsigned char magic[4], in[65536];
+  unsigned char *data = NULL, *grown;
+  size_t size = 0, capacity, nread;
+  z_stream zs;
+  int status = Z_OK;
+
+  if (!mem && !cfile->stream)
+    return 0;
+
+  cfile->loc = 0;
+  if (_inflate_input(cfile, magic, 2) != 2 ||
+      magic[0] != 0x1f || magic[1] != 0x8b) {
+    cfile->loc = 0;
+    return (!mem && fseek(cfile->stream, 0L, SEEK_SET)) ? -1 : 0; }
+
+  if (mem) {
+    if (cfile->length < 4) return -1;
+    memcpy(magic, mem->data + cfile->length - 4, 4);
+  } else if (fseek(cfile->stream, -4L, SEEK_END) ||
+             fread(magic, 1, 4, cfile->stream) != 4) {
+    return -1; }
+  cfile->loc = 0;
+  if (!mem && fseek(cfile->stream, 0L, SEEK_SET))
+    return -1;
+  capacity = magic[0] | magic[1] << 8 | magic[2] << 16 |
+    (size_t) magic[3] << 24;
+  capacity = MAX(capacity, (size_t) 65536);
+
+  memset(&zs, 0, sizeof(zs));
+  /* 32 + 15 window bits detect the gzip header */
+  if (!(data = malloc(capacity)) || inflateInit2(&zs, 32 + 15) != Z_OK) {
+    free(data);
+    return -1; }
+
+  while ((nread = _inflate_input(cfile, in, sizeof(in))) > 0) {
+    zs.next_in = in;
+    zs.avail_in = nread;
+    /* continue while input is left or output is pending */
+    while (zs.avail_in > 0 || (status == Z_OK && zs.avail_out == 0)) {
+      if (status == Z_STREAM_END) {
+        /* next member */
+        if (inflateReset(&zs) != Z_OK) break;
+        status = Z_OK; }
+      if (size == capacity) {
+        if (!(grown = realloc(data, 2 * capacity))) break;
+        data = grown;
+        capacity *= 2; }
+      zs.next_out = data + size;
+      zs.avail_out = capacity - size;
+      status = inflate(&zs, Z_NO_FLUSH);
+      size = capacity - zs.avail_out;
+      if (status == Z_BUF_ERROR) status = Z_OK;
+      if (status != Z_OK && status != Z_STREAM_END) break;
+    }
+    if (zs.avail_in > 0) break;
+  }
+  inflateEnd(&zs);
+
+  /* complete members only */
+  if (zs.avail_in > 0 || status != Z_STREAM_END ||
+      (!mem && ferror(cfile->stream))) {
+    free(data);
+    cfile->loc = 0;
+    if (!mem) fseek(cfile->stream, 0L, SEEK_SET);
+    return -1; }
+
+  if (mem) {
+    if (mem->own) free(mem->data);
+  } else {
+    if (!(mem = (CCP4MemFile *) malloc(sizeof(CCP4MemFile)))) {
+      free(data);
+      return -1; }
+    if (cfile->own) fclose(cfile->stream);
+    cfile->stream = NULL;
+    cfile->buffered = 0;
+    cfile->own = 0;
+    cfile->priv = mem;
+  }
+  mem->data = (char *) data;
+  mem->capacity = capacity;
+  mem->own = 1;
+  cfile->length = size;
+  cfile->loc = 0;
+#endif
+
+  return 0;
+}
+
+/**
+ * ccp4_file_open_memory:
+ * @param data (const void *) buffer, may be NULL for writing
+ * @param length (const size_t) length of @data in bytes
+ * @param flag (const int) io mode (O_RDONLY =0, O_WRONLY =1, O_RDWR =2)
+ *
+ * initialise CCP4File struct backed by memory instead of a file.
+ * Read-only files read @data in place, which must remain valid until
+ * the file is closed. Writable files start with a copy of @data in a
+ * buffer that grows as needed and is retrieved with
+ * ccp4_file_take_memory(). Memory-backed files are direct access.
+ * @return (CCP4File *) on success, NULL on failure
+ */
+CCP4File *ccp4_file_open_memory (const void *data, const size_t length,
+                                 const int flag)
+{
+  CCP4File *cfile;
+  CCP4MemFile *mem;
+
+  if (!data && length) {
+    ccp4_signal(CCP4_ERRLEVEL(3) | CCP4_ERRNO(CIO_NullPtr),
+                "ccp4_file_open_memory", NULL);
+    return NULL; }
+
+  if (!(cfile = _file_init()) ||
+      !(mem = (CCP4MemFile *) calloc(1, sizeof(CCP4MemFile)))) {
+    if (cfile) _file_free(cfile);
+    ccp4_signal(CCP4_ERRLEVEL(3), "ccp4_file_open_memory", NULL);
+    return NULL; }
+
+  _file_open_mode(cfile, flag);
+  if (cfile->write) {
+    mem->own = 1;
+    if (length) {
+      if (!(mem->data = (char *) malloc(length))) {
+        free(mem);
+        _file_free(cfile);
+        ccp4_signal(CCP4_ERRLEVEL(3), "ccp4_file_open_memory", NULL);
+        return NULL; }
+      memcpy(mem->data, data, length);
+      mem->capacity = length; }
+  } else {
+    mem->data = (char *) data;
+    mem->capacity = length;
+  }
+
+  cfile->priv = mem;
+  cfile->buffered = 0;
+  cfile->open = 1;
+  cfile->direct = 1;
+  cfile->length = (flag & O_TRUNC) ? 0 : length;
+  cfile->loc = cfile->append ? cfile->length : 0;
+
+  return cfile;
+}
+
+/**
+ * ccp4_file_take_memory:
+ * @param cfile (CCP4File *) writable memory-backed file
+ * @param length (size_t *) returns the length of the data
+ *
+ * take over the buffer of a writable memory-backed @cfile. The buffer
+ * is no longer freed when @cfile is closed and must be freed by the
+ * caller. Further writes to @cfile fail.
+ * @return the buffer on success, NULL on failure
+ */
+void *ccp4_file_take_memory (CCP4File *cfile, size_t *length)
+{
+  CCP4MemFile *mem;
+
+  if (!cfile || !cfile->priv || !cfile->write) {
+    ccp4_signal(CCP4_ERRLEVEL(3) | CCP4_ERRNO(CIO_BadMode),
+                "ccp4_file_take_memory", NULL);
+    return NULL; }
+
+  mem = (CCP4MemFile *) cfile->priv;
+  if (!mem->own) return NULL;
+  mem->own = 0;
+  *length = cfile->length;
+
+  return mem->data;
+}
+
+/**
+ * ccp4_file_give_memory:
+ * @param cfile (CCP4File *) writable memory-backed file
+ * @param data (void *) buffer allocated with malloc()
+ * @param capacity (size_t) size of @data in bytes
+ *
+ * hand a buffer to a writable memory-backed @cfile, which writes into it
+ * instead of allocating its own, so that one buffer can be reused for
+ * several files. The buffer is owned by @cfile, and the current data
+ * is discarded. Retrieve it with ccp4_file_take_memory().
+ * @return 0 on success, -1 on failure
+ */
+int ccp4_file_give_memory (CCP4File *cfile, void *data, const size_t capacity)
+{
+  CCP4MemFile *mem;
+
+  if (!cfile || !cfile->priv || !cfile->write || !data) {
+    ccp4_signal(CCP4_ERRLEVEL(3) | CCP4_ERRNO(CIO_BadMode),
+                "ccp4_file_give_memory", NULL);
+    return -1; }
+
+  mem = (CCP4MemFile *) cfile->priv;
+  if (mem->own) free(mem->data);
+  mem->data = (char *) data;
+  mem->capacity = capacity;
+  mem->own = 1;
+  cfile->length = 0;
+  cfile->loc = 0;
+
+  return 0;
+}
+
 /**
  * ccp4_file_open:
  * @param filename (const char *) filename
@@ -1005,6 +1326,14 @@ CCP4File *ccp4_file_open (const char *filename, const int flag)
     cfile->direct = 1;
   }
   cfile->loc = cfile->append ? cfile->length : 0;
+
+  if (cfile->read && !cfile->write && cfile->direct && cfile->stream)
+    if (ccp4_file_inflate(cfile)) {
+      ccp4_signal(CCP4_ERRLEVEL(3) | CCP4_ERRNO(CIO_ReadFail),
+                  "ccp4_file_open(inflate)", NULL);
+      _file_close(cfile);
+      _file_free(cfile);
+      return NULL; }
   
   return cfile;
 }
@@ -2002,7 +2331,7 @@ int ccp4_file_writechar (CCP4File *cfile, const uint8 *buffer, size_t nitems)
  *
  * @return 0 on success, -1 on failure
  */
-int ccp4_file_seek (CCP4File *cfile, long offset, int whence)
+int ccp4_file_seek (CCP4File *cfile, off_t offset, int whence)
 {
   int result;
 
@@ -2048,7 +2377,7 @@ void ccp4_file_rewind (CCP4File *cfile)
  * Length of file on disk.
  * @return length of @cfile on success, EOF on failure
  */
-long ccp4_file_length (CCP4File *cfile)
+off_t ccp4_file_length (CCP4File *cfile)
 {
 #if defined _MSC_VER
   struct _stat st;
@@ -2063,6 +2392,9 @@ long ccp4_file_length (CCP4File *cfile)
         
   cfile->last_op = IRRELEVANT_OP;
   
+  if (cfile->priv)
+    return (cfile->length);
+
   if (cfile->buffered && cfile->stream)
       fflush (cfile->stream);
 #if defined _MSC_VER
@@ -2082,9 +2414,9 @@ long ccp4_file_length (CCP4File *cfile)
  * Current location in file, uses either ftell or lseek.
  * @return current offset of @cfile in bytes.
  */
-long ccp4_file_tell (CCP4File *cfile)
+off_t ccp4_file_tell (CCP4File *cfile)
 {
-  long result;
+  off_t result;
   
   if (! cfile) {
     ccp4_signal(CCP4_ERRLEVEL(3) | CCP4_ERRNO(CIO_NullPtr), 
@@ -2093,11 +2425,18 @@ long ccp4_file_tell (CCP4File *cfile)
 
   cfile->last_op = IRRELEVANT_OP;
 
+  if (cfile->priv)
+    return (cfile->loc);
+
   if (cfile->buffered && cfile->stream) {
 #if !defined (_MSC_VER)
     if ( cfile->last_op == WRITE_OP ) fflush (cfile->stream);
 #endif	
-    result = (long) ftell(cfile->stream);
+#if defined _MSC_VER
+    result = ftell(cfile->stream);
+#else
+    result = ftello(cfile->stream);
+#endif
   } else
 #if defined _MSC_VER
     result = _lseek(cfile->fd, 0L, SEEK_CUR);
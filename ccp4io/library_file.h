@@ -66,6 +66,13 @@ struct _CFileStruct {
   void *priv;
 };
 
+/** Buffer of a memory-backed CCP4File, held in @c priv. */
+typedef struct _CMemStruct {
+  char *data;
+  size_t capacity;
+  unsigned int own : 1;
+} CCP4MemFile;
+
 
 CCP4File *ccp4_file_open (const char *, const int);
 
@@ -73,6 +80,14 @@ CCP4File *ccp4_file_open_file (const FILE *, const int);
 
 CCP4File *ccp4_file_open_fd (const int, const int);
 
+CCP4File *ccp4_file_open_memory (const void *, const size_t, const int);
+
+void *ccp4_file_take_memory (CCP4File *, size_t *);
+
+int ccp4_file_give_memory (CCP4File *, void *, const size_t);
+
+int ccp4_file_inflate (CCP4File *);
+
 int ccp4_file_rarch ( CCP4File*);
 
 int ccp4_file_warch ( CCP4File*);
@@ -133,15 +148,15 @@ int ccp4_file_writeshort ( CCP4File*, const uint8 *, size_t);
 
 int ccp4_file_writechar ( CCP4File*, const uint8 *, size_t);
 
-int ccp4_file_seek ( CCP4File*, long, int);
+int ccp4_file_seek ( CCP4File*, off_t, int);
 
 void ccp4_file_rewind ( CCP4File*);
 
 void ccp4_file_flush (CCP4File *);
 
-long ccp4_file_length ( CCP4File*);
+off_t ccp4_file_length ( CCP4File*);
 
-long ccp4_file_tell ( CCP4File*);
+off_t ccp4_file_tell ( CCP4File*);
 
 int ccp4_file_feof(CCP4File *);
 
@@ -151,7 +166,7 @@ void ccp4_file_fatal (CCP4File *, char *);
 
 char *ccp4_file_print(CCP4File *, char *, char *);
 
-int ccp4_file_raw_seek( CCP4File *, long, int);
+int ccp4_file_raw_seek( CCP4File *, off_t, int);
 int ccp4_file_raw_read ( CCP4File*, char *, size_t);
 int ccp4_file_raw_write ( CCP4File*, const char *, size_t);
 int ccp4_file_raw_setstamp( CCP4File *, const size_t);
@@ -549,19 +549,34 @@ char *ccp4_utils_joinfilenames(const char *dir, const char *file)
   return join;
 }
 
+/** Reentrant localtime().
+ * @param tim Time to convert.
+ * @param lt Broken-down local time.
+ * @return lt.
+ */
+struct tm *ccp4_utils_localtime (const time_t *tim, struct tm *lt)
+{
+#if defined(_WIN32)
+     localtime_s(lt, tim);
+#else
+     localtime_r(tim, lt);
+#endif
+     return lt;
+}
+
 /** .
  * 
  * @return 
  */
 void ccp4_utils_idate (int iarray[3])
 {
-     struct tm *lt=NULL;
+     struct tm lt;
      time_t tim;
      tim = time(NULL);
-     lt = localtime(&tim);
-     iarray[0] = lt->tm_mday;
-     iarray[1] = lt->tm_mon+1;  /* need range 1-12 */
-     iarray[2] = lt->tm_year + 1900;
+     ccp4_utils_localtime(&tim, &lt);
+     iarray[0] = lt.tm_mday;
+     iarray[1] = lt.tm_mon+1;  /* need range 1-12 */
+     iarray[2] = lt.tm_year + 1900;
 }
 
 /** .
@@ -585,13 +600,13 @@ char *ccp4_utils_date(char *date)
  */
 void ccp4_utils_itime (int iarray[3])
 {
-     struct tm *lt;
+     struct tm lt;
      time_t tim;
      tim = time(NULL);
-     lt = localtime(&tim);
-     iarray[0] = lt->tm_hour; 
-     iarray[1] = lt->tm_min; 
-     iarray[2] = lt->tm_sec;
+     ccp4_utils_localtime(&tim, &lt);
+     iarray[0] = lt.tm_hour; 
+     iarray[1] = lt.tm_min; 
+     iarray[2] = lt.tm_sec;
 }
 
 /** Alternative to ccp4_utils_itime with time as character string.
@@ -30,6 +30,8 @@
 #ifndef __CMTZData__
 #define __CMTZData__
 
+#include <stdint.h>
+
 #define MTZVERSN "MTZ:V1.1"         /**< traditional version number! */
 #define MTZ_MAJOR_VERSN 1      /**< MTZ file major version - keep to single digit */
 #define MTZ_MINOR_VERSN 1      /**< MTZ file minor version - keep to single digit */
@@ -38,6 +40,7 @@
 
 /** defines for sizes in MTZ structure */
 #define SIZE1 20                    /**< size of pre-reflection block */
+#define HDRST64 4                   /**< word of the 64-bit header start, used if the 32-bit one is -1 */
 #define MTZRECORDLENGTH 80          /**< length of records */
 #define MAXSPGNAMELENGTH 20         /**< max length of a spacegroup name */
 #define MAXPGNAMELENGTH 10          /**< max length of a pointgroup name */
@@ -180,8 +183,8 @@ typedef struct { CCP4File *filein;     /**< file for reading */
 		 int histlines;        /**< number of lines in hist */
 		 int nxtal;            /**< number of crystals */
                  int ncol_read;        /**< number of columns from file */
-		 int nref;             /**< total number of reflections */
-		 int nref_filein;      /**< number of reflections from input file */
+		 int64_t nref;         /**< total number of reflections */
+		 int64_t nref_filein;  /**< number of reflections from input file */
                  int refs_in_memory;   /**< whether reflections are held in memory */
 		 int n_orig_bat;       /**< original number of batches */
                  float resmax_out;     /**< output file max res */
@@ -0,0 +1,556 @@
+/*
+ * compress.c: gzip and zstd compression of JSON files
+ *
+ * Copyright (c) 2017 Frank Buermann <fburmann@mrc-lmb.cam.ac.uk>
+ *
+ * jsonmtz is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ * This software makes use of the jansson library (http://www.digip.org/jansson/)
+ * licensed under the terms of the MIT license,
+ * and the CCP4io library (http://www.ccp4.ac.uk/) licensed under the
+ * Lesser GNU General Public License 3.0.
+ */
+
+/*
+ * Output is cut into blocks of COMPRESS_BLOCK_SIZE bytes, which are
+ * compressed in parallel into independent gzip members or zstd frames.
+ * Concatenated members and frames are valid gzip and zstd files, which
+ * the standard tools and the streaming decompression below read as one.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "jsonmtz.h"
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+/**
+ * Writes a json value to a compressed file.
+ * @param[in] json The json value.
+ * @param[in] file_out The output file.
+ * @param[in] flags The jansson encoding flags.
+ * @param[in] method The compression method.
+ * @return 0 on success, -1 on failure.
+ */
+
+int8_t compressDumpFile(const json_t *json, const char *file_out, size_t flags, compression_t method)
+{
+    compress_writer_t cw;
+    long nproc = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t bound = compressionBound(method, COMPRESS_BLOCK_SIZE);
+    int8_t ret;
+
+    if (bound == 0)
+    {
+        return -1; // Not compiled in
+    }
+
+    memset(&cw, 0, sizeof(cw));
+    cw.method = method;
+    cw.nthreads = nproc > 0 ? (nproc < COMPRESS_MAX_THREADS ? nproc : COMPRESS_MAX_THREADS) : 1;
+    cw.jobs = calloc(cw.nthreads, sizeof(compress_job_t));
+    cw.fp = openOutput(file_out);
+
+    if (!cw.jobs || !cw.fp)
+    {
+        cw.fp ? closeOutput(cw.fp) : 0;
+        free(cw.jobs);
+        return -1;
+    }
+
+    for (size_t i = 0; i < cw.nthreads; i++)
+    {
+        cw.jobs[i].method = method;
+        cw.jobs[i].in = malloc(COMPRESS_BLOCK_SIZE);
+        cw.jobs[i].out = malloc(bound);
+        cw.jobs[i].outcap = bound;
+        (!cw.jobs[i].in || !cw.jobs[i].out) ? cw.failed = 1 : 0;
+    }
+
+    if (!cw.failed)
+    {
+        json_dump_callback(json, compressCallback, &cw, flags) != 0 ? cw.failed = 1 : 0;
+        compressFlush(&cw);
+    }
+
+    ret = cw.failed ? -1 : 0;
+
+    for (size_t i = 0; i < cw.nthreads; i++)
+    {
+        free(cw.jobs[i].in);
+        free(cw.jobs[i].out);
+    }
+    free(cw.jobs);
+
+    if (closeOutput(cw.fp) != 0)
+    {
+        return -1;
+    }
+
+    return ret;
+}
+
+/**
+ * The json_dump_callback() function filling the input blocks.
+ * @param[in] buffer The output of the encoder.
+ * @param[in] size The number of bytes.
+ * @param[in] data The compress_writer_t.
+ * @return 0 on success, -1 on failure.
+ */
+
+int compressCallback(const char *buffer, size_t size, void *data)
+{
+    compress_writer_t *cw = data;
+
+    while (size > 0 && !cw->failed)
+    {
+        compress_job_t *job = cw->jobs + cw->nblocks;
+        size_t n = COMPRESS_BLOCK_SIZE - job->inlen < size ? COMPRESS_BLOCK_SIZE - job->inlen : size;
+
+        memcpy(job->in + job->inlen, buffer, n);
+        job->inlen += n;
+        buffer += n;
+        size -= n;
+
+        if (job->inlen == COMPRESS_BLOCK_SIZE)
+        {
+            cw->nblocks++;
+            cw->nblocks == cw->nthreads ? compressFlush(cw) : 0;
+        }
+    }
+
+    return cw->failed ? -1 : 0;
+}
+
+/**
+ * Compresses the filled blocks in parallel and writes them in order.
+ * @param[in] cw The compress writer.
+ * @return 0 on success, -1 on failure.
+ */
+
+int8_t compressFlush(compress_writer_t *cw)
+{
+    size_t njobs = cw->nblocks;
+    size_t started = 0;
+
+    // Include a partly filled last block
+    njobs < cw->nthreads && cw->jobs[njobs].inlen > 0 ? njobs++ : 0;
+
+    if (njobs == 0)
+    {
+        return cw->failed ? -1 : 0;
+    }
+
+    // The calling thread compresses the first block
+    for (size_t i = 1; i < njobs; i++)
+    {
+        if (pthread_create(&cw->jobs[i].thread, NULL, compressWorker, cw->jobs + i) != 0)
+        {
+            break;
+        }
+        started++;
+    }
+
+    compressWorker(cw->jobs);
+
+    // Compress blocks without a thread here
+    for (size_t i = started + 1; i < njobs; i++)
+    {
+        compressWorker(cw->jobs + i);
+    }
+
+    for (size_t i = 1; i <= started; i++)
+    {
+        pthread_join(cw->jobs[i].thread, NULL);
+    }
+
+    for (size_t i = 0; i < njobs; i++)
+    {
+        compress_job_t *job = cw->jobs + i;
+
+        if (job->outlen == 0 || fwrite(job->out, 1, job->outlen, cw->fp) != job->outlen)
+        {
+            cw->failed = 1;
+        }
+
+        job->inlen = 0;
+    }
+
+    cw->nblocks = 0;
+
+    return cw->failed ? -1 : 0;
+}
+
+/**
+ * Thread function compressing one block.
+ * @param[in] arg The compress_job_t.
+ * @return NULL.
+ */
+
+void *compressWorker(void *arg)
+{
+    compress_job_t *job = arg;
+
+    job->outlen = compressBlock(job->method, job->in, job->inlen, job->out, job->outcap);
+
+    return NULL;
+}
+
+/**
+ * Checks if a compression method is compiled in.
+ * @param[in] method The compression method.
+ * @return 1 if true, 0 if false.
+ */
+
+uint8_t compressionAvailable(compression_t method)
+{
+    switch (method)
+    {
+    case COMPRESS_NONE:
+        return 1;
+#ifdef HAVE_ZLIB
+    case COMPRESS_GZIP:
+        return 1;
+#endif
+#ifdef HAVE_ZSTD
+    case COMPRESS_ZSTD:
+        return 1;
+#endif
+    default:
+        return 0;
+    }
+}
+
+/**
+ * Gets the largest compressed size of a block.
+ * @param[in] method The compression method.
+ * @param[in] length The block length.
+ * @return The compressed size, or 0 if the method is not available.
+ */
+
+size_t compressionBound(compression_t method, size_t length)
+{
+    switch (method)
+    {
+#ifdef HAVE_ZLIB
+    case COMPRESS_GZIP:
+        // deflateBound plus the gzip header and trailer
+        return compressBound(length) + 18;
+#endif
+#ifdef HAVE_ZSTD
+    case COMPRESS_ZSTD:
+        return ZSTD_compressBound(length);
+#endif
+    default:
+        return 0;
+    }
+}
+
+/**
+ * Compresses a block into a gzip member or a zstd frame.
+ * @param[in] method The compression method.
+ * @param[in] in The block.
+ * @param[in] length The block length.
+ * @param[out] out The output buffer.
+ * @param[in] capacity The size of the output buffer.
+ * @return The compressed length, or 0 on failure.
+ */
+
+size_t compressBlock(compression_t method, const char *in, size_t length, unsigned char *out, size_t capacity)
+{
+#ifdef HAVE_ZLIB
+    z_stream stream;
+#endif
+#ifdef HAVE_ZSTD
+    size_t outlen;
+#endif
+
+    switch (method)
+    {
+#ifdef HAVE_ZLIB
+    case COMPRESS_GZIP:
+        memset(&stream, 0, sizeof(stream));
+
+        // Window bits above 15 select the gzip wrapper
+        if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        {
+            return 0;
+        }
+
+        stream.next_in = (Bytef *)in;
+        stream.avail_in = length;
+        stream.next_out = out;
+        stream.avail_out = capacity;
+
+        if (deflate(&stream, Z_FINISH) != Z_STREAM_END)
+        {
+            deflateEnd(&stream);
+            return 0;
+        }
+
+        deflateEnd(&stream);
+        return stream.total_out;
+#endif
+#ifdef HAVE_ZSTD
+    case COMPRESS_ZSTD:
+        outlen = ZSTD_compress(out, capacity, in, length, COMPRESS_ZSTD_LEVEL);
+        return ZSTD_isError(outlen) ? 0 : outlen;
+#endif
+    default:
+        return 0;
+    }
+}
+
+/**
+ * Detects the compression of a file from its first bytes.
+ * @param[in] magic The first bytes.
+ * @param[in] length The number of bytes.
+ * @return The compression method.
+ */
+
+compression_t detectCompression(const unsigned char *magic, size_t length)
+{
+    if (length >= 2 && magic[0] == 0x1f && magic[1] == 0x8b)
+    {
+        return COMPRESS_GZIP;
+    }
+
+    if (length >= 4 && magic[0] == 0x28 && magic[1] == 0xb5 && magic[2] == 0x2f && magic[3] == 0xfd)
+    {
+        return COMPRESS_ZSTD;
+    }
+
+    return COMPRESS_NONE;
+}
+
+/**
+ * Reads a json value from a file that may be gzip or zstd compressed.
+ * Compressed input is decompressed in a streaming fashion into the parser.
+ * @param[in] file_in The input file.
+ * @param[in] flags The jansson decoding flags.
+ * @param[out] error The jansson error.
+ * @return The json value, or NULL on failure.
+ */
+
+json_t *decompressLoadFile(const char *file_in, size_t flags, json_error_t *error)
+{
+    decompress_reader_t dr;
+    json_t *json = NULL;
+
+    memset(&dr, 0, sizeof(dr));
+    dr.fp = strcmp(file_in, "-") == 0 ? stdin : fopen(file_in, "rb");
+
+    if (!dr.fp)
+    {
+        return NULL;
+    }
+
+    dr.inlen = fread(dr.in, 1, sizeof(dr.in), dr.fp);
+    dr.method = detectCompression(dr.in, dr.inlen);
+
+    if (decompressInit(&dr) == 0)
+    {
+        json = json_load_callback(decompressCallback, &dr, flags, error);
+    }
+
+    decompressEnd(&dr);
+    dr.fp != stdin ? fclose(dr.fp) : 0;
+
+    return json;
+}
+
+/**
+ * Sets up the decompression stream of a reader.
+ * @param[in] dr The reader, with the first input bytes read.
+ * @return 0 on success, -1 if the method is not available.
+ */
+
+int8_t decompressInit(decompress_reader_t *dr)
+{
+#ifdef HAVE_ZLIB
+    z_stream *zs = NULL;
+#endif
+
+    switch (dr->method)
+    {
+    case COMPRESS_NONE:
+        return 0;
+#ifdef HAVE_ZLIB
+    case COMPRESS_GZIP:
+        zs = calloc(1, sizeof(z_stream));
+
+        // Window bits above 31 detect zlib and gzip wrappers
+        if (!zs || inflateInit2(zs, 15 + 32) != Z_OK)
+        {
+            free(zs);
+            return -1;
+        }
+
+        zs->next_in = dr->in;
+        zs->avail_in = dr->inlen;
+        dr->stream = zs;
+        return 0;
+#endif
+#ifdef HAVE_ZSTD
+    case COMPRESS_ZSTD:
+        dr->stream = ZSTD_createDStream();
+        return dr->stream && !ZSTD_isError(ZSTD_initDStream(dr->stream)) ? 0 : -1;
+#endif
+    default:
+        return -1;
+    }
+}
+
+/**
+ * Releases the decompression stream of a reader.
+ * @param[in] dr The reader.
+ */
+
+void decompressEnd(decompress_reader_t *dr)
+{
+    switch (dr->method)
+    {
+#ifdef HAVE_ZLIB
+    case COMPRESS_GZIP:
+        dr->stream ? inflateEnd(dr->stream) : 0;
+        free(dr->stream);
+        break;
+#endif
+#ifdef HAVE_ZSTD
+    case COMPRESS_ZSTD:
+        ZSTD_freeDStream(dr->stream);
+        break;
+#endif
+    default:
+        break;
+    }
+
+    dr->stream = NULL;
+}
+
+/**
+ * The json_load_callback() function returning decompressed bytes.
+ * @param[out] buffer The buffer to fill.
+ * @param[in] buflen The buffer size.
+ * @param[in] data The decompress_reader_t.
+ * @return The number of bytes, 0 at the end of input, (size_t)-1 on failure.
+ */
+
+size_t decompressCallback(void *buffer, size_t buflen, void *data)
+{
+    decompress_reader_t *dr = data;
+    size_t n;
+#ifdef HAVE_ZLIB
+    z_stream *zs = NULL;
+    int status;
+#endif
+#ifdef HAVE_ZSTD
+    ZSTD_inBuffer zin;
+    ZSTD_outBuffer zout;
+    size_t status_zstd;
+#endif
+
+    switch (dr->method)
+    {
+    case COMPRESS_NONE:
+        // Hand out the bytes read for detection first
+        if (dr->inpos < dr->inlen)
+        {
+            n = dr->inlen - dr->inpos < buflen ? dr->inlen - dr->inpos : buflen;
+            memcpy(buffer, dr->in + dr->inpos, n);
+            dr->inpos += n;
+            return n;
+        }
+        n = fread(buffer, 1, buflen, dr->fp);
+        return ferror(dr->fp) ? (size_t)-1 : n;
+
+#ifdef HAVE_ZLIB
+    case COMPRESS_GZIP:
+        zs = dr->stream;
+        zs->next_out = buffer;
+        zs->avail_out = buflen;
+
+        while (zs->avail_out == buflen)
+        {
+            if (zs->avail_in == 0)
+            {
+                zs->avail_in = fread(dr->in, 1, sizeof(dr->in), dr->fp);
+                zs->next_in = dr->in;
+
+                if (zs->avail_in == 0)
+                {
+                    // Truncated input
+                    return ferror(dr->fp) || !dr->finished ? (size_t)-1 : 0;
+                }
+            }
+
+            // A new member may follow the end of a member
+            if (dr->finished)
+            {
+                inflateReset(zs);
+                dr->finished = 0;
+            }
+
+            status = inflate(zs, Z_NO_FLUSH);
+
+            if (status == Z_STREAM_END)
+            {
+                dr->finished = 1;
+            }
+            else if (status != Z_OK && status != Z_BUF_ERROR)
+            {
+                return (size_t)-1;
+            }
+        }
+
+        return buflen - zs->avail_out;
+#endif
+
+#ifdef HAVE_ZSTD
+    case COMPRESS_ZSTD:
+        zout.dst = buffer;
+        zout.size = buflen;
+        zout.pos = 0;
+
+        while (zout.pos == 0)
+        {
+            if (dr->inpos == dr->inlen)
+            {
+                dr->inlen = fread(dr->in, 1, sizeof(dr->in), dr->fp);
+                dr->inpos = 0;
+
+                if (dr->inlen == 0)
+                {
+                    return ferror(dr->fp) || !dr->finished ? (size_t)-1 : 0;
+                }
+            }
+
+            zin.src = dr->in;
+            zin.size = dr->inlen;
+            zin.pos = dr->inpos;
+
+            status_zstd = ZSTD_decompressStream(dr->stream, &zout, &zin);
+            dr->inpos = zin.pos;
+
+            if (ZSTD_isError(status_zstd))
+            {
+                return (size_t)-1;
+            }
+
+            // Zero at the end of a frame
+            dr->finished = status_zstd == 0;
+        }
+
+        return zout.pos;
+#endif
+
+    default:
+        return (size_t)-1;
+    }
+}
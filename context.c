@@ -0,0 +1,376 @@
+/*
+ * context.c: Reusable conversion context
+ *
+ * Copyright (c) 2017 Frank Buermann <fburmann@mrc-lmb.cam.ac.uk>
+ *
+ * jsonmtz is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ * This software makes use of the jansson library (http://www.digip.org/jansson/)
+ * licensed under the terms of the MIT license,
+ * and the CCP4io library (http://www.ccp4.ac.uk/) licensed under the
+ * Lesser GNU General Public License 3.0.
+ */
+
+/*
+ * Most allocations of a conversion are jansson values, one per reflection
+ * and column, plus object keys, hashtables and parser buffers. Programs
+ * using contexts call jsonmtzInit() first, before any json value exists,
+ * which installs an allocator for jansson. It serves the threads using a
+ * context from per-context free lists of power-of-two size classes.
+ * Blocks up to 4 KiB are cut from 1 MiB slabs, larger blocks up to 1 MiB
+ * are allocated singly, and both are kept on the free lists when released.
+ * Larger blocks and allocations outside a context go to malloc(). Every
+ * block carries a header naming its context, padded to the alignment of
+ * malloc(). Programs without contexts leave jansson on malloc().
+ * The JSON and MTZ outputs are written to buffers owned by the context,
+ * which grow to the largest output and are then reused.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include "jsonmtz.h"
+
+pthread_once_t ctxOnce = PTHREAD_ONCE_INIT;
+pthread_key_t ctxKey;
+
+/**
+ * Creates a conversion context. jsonmtzInit() must have been called.
+ * @return The context, or NULL on failure or without jsonmtzInit().
+ * Must be freed with jsonmtzCtxFree().
+ */
+
+jsonmtz_ctx_t *jsonmtzCtxNew(void)
+{
+    json_malloc_t malloc_fn;
+
+    json_get_alloc_funcs(&malloc_fn, NULL);
+    if (malloc_fn != ctxMalloc)
+    {
+        return NULL;
+    }
+
+    return calloc(1, sizeof(jsonmtz_ctx_t));
+}
+
+/**
+ * Frees a conversion context. json values allocated while the context was
+ * in use must be released before.
+ * @param[in] ctx The context.
+ */
+
+void jsonmtzCtxFree(jsonmtz_ctx_t *ctx)
+{
+    jsonmtz_ctx_t *previous = NULL;
+
+    if (!ctx)
+    {
+        return;
+    }
+
+    previous = jsonmtzCtxUse(NULL);
+    previous != ctx ? jsonmtzCtxUse(previous) : 0;
+
+    // Singly allocated blocks are on the free lists
+    for (size_t i = CTX_SLAB_CLASSES; i < CTX_CLASSES; i++)
+    {
+        ctx_block_t *block = ctx->freelist[i];
+
+        while (block)
+        {
+            ctx_block_t *next = *(ctx_block_t **)(block + 1);
+            free(block);
+            block = next;
+        }
+    }
+
+    for (size_t i = 0; i < ctx->nslabs; i++)
+    {
+        free(ctx->slabs[i]);
+    }
+
+    free(ctx->slabs);
+    free(ctx->json);
+    free(ctx->mtz);
+    free(ctx);
+}
+
+/**
+ * Makes a context the current context of the calling thread, so that
+ * jansson values are allocated from it. A context is used by one thread
+ * at a time, and values allocated from it must be released by that thread.
+ * @param[in] ctx The context, or NULL to allocate with malloc().
+ * @return The previous context of the thread.
+ */
+
+jsonmtz_ctx_t *jsonmtzCtxUse(jsonmtz_ctx_t *ctx)
+{
+    jsonmtz_ctx_t *previous = NULL;
+
+    pthread_once(&ctxOnce, ctxCreateKey);
+    previous = pthread_getspecific(ctxKey);
+    pthread_setspecific(ctxKey, ctx);
+
+    return previous;
+}
+
+/**
+ * Converts MTZ data in memory to JSON like mtz2jsonBuffer(), allocating
+ * from a context and writing the JSON text to its buffer.
+ * @param[in] ctx The context.
+ * @param[in] mtz The MTZ data.
+ * @param[in] length The length of the MTZ data in bytes.
+ * @param[out] json The JSON text, valid until the next conversion with ctx.
+ * @param[out] jsonlength The length of the JSON text in bytes.
+ * @param[in] opts Options struct.
+ * @return 0 on success, 2 if the MTZ data are not readable, -1 on other failures.
+ */
+
+int8_t mtz2jsonCtx(jsonmtz_ctx_t *ctx, const void *mtz, size_t length, const char **json, size_t *jsonlength, const options_mtz2json_t *opts)
+{
+    jsonmtz_ctx_t *previous = jsonmtzCtxUse(ctx);
+    int8_t ret;
+
+    ctx->jsonlength = 0;
+    ret = mtz2jsonBuffer(mtz, length, ctxCallback, ctx, opts);
+    jsonmtzCtxUse(previous);
+
+    *json = ret == 0 ? ctx->json : NULL;
+    *jsonlength = ret == 0 ? ctx->jsonlength : 0;
+
+    return ret;
+}
+
+/**
+ * Converts JSON or CBOR data in memory to MTZ like json2mtzBuffer(),
+ * allocating from a context and writing the MTZ data to its buffer.
+ * @param[in] ctx The context.
+ * @param[in] json The JSON text or CBOR data, depending on opts->format.
+ * @param[in] length The length of the input in bytes.
+ * @param[out] mtz The MTZ data, valid until the next conversion with ctx.
+ * @param[out] mtzlength The length of the MTZ data in bytes.
+ * @param[in] opts Options struct.
+ * @return 0 on success, 1 if the input is not readable, 2 if the conversion fails.
+ */
+
+int8_t json2mtzCtx(jsonmtz_ctx_t *ctx, const char *json, size_t length, const void **mtz, size_t *mtzlength, const options_json2mtz_t *opts)
+{
+    jsonmtz_ctx_t *previous = jsonmtzCtxUse(ctx);
+    int8_t ret;
+
+    ret = json2mtzInto(json, length, &ctx->mtz, &ctx->mtzcapacity, mtzlength, opts);
+    jsonmtzCtxUse(previous);
+
+    *mtz = ret == 0 ? ctx->mtz : NULL;
+    ret != 0 ? *mtzlength = 0 : 0;
+
+    return ret;
+}
+
+/**
+ * Appends JSON text to the buffer of a context, see json_dump_callback().
+ * @param[in] buffer The text.
+ * @param[in] size The number of bytes.
+ * @param[in] data The context.
+ * @return 0 on success, -1 on failure.
+ */
+
+int ctxCallback(const char *buffer, size_t size, void *data)
+{
+    jsonmtz_ctx_t *ctx = data;
+
+    if (ctx->jsonlength + size > ctx->jsoncapacity)
+    {
+        size_t capacity = ctx->jsoncapacity ? ctx->jsoncapacity : 65536;
+        char *grown = NULL;
+
+        while (capacity < ctx->jsonlength + size)
+        {
+            capacity *= 2;
+        }
+
+        grown = realloc(ctx->json, capacity);
+        if (!grown)
+        {
+            return -1;
+        }
+
+        ctx->json = grown;
+        ctx->jsoncapacity = capacity;
+    }
+
+    memcpy(ctx->json + ctx->jsonlength, buffer, size);
+    ctx->jsonlength += size;
+
+    return 0;
+}
+
+/**
+ * Installs the context allocator for jansson, which jsonmtzCtxNew()
+ * requires. Must be called before any json value exists, so that every
+ * block released by jansson was allocated by ctxMalloc(), and not in
+ * programs setting their own allocator with json_set_alloc_funcs().
+ */
+
+void jsonmtzInit(void)
+{
+    pthread_once(&ctxOnce, ctxCreateKey);
+    json_set_alloc_funcs(ctxMalloc, ctxFree);
+}
+
+/**
+ * Creates the thread key of the current context. Called once.
+ */
+
+void ctxCreateKey(void)
+{
+    pthread_key_create(&ctxKey, NULL);
+}
+
+/**
+ * Allocates memory for jansson from the current context of the thread.
+ * @param[in] size The number of bytes.
+ * @return The memory, or NULL on failure.
+ */
+
+void *ctxMalloc(size_t size)
+{
+    jsonmtz_ctx_t *ctx = pthread_getspecific(ctxKey);
+    size_t sizeclass = ctxSizeClass(size);
+    ctx_block_t *block = NULL;
+
+    if (!ctx || sizeclass == CTX_CLASSES)
+    {
+        block = malloc(sizeof(ctx_block_t) + size);
+        ctx = NULL;
+    }
+    else if (ctx->freelist[sizeclass])
+    {
+        block = ctx->freelist[sizeclass];
+        ctx->freelist[sizeclass] = *(ctx_block_t **)(block + 1);
+    }
+    else if (sizeclass < CTX_SLAB_CLASSES)
+    {
+        block = ctxSlabBlock(ctx, sizeof(ctx_block_t) + (CTX_MIN_BLOCK << sizeclass));
+    }
+    else
+    {
+        block = malloc(sizeof(ctx_block_t) + (CTX_MIN_BLOCK << sizeclass));
+    }
+
+    if (!block)
+    {
+        return NULL;
+    }
+
+    block->header.owner = ctx;
+    block->header.sizeclass = sizeclass;
+
+    return block + 1;
+}
+
+/**
+ * Releases memory allocated for jansson. Blocks from a context go back to
+ * its free lists, and other memory is passed to free().
+ * @param[in] ptr The memory.
+ */
+
+void ctxFree(void *ptr)
+{
+    ctx_block_t *block = (ctx_block_t *)ptr - 1;
+
+    if (!ptr)
+    {
+        return;
+    }
+
+    if (!block->header.owner)
+    {
+        free(block);
+        return;
+    }
+
+    // The payload holds the link
+    *(ctx_block_t **)ptr = block->header.owner->freelist[block->header.sizeclass];
+    block->header.owner->freelist[block->header.sizeclass] = block;
+}
+
+/**
+ * Frees memory returned by jansson, such as the text from json_dumps().
+ * @param[in] ptr The memory.
+ */
+
+void jsonFree(void *ptr)
+{
+    json_free_t free_fn;
+
+    json_get_alloc_funcs(NULL, &free_fn);
+    free_fn(ptr);
+}
+
+/**
+ * Finds the size class of an allocation.
+ * @param[in] size The number of bytes.
+ * @return The smallest class holding size bytes, or CTX_CLASSES if too large.
+ */
+
+size_t ctxSizeClass(size_t size)
+{
+    size_t sizeclass = 0;
+
+    while (sizeclass < CTX_CLASSES && (CTX_MIN_BLOCK << sizeclass) < size)
+    {
+        sizeclass++;
+    }
+
+    return sizeclass;
+}
+
+/**
+ * Cuts a block from the current slab of a context, starting a new slab
+ * when it is used up. The rest of the old slab is left unused.
+ * @param[in] ctx The context.
+ * @param[in] size The size of the block including its header.
+ * @return The block, or NULL on failure.
+ */
+
+ctx_block_t *ctxSlabBlock(jsonmtz_ctx_t *ctx, size_t size)
+{
+    ctx_block_t *block = NULL;
+
+    if (size > ctx->slableft)
+    {
+        char *slab = NULL;
+
+        if (ctx->nslabs == ctx->slabcapacity)
+        {
+            size_t capacity = ctx->slabcapacity ? 2 * ctx->slabcapacity : 16;
+            char **slabs = realloc(ctx->slabs, capacity * sizeof(char *));
+
+            if (!slabs)
+            {
+                return NULL;
+            }
+
+            ctx->slabs = slabs;
+            ctx->slabcapacity = capacity;
+        }
+
+        slab = malloc(CTX_SLAB_SIZE);
+        if (!slab)
+        {
+            return NULL;
+        }
+
+        ctx->slabs[ctx->nslabs++] = slab;
+        ctx->slabtop = slab;
+        ctx->slableft = CTX_SLAB_SIZE;
+    }
+
+    block = (ctx_block_t *)ctx->slabtop;
+    ctx->slabtop += size;
+    ctx->slableft -= size;
+
+    return block;
+}
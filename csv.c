@@ -0,0 +1,400 @@
+/*
+ * csv.c: MTZ to CSV/TSV export
+ *
+ * Copyright (c) 2017 Frank Buermann <fburmann@mrc-lmb.cam.ac.uk>
+ *
+ * jsonmtz is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ * This software makes use of the jansson library (http://www.digip.org/jansson/)
+ * licensed under the terms of the MIT license,
+ * and the CCP4io library (http://www.ccp4.ac.uk/) licensed under the
+ * Lesser GNU General Public License 3.0.
+ */
+
+/*
+ * Reflections are formatted in chunks of CSV_CHUNK_ROWS rows. Worker thread t
+ * formats chunks t, t + nthreads, t + 2 * nthreads, ... into its own buffer,
+ * and the calling thread writes the buffers in chunk order.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <unistd.h>
+#include "jsonmtz.h"
+
+/**
+ * Converts an MTZ reflection file to a CSV or TSV file.
+ * @param[in] file_in The input MTZ file.
+ * @param[in] file_out The output file.
+ * @param[in] opts Options struct.
+ * @return 0 on success, 2 if the input is not readable,
+ * 3 if a selected column does not exist, -1 on other failures.
+ */
+
+int8_t mtz2csv(const char *file_in, const char *file_out, const options_mtz2csv_t *opts)
+{
+    void *previous = useCLocale();
+    int8_t ret = mtz2csvFile(file_in, file_out, opts);
+
+    restoreLocale(previous);
+
+    return ret;
+}
+
+/**
+ * Converts an MTZ reflection file to a CSV or TSV file in the locale of the thread.
+ * @param[in] file_in The input MTZ file.
+ * @param[in] file_out The output file.
+ * @param[in] opts Options struct.
+ * @return 0 on success, 2 if the input is not readable,
+ * 3 if a selected column does not exist, -1 on other failures.
+ */
+
+int8_t mtz2csvFile(const char *file_in, const char *file_out, const options_mtz2csv_t *opts)
+{
+    MTZ *mtzin = NULL;
+    csv_writer_t writer;
+    FILE *fp = NULL;
+    int8_t ret;
+
+    if (access(file_in, F_OK | R_OK) == -1)
+    {
+        return 2; // Input not readable
+    }
+
+    mtzin = MtzGet(file_in, 1);
+    if (!mtzin)
+    {
+        return 2; // Input not readable
+    }
+
+    memset(&writer, 0, sizeof(writer));
+    writer.mtz = mtzin;
+    writer.nref = mtzin->nref;
+    writer.delimiter = opts->delimiter;
+    writer.missing = opts->missing ? opts->missing : "";
+    writer.missinglen = strlen(writer.missing);
+
+    errno = 0;
+    writer.cols = selectCsvColumns(mtzin, opts->columns, &writer.ncol);
+    if (!writer.cols)
+    {
+        MtzFree(mtzin);
+        return errno == ENOMEM ? -1 : 3; // Out of memory or unknown column
+    }
+
+    fp = fopen(file_out, "wb");
+    if (!fp)
+    {
+        free(writer.cols);
+        MtzFree(mtzin);
+        return -1;
+    }
+
+    writeCsvHeader(&writer, fp);
+    ret = writeCsvRows(&writer, fp, opts->threads);
+
+    fclose(fp) != 0 ? ret = -1 : 0;
+    free(writer.cols);
+    MtzFree(mtzin);
+
+    return ret;
+}
+
+/**
+ * Selects the columns to export.
+ * @param[in] mtzin The MTZ struct.
+ * @param[in] columns Comma-separated column labels, or NULL for all columns.
+ * Labels can be given as crystal/dataset/label paths.
+ * @param[out] ncol The number of selected columns.
+ * @return Array of columns, or NULL if a column does not exist or on allocation
+ * failure, with errno set to ENOMEM. Must be freed by the caller.
+ */
+
+const MTZCOL **selectCsvColumns(const MTZ *mtzin, const char *columns, size_t *ncol)
+{
+    const MTZCOL **cols = NULL;
+    char *labels = NULL;
+    char *label = NULL;
+    char *saveptr = NULL;
+
+    *ncol = 0;
+
+    if (!columns)
+    {
+        cols = malloc((MtzNumActiveCol(mtzin) + 1) * sizeof(MTZCOL *));
+        if (!cols)
+        {
+            errno = ENOMEM;
+            return NULL;
+        }
+
+        for (size_t i = 0; i < mtzin->nxtal; i++)
+        {
+            for (size_t j = 0; j < mtzin->xtal[i]->nset; j++)
+            {
+                for (size_t k = 0; k < mtzin->xtal[i]->set[j]->ncol; k++)
+                {
+                    const MTZCOL *col = mtzin->xtal[i]->set[j]->col[k];
+
+                    col->active ? cols[(*ncol)++] = col : 0;
+                }
+            }
+        }
+
+        return cols;
+    }
+
+    labels = malloc(strlen(columns) + 1);
+    cols = malloc((strlen(columns) / 2 + 1) * sizeof(MTZCOL *));
+    if (!labels || !cols)
+    {
+        free(labels);
+        free(cols);
+        errno = ENOMEM;
+        return NULL;
+    }
+    strcpy(labels, columns);
+
+    for (label = strtok_r(labels, ",", &saveptr); label; label = strtok_r(NULL, ",", &saveptr))
+    {
+        const MTZCOL *col = MtzColLookup(mtzin, label);
+
+        if (!col)
+        {
+            free(labels);
+            free(cols);
+            return NULL;
+        }
+
+        cols[(*ncol)++] = col;
+    }
+
+    free(labels);
+
+    return cols;
+}
+
+/**
+ * Writes the header row from the column labels. Labels are quoted
+ * in CSV files if they contain the delimiter, quotes or line breaks.
+ * @param[in] writer The writer.
+ * @param[in] fp The output file.
+ */
+
+void writeCsvHeader(const csv_writer_t *writer, FILE *fp)
+{
+    for (size_t i = 0; i < writer->ncol; i++)
+    {
+        const char *label = writer->cols[i]->label;
+        uint8_t quote = writer->delimiter != '\t' && (strpbrk(label, "\"\r\n") || strchr(label, writer->delimiter));
+
+        i > 0 ? fputc(writer->delimiter, fp) : 0;
+
+        if (!quote)
+        {
+            fputs(label, fp);
+        }
+        else
+        {
+            fputc('"', fp);
+            for (const char *c = label; *c; c++)
+            {
+                *c == '"' ? fputc('"', fp) : 0;
+                fputc(*c, fp);
+            }
+            fputc('"', fp);
+        }
+    }
+
+    fputc('\n', fp);
+}
+
+/**
+ * Formats the reflection rows of a chunk.
+ * @param[in] writer The writer.
+ * @param[in] chunk Index of the chunk.
+ * @param[out] out Buffer of at least CSV_CHUNK_ROWS times the maximum row length.
+ * @return The number of characters written.
+ */
+
+size_t formatCsvChunk(const csv_writer_t *writer, size_t chunk, char *out)
+{
+    size_t first = chunk * CSV_CHUNK_ROWS;
+    size_t last = first + CSV_CHUNK_ROWS < writer->nref ? first + CSV_CHUNK_ROWS : writer->nref;
+    size_t length = 0;
+
+    for (size_t i = first; i < last; i++)
+    {
+        for (size_t j = 0; j < writer->ncol; j++)
+        {
+            const MTZCOL *col = writer->cols[j];
+            float refl = col->ref[i];
+
+            j > 0 ? out[length++] = writer->delimiter : 0;
+
+            if (ccp4_ismnf(writer->mtz, refl) || !isfinite(refl))
+            {
+                memcpy(out + length, writer->missing, writer->missinglen);
+                length += writer->missinglen;
+            }
+            else
+            {
+                length += formatReflection(refl, isIntegralColumnType(col->type), out + length);
+            }
+        }
+
+        out[length++] = '\n';
+    }
+
+    return length;
+}
+
+/**
+ * Thread function formatting every nthreads-th chunk.
+ * @param[in] arg The csv_worker_t of the thread.
+ * @return NULL.
+ */
+
+void *csvWorker(void *arg)
+{
+    csv_worker_t *worker = arg;
+    csv_writer_t *writer = worker->writer;
+
+    useCLocale(); // Threads start in the global locale
+
+    for (size_t chunk = worker->index; chunk < writer->nchunks; chunk += writer->nthreads)
+    {
+        size_t length;
+        bool failed;
+
+        // Wait until the buffer has been written
+        pthread_mutex_lock(&writer->mutex);
+        while (worker->ready && !writer->failed)
+        {
+            pthread_cond_wait(&writer->cond, &writer->mutex);
+        }
+        failed = writer->failed;
+        pthread_mutex_unlock(&writer->mutex);
+
+        if (failed)
+        {
+            break;
+        }
+
+        length = formatCsvChunk(writer, chunk, worker->buffer);
+
+        pthread_mutex_lock(&writer->mutex);
+        worker->length = length;
+        worker->ready = 1;
+        pthread_cond_broadcast(&writer->cond);
+        pthread_mutex_unlock(&writer->mutex);
+    }
+
+    return NULL;
+}
+
+/**
+ * Formats and writes all reflection rows in order.
+ * @param[in] writer The writer.
+ * @param[in] fp The output file.
+ * @param[in] nthreads The number of threads, or 0 for the number of processors.
+ * @return 0 on success, -1 on failure.
+ */
+
+int8_t writeCsvRows(csv_writer_t *writer, FILE *fp, size_t nthreads)
+{
+    csv_worker_t *workers = NULL;
+    size_t rowlength = 1;
+    size_t started = 0;
+    int8_t ret = 0;
+
+    // Longest possible row
+    for (size_t j = 0; j < writer->ncol; j++)
+    {
+        rowlength += (writer->missinglen > MAX_REFLECTION_LENGTH ? writer->missinglen : MAX_REFLECTION_LENGTH) + 1;
+    }
+
+    writer->nchunks = (writer->nref + CSV_CHUNK_ROWS - 1) / CSV_CHUNK_ROWS;
+
+    if (nthreads == 0)
+    {
+        long nproc = sysconf(_SC_NPROCESSORS_ONLN);
+        nthreads = nproc > 0 ? nproc : 1;
+    }
+
+    nthreads > writer->nchunks ? nthreads = writer->nchunks : 0;
+    nthreads > CSV_MAX_THREADS ? nthreads = CSV_MAX_THREADS : 0;
+    writer->nthreads = nthreads;
+    writer->failed = 0;
+
+    if (nthreads == 0)
+    {
+        return 0;
+    }
+
+    workers = calloc(nthreads, sizeof(csv_worker_t));
+    if (!workers)
+    {
+        return -1;
+    }
+
+    pthread_mutex_init(&writer->mutex, NULL);
+    pthread_cond_init(&writer->cond, NULL);
+
+    for (size_t t = 0; t < nthreads; t++)
+    {
+        workers[t].writer = writer;
+        workers[t].index = t;
+        workers[t].buffer = malloc(CSV_CHUNK_ROWS * rowlength);
+
+        if (!workers[t].buffer || pthread_create(&workers[t].thread, NULL, csvWorker, workers + t) != 0)
+        {
+            free(workers[t].buffer);
+            ret = -1;
+            break;
+        }
+        started++;
+    }
+
+    // Write chunks in order
+    for (size_t chunk = 0; chunk < writer->nchunks && ret == 0; chunk++)
+    {
+        csv_worker_t *worker = workers + chunk % nthreads;
+
+        pthread_mutex_lock(&writer->mutex);
+        while (!worker->ready)
+        {
+            pthread_cond_wait(&writer->cond, &writer->mutex);
+        }
+        pthread_mutex_unlock(&writer->mutex);
+
+        fwrite(worker->buffer, 1, worker->length, fp) != worker->length ? ret = -1 : 0;
+
+        pthread_mutex_lock(&writer->mutex);
+        worker->ready = 0;
+        pthread_cond_broadcast(&writer->cond);
+        pthread_mutex_unlock(&writer->mutex);
+    }
+
+    // Stop the workers on failure
+    pthread_mutex_lock(&writer->mutex);
+    ret != 0 ? writer->failed = 1 : 0;
+    pthread_cond_broadcast(&writer->cond);
+    pthread_mutex_unlock(&writer->mutex);
+
+    for (size_t t = 0; t < started; t++)
+    {
+        pthread_join(workers[t].thread, NULL);
+        free(workers[t].buffer);
+    }
+
+    pthread_cond_destroy(&writer->cond);
+    pthread_mutex_destroy(&writer->mutex);
+    free(workers);
+
+    return ret;
+}
@@ -0,0 +1,445 @@
+/*
+ * generator.c: Pull-based chunked JSON output
+ *
+ * Copyright (c) 2017 Frank Buermann <fburmann@mrc-lmb.cam.ac.uk>
+ *
+ * jsonmtz is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ * This software makes use of the jansson library (http://www.digip.org/jansson/)
+ * licensed under the terms of the MIT license,
+ * and the CCP4io library (http://www.ccp4.ac.uk/) licensed under the
+ * Lesser GNU General Public License 3.0.
+ */
+
+/*
+ * The document is produced as a sequence of pieces by a state machine over
+ * crystals, datasets, columns, blocks of JSON_GENERATOR_ROWS rows, and
+ * batches. Each header piece is a small json object dumped by jansson with
+ * its trailing container brackets stripped, so that the children can
+ * follow, and the brackets are closed by the matching end state. Only the
+ * current piece is held, so memory does not grow with the number of rows.
+ *
+ * If the reflections were not read into memory, each column is produced by
+ * its own pass over the reflection block of the file, which is read in
+ * windows of whole records. Memory is then bounded by the window size
+ * rather than by the file size, at the cost of reading the block once
+ * per column.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <limits.h>
+#include "jsonmtz.h"
+
+/**
+ * Creates a generator yielding the JSON document of an MTZ struct in chunks.
+ * The document is compact JSON, and column data use the plain encoding
+ * with values formatted as by formatReflection(). Missing values listed by
+ * index are written as null instead.
+ * @param[in] mtzin The MTZ struct, with reflections in memory or left in
+ * the file by getMtz(). It must stay valid until the generator is freed.
+ * @param[in] opts Options struct. The missing value format is used, and
+ * the window size in bytes for reflections left in the file, or 0 for
+ * JSON_GENERATOR_WINDOW.
+ * @return The generator, or NULL on failure. Must be freed with jsonGeneratorFree().
+ */
+
+json_generator_t *jsonGeneratorNew(const MTZ *mtzin, const options_mtz2json_t *opts)
+{
+    json_generator_t *gen = NULL;
+    size_t ncol = mtzin ? mtzin->ncol_read : 0;
+
+    if (!mtzin || (!mtzin->refs_in_memory && (!mtzin->filein || ncol == 0)))
+    {
+        return NULL;
+    }
+
+    gen = calloc(1, sizeof(json_generator_t));
+    if (!gen)
+    {
+        return NULL;
+    }
+
+    gen->rows = malloc(JSON_GENERATOR_ROWS * (MAX_REFLECTION_LENGTH + 1));
+    if (!gen->rows)
+    {
+        free(gen);
+        return NULL;
+    }
+
+    // Whole records, at least one
+    if (!mtzin->refs_in_memory)
+    {
+        size_t window = opts->window ? opts->window : JSON_GENERATOR_WINDOW;
+
+        gen->windowrows = window / (ncol * sizeof(float));
+        gen->windowrows == 0 ? gen->windowrows = 1 : 0;
+        gen->windowrows > INT_MAX / ncol ? gen->windowrows = INT_MAX / ncol : 0; // ccp4_file_read() count
+        gen->window = malloc(gen->windowrows * ncol * sizeof(float));
+
+        if (!gen->window)
+        {
+            free(gen->rows);
+            free(gen);
+            return NULL;
+        }
+    }
+
+    gen->mtz = mtzin;
+    gen->opts = *opts;
+    gen->opts.encoding = ENCODING_NONE; // Column data are generated here
+    gen->opts.missing == MISSING_INDEX ? gen->opts.missing = MISSING_NULL : 0; // Plain arrays only
+    gen->flags = JSON_COMPACT | JSON_ENCODE_ANY;
+    opts->missing == MISSING_NAN ? gen->flags |= JSON_ENCODE_NAN : 0;
+    gen->state = GENERATOR_START;
+
+    return gen;
+}
+
+/**
+ * Copies the next chunk of the document into a buffer.
+ * @param[in] gen The generator.
+ * @param[out] buffer The buffer.
+ * @param[in] capacity The size of the buffer.
+ * @return The number of bytes copied. Less than capacity only at the end of
+ * the document, or on failure, which sets gen->failed.
+ */
+
+size_t jsonGeneratorNext(json_generator_t *gen, char *buffer, size_t capacity)
+{
+    void *previous = useCLocale();
+    size_t n = 0;
+
+    while (n < capacity)
+    {
+        size_t length;
+
+        if (gen->pos == gen->length)
+        {
+            if (!jsonGeneratorStep(gen))
+            {
+                break;
+            }
+            continue;
+        }
+
+        length = gen->length - gen->pos < capacity - n ? gen->length - gen->pos : capacity - n;
+        memcpy(buffer + n, gen->piece + gen->pos, length);
+        gen->pos += length;
+        n += length;
+    }
+
+    restoreLocale(previous);
+
+    return n;
+}
+
+/**
+ * Frees a generator.
+ * @param[in] gen The generator.
+ */
+
+void jsonGeneratorFree(json_generator_t *gen)
+{
+    if (!gen)
+    {
+        return;
+    }
+
+    gen->piece != gen->rows ? free(gen->piece) : 0;
+    free(gen->rows);
+    free(gen->window);
+    free(gen);
+}
+
+/**
+ * Produces the next piece of the document and advances the state.
+ * @param[in] gen The generator.
+ * @return 1 if a piece was produced, 0 at the end of the document or on failure.
+ */
+
+uint8_t jsonGeneratorStep(json_generator_t *gen)
+{
+    const MTZ *mtzin = gen->mtz;
+    const MTZXTAL *xtal = gen->xtal < (size_t)mtzin->nxtal ? mtzin->xtal[gen->xtal] : NULL;
+    const MTZSET *set = xtal && gen->set < (size_t)xtal->nset ? xtal->set[gen->set] : NULL;
+    size_t nref = mtzin->nref_filein;
+    json_t *json = NULL;
+    MTZXTAL xtalhead;
+    MTZSET sethead;
+    uint8_t ret = 1;
+
+    gen->piece != gen->rows ? free(gen->piece) : 0;
+    gen->piece = NULL;
+    gen->length = 0;
+    gen->pos = 0;
+
+    switch (gen->state)
+    {
+    case GENERATOR_START:
+        json = json_object();
+        json_object_set_new(json, "Title", json_string(mtzin->title));
+        json_object_set_new(json, "History", readMtzHistory(mtzin));
+        json_object_set_new(json, "Crystals", json_array());
+        ret = jsonGeneratorDump(gen, "", json, 0, 2, ""); // Open Crystals
+        gen->state = mtzin->nxtal > 0 ? GENERATOR_XTAL : GENERATOR_SYMMETRY;
+        break;
+    case GENERATOR_XTAL:
+        xtalhead = *xtal;
+        xtalhead.nset = 0;
+        json = readMtzXtal(&xtalhead, nref, mtzin, &gen->opts);
+        ret = jsonGeneratorDump(gen, gen->xtal > 0 ? "," : "", json, 0, 2, ""); // Open Datasets
+        gen->set = 0;
+        gen->state = xtal->nset > 0 ? GENERATOR_SET : GENERATOR_XTAL_END;
+        break;
+    case GENERATOR_SET:
+        sethead = *set;
+        sethead.ncol = 0;
+        json = readMtzSet(&sethead, nref, mtzin, &gen->opts);
+        ret = jsonGeneratorDump(gen, gen->set > 0 ? "," : "", json, 0, 2, ""); // Open Columns
+        gen->col = 0;
+        gen->state = set->ncol > 0 ? GENERATOR_COL : GENERATOR_SET_END;
+        break;
+    case GENERATOR_COL:
+        json = readMtzCol(set->col[gen->col], nref, mtzin, &gen->opts);
+        ret = jsonGeneratorDump(gen, gen->col > 0 ? "," : "", json, 0, 1, ",\"Data\":[");
+        gen->row = 0;
+        gen->windowfirst = 0;
+        gen->windowcount = 0;
+
+        // Each column is a new pass over the reflections
+        if (gen->window && ccp4_file_seek(mtzin->filein, SIZE1, SEEK_SET) != 0)
+        {
+            ret = 0;
+        }
+        gen->state = nref > 0 ? GENERATOR_ROWS : GENERATOR_COL_END;
+        break;
+    case GENERATOR_ROWS:
+        gen->piece = gen->rows;
+        gen->length = jsonGeneratorRows(gen);
+        gen->failed ? ret = 0 : 0;
+        gen->state = gen->row < nref ? GENERATOR_ROWS : GENERATOR_COL_END;
+        break;
+    case GENERATOR_COL_END:
+        gen->piece = strdup("]}");
+        gen->length = 2;
+        gen->col++;
+        gen->state = gen->col < (size_t)set->ncol ? GENERATOR_COL : GENERATOR_SET_END;
+        break;
+    case GENERATOR_SET_END:
+        gen->piece = strdup("]}");
+        gen->length = 2;
+        gen->set++;
+        gen->state = gen->set < (size_t)xtal->nset ? GENERATOR_SET : GENERATOR_XTAL_END;
+        break;
+    case GENERATOR_XTAL_END:
+        gen->piece = strdup("]}");
+        gen->length = 2;
+        gen->xtal++;
+        gen->state = gen->xtal < (size_t)mtzin->nxtal ? GENERATOR_XTAL : GENERATOR_SYMMETRY;
+        break;
+    case GENERATOR_SYMMETRY:
+        json = readMtzSymmetry(mtzin->mtzsymm);
+        ret = jsonGeneratorDump(gen, "],\"Symmetry\":", json, 0, 0, ",\"Batches\":["); // Open Batches
+        gen->batch = mtzin->batch;
+        gen->state = gen->batch ? GENERATOR_BATCH : GENERATOR_END;
+        break;
+    case GENERATOR_BATCH:
+        json = readMtzBatch(gen->batch);
+        ret = jsonGeneratorDump(gen, gen->batch != mtzin->batch ? "," : "", json, 0, 0, "");
+        gen->batch = gen->batch->next;
+        gen->state = gen->batch ? GENERATOR_BATCH : GENERATOR_END;
+        break;
+    case GENERATOR_END:
+        json = json_object();
+        json_object_set_new(json, "SortOrder", readMtzSortOrder(mtzin));
+        json_object_set_new(json, "UnknownHeaders", readMtzUnknownHeaders(mtzin));
+        ret = jsonGeneratorDump(gen, "],", json, 1, 0, ""); // Continue the document
+        gen->state = GENERATOR_DONE;
+        break;
+    default:
+        return 0;
+    }
+
+    if (!ret || !gen->piece)
+    {
+        gen->piece != gen->rows ? free(gen->piece) : 0;
+        gen->piece = NULL;
+        gen->length = 0;
+        gen->failed = 1;
+        gen->state = GENERATOR_DONE;
+        return 0;
+    }
+
+    return 1;
+}
+
+/**
+ * Sets the current piece to a json value dumped between a prefix and a suffix.
+ * @param[in] gen The generator.
+ * @param[in] prefix Text before the value.
+ * @param[in] json The value. The reference is stolen.
+ * @param[in] skip The number of leading characters removed from the dump.
+ * @param[in] strip The number of trailing characters removed from the dump.
+ * @param[in] suffix Text after the value.
+ * @return 1 on success, 0 on failure.
+ */
+
+uint8_t jsonGeneratorDump(json_generator_t *gen, const char *prefix, json_t *json, size_t skip, size_t strip, const char *suffix)
+{
+    char *dump = json ? json_dumps(json, gen->flags) : NULL;
+    size_t prefixlen = strlen(prefix);
+    size_t suffixlen = strlen(suffix);
+    size_t dumplen;
+
+    json_decref(json);
+
+    if (!dump || strlen(dump) < skip + strip)
+    {
+        jsonFree(dump);
+        return 0;
+    }
+
+    dumplen = strlen(dump) - skip - strip;
+    gen->piece = malloc(prefixlen + dumplen + suffixlen + 1);
+
+    if (gen->piece)
+    {
+        memcpy(gen->piece, prefix, prefixlen);
+        memcpy(gen->piece + prefixlen, dump + skip, dumplen);
+        memcpy(gen->piece + prefixlen + dumplen, suffix, suffixlen + 1);
+        gen->length = prefixlen + dumplen + suffixlen;
+    }
+
+    jsonFree(dump);
+
+    return gen->piece != NULL;
+}
+
+/**
+ * Formats the next block of rows of the current column into gen->rows.
+ * @param[in] gen The generator.
+ * @return The number of characters written.
+ */
+
+size_t jsonGeneratorRows(json_generator_t *gen)
+{
+    const MTZSET *set = gen->mtz->xtal[gen->xtal]->set[gen->set];
+    const MTZCOL *col = set->col[gen->col];
+    uint8_t integral = isIntegralColumnType(col->type);
+    const char *missing = missingToken(gen->opts.missing);
+    size_t missinglen = strlen(missing);
+    size_t nref = gen->mtz->nref_filein;
+    size_t last = gen->row + JSON_GENERATOR_ROWS < nref ? gen->row + JSON_GENERATOR_ROWS : nref;
+    size_t ncol = gen->mtz->ncol_read;
+    size_t length = 0;
+
+    // Columns added after reading are not in the file
+    if (gen->window && (col->source < 1 || (size_t)col->source > ncol))
+    {
+        gen->failed = 1;
+        return 0;
+    }
+
+    for (size_t i = gen->row; i < last; i++)
+    {
+        float refl;
+
+        if (gen->window && i == gen->windowfirst + gen->windowcount && !jsonGeneratorWindow(gen))
+        {
+            gen->failed = 1;
+            return 0;
+        }
+
+        refl = gen->window ? gen->window[(i - gen->windowfirst) * ncol + col->source - 1] : col->ref[i];
+
+        i > 0 ? gen->rows[length++] = ',' : 0;
+
+        if (ccp4_ismnf(gen->mtz, refl))
+        {
+            memcpy(gen->rows + length, missing, missinglen);
+            length += missinglen;
+        }
+        else
+        {
+            length += formatReflection(refl, integral, gen->rows + length);
+        }
+    }
+
+    gen->row = last;
+
+    return length;
+}
+
+/**
+ * Reads the records following the current window from the file.
+ * @param[in] gen The generator.
+ * @return 1 on success, 0 on failure.
+ */
+
+uint8_t jsonGeneratorWindow(json_generator_t *gen)
+{
+    size_t nref = gen->mtz->nref_filein;
+    size_t ncol = gen->mtz->ncol_read;
+    size_t first = gen->windowfirst + gen->windowcount;
+    size_t count = nref - first < gen->windowrows ? nref - first : gen->windowrows;
+
+    ccp4_file_setmode(gen->mtz->filein, 2);
+    if (ccp4_file_read(gen->mtz->filein, (uint8 *)gen->window, count * ncol) != (int)(count * ncol))
+    {
+        return 0;
+    }
+
+    gen->windowfirst = first;
+    gen->windowcount = count;
+
+    return 1;
+}
+
+/**
+ * Writes the JSON document of an MTZ struct produced by a generator.
+ * With reflections left in the file, memory is bounded by opts->window.
+ * @param[in] mtzin The MTZ struct.
+ * @param[in] file_out The output file.
+ * @param[in] opts Options struct.
+ * @return 0 on success, -1 on failure.
+ */
+
+int8_t writeGenerated(const MTZ *mtzin, const char *file_out, const options_mtz2json_t *opts)
+{
+    json_generator_t *gen = jsonGeneratorNew(mtzin, opts);
+    char *buffer = malloc(JSON_GENERATOR_CHUNK);
+    FILE *fp = NULL;
+    int8_t ret = 0;
+    size_t n;
+
+    fp = gen && buffer ? openOutput(file_out) : NULL;
+    if (!fp)
+    {
+        jsonGeneratorFree(gen);
+        free(buffer);
+        return -1;
+    }
+
+    while ((n = jsonGeneratorNext(gen, buffer, JSON_GENERATOR_CHUNK)) > 0)
+    {
+        if (fwrite(buffer, 1, n, fp) != n)
+        {
+            ret = -1;
+            break;
+        }
+    }
+
+    gen->failed ? ret = -1 : 0;
+    jsonGeneratorFree(gen);
+    free(buffer);
+
+    if (closeOutput(fp) != 0)
+    {
+        return -1;
+    }
+
+    return ret;
+}
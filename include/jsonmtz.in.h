@@ -15,11 +15,165 @@
 #define VERSION_MINOR @PROJECT_VERSION_MINOR@
 #define VERSION_PATCH @PROJECT_VERSION_PATCH@
 
+#cmakedefine HAVE_ZLIB
+#cmakedefine HAVE_ZSTD
+
 #include <stdint.h>
+#include <stdio.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include "jansson.h"
 #include "cmtzlib.h"
 
+typedef enum missing_format_t
+{
+    MISSING_STRING,
+    MISSING_NULL,
+    MISSING_NAN,
+    MISSING_INDEX
+} missing_format_t;
+
+typedef enum data_encoding_t
+{
+    ENCODING_PLAIN,
+    ENCODING_AUTO,
+    ENCODING_BASE64,
+    ENCODING_SIDECAR,
+    ENCODING_NONE
+} data_encoding_t;
+
+typedef enum file_format_t
+{
+    FORMAT_JSON,
+    FORMAT_CBOR,
+    FORMAT_NDJSON,
+    FORMAT_ARROW,
+    FORMAT_NPZ
+} file_format_t;
+
+typedef enum compression_t
+{
+    COMPRESS_NONE,
+    COMPRESS_GZIP,
+    COMPRESS_ZSTD
+} compression_t;
+
+typedef enum column_encoding_t
+{
+    COLUMN_PLAIN,
+    COLUMN_MISSING_INDEX,
+    COLUMN_RUN_LENGTH,
+    COLUMN_DICTIONARY,
+    COLUMN_SPARSE,
+    COLUMN_BASE64_F32LE,
+    COLUMN_SIDECAR_F32LE,
+    COLUMN_F32LE,
+    COLUMN_NPY,
+    COLUMN_SHARD,
+    COLUMN_UNKNOWN
+} column_encoding_t;
+
+#define MAX_DICTIONARY_SIZE 256
+#define SIDECAR_ALIGNMENT 64
+#define MAX_REFLECTION_LENGTH 24
+#define MAX_FIXED_PLACES 6
+
+#define CBOR_UNSIGNED 0
+#define CBOR_NEGATIVE 1
+#define CBOR_BYTE_STRING 2
+#define CBOR_TEXT_STRING 3
+#define CBOR_ARRAY 4
+#define CBOR_MAP 5
+#define CBOR_TAG 6
+#define CBOR_SIMPLE 7
+#define CBOR_SIMPLE_FALSE 20
+#define CBOR_SIMPLE_TRUE 21
+#define CBOR_SIMPLE_NULL 22
+#define CBOR_SIMPLE_UNDEFINED 23
+#define CBOR_TAG_FLOAT32LE 85
+#define CBOR_TAG_SELF_DESCRIBE 55799
+#define CBOR_MAX_DEPTH 64
+
+typedef struct cbor_reader_t
+{
+    const unsigned char *data;
+    size_t size;
+    size_t pos;
+} cbor_reader_t;
+
+#define ARROW_BATCH_ROWS 65536
+#define ARROW_METADATA_V5 4
+#define ARROW_HEADER_SCHEMA 1
+#define ARROW_HEADER_RECORD_BATCH 3
+#define ARROW_TYPE_INT 2
+#define ARROW_TYPE_FLOATING_POINT 3
+
+typedef struct fb_builder_t
+{
+    unsigned char *data;
+    size_t size;
+    size_t capacity;
+    bool failed;
+} fb_builder_t;
+
+#define NPZ_METADATA "metadata.json"
+#define NPZ_PADDING_ID 0xd935
+#define NPY_HEADER_LENGTH 128
+#define NPY_DESCR_LENGTH 8
+
+typedef struct npz_member_t
+{
+    char *name;
+    uint32_t crc;
+    uint32_t size;
+    uint32_t offset;
+} npz_member_t;
+
+typedef struct npz_writer_t
+{
+    FILE *fp;
+    npz_member_t *members;
+    size_t nmembers;
+    size_t capacity;
+    uint32_t crctable[256];
+} npz_writer_t;
+
+#define COMPRESS_BLOCK_SIZE (1 << 20)
+#define COMPRESS_MAX_THREADS 64
+#define COMPRESS_ZSTD_LEVEL 3
+
+typedef struct compress_job_t
+{
+    compression_t method;
+    pthread_t thread;
+    char *in;
+    size_t inlen;
+    unsigned char *out;
+    size_t outcap;
+    size_t outlen;
+} compress_job_t;
+
+typedef struct compress_writer_t
+{
+    FILE *fp;
+    compression_t method;
+    compress_job_t *jobs;
+    size_t nthreads;
+    size_t nblocks;
+    bool failed;
+} compress_writer_t;
+
+typedef struct decompress_reader_t
+{
+    FILE *fp;
+    compression_t method;
+    void *stream;
+    unsigned char in[65536];
+    size_t inlen;
+    size_t inpos;
+    bool finished;
+} decompress_reader_t;
+
 typedef struct options_mtz2json_t
 {
     bool compact;
@@ -27,29 +181,342 @@ typedef struct options_mtz2json_t
     bool version;
     bool timestamp;
     bool force;
+    missing_format_t missing;
+    data_encoding_t encoding;
+    file_format_t format;
+    compression_t compress;
+    size_t window;
+    size_t shards;
+    size_t shard;
+    bool index;
 } options_mtz2json_t;
 
+#define SHARD_ALL ((size_t)-1)
+#define SHARD_MAX_THREADS 64
+
+typedef struct shard_job_t
+{
+    const char *file_in;
+    char *path;
+    size_t first;
+    size_t count;
+    MTZCOL **cols;
+    size_t ncol;
+    const options_mtz2json_t *opts;
+    int8_t ret;
+} shard_job_t;
+
+typedef struct shard_queue_t
+{
+    shard_job_t *jobs;
+    size_t njobs;
+    size_t next;
+    int8_t (*run)(shard_job_t *job);
+    pthread_mutex_t mutex;
+} shard_queue_t;
+
+#define JSON_SCAN_ERROR ((size_t)-1)
+
+typedef struct json_span_t
+{
+    size_t offset;
+    size_t length;
+} json_span_t;
+
+#define JSON_POINTER_KEY ((size_t)-1)
+#define JSON_POINTER_ANY ((size_t)-2)
+
+typedef struct json_pointer_t
+{
+    char *buffer;
+    char **tokens;
+    size_t *indices;
+    size_t ntokens;
+} json_pointer_t;
+
+#define VALIDATE_BUFFER (1 << 16)
+#define VALIDATE_MAX_DEPTH 2048
+#define VALIDATE_REQUIRED 1
+#define VALIDATE_NONEMPTY 2
+#define VALIDATE_INTEGER_MAX ((json_int_t)((1ULL << (sizeof(json_int_t) * 8 - 1)) - 1))
+
+typedef enum validate_kind_t
+{
+    VALIDATE_ANY,
+    VALIDATE_STRING,
+    VALIDATE_INTEGER,
+    VALIDATE_REAL,
+    VALIDATE_DOCUMENT,
+    VALIDATE_SYMMETRY,
+    VALIDATE_BATCH,
+    VALIDATE_CRYSTAL,
+    VALIDATE_DATASET,
+    VALIDATE_COLUMN,
+    VALIDATE_DATA,
+    VALIDATE_ENCODING,
+    VALIDATE_REFLECTION
+} validate_kind_t;
+
+typedef enum validate_data_key_t
+{
+    VALIDATE_DATA_LENGTH,
+    VALIDATE_DATA_OFFSET,
+    VALIDATE_DATA_MEMBER,
+    VALIDATE_DATA_MISSING,
+    VALIDATE_DATA_VALUES,
+    VALIDATE_DATA_RUNS,
+    VALIDATE_DATA_DICTIONARY,
+    VALIDATE_DATA_CODES,
+    VALIDATE_DATA_INDICES,
+    VALIDATE_DATA_KEYS
+} validate_data_key_t;
+
+typedef struct validate_key_t
+{
+    const char *key;
+    validate_kind_t kind;
+    uint8_t ndims;
+    size_t dims[3];
+    uint8_t flags;
+} validate_key_t;
+
+typedef struct validate_error_t
+{
+    uint64_t offset;
+    char text[128];
+} validate_error_t;
+
+typedef struct validate_summary_t
+{
+    size_t count;
+    json_int_t min;
+    json_int_t max;
+    json_int_t last;
+    json_int_t sum;
+    bool unordered;
+} validate_summary_t;
+
+typedef struct validate_column_t
+{
+    column_encoding_t encoding;
+    json_type type;
+    uint64_t offset;
+    size_t length;
+    size_t base64;
+    uint64_t present;
+    validate_summary_t data;
+    validate_summary_t member[VALIDATE_DATA_KEYS];
+} validate_column_t;
+
+typedef struct validate_token_t
+{
+    json_type type;
+    json_int_t integer;
+    char text[32];
+    size_t length;
+} validate_token_t;
+
+typedef struct validator_t
+{
+    size_t (*read)(void *buffer, size_t buflen, void *data);
+    void *data;
+    const unsigned char *buffer;
+    unsigned char *storage;
+    size_t length;
+    size_t pos;
+    uint64_t offset;
+    size_t depth;
+    size_t nref;
+    bool counted;
+    bool broken;
+    validate_error_t *error;
+} validator_t;
+
+#define JSON_GENERATOR_ROWS 1024
+#define JSON_GENERATOR_WINDOW (64 << 20)
+#define JSON_GENERATOR_CHUNK (1 << 16)
+
+typedef enum json_generator_state_t
+{
+    GENERATOR_START,
+    GENERATOR_XTAL,
+    GENERATOR_SET,
+    GENERATOR_COL,
+    GENERATOR_ROWS,
+    GENERATOR_COL_END,
+    GENERATOR_SET_END,
+    GENERATOR_XTAL_END,
+    GENERATOR_SYMMETRY,
+    GENERATOR_BATCH,
+    GENERATOR_END,
+    GENERATOR_DONE
+} json_generator_state_t;
+
+typedef struct json_generator_t
+{
+    const MTZ *mtz;
+    options_mtz2json_t opts;
+    size_t flags;
+    json_generator_state_t state;
+    size_t xtal;
+    size_t set;
+    size_t col;
+    size_t row;
+    const MTZBAT *batch;
+    char *piece;
+    size_t length;
+    size_t pos;
+    char *rows;
+    float *window;
+    size_t windowrows;
+    size_t windowfirst;
+    size_t windowcount;
+    bool failed;
+} json_generator_t;
+
+typedef struct options_mtz2csv_t
+{
+    bool help;
+    bool version;
+    bool force;
+    char delimiter;
+    const char *columns;
+    const char *missing;
+    size_t threads;
+} options_mtz2csv_t;
+
+#define CSV_CHUNK_ROWS 16384
+#define CSV_MAX_THREADS 64
+
+typedef struct csv_writer_t
+{
+    const MTZ *mtz;
+    const MTZCOL **cols;
+    size_t ncol;
+    size_t nref;
+    char delimiter;
+    const char *missing;
+    size_t missinglen;
+    size_t nchunks;
+    size_t nthreads;
+    bool failed;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+} csv_writer_t;
+
+typedef struct csv_worker_t
+{
+    csv_writer_t *writer;
+    size_t index;
+    pthread_t thread;
+    char *buffer;
+    size_t length;
+    bool ready;
+} csv_worker_t;
+
 typedef struct options_json2mtz_t
 {
     bool help;
     bool version;
     bool timestamp;
     bool force;
+    file_format_t format;
+    bool validate;
 } options_json2mtz_t;
 
-json_t *readMtz(const MTZ *mtzin);
+#define CTX_MIN_BLOCK ((size_t)16)
+#define CTX_CLASSES 17
+#define CTX_SLAB_CLASSES 9
+#define CTX_SLAB_SIZE (1 << 20)
+// The strictest alignment of the basic types, max_align_t in C11
+typedef union ctx_align_t
+{
+    long double ld;
+    long long ll;
+    double d;
+    void *p;
+    void (*f)(void);
+} ctx_align_t;
+
+// Block headers are padded to the alignment, which slab blocks keep
+typedef union ctx_block_t
+{
+    struct
+    {
+        struct jsonmtz_ctx_t *owner;
+        size_t sizeclass;
+    } header;
+    ctx_align_t align;
+} ctx_block_t;
+
+typedef struct jsonmtz_ctx_t
+{
+    ctx_block_t *freelist[CTX_CLASSES];
+    char **slabs;
+    size_t nslabs;
+    size_t slabcapacity;
+    char *slabtop;
+    size_t slableft;
+    char *json;
+    size_t jsonlength;
+    size_t jsoncapacity;
+    void *mtz;
+    size_t mtzcapacity;
+} jsonmtz_ctx_t;
+
+json_t *readMtz(const MTZ *mtzin, const options_mtz2json_t *opts);
 json_t *readMtzBatch(const MTZBAT *batch);
-json_t *readMtzXtal(const MTZXTAL *xtal, size_t nref, const MTZ *mtzin);
-json_t *readMtzSet(const MTZSET *set, size_t nref, const MTZ *mtzin);
+json_t *readMtzHistory(const MTZ *mtzin);
+json_t *readMtzSortOrder(const MTZ *mtzin);
+json_t *readMtzUnknownHeaders(const MTZ *mtzin);
+json_t *readMtzXtal(const MTZXTAL *xtal, size_t nref, const MTZ *mtzin, const options_mtz2json_t *opts);
+json_t *readMtzSet(const MTZSET *set, size_t nref, const MTZ *mtzin, const options_mtz2json_t *opts);
+json_t *readMtzCol(const MTZCOL *col, size_t nref, const MTZ *mtzin, const options_mtz2json_t *opts);
+json_t *readMtzColData(const MTZCOL *col, size_t nref, const MTZ *mtzin, missing_format_t missing);
+json_t *readMtzColMissingIndex(const MTZCOL *col, size_t nref, const MTZ *mtzin);
+json_t *readMtzColRunLength(const MTZCOL *col, size_t nref, const MTZ *mtzin, missing_format_t missing);
+json_t *readMtzColDictionary(const MTZCOL *col, size_t nref, const MTZ *mtzin, missing_format_t missing);
+json_t *readMtzColSparse(const MTZCOL *col, size_t nref, const MTZ *mtzin);
+json_t *readMtzColBase64(const MTZCOL *col, size_t nref, const MTZ *mtzin);
+json_t *readMtzColF32LE(const MTZCOL *col, size_t nref, const MTZ *mtzin);
+void packFloat32LE(float value, unsigned char *out);
+float unpackFloat32LE(const unsigned char *in);
+size_t base64EncodedLength(size_t len);
+size_t base64Encode(const unsigned char *in, size_t len, char *out);
+size_t base64DecodedLength(const char *in, size_t len);
+size_t base64Decode(const char *in, size_t len, unsigned char *out);
+column_encoding_t chooseColumnEncoding(const MTZCOL *col, size_t nref, const MTZ *mtzin, const options_mtz2json_t *opts);
+uint8_t sameReflection(float a, float b, const MTZ *mtzin);
+const char *columnEncodingName(column_encoding_t encoding);
+column_encoding_t columnEncodingFromName(const char *name);
+column_encoding_t columnDataEncoding(const json_t *jcol);
+json_t *makeMissingValue(missing_format_t missing);
+json_t *reflectionToJson(float refl, uint8_t integral);
+float jsonToReflection(const json_t *value);
+uint8_t columnDataLength(const json_t *jcol, size_t *nref);
 json_t *readMtzSymmetry(SYMGRP sym);
 int8_t mtz2json(const char *file_in, const char *file_out, const options_mtz2json_t *opts);
+int8_t mtz2jsonFile(const char *file_in, const char *file_out, const options_mtz2json_t *opts);
 int8_t json2mtz(const char *file_in, const char *file_out, const options_json2mtz_t *opts);
+int8_t json2mtzFile(const char *file_in, const char *file_out, const options_json2mtz_t *opts);
+int8_t mtz2jsonBuffer(const void *mtz, size_t length, json_dump_callback_t callback, void *data, const options_mtz2json_t *opts);
+int8_t mtz2jsonMemory(const void *mtz, size_t length, json_dump_callback_t callback, void *data, const options_mtz2json_t *opts);
+int8_t json2mtzBuffer(const char *json, size_t length, void **mtz, size_t *mtzlength, const options_json2mtz_t *opts);
+int8_t json2mtzInto(const char *json, size_t length, void **mtz, size_t *capacity, size_t *mtzlength, const options_json2mtz_t *opts);
+int8_t json2mtzMemory(const char *json, size_t length, void **mtz, size_t *capacity, size_t *mtzlength, const options_json2mtz_t *opts);
+void defaultMtz2jsonOptions(options_mtz2json_t *opts);
+int8_t setMtz2jsonOption(options_mtz2json_t *opts, int option, const char *value);
+void defaultJson2mtzOptions(options_json2mtz_t *opts);
+int8_t setJson2mtzOption(options_json2mtz_t *opts, int option, const char *value);
 MTZ *makeMtz(json_t *json);
 MTZ *setMtzSymmetry(MTZ *mtzout, json_t *jsymm);
 MTZ *setMtzBatches(MTZ *mtzout, const json_t *jbatches);
 MTZ *setMtzXtals(MTZ *mtzout, const json_t *jcrystals);
 MTZSET *setMtzSet(MTZSET *xtal, json_t *jset, MTZ *mtzout);
+MTZCOL *setMtzColData(MTZCOL *mtzcol, const json_t *jcol, size_t nref);
 MTZCOL *findColumnBySource(const MTZ *mtzout, size_t source);
+uint8_t isIntegralColumnType(const char *type);
+uint8_t isInt32Column(const MTZ *mtzin, const MTZCOL *col, size_t nref);
 uint8_t json_array_is_homogenous_object(const json_t *json);
 uint8_t json_array_is_homogenous_array(const json_t *json);
 uint8_t json_array_is_homogenous_string(const json_t *json);
@@ -58,5 +525,159 @@ uint8_t json_array_is_homogenous_real(const json_t *json);
 uint8_t json_array_check_dimensions(const json_t *json, const size_t *dim, size_t len);
 uint8_t json_array_check_dimensions_f(const json_t *json, const size_t *dim, size_t len, uint8_t (*inner_check_function)(const json_t *json));
 uint8_t json_truth(const json_t *);
+json_generator_t *jsonGeneratorNew(const MTZ *mtzin, const options_mtz2json_t *opts);
+size_t jsonGeneratorNext(json_generator_t *gen, char *buffer, size_t capacity);
+void jsonGeneratorFree(json_generator_t *gen);
+uint8_t jsonGeneratorStep(json_generator_t *gen);
+uint8_t jsonGeneratorDump(json_generator_t *gen, const char *prefix, json_t *json, size_t skip, size_t strip, const char *suffix);
+size_t jsonGeneratorRows(json_generator_t *gen);
+uint8_t jsonGeneratorWindow(json_generator_t *gen);
+int8_t writeGenerated(const MTZ *mtzin, const char *file_out, const options_mtz2json_t *opts);
+int8_t writeNdjson(const MTZ *mtzin, const char *file_out, const options_mtz2json_t *opts);
+int8_t writeShards(const MTZ *mtzin, const char *file_in, const char *file_out, const options_mtz2json_t *opts);
+int8_t writeShardManifest(const MTZ *mtzin, const shard_job_t *jobs, size_t njobs, const char *file_out, const options_mtz2json_t *opts);
+int8_t writeShard(shard_job_t *job);
+MTZ *setMtzShards(MTZ *mtzout, const json_t *json, const char *file_in);
+int8_t readShard(shard_job_t *job);
+int8_t runShardJobs(shard_job_t *jobs, size_t njobs, int8_t (*run)(shard_job_t *job));
+void *shardWorker(void *arg);
+char *shardFilename(const char *file_out, size_t index);
+char *indexFilename(const char *file_json);
+int8_t writeJsonIndex(const char *file_json);
+json_t *indexJson(const char *text, size_t length);
+int8_t indexJsonCrystals(const char *text, size_t length, json_span_t crystals, json_t *jcolumns);
+json_t *jsonIndexLoad(const char *file_json);
+const json_t *jsonIndexColumn(const json_t *index, const char *column);
+json_t *jsonIndexRead(const char *file_json, const json_t *entry);
+float *jsonIndexReadColumn(const char *file_json, const json_t *index, const char *column, size_t *nref);
+json_t *jsonSpan(json_span_t span);
+uint8_t jsonSpanIs(const char *text, json_span_t key, const char *str);
+json_t *jsonSpanLoad(const char *text, json_span_t span);
+size_t jsonScanSpace(const char *text, size_t length, size_t pos);
+size_t jsonScanString(const char *text, size_t length, size_t pos);
+size_t jsonScanValue(const char *text, size_t length, size_t pos);
+int8_t jsonScanMember(const char *text, size_t length, size_t *pos, json_span_t *key, json_span_t *value);
+int8_t jsonScanMemberKey(const char *text, size_t length, size_t *pos, json_span_t *key);
+int8_t jsonScanElement(const char *text, size_t length, size_t *pos, json_span_t *value);
+int8_t jsonScanElementStart(const char *text, size_t length, size_t *pos);
+json_t *jsonLoadPointers(const char *file_json, const char *const *pointers, size_t npointers);
+json_t *jsonLoadbPointers(const char *text, size_t length, const char *const *pointers, size_t npointers);
+int8_t jsonPointerScan(const char *text, size_t length, json_span_t *value, const json_pointer_t *pointers,
+                       const size_t *active, size_t nactive, size_t level, json_t **json);
+uint8_t jsonPointerMatch(const json_pointer_t *pointer, size_t level, const char *key, size_t keylen, size_t index);
+int8_t jsonPointerParse(const char *pointer, json_pointer_t *parsed);
+void jsonPointerFree(json_pointer_t *parsed);
+int8_t validateJson(const char *file_in, validate_error_t *error);
+int8_t validateJsonBuffer(const char *json, size_t length, validate_error_t *error);
+int8_t validateStream(validator_t *v);
+int8_t validateValue(validator_t *v, const validate_key_t *spec, size_t level, validate_summary_t *summary, validate_column_t *column);
+int8_t validateObject(validator_t *v, const validate_key_t *spec, validate_kind_t kind, validate_column_t *column);
+int8_t validateColumn(validator_t *v, const validate_column_t *column);
+int8_t validateAny(validator_t *v);
+int8_t validateScalar(validator_t *v, validate_token_t *token);
+int8_t validateNumber(validator_t *v, validate_token_t *token);
+int8_t validateString(validator_t *v, char *out, size_t outsize, size_t *length, validate_column_t *column);
+int8_t validateEscape(validator_t *v, uint64_t start, unsigned char *bytes, size_t *nbytes);
+int8_t validateHex(validator_t *v, uint32_t *code);
+int8_t validateUtf8(validator_t *v, uint64_t start, int first, unsigned char *bytes, size_t *nbytes);
+uint8_t validateBase64(unsigned char c);
+void validateSummarise(validate_summary_t *summary, json_int_t value);
+const validate_key_t *validateKeys(validate_kind_t kind, size_t *nkeys);
+int validateSpace(validator_t *v);
+int validatePeek(validator_t *v);
+int validateNext(validator_t *v);
+uint8_t validateFill(validator_t *v);
+uint64_t validateOffset(const validator_t *v);
+int8_t validateFail(validator_t *v, uint64_t offset, const char *format, ...);
+const char *missingToken(missing_format_t missing);
+size_t formatReflection(float refl, uint8_t integral, char *out);
+int8_t mtz2csv(const char *file_in, const char *file_out, const options_mtz2csv_t *opts);
+int8_t mtz2csvFile(const char *file_in, const char *file_out, const options_mtz2csv_t *opts);
+const MTZCOL **selectCsvColumns(const MTZ *mtzin, const char *columns, size_t *ncol);
+void writeCsvHeader(const csv_writer_t *writer, FILE *fp);
+size_t formatCsvChunk(const csv_writer_t *writer, size_t chunk, char *out);
+void *csvWorker(void *arg);
+int8_t writeCsvRows(csv_writer_t *writer, FILE *fp, size_t nthreads);
+int8_t writeArrowStream(const MTZ *mtzin, const char *file_out, const options_mtz2json_t *opts);
+void buildArrowSchema(fb_builder_t *fb, const MTZ *mtzin, const MTZCOL **cols, const uint8_t *integral, size_t ncol, const char *metadata);
+void buildArrowRecordBatch(fb_builder_t *fb, size_t nrows, size_t ncol, const size_t *nulls);
+int8_t writeArrowColumn(FILE *fp, const MTZ *mtzin, const MTZCOL *col, uint8_t integral, size_t first, size_t nrows, size_t nulls);
+int8_t writeArrowMessage(FILE *fp, const fb_builder_t *fb);
+size_t arrowPadding(size_t length);
+size_t fbAlloc(fb_builder_t *fb, size_t length, size_t align);
+size_t fbTable(fb_builder_t *fb, const uint8_t *sizes, size_t nfields, size_t *fields);
+size_t fbVector(fb_builder_t *fb, size_t count, size_t size, size_t align);
+size_t fbString(fb_builder_t *fb, const char *str);
+size_t fbKeyValue(fb_builder_t *fb, const char *key, const char *value);
+void fbSetOffset(fb_builder_t *fb, size_t pos, size_t target);
+void fbWriteU8(fb_builder_t *fb, size_t pos, uint8_t value);
+void fbWriteU16(fb_builder_t *fb, size_t pos, uint16_t value);
+void fbWriteU32(fb_builder_t *fb, size_t pos, uint32_t value);
+void fbWriteU64(fb_builder_t *fb, size_t pos, uint64_t value);
+int8_t writeNpz(const MTZ *mtzin, const char *file_out, const options_mtz2json_t *opts);
+int8_t writeNpyMember(npz_writer_t *zw, const char *name, const MTZ *mtzin, const MTZCOL *col, size_t nref);
+size_t npyHeader(char *out, const char *descr, size_t count);
+int8_t npzStartMember(npz_writer_t *zw, const char *name);
+int8_t npzWrite(npz_writer_t *zw, const void *data, size_t length);
+int8_t npzEndMember(npz_writer_t *zw);
+int8_t npzFinish(npz_writer_t *zw);
+json_t *npzLoadMetadata(const char *file_in);
+MTZ *setMtzNpz(MTZ *mtzout, const json_t *json, const char *file_in);
+const unsigned char *npzFindMember(const unsigned char *data, size_t size, const char *name, size_t *length);
+const unsigned char *npyPayload(const unsigned char *npy, size_t length, char *descr, size_t *count);
+uint8_t npyToReflections(const unsigned char *payload, const char *descr, size_t count, float *ref);
+void crc32Table(uint32_t *table);
+uint32_t crc32Update(const uint32_t *table, uint32_t crc, const void *data, size_t length);
+void packLE(unsigned char *out, uint64_t value, size_t nbytes);
+uint64_t unpackLE(const unsigned char *in, size_t nbytes);
+int8_t compressDumpFile(const json_t *json, const char *file_out, size_t flags, compression_t method);
+int compressCallback(const char *buffer, size_t size, void *data);
+int8_t compressFlush(compress_writer_t *cw);
+void *compressWorker(void *arg);
+uint8_t compressionAvailable(compression_t method);
+size_t compressionBound(compression_t method, size_t length);
+size_t compressBlock(compression_t method, const char *in, size_t length, unsigned char *out, size_t capacity);
+compression_t detectCompression(const unsigned char *magic, size_t length);
+json_t *decompressLoadFile(const char *file_in, size_t flags, json_error_t *error);
+int8_t decompressInit(decompress_reader_t *dr);
+void decompressEnd(decompress_reader_t *dr);
+size_t decompressCallback(void *buffer, size_t buflen, void *data);
+int8_t writeSidecar(const MTZ *mtzin, json_t *jsonmtz, const char *path);
+MTZ *setMtzSidecar(MTZ *mtzout, const json_t *json, const char *path);
+char *sidecarFilename(const char *file_out);
+const char *baseName(const char *path);
+char *siblingPath(const char *path, const char *name);
+const unsigned char *mapFile(const char *path, size_t *size);
+void unmapFile(const unsigned char *data, size_t size);
+void *useCLocale(void);
+void restoreLocale(void *previous);
+void initCLocale(void);
+FILE *openOutput(const char *file_out);
+int closeOutput(FILE *fp);
+unsigned char *readStream(FILE *fp, size_t *size);
+MTZ *getMtz(const char *file_in, int read_refs);
+int8_t putMtz(MTZ *mtz, const char *file_out);
+int8_t cborDumpFile(const json_t *json, const char *file_out);
+void cborWriteHead(FILE *fp, uint8_t major, uint64_t value);
+int8_t cborWriteValue(FILE *fp, const json_t *json, uint8_t typed);
+json_t *cborLoadFile(const char *file_in);
+json_t *cborLoadBuffer(const unsigned char *data, size_t size);
+uint8_t cborReadHead(cbor_reader_t *reader, uint8_t *major, uint8_t *info, uint64_t *value);
+double cborHalfToDouble(uint16_t half);
+json_t *cborReadValue(cbor_reader_t *reader, size_t depth);
+void jsonmtzInit(void);
+jsonmtz_ctx_t *jsonmtzCtxNew(void);
+void jsonmtzCtxFree(jsonmtz_ctx_t *ctx);
+jsonmtz_ctx_t *jsonmtzCtxUse(jsonmtz_ctx_t *ctx);
+int8_t mtz2jsonCtx(jsonmtz_ctx_t *ctx, const void *mtz, size_t length, const char **json, size_t *jsonlength, const options_mtz2json_t *opts);
+int8_t json2mtzCtx(jsonmtz_ctx_t *ctx, const char *json, size_t length, const void **mtz, size_t *mtzlength, const options_json2mtz_t *opts);
+int ctxCallback(const char *buffer, size_t size, void *data);
+void ctxCreateKey(void);
+void *ctxMalloc(size_t size);
+void ctxFree(void *ptr);
+void jsonFree(void *ptr);
+size_t ctxSizeClass(size_t size);
+ctx_block_t *ctxSlabBlock(jsonmtz_ctx_t *ctx, size_t size);
 char *makeTimestamp(const char *jobstring, const char *datestring, char *timestamp);
+void addMtzTimestamp(MTZ *mtz, const char *program);
 char *stringtrimn(const char *str, size_t len);
\ No newline at end of file
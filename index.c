@@ -0,0 +1,774 @@
+/*
+ * index.c: Random-access index for JSON outputs
+ *
+ * Copyright (c) 2017 Frank Buermann <fburmann@mrc-lmb.cam.ac.uk>
+ *
+ * jsonmtz is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ * This software makes use of the jansson library (http://www.digip.org/jansson/)
+ * licensed under the terms of the MIT license,
+ * and the CCP4io library (http://www.ccp4.ac.uk/) licensed under the
+ * Lesser GNU General Public License 3.0.
+ */
+
+/*
+ * The index of a JSON file is a small json object:
+ *
+ *     {"File":"out.json","Size":123456,
+ *      "Sections":{"Title":{"Offset":10,"Length":7},...},
+ *      "Columns":[{"Crystal":"HKL_base","Dataset":"HKL_base","Label":"H",
+ *                  "DataEncoding":"plain","Offset":512,"Length":4096},...]}
+ *
+ * The offsets and lengths are in bytes and delimit the JSON text of each
+ * top-level value and of the Data value of each column, which can then be
+ * read and parsed on their own. The index is built by scanning the written
+ * file without parsing it: strings are skipped to their closing quote, and
+ * arrays and objects by counting brackets outside strings. Only the names
+ * of crystals, datasets and columns are decoded.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "jsonmtz.h"
+
+/**
+ * Makes the index filename for a JSON file by replacing its extension with .idx.
+ * @param[in] file_json The JSON file.
+ * @return The index filename, or NULL on failure. Must be freed by the caller.
+ */
+
+char *indexFilename(const char *file_json)
+{
+    const char *base = baseName(file_json);
+    const char *dot = strrchr(base, '.');
+    size_t stem = dot && dot != base ? (size_t)(dot - file_json) : strlen(file_json);
+    char *index = malloc(stem + 5);
+
+    if (!index)
+    {
+        return NULL;
+    }
+
+    memcpy(index, file_json, stem);
+    strcpy(index + stem, ".idx");
+
+    return index;
+}
+
+/**
+ * Writes the index of a JSON file written by mtz2json, see indexFilename().
+ * @param[in] file_json The JSON file.
+ * @return 0 on success, -1 on failure.
+ */
+
+int8_t writeJsonIndex(const char *file_json)
+{
+    const unsigned char *data = NULL;
+    size_t size = 0;
+    json_t *index = NULL;
+    char *file_index = NULL;
+    int8_t ret = -1;
+
+    data = mapFile(file_json, &size);
+    if (!data)
+    {
+        return -1;
+    }
+
+    index = indexJson((const char *)data, size);
+    unmapFile(data, size);
+
+    if (index)
+    {
+        json_object_set_new(index, "File", json_string(baseName(file_json)));
+        file_index = indexFilename(file_json);
+        file_index ? ret = json_dump_file(index, file_index, JSON_COMPACT) : 0;
+        free(file_index);
+    }
+
+    json_decref(index);
+
+    return ret;
+}
+
+/**
+ * Builds the index of a JSON document in memory.
+ * @param[in] text The JSON text.
+ * @param[in] length The length of the text in bytes.
+ * @return The index without File key, or NULL if the document is malformed.
+ */
+
+json_t *indexJson(const char *text, size_t length)
+{
+    json_t *index = json_object();
+    json_t *jsections = json_object();
+    json_t *jcolumns = json_array();
+    json_span_t key, value;
+    size_t pos = jsonScanSpace(text, length, 0);
+    int8_t ret;
+
+    json_object_set_new(index, "Size", json_integer(length));
+    json_object_set_new(index, "Sections", jsections);
+    json_object_set_new(index, "Columns", jcolumns);
+
+    while ((ret = jsonScanMember(text, length, &pos, &key, &value)) == 1)
+    {
+        json_span_t quoted = {key.offset - 1, key.length + 2};
+        json_t *jkey = jsonSpanLoad(text, quoted);
+
+        json_is_string(jkey) ? json_object_set_new(jsections, json_string_value(jkey), jsonSpan(value)) : 0;
+        json_decref(jkey);
+
+        if (jsonSpanIs(text, key, "Crystals") && indexJsonCrystals(text, length, value, jcolumns) != 0)
+        {
+            ret = -1;
+            break;
+        }
+    }
+
+    if (ret != 0)
+    {
+        json_decref(index);
+        return NULL;
+    }
+
+    return index;
+}
+
+/**
+ * Adds the Data values of the columns of the Crystals array to an index.
+ * @param[in] text The JSON text.
+ * @param[in] length The length of the text in bytes.
+ * @param[in] crystals The Crystals value.
+ * @param[in] jcolumns The Columns array of the index.
+ * @return 0 on success, -1 if the crystals are malformed.
+ */
+
+int8_t indexJsonCrystals(const char *text, size_t length, json_span_t crystals, json_t *jcolumns)
+{
+    json_span_t xtal, set, col, key, value;
+    size_t xtalpos = crystals.offset;
+    int8_t ret;
+
+    while ((ret = jsonScanElement(text, length, &xtalpos, &xtal)) == 1)
+    {
+        size_t xtalfirst = json_array_size(jcolumns);
+        json_t *xname = NULL;
+        size_t xtalmember = xtal.offset;
+
+        while ((ret = jsonScanMember(text, length, &xtalmember, &key, &value)) == 1)
+        {
+            size_t setpos = value.offset;
+
+            if (jsonSpanIs(text, key, "CrystalName"))
+            {
+                json_decref(xname);
+                xname = jsonSpanLoad(text, value);
+                continue;
+            }
+
+            if (!jsonSpanIs(text, key, "Datasets"))
+            {
+                continue;
+            }
+
+            while ((ret = jsonScanElement(text, length, &setpos, &set)) == 1)
+            {
+                size_t setfirst = json_array_size(jcolumns);
+                json_t *dname = NULL;
+                size_t setmember = set.offset;
+
+                while ((ret = jsonScanMember(text, length, &setmember, &key, &value)) == 1)
+                {
+                    size_t colpos = value.offset;
+
+                    if (jsonSpanIs(text, key, "DatasetName"))
+                    {
+                        json_decref(dname);
+                        dname = jsonSpanLoad(text, value);
+                        continue;
+                    }
+
+                    if (!jsonSpanIs(text, key, "Columns"))
+                    {
+                        continue;
+                    }
+
+                    while ((ret = jsonScanElement(text, length, &colpos, &col)) == 1)
+                    {
+                        json_t *jcol = json_object();
+                        size_t colmember = col.offset;
+
+                        while ((ret = jsonScanMember(text, length, &colmember, &key, &value)) == 1)
+                        {
+                            if (jsonSpanIs(text, key, "Label"))
+                            {
+                                json_object_set_new(jcol, "Label", jsonSpanLoad(text, value));
+                            }
+                            else if (jsonSpanIs(text, key, "DataEncoding"))
+                            {
+                                json_object_set_new(jcol, "DataEncoding", jsonSpanLoad(text, value));
+                            }
+                            else if (jsonSpanIs(text, key, "Data"))
+                            {
+                                json_object_set_new(jcol, "Offset", json_integer(value.offset));
+                                json_object_set_new(jcol, "Length", json_integer(value.length));
+                            }
+                        }
+
+                        json_array_append_new(jcolumns, jcol);
+                        if (ret != 0)
+                        {
+                            break;
+                        }
+                    }
+
+                    if (ret != 0)
+                    {
+                        break;
+                    }
+                }
+
+                for (size_t i = setfirst; i < json_array_size(jcolumns); i++)
+                {
+                    json_object_set(json_array_get(jcolumns, i), "Dataset", dname ? dname : json_null());
+                }
+                json_decref(dname);
+
+                if (ret != 0)
+                {
+                    break;
+                }
+            }
+
+            if (ret != 0)
+            {
+                break;
+            }
+        }
+
+        for (size_t i = xtalfirst; i < json_array_size(jcolumns); i++)
+        {
+            json_object_set(json_array_get(jcolumns, i), "Crystal", xname ? xname : json_null());
+        }
+        json_decref(xname);
+
+        if (ret != 0)
+        {
+            break;
+        }
+    }
+
+    return ret;
+}
+
+/**
+ * Loads the index of a JSON file. An index whose size does not match the
+ * file is stale and not used.
+ * @param[in] file_json The JSON file.
+ * @return The index, or NULL if there is no valid index.
+ */
+
+json_t *jsonIndexLoad(const char *file_json)
+{
+    char *file_index = indexFilename(file_json);
+    json_t *index = NULL;
+    void *previous;
+    struct stat st;
+
+    if (!file_index)
+    {
+        return NULL;
+    }
+
+    previous = useCLocale();
+    index = json_load_file(file_index, 0, NULL);
+    restoreLocale(previous);
+    free(file_index);
+
+    if (!index || stat(file_json, &st) != 0 ||
+        json_integer_value(json_object_get(index, "Size")) != (json_int_t)st.st_size)
+    {
+        json_decref(index);
+        return NULL;
+    }
+
+    return index;
+}
+
+/**
+ * Finds a column in an index.
+ * @param[in] index The index.
+ * @param[in] column The column label, or a crystal/dataset/label path.
+ * @return The index entry of the first matching column, or NULL.
+ */
+
+const json_t *jsonIndexColumn(const json_t *index, const char *column)
+{
+    const char *label = strrchr(column, '/');
+    const char *dataset = NULL;
+    size_t xnamelen = 0;
+    size_t dnamelen = 0;
+    size_t i;
+    json_t *jcol = NULL;
+
+    // Split crystal/dataset/label paths
+    if (label)
+    {
+        dataset = memchr(column, '/', label - column);
+        if (!dataset)
+        {
+            return NULL;
+        }
+        xnamelen = dataset - column;
+        dnamelen = label - ++dataset;
+        label++;
+    }
+    else
+    {
+        label = column;
+    }
+
+    json_array_foreach(json_object_get(index, "Columns"), i, jcol)
+    {
+        const char *xname = json_string_value(json_object_get(jcol, "Crystal"));
+        const char *dname = json_string_value(json_object_get(jcol, "Dataset"));
+        const char *clabel = json_string_value(json_object_get(jcol, "Label"));
+
+        if (!clabel || strcmp(clabel, label) != 0)
+        {
+            continue;
+        }
+
+        if (dataset && (!xname || !dname || strlen(xname) != xnamelen || strncmp(xname, column, xnamelen) != 0 ||
+                        strlen(dname) != dnamelen || strncmp(dname, dataset, dnamelen) != 0))
+        {
+            continue;
+        }
+
+        return jcol;
+    }
+
+    return NULL;
+}
+
+/**
+ * Reads and parses the JSON text delimited by an index entry.
+ * @param[in] file_json The JSON file.
+ * @param[in] entry The index entry, a section from Sections or a column from Columns.
+ * @return The json value, or NULL on failure.
+ */
+
+json_t *jsonIndexRead(const char *file_json, const json_t *entry)
+{
+    json_int_t offset = json_integer_value(json_object_get(entry, "Offset"));
+    json_int_t length = json_integer_value(json_object_get(entry, "Length"));
+    FILE *fp = NULL;
+    char *text = NULL;
+    json_t *json = NULL;
+
+    if (!json_is_integer(json_object_get(entry, "Offset")) || offset < 0 || length <= 0 || (uint64_t)length > SIZE_MAX)
+    {
+        return NULL;
+    }
+
+    fp = fopen(file_json, "rb");
+    text = malloc(length);
+
+#ifdef _WIN32
+    if (fp && text && _fseeki64(fp, offset, SEEK_SET) == 0 && fread(text, 1, length, fp) == (size_t)length)
+#else
+    if (fp && text && fseeko(fp, offset, SEEK_SET) == 0 && fread(text, 1, length, fp) == (size_t)length)
+#endif
+    {
+        void *previous = useCLocale();
+        json = json_loadb(text, length, JSON_DECODE_ANY | JSON_DECODE_NAN, NULL);
+        restoreLocale(previous);
+    }
+
+    fp ? fclose(fp) : 0;
+    free(text);
+
+    return json;
+}
+
+/**
+ * Reads the values of one column of a JSON file through its index.
+ * Encoded column data are decoded. Sidecar, npz and sharded columns are
+ * stored elsewhere and not supported.
+ * @param[in] file_json The JSON file.
+ * @param[in] index The index, see jsonIndexLoad().
+ * @param[in] column The column label, or a crystal/dataset/label path.
+ * @param[out] nref The number of values.
+ * @return The values with missing values as NaN, or NULL on failure. Must be freed by the caller.
+ */
+
+float *jsonIndexReadColumn(const char *file_json, const json_t *index, const char *column, size_t *nref)
+{
+    const json_t *entry = jsonIndexColumn(index, column);
+    json_t *jcol = NULL;
+    void *previous;
+    MTZCOL col;
+
+    *nref = 0;
+    col.ref = NULL;
+
+    if (!entry)
+    {
+        return NULL;
+    }
+
+    previous = useCLocale();
+    jcol = json_object();
+    json_object_set_new(jcol, "Data", jsonIndexRead(file_json, entry));
+    json_object_get(entry, "DataEncoding") ? json_object_set(jcol, "DataEncoding", json_object_get(entry, "DataEncoding")) : 0;
+
+    switch (columnDataEncoding(jcol))
+    {
+    case COLUMN_SIDECAR_F32LE:
+    case COLUMN_NPY:
+    case COLUMN_SHARD:
+    case COLUMN_UNKNOWN:
+        break;
+    default:
+        if (columnDataLength(jcol, nref))
+        {
+            col.ref = malloc(*nref * sizeof(float) + 1);
+        }
+    }
+
+    if (col.ref && !setMtzColData(&col, jcol, *nref))
+    {
+        free(col.ref);
+        col.ref = NULL;
+    }
+
+    !col.ref ? *nref = 0 : 0;
+    json_decref(jcol);
+    restoreLocale(previous);
+
+    return col.ref;
+}
+
+/**
+ * Makes the Offset and Length object of a span.
+ * @param[in] span The span.
+ * @return The json object.
+ */
+
+json_t *jsonSpan(json_span_t span)
+{
+    return json_pack("{s:I, s:I}", "Offset", (json_int_t)span.offset, "Length", (json_int_t)span.length);
+}
+
+/**
+ * Checks if a span holding an object key equals a string.
+ * @param[in] text The JSON text.
+ * @param[in] key The key without quotes.
+ * @param[in] str The string.
+ * @return 1 if equal, 0 otherwise.
+ */
+
+uint8_t jsonSpanIs(const char *text, json_span_t key, const char *str)
+{
+    return strlen(str) == key.length && memcmp(text + key.offset, str, key.length) == 0;
+}
+
+/**
+ * Parses the JSON text of a span.
+ * @param[in] text The JSON text.
+ * @param[in] span The span.
+ * @return The json value, or NULL if malformed.
+ */
+
+json_t *jsonSpanLoad(const char *text, json_span_t span)
+{
+    return json_loadb(text + span.offset, span.length, JSON_DECODE_ANY | JSON_DECODE_NAN, NULL);
+}
+
+/**
+ * Skips whitespace.
+ * @param[in] text The JSON text.
+ * @param[in] length The length of the text in bytes.
+ * @param[in] pos The position.
+ * @return The position of the next other character, or length.
+ */
+
+size_t jsonScanSpace(const char *text, size_t length, size_t pos)
+{
+    while (pos < length && (text[pos] == ' ' || text[pos] == '\n' || text[pos] == '\r' || text[pos] == '\t'))
+    {
+        pos++;
+    }
+
+    return pos;
+}
+
+/**
+ * Skips a string.
+ * @param[in] text The JSON text.
+ * @param[in] length The length of the text in bytes.
+ * @param[in] pos The position of the opening quote.
+ * @return The position after the closing quote, or JSON_SCAN_ERROR.
+ */
+
+size_t jsonScanString(const char *text, size_t length, size_t pos)
+{
+    size_t start = pos + 1;
+
+    for (pos = start; pos < length; pos++)
+    {
+        const char *quote = memchr(text + pos, '"', length - pos);
+        size_t escapes = 0;
+
+        if (!quote)
+        {
+            break;
+        }
+
+        // A quote after an odd number of backslashes is escaped
+        pos = quote - text;
+        while (pos - escapes > start && text[pos - escapes - 1] == '\\')
+        {
+            escapes++;
+        }
+
+        if (escapes % 2 == 0)
+        {
+            return pos + 1;
+        }
+    }
+
+    return JSON_SCAN_ERROR;
+}
+
+/**
+ * Skips a value. Arrays and objects are skipped by counting brackets, so
+ * their contents are not validated.
+ * @param[in] text The JSON text.
+ * @param[in] length The length of the text in bytes.
+ * @param[in] pos The position of the first character of the value.
+ * @return The position after the value, or JSON_SCAN_ERROR.
+ */
+
+size_t jsonScanValue(const char *text, size_t length, size_t pos)
+{
+    size_t start = pos;
+    size_t depth = 0;
+
+    if (pos >= length)
+    {
+        return JSON_SCAN_ERROR;
+    }
+
+    if (text[pos] == '"')
+    {
+        return jsonScanString(text, length, pos);
+    }
+
+    if (text[pos] != '[' && text[pos] != '{')
+    {
+        // Numbers and literals
+        while (pos < length && !strchr(",]} \n\r\t", text[pos]))
+        {
+            pos++;
+        }
+
+        return pos > start ? pos : JSON_SCAN_ERROR;
+    }
+
+    for (; pos < length; pos++)
+    {
+        switch (text[pos])
+        {
+        case '"':
+            pos = jsonScanString(text, length, pos);
+            if (pos == JSON_SCAN_ERROR)
+            {
+                return JSON_SCAN_ERROR;
+            }
+            pos--;
+            break;
+        case '[':
+        case '{':
+            depth++;
+            break;
+        case ']':
+        case '}':
+            if (--depth == 0)
+            {
+                return pos + 1;
+            }
+            break;
+        }
+    }
+
+    return JSON_SCAN_ERROR;
+}
+
+/**
+ * Scans the next member of an object.
+ * @param[in] text The JSON text.
+ * @param[in] length The length of the text in bytes.
+ * @param[in,out] pos The position of the opening brace, or the end of the
+ * previous member. Advanced to the end of the member.
+ * @param[out] key The key without quotes.
+ * @param[out] value The value.
+ * @return 1 for a member, 0 at the end of the object, -1 if malformed.
+ */
+
+int8_t jsonScanMember(const char *text, size_t length, size_t *pos, json_span_t *key, json_span_t *value)
+{
+    int8_t ret = jsonScanMemberKey(text, length, pos, key);
+    size_t p;
+
+    if (ret != 1)
+    {
+        return ret;
+    }
+
+    value->offset = *pos;
+    p = jsonScanValue(text, length, value->offset);
+
+    if (p == JSON_SCAN_ERROR)
+    {
+        return -1;
+    }
+
+    value->length = p - value->offset;
+    *pos = p;
+
+    return 1;
+}
+
+/**
+ * Scans the key of the next member of an object.
+ * @param[in] text The JSON text.
+ * @param[in] length The length of the text in bytes.
+ * @param[in,out] pos The position of the opening brace, or the end of the
+ * previous member. Advanced to the first character of the value.
+ * @param[out] key The key without quotes.
+ * @return 1 for a member, 0 at the end of the object, -1 if malformed.
+ */
+
+int8_t jsonScanMemberKey(const char *text, size_t length, size_t *pos, json_span_t *key)
+{
+    size_t p = jsonScanSpace(text, length, *pos);
+    char c = p < length ? text[p] : '\0';
+
+    if (c == '}')
+    {
+        return 0;
+    }
+
+    if (c != '{' && c != ',')
+    {
+        return -1;
+    }
+
+    p = jsonScanSpace(text, length, p + 1);
+
+    if (c == '{' && p < length && text[p] == '}')
+    {
+        *pos = p;
+        return 0; // Empty object
+    }
+
+    if (p >= length || text[p] != '"')
+    {
+        return -1;
+    }
+
+    key->offset = p + 1;
+    p = jsonScanString(text, length, p);
+
+    if (p == JSON_SCAN_ERROR)
+    {
+        return -1;
+    }
+
+    key->length = p - 1 - key->offset;
+    p = jsonScanSpace(text, length, p);
+
+    if (p >= length || text[p] != ':')
+    {
+        return -1;
+    }
+
+    *pos = jsonScanSpace(text, length, p + 1);
+
+    return 1;
+}
+
+/**
+ * Scans the next element of an array.
+ * @param[in] text The JSON text.
+ * @param[in] length The length of the text in bytes.
+ * @param[in,out] pos The position of the opening bracket, or the end of the
+ * previous element. Advanced to the end of the element.
+ * @param[out] value The element.
+ * @return 1 for an element, 0 at the end of the array, -1 if malformed.
+ */
+
+int8_t jsonScanElement(const char *text, size_t length, size_t *pos, json_span_t *value)
+{
+    int8_t ret = jsonScanElementStart(text, length, pos);
+    size_t p;
+
+    if (ret != 1)
+    {
+        return ret;
+    }
+
+    value->offset = *pos;
+    p = jsonScanValue(text, length, value->offset);
+
+    if (p == JSON_SCAN_ERROR)
+    {
+        return -1;
+    }
+
+    value->length = p - value->offset;
+    *pos = p;
+
+    return 1;
+}
+
+/**
+ * Scans to the start of the next element of an array.
+ * @param[in] text The JSON text.
+ * @param[in] length The length of the text in bytes.
+ * @param[in,out] pos The position of the opening bracket, or the end of the
+ * previous element. Advanced to the first character of the element.
+ * @return 1 for an element, 0 at the end of the array, -1 if malformed.
+ */
+
+int8_t jsonScanElementStart(const char *text, size_t length, size_t *pos)
+{
+    size_t p = jsonScanSpace(text, length, *pos);
+    char c = p < length ? text[p] : '\0';
+
+    if (c == ']')
+    {
+        return 0;
+    }
+
+    if (c != '[' && c != ',')
+    {
+        return -1;
+    }
+
+    p = jsonScanSpace(text, length, p + 1);
+
+    if (c == '[' && p < length && text[p] == ']')
+    {
+        *pos = p;
+        return 0; // Empty array
+    }
+
+    *pos = p;
+
+    return 1;
+}
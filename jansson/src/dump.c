@@ -15,6 +15,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <math.h>
 #ifdef HAVE_UNISTD_H
 #include <unistd.h>
 #endif
@@ -221,10 +222,9 @@ static int do_dump(const json_t *json, size_t flags, int depth,
             char buffer[MAX_INTEGER_STR_LENGTH];
             int size;
 
-            size = snprintf(buffer, MAX_INTEGER_STR_LENGTH,
-                            "%" JSON_INTEGER_FORMAT,
-                            json_integer_value(json));
-            if(size < 0 || size >= MAX_INTEGER_STR_LENGTH)
+            size = jsonp_itostr(buffer, MAX_INTEGER_STR_LENGTH,
+                                json_integer_value(json));
+            if(size < 0)
                 return -1;
 
             return dump(buffer, size, data);
@@ -236,6 +236,12 @@ static int do_dump(const json_t *json, size_t flags, int depth,
             int size;
             double value = json_real_value(json);
 
+            if(isnan(value)) {
+                if(!(flags & JSON_ENCODE_NAN))
+                    return -1;
+                return dump("NaN", 3, data);
+            }
+
             size = jsonp_dtostr(buffer, MAX_REAL_STR_LENGTH, value,
                                 FLAGS_TO_PRECISION(flags));
             if(size < 0)
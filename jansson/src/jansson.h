@@ -93,6 +93,7 @@ json_t *json_true(void);
 json_t *json_false(void);
 #define json_boolean(val)      ((val) ? json_true() : json_false())
 json_t *json_null(void);
+json_t *json_nan(void);
 
 static JSON_INLINE
 json_t *json_incref(json_t *json)
@@ -291,6 +292,7 @@ json_t *json_deep_copy(const json_t *value);
 #define JSON_DECODE_ANY         0x4
 #define JSON_DECODE_INT_AS_REAL 0x8
 #define JSON_ALLOW_NUL          0x10
+#define JSON_DECODE_NAN         0x20
 
 typedef size_t (*json_load_callback_t)(void *buffer, size_t buflen, void *data);
 
@@ -314,6 +316,7 @@ json_t *json_load_callback(json_load_callback_t callback, void *data, size_t fla
 #define JSON_ESCAPE_SLASH       0x400
 #define JSON_REAL_PRECISION(n)  (((n) & 0x1F) << 11)
 #define JSON_EMBED              0x10000
+#define JSON_ENCODE_NAN         0x20000
 
 typedef int (*json_dump_callback_t)(const char *buffer, size_t size, void *data);
 
@@ -37,6 +37,7 @@
 #define TOKEN_TRUE           259
 #define TOKEN_FALSE          260
 #define TOKEN_NULL           261
+#define TOKEN_NAN            262
 
 /* Locale independent versions of isxxx() functions */
 #define l_isupper(c)  ('A' <= (c) && (c) <= 'Z')
@@ -487,18 +488,28 @@ out:
 #endif
 #endif
 
+/* Integers with at most this many digits fit into any json_int_t and
+   are accumulated while scanning instead of going through strtol() */
+#define MAX_FAST_INTEGER_DIGITS 9
+
 static int lex_scan_number(lex_t *lex, int c, json_error_t *error)
 {
     const char *saved_text;
     char *end;
     double doubleval;
+    int negative = 0;
+    int digits = 0;
+    json_int_t accumulator = 0;
 
     lex->token = TOKEN_INVALID;
 
-    if(c == '-')
+    if(c == '-') {
+        negative = 1;
         c = lex_get_save(lex, error);
+    }
 
     if(c == '0') {
+        digits = 1;
         c = lex_get_save(lex, error);
         if(l_isdigit(c)) {
             lex_unget_unsave(lex, c);
@@ -506,9 +517,12 @@ static int lex_scan_number(lex_t *lex, int c, json_error_t *error)
         }
     }
     else if(l_isdigit(c)) {
-        do
+        do {
+            if(digits < MAX_FAST_INTEGER_DIGITS)
+                accumulator = accumulator * 10 + (c - '0');
+            digits++;
             c = lex_get_save(lex, error);
-        while(l_isdigit(c));
+        } while(l_isdigit(c));
     }
     else {
         lex_unget_unsave(lex, c);
@@ -522,6 +536,12 @@ static int lex_scan_number(lex_t *lex, int c, json_error_t *error)
 
         lex_unget_unsave(lex, c);
 
+        if(digits <= MAX_FAST_INTEGER_DIGITS) {
+            lex->token = TOKEN_INTEGER;
+            lex->value.integer = negative ? -accumulator : accumulator;
+            return 0;
+        }
+
         saved_text = strbuffer_value(&lex->saved_text);
 
         errno = 0;
@@ -637,6 +657,9 @@ static int lex_scan(lex_t *lex, json_error_t *error)
             lex->token = TOKEN_FALSE;
         else if(strcmp(saved_text, "null") == 0)
             lex->token = TOKEN_NULL;
+        else if((lex->flags & JSON_DECODE_NAN) &&
+                strcmp(saved_text, "NaN") == 0)
+            lex->token = TOKEN_NAN;
         else
             lex->token = TOKEN_INVALID;
     }
@@ -858,6 +881,10 @@ static json_t *parse_value(lex_t *lex, size_t flags, json_error_t *error)
             json = json_null();
             break;
 
+        case TOKEN_NAN:
+            json = json_nan();
+            break;
+
         case '{':
             json = parse_object(lex, flags, error);
             break;
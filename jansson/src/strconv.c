@@ -143,3 +143,53 @@ int jsonp_dtostr(char *buffer, size_t size, double value, int precision)
 
     return (int)length;
 }
+
+static const char digit_pairs[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+int jsonp_itostr(char *buffer, size_t size, json_int_t value)
+{
+    char digits[24];
+    char *pos = digits + sizeof(digits);
+    unsigned long long magnitude;
+    size_t length;
+
+    /* Negate in unsigned arithmetic so that the minimum value works */
+    magnitude = value < 0 ? 0ULL - (unsigned long long)value
+                          : (unsigned long long)value;
+
+    /* Emit two digits per division */
+    while(magnitude >= 100) {
+        unsigned int pair = (unsigned int)(magnitude % 100) * 2;
+        magnitude /= 100;
+        *--pos = digit_pairs[pair + 1];
+        *--pos = digit_pairs[pair];
+    }
+    if(magnitude >= 10) {
+        unsigned int pair = (unsigned int)magnitude * 2;
+        *--pos = digit_pairs[pair + 1];
+        *--pos = digit_pairs[pair];
+    }
+    else
+        *--pos = (char)('0' + magnitude);
+
+    if(value < 0)
+        *--pos = '-';
+
+    length = (size_t)(digits + sizeof(digits) - pos);
+    if(length >= size)
+        return -1;
+
+    memcpy(buffer, pos, length);
+    buffer[length] = '\0';
+    return (int)length;
+}
@@ -867,6 +867,10 @@ int json_real_set(json_t *json, double value)
     if(!json_is_real(json) || isnan(value) || isinf(value))
         return -1;
 
+    /* The NaN singleton is immutable */
+    if(json->refcount == (size_t)-1)
+        return -1;
+
     json_to_real(json)->value = value;
 
     return 0;
@@ -884,6 +888,9 @@ static int json_real_equal(const json_t *real1, const json_t *real2)
 
 static json_t *json_real_copy(const json_t *real)
 {
+    if(isnan(json_real_value(real)))
+        return json_nan();
+
     return json_real(json_real_value(real));
 }
 
@@ -923,6 +930,12 @@ json_t *json_null(void)
     return &the_null;
 }
 
+json_t *json_nan(void)
+{
+    static json_real_t the_nan = {{JSON_REAL, (size_t)-1}, NAN};
+    return &the_nan.json;
+}
+
 
 /*** deletion ***/
 
@@ -210,6 +210,25 @@ static void encode_nul_byte()
     json_decref(json);
 }
 
+static void encode_nan()
+{
+    json_t *json;
+    char *result;
+
+    json = json_array();
+    json_array_append(json, json_nan());
+
+    if(json_dumps(json, 0))
+        fail("json_dumps encoded NaN without JSON_ENCODE_NAN");
+
+    result = json_dumps(json, JSON_COMPACT | JSON_ENCODE_NAN);
+    if(!result || strcmp(result, "[NaN]"))
+        fail("json_dumps failed to encode NaN");
+
+    free(result);
+    json_decref(json);
+}
+
 static void dump_file()
 {
     json_t *json;
@@ -319,6 +338,7 @@ static void run_tests()
     encode_other_than_array_or_object();
     escape_slashes();
     encode_nul_byte();
+    encode_nan();
     dump_file();
     dumpb();
     dumpfd();
@@ -168,6 +168,25 @@ static void allow_nul()
     json_decref(json);
 }
 
+static void decode_nan()
+{
+    const char *text = "[1.5, NaN]";
+    json_t *json;
+
+    json = json_loads(text, 0, NULL);
+    if(json)
+        fail("json_loads accepted NaN without JSON_DECODE_NAN");
+
+    json = json_loads(text, JSON_DECODE_NAN, NULL);
+    if(!json || json_array_size(json) != 2)
+        fail("json_loads failed with JSON_DECODE_NAN");
+
+    if(json_array_get(json, 1) != json_nan())
+        fail("json_loads did not decode NaN to json_nan()");
+
+    json_decref(json);
+}
+
 static void load_wrong_args()
 {
     json_t *json;
@@ -232,6 +251,7 @@ static void run_tests()
     decode_any();
     decode_int_as_real();
     allow_nul();
+    decode_nan();
     load_wrong_args();
     position();
     error_code();
@@ -13,6 +13,7 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <getopt.h>
 #include "jsonmtz.h"
 
@@ -21,12 +22,10 @@ int main(int argc, char *argv[])
     uint8_t ret;
     int o;
     options_json2mtz_t opts;
+    validate_error_t error;
     opterr = 0;
 
-    opts.version = 0;
-    opts.help = 0;
-    opts.timestamp = 1;
-    opts.force = 0;
+    defaultJson2mtzOptions(&opts);
 
     while (TRUE)
     {
@@ -35,11 +34,13 @@ int main(int argc, char *argv[])
             {"version", no_argument, 0, 'v'},
             {"no-timestamp", no_argument, 0, 'n'},
             {"force", no_argument, 0, 'f'},
+            {"format", required_argument, 0, 'F'},
+            {"validate", no_argument, 0, 'V'},
             {0, 0, 0, 0}};
 
         int option_index = 0;
 
-        o = getopt_long(argc, argv, "hvnf", long_options, &option_index);
+        o = getopt_long(argc, argv, "hvnfF:V", long_options, &option_index);
 
         if (o == -1)
         {
@@ -54,14 +55,15 @@ int main(int argc, char *argv[])
         case 'v':
             opts.version = 1;
             break;
-        case 'n':
-            opts.timestamp = 0;
+        case 'V':
+            opts.validate = 1;
             break;
-        case 'f':
-            opts.force = 1;
-        case '?':
-            fprintf(stderr, "%s", "json2mtz --help\n");
-            return 1;
+        default:
+            if (setJson2mtzOption(&opts, o, optarg) != 0)
+            {
+                fprintf(stderr, "%s", "json2mtz --help\n");
+                return 1;
+            }
         }
     }
 
@@ -73,12 +75,31 @@ int main(int argc, char *argv[])
         puts("");
         puts("Usage:");
         puts("    json2mtz [options] in.json out.mtz");
+        puts("    json2mtz --validate in.json");
+        puts("");
+#if defined(HAVE_ZLIB) && defined(HAVE_ZSTD)
+        puts("gzip and zstd compressed JSON input is detected.");
+#elif defined(HAVE_ZLIB)
+        puts("gzip compressed JSON input is detected.");
+#elif defined(HAVE_ZSTD)
+        puts("zstd compressed JSON input is detected.");
+#endif
+        puts("Use - to read from stdin or write to stdout.");
+        puts("npz input cannot be read from stdin.");
+        puts("Shards listed in a manifest written by mtz2json -s are read");
+        puts("in parallel.");
         puts("");
         puts("Options:");
         puts("    -v --version          Print program version.");
         puts("    -n --no-timestamp     Do not add timestamp to history.");
         puts("    -h --help             Print help.");
         puts("    -f --force            Input and output filenames can be the same.");
+        puts("    -F --format FORMAT    Read JSON (json), CBOR (cbor) or a NumPy");
+        puts("                          archive written by mtz2json (npz).");
+        puts("    -V --validate         Check the layout, value types and column");
+        puts("                          lengths of a JSON file in a single pass");
+        puts("                          without converting it, and report the byte");
+        puts("                          offset of the first error.");
         puts("");
         exit(0);
     }
@@ -89,13 +110,36 @@ int main(int argc, char *argv[])
         exit(0);
     }
 
+    // Validation reads a single JSON file
+    if (opts.validate)
+    {
+        if (argc - optind != 1 || opts.format != FORMAT_JSON)
+        {
+            fprintf(stderr, "%s", "json2mtz --help\n");
+            return 1;
+        }
+
+        ret = validateJson(argv[optind], &error);
+
+        if (ret == 0)
+        {
+            puts(argv[optind]);
+            return 0;
+        }
+
+        ret == 1 ? fprintf(stderr, "%s", "Unable to read JSON file.\n")
+                 : fprintf(stderr, "%s: byte %llu: %s\n", argv[optind], (unsigned long long)error.offset, error.text);
+        return 1;
+    }
+
     if (argc - optind != 2)
     {
         fprintf(stderr, "%s", "json2mtz --help\n");
         return 1;
     }
 
-    if (strcmp(argv[optind], argv[optind + 1]) != 0 || opts.force)
+    // "-" is stdin or stdout
+    if (strcmp(argv[optind], argv[optind + 1]) != 0 || strcmp(argv[optind], "-") == 0 || opts.force)
     {
         ret = json2mtz(argv[optind], argv[optind + 1], &opts);
     }
@@ -108,7 +152,7 @@ int main(int argc, char *argv[])
     switch (ret)
     {
     case 0:
-        puts(argv[optind + 1]);
+        strcmp(argv[optind + 1], "-") != 0 ? puts(argv[optind + 1]) : 0;
         return 0;
     case 1:
         fprintf(stderr, "%s", "Unable to read JSON file.\n");
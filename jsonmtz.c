@@ -20,13 +20,17 @@
  * format MTZ used in macromolecular X-ray crystallography and the
  * data exchange format JSON. The program contains two executables.
  * mtz2json converts MTZ reflection files to JSON format, and json2mtz does the
- * reverse.
+ * reverse. mtz2csv exports reflection data as CSV or TSV.
  * 
  * @section Usage Example usage
  * $ mtz2json <i>in.mtz</i> <i>out.json</i>
  * 
  * $ json2mtz <i>in.json</i> <i>out.mtz</i>
  * 
+ * $ mtz2csv <i>in.mtz</i> <i>out.csv</i>
+ * 
+ * $ jsonmtzc mtz2json <i>in.mtz</i> <i>out.json</i>, served by jsonmtzd
+ * 
  * @section Building Building from source
  * Use <a href="https://cmake.org/">CMake</a> to build from source.
  * 
@@ -48,7 +52,11 @@
  * 
  * @subsection Library Use as a library
  * <b>jsonmtz</b> can be used as a C library. Include jsonmtz.h in your source
- * code. The functions <i>mtz2jso</i> and <i>json2mtz</i> are the API. */
+ * code. The functions <i>mtz2jso</i> and <i>json2mtz</i> are the API.
+ * <i>mtz2jsonBuffer</i> and <i>json2mtzBuffer</i> convert data in memory
+ * without touching the filesystem. */
+
+#define _XOPEN_SOURCE 700 // locale_t and uselocale()
 
 #include <stdlib.h>
 #include <stdio.h>
@@ -56,8 +64,23 @@
 #include <math.h>
 #include <time.h>
 #include <unistd.h>
+#ifndef _WIN32
+#include <locale.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#ifdef __APPLE__
+#include <xlocale.h>
+#endif
 #include "jsonmtz.h"
 #include "ccp4_utils.h"
+#include "ccp4_array.h"
+
+pthread_once_t localeOnce = PTHREAD_ONCE_INIT;
+#ifndef _WIN32
+locale_t cLocale = (locale_t)0;
+#endif
 
 /**
  * Converts an MTZ reflection file to a JSON file.
@@ -68,23 +91,76 @@
  */
 
 int8_t mtz2json(const char *file_in, const char *file_out, const options_mtz2json_t *opts)
+{
+    void *previous = useCLocale();
+    int8_t ret = mtz2jsonFile(file_in, file_out, opts);
+
+    restoreLocale(previous);
+
+    return ret;
+}
+
+/**
+ * Converts an MTZ reflection file to a JSON file in the locale of the thread.
+ * @param[in] file_in The input MTZ file.
+ * @param[in] file_out The ouptut JSON file.
+ * @param[in] opts Options struct.
+ * @return 0 on success, error code on failure.
+ */
+
+int8_t mtz2jsonFile(const char *file_in, const char *file_out, const options_mtz2json_t *opts)
 {
     MTZ *mtzin = NULL;
     json_t *jsonmtz = NULL;
-    time_t current_time;
-    char *timestring = NULL;
-    char *hist = NULL;
-    char timestamp[80];
-    char jobstring[57];
     uint8_t ret;
     size_t format = JSON_INDENT(4);
+    char *sidecar = NULL;
 
-    if (access(file_in, F_OK | R_OK) == -1)
+    if (strcmp(file_in, "-") != 0 && access(file_in, F_OK | R_OK) == -1)
     {
         return 2; // Input not readable
     }
 
-    mtzin = MtzGet(file_in, 1);
+    // Only JSON output is compressed
+    if (opts->compress != COMPRESS_NONE && opts->format != FORMAT_JSON)
+    {
+        return -1;
+    }
+
+    // Windowed reading produces plain compact JSON only
+    if (opts->window > 0 && (opts->format != FORMAT_JSON || opts->encoding != ENCODING_PLAIN ||
+                             opts->compress != COMPRESS_NONE || opts->missing == MISSING_INDEX))
+    {
+        return -1;
+    }
+
+    // Outputs written with seeks or to more than one file
+    if (strcmp(file_out, "-") == 0 && (opts->format == FORMAT_NPZ || opts->encoding == ENCODING_SIDECAR))
+    {
+        return -1;
+    }
+
+    // Shards are plain JSON, and each shard writer opens the input again
+    if (opts->shards > 0 && (opts->format != FORMAT_JSON || opts->encoding != ENCODING_PLAIN ||
+                             opts->compress != COMPRESS_NONE || opts->missing == MISSING_INDEX ||
+                             strcmp(file_in, "-") == 0 || strcmp(file_out, "-") == 0))
+    {
+        return -1;
+    }
+
+    if (opts->shard != SHARD_ALL && opts->shard >= opts->shards)
+    {
+        return -1;
+    }
+
+    // The index is made from the written JSON file
+    if (opts->index && (opts->format != FORMAT_JSON || opts->compress != COMPRESS_NONE || strcmp(file_out, "-") == 0))
+    {
+        return -1;
+    }
+
+    // Rows are streamed from the file for NDJSON, windowed and sharded output
+    mtzin = getMtz(file_in, opts->format != FORMAT_NDJSON && opts->window == 0 && opts->shards == 0);
     if (!mtzin)
     {
         return 2; // Input not readable
@@ -93,28 +169,87 @@ int8_t mtz2json(const char *file_in, const char *file_out, const options_mtz2jso
     MtzAssignHKLtoBase(mtzin);
 
     // Add timestamp
-    if (opts->timestamp)
+    opts->timestamp ? addMtzTimestamp(mtzin, "mtz2json") : 0;
+
+    if (opts->shards > 0)
+    {
+        ret = writeShards(mtzin, file_in, file_out, opts);
+        MtzFree(mtzin);
+        ret == 0 && opts->index && (opts->shard == SHARD_ALL || opts->shard == 0) ? ret = writeJsonIndex(file_out) : 0;
+        return ret;
+    }
+
+    if (opts->window > 0)
+    {
+        ret = writeGenerated(mtzin, file_out, opts);
+        MtzFree(mtzin);
+        ret == 0 && opts->index ? ret = writeJsonIndex(file_out) : 0;
+        return ret;
+    }
+
+    if (opts->format == FORMAT_NDJSON)
+    {
+        ret = writeNdjson(mtzin, file_out, opts);
+        MtzFree(mtzin);
+        return ret;
+    }
+
+    if (opts->format == FORMAT_ARROW)
     {
-        snprintf(jobstring, 56, "mtz2json v%d.%d.%d run on", VERSION_MAJOR, VERSION_MINOR, VERSION_PATCH);
-        time(&current_time);
-        timestring = ctime(&current_time);
-        makeTimestamp(jobstring, timestring, timestamp);
-        hist = MtzCallocHist(mtzin->histlines + 1);
-        strncpy(hist, mtzin->hist, MTZRECORDLENGTH * mtzin->histlines);
-        strncpy(hist + MTZRECORDLENGTH * mtzin->histlines, timestamp, MTZRECORDLENGTH);
-        MtzFreeHist(mtzin->hist);
-        mtzin->hist = hist;
-        mtzin->histlines += 1;
+        ret = writeArrowStream(mtzin, file_out, opts);
+        MtzFree(mtzin);
+        return ret;
+    }
+
+    if (opts->format == FORMAT_NPZ)
+    {
+        ret = writeNpz(mtzin, file_out, opts);
+        MtzFree(mtzin);
+        return ret;
+    }
+
+    jsonmtz = readMtz(mtzin, opts);
+
+    // Write column data to the sidecar file
+    if (opts->encoding == ENCODING_SIDECAR)
+    {
+        sidecar = sidecarFilename(file_out);
+        if (writeSidecar(mtzin, jsonmtz, sidecar) != 0)
+        {
+            free(sidecar);
+            MtzFree(mtzin);
+            json_decref(jsonmtz);
+            return -1;
+        }
+        free(sidecar);
     }
 
-    jsonmtz = readMtz(mtzin);
     MtzFree(mtzin);
 
     opts->compact ? format = 0 : 0;
+    opts->missing == MISSING_NAN ? format |= JSON_ENCODE_NAN : 0;
 
-    ret = json_dump_file(jsonmtz, file_out, format | JSON_COMPACT);
+    if (opts->format == FORMAT_CBOR)
+    {
+        ret = cborDumpFile(jsonmtz, file_out);
+    }
+    else if (opts->compress != COMPRESS_NONE)
+    {
+        ret = compressDumpFile(jsonmtz, file_out, format | JSON_COMPACT, opts->compress);
+    }
+    else if (strcmp(file_out, "-") == 0)
+    {
+        ret = json_dumpf(jsonmtz, stdout, format | JSON_COMPACT);
+        fflush(stdout) != 0 ? ret = -1 : 0;
+    }
+    else
+    {
+        ret = json_dump_file(jsonmtz, file_out, format | JSON_COMPACT);
+    }
     json_decref(jsonmtz);
 
+    ret == 0 && opts->index ? ret = writeJsonIndex(file_out) : 0;
+
     return ret; // 0 on success, -1 on failure
 }
 
@@ -127,18 +262,46 @@ int8_t mtz2json(const char *file_in, const char *file_out, const options_mtz2jso
  */
 
 int8_t json2mtz(const char *file_in, const char *file_out, const options_json2mtz_t *opts)
+{
+    void *previous = useCLocale();
+    int8_t ret = json2mtzFile(file_in, file_out, opts);
+
+    restoreLocale(previous);
+
+    return ret;
+}
+
+/**
+ * Converts a JSON reflection file to MTZ format in the locale of the thread.
+ * @param[in] file_in The input file.
+ * @param[in] file_out The output file.
+ * @param[in] opts Options struct.
+ * @return 0 for success, other error codes for failure.
+ */
+
+int8_t json2mtzFile(const char *file_in, const char *file_out, const options_json2mtz_t *opts)
 {
     MTZ *mtzout = NULL;
     json_t *json;
     json_error_t err;
-    time_t current_time;
-    char *timestring = NULL;
-    char *hist = NULL;
-    char timestamp[80];
-    char jobstring[57];
-    uint8_t ret;
+    json_t *jsidecar = NULL;
+    char *sidecar = NULL;
+    int8_t ret;
 
-    json = json_load_file(file_in, 0, &err);
+    if (opts->format == FORMAT_CBOR)
+    {
+        json = cborLoadFile(file_in);
+    }
+    else if (opts->format == FORMAT_NPZ)
+    {
+        // Members are read with random access
+        json = strcmp(file_in, "-") != 0 ? npzLoadMetadata(file_in) : NULL;
+    }
+    else
+    {
+        // Compressed input is detected
+        json = decompressLoadFile(file_in, JSON_DECODE_NAN, &err);
+    }
 
     if (!json)
     {
@@ -151,435 +314,2535 @@ int8_t json2mtz(const char *file_in, const char *file_out, const options_json2mt
     if (!mtzout)
     {
         // Unable to make MTZ file
+        json_decref(json);
         return 2;
     }
 
-    // Add timestamp
-    if (opts->timestamp)
+    // Read column data from the sidecar file
+    jsidecar = json_object_get(json, "Sidecar");
+    if (jsidecar && json_is_string(jsidecar))
     {
-        snprintf(jobstring, 56, "json2mtz v%d.%d.%d run on", VERSION_MAJOR, VERSION_MINOR, VERSION_PATCH);
-        time(&current_time);
-        timestring = ctime(&current_time);
-        makeTimestamp(jobstring, timestring, timestamp);
-        hist = MtzCallocHist(mtzout->histlines + 1);
-        for (size_t i = 0; i < mtzout->histlines * MTZRECORDLENGTH; i++)
+        sidecar = siblingPath(file_in, json_string_value(jsidecar));
+        if (!setMtzSidecar(mtzout, json, sidecar))
         {
-            hist[i] = mtzout->hist[i];
+            free(sidecar);
+            MtzFree(mtzout);
+            json_decref(json);
+            return 2;
         }
-        //strncpy(hist, mtzout->hist, MTZRECORDLENGTH * mtzout->histlines);
-        strncpy(hist + MTZRECORDLENGTH * mtzout->histlines, timestamp, MTZRECORDLENGTH);
-        MtzFreeHist(mtzout->hist);
-        mtzout->hist = hist;
-        mtzout->histlines += 1;
+        free(sidecar);
+    }
+
+    // Read column data from the shards
+    if (json_object_get(json, "Shards") && !setMtzShards(mtzout, json, file_in))
+    {
+        MtzFree(mtzout);
+        json_decref(json);
+        return 2;
     }
 
-    MtzPut(mtzout, file_out);
+    // Read column data from the npz members
+    if (opts->format == FORMAT_NPZ && !setMtzNpz(mtzout, json, file_in))
+    {
+        MtzFree(mtzout);
+        json_decref(json);
+        return 2;
+    }
+
+    // Add timestamp
+    opts->timestamp ? addMtzTimestamp(mtzout, "json2mtz") : 0;
+
+    ret = putMtz(mtzout, file_out);
     MtzFree(mtzout);
     json_decref(json);
 
-    return 0;
+    return ret == 0 ? 0 : 2;
 }
 
 /**
- * Trims trailing whitespaces from a string and adds a null terminator.
- * @param[in] str The string.
- * @param[in] len The string length (including null terminator).
- * @return The string
+ * Converts MTZ data in memory to JSON. The MTZ data are read through a
+ * memory-backed CCP4File, and the JSON text is passed to a callback
+ * as it is encoded, so no files are involved.
+ * Only plain JSON output is supported.
+ * @param[in] mtz The MTZ data.
+ * @param[in] length The length of the MTZ data in bytes.
+ * @param[in] callback Function receiving the JSON text, see json_dump_callback().
+ * @param[in] data User data passed to the callback.
+ * @param[in] opts Options struct.
+ * @return 0 on success, 2 if the MTZ data are not readable, -1 on other failures.
  */
 
-char *stringtrimn(const char *str, size_t len)
+int8_t mtz2jsonBuffer(const void *mtz, size_t length, json_dump_callback_t callback, void *data, const options_mtz2json_t *opts)
 {
-    char *start = malloc((len + 1) * sizeof(char));
-    char *end = start + len;
-    memset(start, '\0', len + 1);
+    void *previous = useCLocale();
+    int8_t ret = mtz2jsonMemory(mtz, length, callback, data, opts);
 
-    strncpy(start, str, len);
-
-    while (*end == '\0' || *end == ' ')
-    {
-        end--;
-    }
-
-    *(end + 1) = '\0';
+    restoreLocale(previous);
 
-    return start;
+    return ret;
 }
 
 /**
- * Reads an MTZ struct into a json object and returns a pointer to that object.
- * @param[in] mtzin The MTZ struct.
- * @return Pointer to json_t object.
+ * Converts MTZ data in memory to JSON in the locale of the thread.
+ * @param[in] mtz The MTZ data.
+ * @param[in] length The length of the MTZ data in bytes.
+ * @param[in] callback Function receiving the JSON text, see json_dump_callback().
+ * @param[in] data User data passed to the callback.
+ * @param[in] opts Options struct.
+ * @return 0 on success, 2 if the MTZ data are not readable, -1 on other failures.
  */
 
-json_t *readMtz(const MTZ *mtzin)
+int8_t mtz2jsonMemory(const void *mtz, size_t length, json_dump_callback_t callback, void *data, const options_mtz2json_t *opts)
 {
-    json_t *jsonmtz = json_object();
-    json_t *jsonxtals = json_array();
-    json_t *jsonbatches = json_array();
-    MTZBAT *batch = NULL;
-    uint8_t order[5] = {0};
-    json_t *jorder = json_array();
-    json_t *junknown_headers = json_array();
-    json_t *jhist = json_array();
+    MTZ *mtzin = NULL;
+    CCP4File *filein = NULL;
+    json_t *jsonmtz = NULL;
+    size_t format = JSON_INDENT(4);
+    int8_t ret;
 
-    // Read crystals
-    for (size_t i = 0; i < mtzin->nxtal; i++)
+    if (opts->format != FORMAT_JSON || opts->encoding == ENCODING_SIDECAR || opts->compress != COMPRESS_NONE ||
+        opts->shards > 0 || opts->index)
     {
-        json_array_append_new(jsonxtals, readMtzXtal(mtzin->xtal[i], mtzin->nref_filein, mtzin));
+        return -1; // Needs a file
     }
 
-    // Read batches
-    batch = mtzin->batch;
-    while (TRUE)
+    filein = ccp4_file_open_memory(mtz, length, O_RDONLY);
+    if (!filein)
     {
-        if (batch)
-        {
-            json_array_append_new(jsonbatches, readMtzBatch(batch));
-            batch = batch->next;
-        }
-        else
-        {
-            break;
-        }
+        return 2; // Input not readable
     }
 
-    // Read history
-    for (size_t i = 0; i < mtzin->histlines; i++)
+    mtzin = MtzGetFromFile(filein, 1, 0.002);
+    if (!mtzin)
     {
-        char *line;
-        line = stringtrimn(mtzin->hist + i * MTZRECORDLENGTH, MTZRECORDLENGTH);
-        json_array_append_new(jhist, json_string(line));
-        free(line);
+        return 2; // Input not readable
     }
 
-    // Read sort order
-    for (size_t i = 0; i < 5; i++)
-    {
-        if (mtzin->order[i])
-        {
-            json_array_append_new(jorder, json_integer(mtzin->order[i]->source));
-        }
-    }
+    MtzAssignHKLtoBase(mtzin);
 
-    // Read unknown headers
-    if (mtzin->n_unknown_headers)
-    {
-        for (size_t i = 0; i < mtzin->n_unknown_headers / 2; i++) // Bug in cmtzlib? Headers duplicate if not divided by 2.
-        {
-            char *line;
-            line = stringtrimn(mtzin->unknown_headers + i * MTZRECORDLENGTH, MTZRECORDLENGTH);
-            json_array_append_new(junknown_headers, json_string(line));
-            free(line);
-        }
-    }
+    // Add timestamp
+    opts->timestamp ? addMtzTimestamp(mtzin, "mtz2json") : 0;
 
-    // Populate object
-    json_object_set_new(jsonmtz, "Title", json_string(mtzin->title));
-    json_object_set_new(jsonmtz, "History", jhist);
-    json_object_set_new(jsonmtz, "Crystals", jsonxtals);
-    json_object_set_new(jsonmtz, "Symmetry", readMtzSymmetry(mtzin->mtzsymm));
-    json_object_set_new(jsonmtz, "Batches", jsonbatches);
-    json_object_set_new(jsonmtz, "SortOrder", jorder);
-    json_object_set_new(jsonmtz, "UnknownHeaders", junknown_headers);
+    jsonmtz = readMtz(mtzin, opts);
+    MtzFree(mtzin);
 
-    return jsonmtz;
+    opts->compact ? format = 0 : 0;
+    opts->missing == MISSING_NAN ? format |= JSON_ENCODE_NAN : 0;
+
+    ret = json_dump_callback(jsonmtz, callback, data, format | JSON_COMPACT);
+    json_decref(jsonmtz);
+
+    return ret;
 }
 
 /**
- * Reads a SYMGRP struct into a json object and returns a pointer to that object.
- * @param[in] sym The SYMGRP struct.
- * @return Pointer to json_t object.
+ * Converts JSON or CBOR data in memory to MTZ. The MTZ file is written
+ * to a memory-backed CCP4File, whose buffer is returned.
+ * Sidecar and npz column data are not supported.
+ * @param[in] json The JSON text or CBOR data, depending on opts->format.
+ * @param[in] length The length of the input in bytes.
+ * @param[out] mtz The MTZ data. Must be freed by the caller.
+ * @param[out] mtzlength The length of the MTZ data in bytes.
+ * @param[in] opts Options struct.
+ * @return 0 on success, 1 if the input is not readable, 2 if the conversion fails.
  */
 
-json_t *readMtzSymmetry(SYMGRP sym)
+int8_t json2mtzBuffer(const char *json, size_t length, void **mtz, size_t *mtzlength, const options_json2mtz_t *opts)
 {
-    json_t *jsonsym = json_object();
-    json_t *symop = json_array();
+    size_t capacity = 0;
 
-    // Read symmetry operations
-    for (size_t i = 0; i < 192; i++)
-    {
-        json_t *symopOuter = json_array();
-        for (size_t j = 0; j < 4; j++)
-        {
-            json_t *symopInner = json_array();
-            for (size_t k = 0; k < 4; k++)
-            {
-                json_array_append_new(symopInner, json_real(sym.sym[i][j][k]));
-            }
-            json_array_append_new(symopOuter, symopInner);
-        }
-        json_array_append_new(symop, symopOuter);
-    }
+    *mtz = NULL;
 
-    // Populate object
-    json_object_set_new(jsonsym, "SpaceGroupNumber", json_integer(sym.spcgrp));
-    json_object_set_new(jsonsym, "SpaceGroupName", json_string(sym.spcgrpname));
-    json_object_set_new(jsonsym, "PointGroupName", json_string(sym.pgname));
-    json_object_set_new(jsonsym, "SpaceGroupConfidence", json_stringn(&(sym.spg_confidence), 1));
-    json_object_set_new(jsonsym, "NumberOfSymmetryOperations", json_integer(sym.nsym));
-    json_object_set_new(jsonsym, "NumberOfPrimitiveSymmetryOperations", json_integer(sym.nsymp));
-    json_object_set_new(jsonsym, "SymmetryOperations", symop);
-    json_object_set_new(jsonsym, "LatticeType", json_stringn(&(sym.symtyp), 1));
+    return json2mtzInto(json, length, mtz, &capacity, mtzlength, opts);
+}
 
-    return jsonsym;
+/**
+ * Converts JSON or CBOR data in memory to MTZ like json2mtzBuffer(),
+ * writing into a buffer from an earlier call, which is grown as needed.
+ * @param[in] json The JSON text or CBOR data, depending on opts->format.
+ * @param[in] length The length of the input in bytes.
+ * @param[in,out] mtz The buffer allocated with malloc(), or NULL.
+ * Holds the MTZ data on return. Must be freed by the caller.
+ * @param[in,out] capacity The size of the buffer in bytes.
+ * @param[out] mtzlength The length of the MTZ data in bytes.
+ * @param[in] opts Options struct.
+ * @return 0 on success, 1 if the input is not readable, 2 if the conversion fails.
+ */
+
+int8_t json2mtzInto(const char *json, size_t length, void **mtz, size_t *capacity, size_t *mtzlength, const options_json2mtz_t *opts)
+{
+    void *previous = useCLocale();
+    int8_t ret = json2mtzMemory(json, length, mtz, capacity, mtzlength, opts);
+
+    restoreLocale(previous);
+
+    return ret;
 }
 
 /**
- * Reads an MTZBAT struct into a json object and returns a pointer to that object.
- * @param[in] batch The MTZBAT struct.
- * @return Pointer to json_t object.
+ * Converts JSON or CBOR data in memory to MTZ like json2mtzInto(),
+ * in the locale of the thread.
+ * @param[in] json The JSON text or CBOR data, depending on opts->format.
+ * @param[in] length The length of the input in bytes.
+ * @param[in,out] mtz The buffer allocated with malloc(), or NULL.
+ * @param[in,out] capacity The size of the buffer in bytes.
+ * @param[out] mtzlength The length of the MTZ data in bytes.
+ * @param[in] opts Options struct.
+ * @return 0 on success, 1 if the input is not readable, 2 if the conversion fails.
  */
 
-json_t *readMtzBatch(const MTZBAT *batch)
+int8_t json2mtzMemory(const char *json, size_t length, void **mtz, size_t *capacity, size_t *mtzlength, const options_json2mtz_t *opts)
 {
-    json_t *jsonbatch = json_object();
-    json_t *cell = json_array();
-    json_t *mosaicity = json_array();
-    json_t *datum = json_array();
-    json_t *detlm = NULL;
-    json_t *vec1 = json_array();
-    json_t *vec2 = json_array();
-    json_t *vec3 = json_array();
-    json_t *axesLabels = json_array();
-    json_t *cellRefineFlags = json_array();
-    json_t *missettingAngles;
-    json_t *rotAxis = json_array();
-    json_t *svec = json_array();
-    json_t *idealsvec = json_array();
-    json_t *umat = json_array();
+    MTZ *mtzout = NULL;
+    CCP4File *fileout = NULL;
+    json_t *jsonmtz = NULL;
+    json_error_t err;
+    void *given = NULL;
+    size_t givencap = 0;
+    int8_t ret = 0;
 
-    // Read cell dimensions
-    for (size_t i = 0; i < 6; i++)
+    *mtzlength = 0;
+
+    if (opts->format == FORMAT_CBOR)
     {
-        json_array_append_new(cell, json_real(batch->cell[i]));
+        jsonmtz = cborLoadBuffer((const unsigned char *)json, length);
+    }
+    else if (opts->format == FORMAT_JSON)
+    {
+        jsonmtz = json_loadb(json, length, JSON_DECODE_NAN, &err);
+    }
+
+    if (!jsonmtz)
+    {
+        return 1; // Unable to read JSON
+    }
+
+    // Column data in other files
+    if (json_object_get(jsonmtz, "Sidecar") || json_object_get(jsonmtz, "Shards"))
+    {
+        json_decref(jsonmtz);
+        return 2;
+    }
+
+    mtzout = makeMtz(jsonmtz);
+    json_decref(jsonmtz);
+
+    if (!mtzout)
+    {
+        return 2; // Unable to make MTZ file
+    }
+
+    // Add timestamp
+    opts->timestamp ? addMtzTimestamp(mtzout, "json2mtz") : 0;
+
+    fileout = ccp4_file_open_memory(NULL, 0, O_RDWR | O_TRUNC);
+
+    // The file owns the buffer until it is taken back
+    if (fileout && *mtz && ccp4_file_give_memory(fileout, *mtz, *capacity) == 0)
+    {
+        given = *mtz;
+        givencap = *capacity;
+        *mtz = NULL;
+        *capacity = 0;
+    }
+
+    if (!fileout || !MtzPutFile(mtzout, fileout))
+    {
+        ret = 2;
+    }
+    else
+    {
+        *mtz = ccp4_file_take_memory(fileout, mtzlength);
+        !*mtz ? ret = 2 : 0;
+        *capacity = *mtz == given && *mtzlength <= givencap ? givencap : *mtzlength;
+    }
+
+    fileout ? ccp4_file_close(fileout) : 0;
+    MtzFree(mtzout);
+
+    return ret;
+}
+
+/**
+ * Sets the default mtz2json options.
+ * @param[out] opts Options struct.
+ */
+
+void defaultMtz2jsonOptions(options_mtz2json_t *opts)
+{
+    opts->compact = 0;
+    opts->version = 0;
+    opts->help = 0;
+    opts->timestamp = 1;
+    opts->force = 0;
+    opts->missing = MISSING_STRING;
+    opts->encoding = ENCODING_PLAIN;
+    opts->format = FORMAT_JSON;
+    opts->compress = COMPRESS_NONE;
+    opts->window = 0;
+    opts->shards = 0;
+    opts->shard = SHARD_ALL;
+    opts->index = 0;
+}
+
+/**
+ * Sets an mtz2json option from its short command line flag.
+ * @param[in,out] opts Options struct.
+ * @param[in] option The flag, one of c, n, f, i, m, e, F, z, w, s and S.
+ * @param[in] value The argument of the flag, or NULL for switches.
+ * @return 0 on success, -1 for unknown flags or values.
+ */
+
+int8_t setMtz2jsonOption(options_mtz2json_t *opts, int option, const char *value)
+{
+    char *end = NULL;
+    long window;
+    long shard;
+
+    switch (option)
+    {
+    case 'c':
+        opts->compact = 1;
+        return 0;
+    case 'n':
+        opts->timestamp = 0;
+        return 0;
+    case 'f':
+        opts->force = 1;
+        return 0;
+    case 'i':
+        opts->index = 1;
+        return 0;
+    }
+
+    if (!value)
+    {
+        return -1;
+    }
+
+    switch (option)
+    {
+    case 'm':
+        if (strcmp(value, "string") == 0)
+        {
+            opts->missing = MISSING_STRING;
+        }
+        else if (strcmp(value, "null") == 0)
+        {
+            opts->missing = MISSING_NULL;
+        }
+        else if (strcmp(value, "nan") == 0)
+        {
+            opts->missing = MISSING_NAN;
+        }
+        else if (strcmp(value, "index") == 0)
+        {
+            opts->missing = MISSING_INDEX;
+        }
+        else
+        {
+            return -1;
+        }
+        return 0;
+    case 'e':
+        if (strcmp(value, "plain") == 0)
+        {
+            opts->encoding = ENCODING_PLAIN;
+        }
+        else if (strcmp(value, "auto") == 0)
+        {
+            opts->encoding = ENCODING_AUTO;
+        }
+        else if (strcmp(value, "base64") == 0)
+        {
+            opts->encoding = ENCODING_BASE64;
+        }
+        else if (strcmp(value, "sidecar") == 0)
+        {
+            opts->encoding = ENCODING_SIDECAR;
+        }
+        else if (strcmp(value, "none") == 0)
+        {
+            opts->encoding = ENCODING_NONE;
+        }
+        else
+        {
+            return -1;
+        }
+        return 0;
+    case 'F':
+        if (strcmp(value, "json") == 0)
+        {
+            opts->format = FORMAT_JSON;
+        }
+        else if (strcmp(value, "cbor") == 0)
+        {
+            opts->format = FORMAT_CBOR;
+        }
+        else if (strcmp(value, "ndjson") == 0)
+        {
+            opts->format = FORMAT_NDJSON;
+        }
+        else if (strcmp(value, "arrow") == 0)
+        {
+            opts->format = FORMAT_ARROW;
+        }
+        else if (strcmp(value, "npz") == 0)
+        {
+            opts->format = FORMAT_NPZ;
+        }
+        else
+        {
+            return -1;
+        }
+        return 0;
+    case 'z':
+        if (strcmp(value, "gzip") == 0)
+        {
+            opts->compress = COMPRESS_GZIP;
+        }
+        else if (strcmp(value, "zstd") == 0)
+        {
+            opts->compress = COMPRESS_ZSTD;
+        }
+        else
+        {
+            return -1;
+        }
+        return 0;
+    case 'w':
+        // Window size in MiB
+        window = strtol(value, &end, 10);
+        if (*end != '\0' || window <= 0 || (unsigned long)window > SIZE_MAX >> 20)
+        {
+            return -1;
+        }
+        opts->window = (size_t)window << 20;
+        return 0;
+    case 's':
+        // Number of shards
+        shard = strtol(value, &end, 10);
+        if (*end != '\0' || shard <= 0)
+        {
+            return -1;
+        }
+        opts->shards = shard;
+        return 0;
+    case 'S':
+        // Index of the only shard to write
+        shard = strtol(value, &end, 10);
+        if (*end != '\0' || shard < 0)
+        {
+            return -1;
+        }
+        opts->shard = shard;
+        return 0;
+    }
+
+    return -1;
+}
+
+/**
+ * Sets the default json2mtz options.
+ * @param[out] opts Options struct.
+ */
+
+void defaultJson2mtzOptions(options_json2mtz_t *opts)
+{
+    opts->help = 0;
+    opts->version = 0;
+    opts->timestamp = 1;
+    opts->force = 0;
+    opts->format = FORMAT_JSON;
+    opts->validate = 0;
+}
+
+/**
+ * Sets a json2mtz option from its short command line flag.
+ * @param[in,out] opts Options struct.
+ * @param[in] option The flag, one of n, f and F.
+ * @param[in] value The argument of the flag, or NULL for switches.
+ * @return 0 on success, -1 for unknown flags or values.
+ */
+
+int8_t setJson2mtzOption(options_json2mtz_t *opts, int option, const char *value)
+{
+    switch (option)
+    {
+    case 'n':
+        opts->timestamp = 0;
+        return 0;
+    case 'f':
+        opts->force = 1;
+        return 0;
+    case 'F':
+        if (!value)
+        {
+            return -1;
+        }
+        else if (strcmp(value, "json") == 0)
+        {
+            opts->format = FORMAT_JSON;
+        }
+        else if (strcmp(value, "cbor") == 0)
+        {
+            opts->format = FORMAT_CBOR;
+        }
+        else if (strcmp(value, "npz") == 0)
+        {
+            opts->format = FORMAT_NPZ;
+        }
+        else
+        {
+            return -1;
+        }
+        return 0;
+    }
+
+    return -1;
+}
+
+/**
+ * Writes an MTZ file as newline-delimited JSON. The first line is the
+ * json object produced by readMtz() without column data, with the key
+ * RowColumns listing the ColumnID of each row element. Every following
+ * line is a compact json array holding one reflection in file order.
+ * Reflections are read from the file one at a time, so the MTZ struct
+ * must be read without reflections.
+ * @param[in] mtzin The MTZ struct.
+ * @param[in] file_out The output file.
+ * @param[in] opts Options struct.
+ * @return 0 on success, -1 on failure.
+ */
+
+int8_t writeNdjson(const MTZ *mtzin, const char *file_out, const options_mtz2json_t *opts)
+{
+    FILE *fp = NULL;
+    json_t *jsonmtz = NULL;
+    json_t *jrowcolumns = json_array();
+    size_t ncol = mtzin->ncol_read;
+    float *row = malloc(ncol * sizeof(float) + 1);
+    uint8_t *integral = calloc(ncol + 1, 1);
+    char *line = malloc(ncol * (MAX_REFLECTION_LENGTH + 1) + 2);
+    const char *missing = missingToken(opts->missing);
+    size_t missinglen = strlen(missing);
+    size_t format = JSON_COMPACT;
+    int8_t ret = 0;
+
+    opts->missing == MISSING_NAN ? format |= JSON_ENCODE_NAN : 0;
+
+    fp = openOutput(file_out);
+    if (!fp || !row || !integral || !line)
+    {
+        fp ? closeOutput(fp) : 0;
+        free(row);
+        free(integral);
+        free(line);
+        json_decref(jrowcolumns);
+        return -1;
+    }
+
+    // Columns from the file, by position in the reflection record
+    for (size_t i = 0; i < mtzin->nxtal; i++)
+    {
+        for (size_t j = 0; j < mtzin->xtal[i]->nset; j++)
+        {
+            for (size_t k = 0; k < mtzin->xtal[i]->set[j]->ncol; k++)
+            {
+                const MTZCOL *col = mtzin->xtal[i]->set[j]->col[k];
+
+                if (col->source > 0 && (size_t)col->source <= ncol)
+                {
+                    integral[col->source - 1] = isIntegralColumnType(col->type);
+                }
+            }
+        }
+    }
+
+    for (size_t i = 0; i < ncol; i++)
+    {
+        json_array_append_new(jrowcolumns, json_integer(i + 1));
+    }
+
+    // Header line
+    jsonmtz = readMtz(mtzin, opts);
+    json_object_set_new(jsonmtz, "RowColumns", jrowcolumns);
+    ret = json_dumpf(jsonmtz, fp, format);
+    json_decref(jsonmtz);
+    fputc('\n', fp);
+
+    // Reflection lines
+    for (size_t i = 0; i < mtzin->nref_filein && ret == 0; i++)
+    {
+        size_t length = 0;
+
+        if (MtzRrefl(mtzin->filein, ncol, row) == EOF)
+        {
+            ret = -1;
+            break;
+        }
+
+        line[length++] = '[';
+        for (size_t j = 0; j < ncol; j++)
+        {
+            j > 0 ? line[length++] = ',' : 0;
+
+            if (ccp4_ismnf(mtzin, row[j]))
+            {
+                memcpy(line + length, missing, missinglen);
+                length += missinglen;
+            }
+            else
+            {
+                length += formatReflection(row[j], integral[j], line + length);
+            }
+        }
+        line[length++] = ']';
+        line[length++] = '\n';
+
+        fwrite(line, 1, length, fp) != length ? ret = -1 : 0;
+    }
+
+    free(row);
+    free(integral);
+    free(line);
+
+    if (closeOutput(fp) != 0)
+    {
+        return -1;
+    }
+
+    return ret;
+}
+
+/**
+ * Gets the literal written for missing values in row-oriented output.
+ * Missing values listed by index are written as null.
+ * @param[in] missing Representation of missing values.
+ * @return The literal.
+ */
+
+const char *missingToken(missing_format_t missing)
+{
+    switch (missing)
+    {
+    case MISSING_NULL:
+    case MISSING_INDEX:
+        return "null";
+    case MISSING_NAN:
+        return "NaN";
+    default:
+        return "\"NaN\"";
+    }
+}
+
+/**
+ * Formats a reflection value as a json number. Integral values of integral
+ * columns are written as integers. Values with few decimal places are written
+ * in fixed notation if they read back as the same float. Other values are
+ * written with the nine significant digits needed to round-trip a float.
+ * Reals always contain a decimal point or exponent. Non-finite values are
+ * written as null.
+ * @param[in] refl The reflection value.
+ * @param[in] integral Whether the column is integral.
+ * @param[out] out Buffer of at least MAX_REFLECTION_LENGTH characters.
+ * @return The number of characters written, without null terminator.
+ */
+
+size_t formatReflection(float refl, uint8_t integral, char *out)
+{
+    char digits[20];
+    size_t ndigits = 0;
+    size_t length = 0;
+    int written;
+
+    if (!isfinite(refl))
+    {
+        memcpy(out, "null", 4);
+        return 4;
+    }
+
+    // Integers up to 2^24 are exact in a float, the range check keeps the cast defined
+    if (integral && fabsf(refl) <= 16777216.0f && refl == (float)(int32_t)refl)
+    {
+        int32_t value = (int32_t)refl;
+        uint32_t magnitude = value < 0 ? -(uint32_t)value : (uint32_t)value;
+
+        value < 0 ? out[length++] = '-' : 0;
+
+        do
+        {
+            digits[ndigits++] = '0' + magnitude % 10;
+            magnitude /= 10;
+        } while (magnitude);
+
+        while (ndigits)
+        {
+            out[length++] = digits[--ndigits];
+        }
+
+        return length;
+    }
+
+    // The decimal must be well within half a float ulp of the value
+    if (fabsf(refl) < 1e9f)
+    {
+        double value = refl;
+        double tolerance = 0.25 * (nextafterf(fabsf(refl), INFINITY) - fabsf(refl));
+        double scale = 1.0;
+
+        for (size_t places = 0; places <= MAX_FIXED_PLACES; places++, scale *= 10.0)
+        {
+            double scaled = round(value * scale);
+
+            if (fabs(scaled / scale - value) <= tolerance)
+            {
+                uint64_t magnitude = (uint64_t)fabs(scaled);
+
+                signbit(refl) ? out[length++] = '-' : 0;
+
+                do
+                {
+                    digits[ndigits++] = '0' + magnitude % 10;
+                    magnitude /= 10;
+                } while (magnitude || ndigits <= places);
+
+                while (ndigits > places)
+                {
+                    out[length++] = digits[--ndigits];
+                }
+
+                out[length++] = '.';
+                places == 0 ? out[length++] = '0' : 0;
+
+                while (ndigits)
+                {
+                    out[length++] = digits[--ndigits];
+                }
+
+                return length;
+            }
+        }
+    }
+
+    written = snprintf(out, MAX_REFLECTION_LENGTH, "%.9g", refl);
+
+    // Keep reals distinguishable from integers
+    if (!strpbrk(out, ".e"))
+    {
+        out[written++] = '.';
+        out[written++] = '0';
+    }
+
+    return written;
+}
+
+/**
+ * Writes the column data of an MTZ struct to a sidecar file and records
+ * the location of each column in the json object. Columns are written in
+ * order as little-endian float32 arrays, each starting at a multiple of
+ * SIDECAR_ALIGNMENT bytes. Missing values are written as NaN.
+ * @param[in] mtzin The MTZ struct.
+ * @param[in] jsonmtz The json object as returned by readMtz().
+ * @param[in] path The sidecar file.
+ * @return 0 on success, -1 on failure.
+ */
+
+int8_t writeSidecar(const MTZ *mtzin, json_t *jsonmtz, const char *path)
+{
+    FILE *fp = NULL;
+    json_t *jcrystals = NULL;
+    size_t nref = mtzin->nref_filein;
+    size_t stride = (4 * nref + SIDECAR_ALIGNMENT - 1) / SIDECAR_ALIGNMENT * SIDECAR_ALIGNMENT;
+    size_t offset = 0;
+    unsigned char buffer[4 * 1024];
+    static const unsigned char padding[SIDECAR_ALIGNMENT] = {0};
+
+    json_unpack(jsonmtz, "{s:o}", "Crystals", &jcrystals);
+
+    fp = fopen(path, "wb");
+    if (!fp || !jcrystals)
+    {
+        fp ? fclose(fp) : 0;
+        return -1;
+    }
+
+    for (size_t i = 0; i < mtzin->nxtal; i++)
+    {
+        json_t *jsets = json_object_get(json_array_get(jcrystals, i), "Datasets");
+
+        for (size_t j = 0; j < mtzin->xtal[i]->nset; j++)
+        {
+            json_t *jcols = json_object_get(json_array_get(jsets, j), "Columns");
+
+            for (size_t k = 0; k < mtzin->xtal[i]->set[j]->ncol; k++)
+            {
+                const MTZCOL *col = mtzin->xtal[i]->set[j]->col[k];
+                json_t *jcol = json_array_get(jcols, k);
+
+                // Write column in blocks
+                for (size_t first = 0; first < nref; first += sizeof(buffer) / 4)
+                {
+                    size_t nblock = nref - first < sizeof(buffer) / 4 ? nref - first : sizeof(buffer) / 4;
+
+                    for (size_t l = 0; l < nblock; l++)
+                    {
+                        float refl = col->ref[first + l];
+                        packFloat32LE(ccp4_ismnf(mtzin, refl) ? ccp4_nan().f : refl, buffer + 4 * l);
+                    }
+
+                    if (fwrite(buffer, 4, nblock, fp) != nblock)
+                    {
+                        fclose(fp);
+                        return -1;
+                    }
+                }
+
+                if (fwrite(padding, 1, stride - 4 * nref, fp) != stride - 4 * nref)
+                {
+                    fclose(fp);
+                    return -1;
+                }
+
+                json_object_set_new(jcol, "DataEncoding", json_string(columnEncodingName(COLUMN_SIDECAR_F32LE)));
+                json_object_set_new(jcol, "Data", json_pack("{s:I, s:I}", "Offset", (json_int_t)offset, "Length", (json_int_t)nref));
+                offset += stride;
+            }
+        }
+    }
+
+    json_object_set_new(jsonmtz, "Sidecar", json_string(baseName(path)));
+
+    return fclose(fp) == 0 ? 0 : -1;
+}
+
+/**
+ * Transfer column data from a sidecar file to an MTZ struct.
+ * The sidecar file is memory-mapped and copied into the column buffers.
+ * @param[in] mtzout The MTZ struct as returned by makeMtz().
+ * @param[in] json The json object the MTZ struct was made from.
+ * @param[in] path The sidecar file.
+ * @return The MTZ struct, or NULL on failure.
+ */
+
+MTZ *setMtzSidecar(MTZ *mtzout, const json_t *json, const char *path)
+{
+    const unsigned char *data = NULL;
+    size_t size = 0;
+    json_t *jcrystals = json_object_get(json, "Crystals");
+    size_t nref = mtzout->nref;
+
+    data = mapFile(path, &size);
+    if (!data)
+    {
+        return NULL;
+    }
+
+    for (size_t i = 0; i < mtzout->nxtal; i++)
+    {
+        json_t *jsets = json_object_get(json_array_get(jcrystals, i), "Datasets");
+
+        for (size_t j = 0; j < mtzout->xtal[i]->nset; j++)
+        {
+            json_t *jcols = json_object_get(json_array_get(jsets, j), "Columns");
+
+            for (size_t k = 0; k < mtzout->xtal[i]->set[j]->ncol; k++)
+            {
+                MTZCOL *col = mtzout->xtal[i]->set[j]->col[k];
+                json_t *jcol = json_array_get(jcols, k);
+                json_int_t offset;
+
+                if (columnDataEncoding(jcol) != COLUMN_SIDECAR_F32LE)
+                {
+                    continue;
+                }
+
+                offset = json_integer_value(json_object_get(json_object_get(jcol, "Data"), "Offset"));
+
+                if ((size_t)offset > size || size - offset < 4 * nref)
+                {
+                    unmapFile(data, size);
+                    return NULL;
+                }
+
+                for (size_t l = 0; l < nref; l++)
+                {
+                    col->ref[l] = unpackFloat32LE(data + offset + 4 * l);
+                }
+            }
+        }
+    }
+
+    unmapFile(data, size);
+
+    return mtzout;
+}
+
+/**
+ * Makes the sidecar filename for an output file by replacing its extension with .bin.
+ * @param[in] file_out The output file.
+ * @return The sidecar filename. Must be freed by the caller.
+ */
+
+char *sidecarFilename(const char *file_out)
+{
+    const char *base = baseName(file_out);
+    const char *dot = strrchr(base, '.');
+    size_t stem = dot && dot != base ? (size_t)(dot - file_out) : strlen(file_out);
+    char *sidecar = malloc(stem + 5);
+
+    memcpy(sidecar, file_out, stem);
+    strcpy(sidecar + stem, ".bin");
+
+    return sidecar;
+}
+
+/**
+ * Gets the filename part of a path.
+ * @param[in] path The path.
+ * @return Pointer into the path.
+ */
+
+const char *baseName(const char *path)
+{
+    const char *base = path;
+
+    for (const char *c = path; *c; c++)
+    {
+        if (*c == '/' || *c == '\\')
+        {
+            base = c + 1;
+        }
+    }
+
+    return base;
+}
+
+/**
+ * Resolves a filename relative to the directory of another file.
+ * @param[in] path The file whose directory is used.
+ * @param[in] name The filename. Absolute paths are returned unchanged.
+ * @return The resolved path. Must be freed by the caller.
+ */
+
+char *siblingPath(const char *path, const char *name)
+{
+    size_t dirlen = baseName(path) - path;
+    char *sibling = NULL;
+
+    if (name[0] == '/' || name[0] == '\\' || (name[0] && name[1] == ':'))
+    {
+        dirlen = 0;
+    }
+
+    sibling = malloc(dirlen + strlen(name) + 1);
+    memcpy(sibling, path, dirlen);
+    strcpy(sibling + dirlen, name);
+
+    return sibling;
+}
+
+/**
+ * Switches the calling thread to the C locale, so that numbers are read
+ * and written with a decimal point whatever the locale of the process.
+ * Other threads are not affected. Does nothing on Windows.
+ * @return The previous locale_t of the thread, see restoreLocale().
+ */
+
+void *useCLocale(void)
+{
+#ifndef _WIN32
+    pthread_once(&localeOnce, initCLocale);
+
+    return cLocale ? (void *)uselocale(cLocale) : NULL;
+#else
+    return NULL;
+#endif
+}
+
+/**
+ * Restores the locale of the calling thread.
+ * @param[in] previous The locale returned by useCLocale().
+ */
+
+void restoreLocale(void *previous)
+{
+#ifndef _WIN32
+    previous ? uselocale((locale_t)previous) : 0;
+#else
+    (void)previous;
+#endif
+}
+
+/**
+ * Creates the C locale object. Called once.
+ */
+
+void initCLocale(void)
+{
+#ifndef _WIN32
+    cLocale = newlocale(LC_ALL_MASK, "C", (locale_t)0);
+#endif
+}
+
+/**
+ * Maps a file into memory for reading. Falls back to reading the file
+ * into a buffer where mmap is not available.
+ * @param[in] path The file.
+ * @param[out] size The file size.
+ * @return Pointer to the file contents, or NULL on failure.
+ */
+
+const unsigned char *mapFile(const char *path, size_t *size)
+{
+#ifndef _WIN32
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    void *data = NULL;
+
+    if (fd == -1)
+    {
+        return NULL;
+    }
+
+    if (fstat(fd, &st) == -1)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    *size = st.st_size;
+    data = *size ? mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0) : malloc(1);
+    close(fd);
+
+    return data == MAP_FAILED ? NULL : data;
+#else
+    FILE *fp = fopen(path, "rb");
+    unsigned char *data = NULL;
+    __int64 length;
+
+    if (!fp)
+    {
+        return NULL;
+    }
+
+    _fseeki64(fp, 0, SEEK_END);
+    length = _ftelli64(fp);
+    _fseeki64(fp, 0, SEEK_SET);
+
+    data = length >= 0 ? malloc(length + 1) : NULL;
+    if (!data || fread(data, 1, length, fp) != (size_t)length)
+    {
+        free(data);
+        fclose(fp);
+        return NULL;
+    }
+
+    fclose(fp);
+    *size = length;
+
+    return data;
+#endif
+}
+
+/**
+ * Releases a file mapped with mapFile().
+ * @param[in] data Pointer to the file contents.
+ * @param[in] size The file size.
+ */
+
+void unmapFile(const unsigned char *data, size_t size)
+{
+#ifndef _WIN32
+    size ? munmap((void *)data, size) : (free((void *)data), 0);
+#else
+    free((void *)data);
+#endif
+}
+
+/**
+ * Opens an output file for writing, or stdout for "-".
+ * @param[in] file_out The output file.
+ * @return The stream, or NULL on failure. Must be closed with closeOutput().
+ */
+
+FILE *openOutput(const char *file_out)
+{
+    return strcmp(file_out, "-") == 0 ? stdout : fopen(file_out, "wb");
+}
+
+/**
+ * Closes a stream opened with openOutput(). stdout is flushed but left open.
+ * @param[in] fp The stream.
+ * @return 0 on success, EOF on failure.
+ */
+
+int closeOutput(FILE *fp)
+{
+    return fp == stdout ? fflush(fp) : fclose(fp);
+}
+
+/**
+ * Reads a stream to its end.
+ * @param[in] fp The stream.
+ * @param[out] size The number of bytes read.
+ * @return The data, or NULL on failure. Must be freed by the caller.
+ */
+
+unsigned char *readStream(FILE *fp, size_t *size)
+{
+    unsigned char *data = NULL;
+    unsigned char *grown = NULL;
+    size_t capacity = 65536;
+    size_t nread;
+
+    *size = 0;
+    data = malloc(capacity);
+
+    while (data && (nread = fread(data + *size, 1, capacity - *size, fp)) > 0)
+    {
+        *size += nread;
+
+        if (*size == capacity)
+        {
+            grown = realloc(data, 2 * capacity);
+            !grown ? free(data) : 0;
+            data = grown;
+            capacity *= 2;
+        }
+    }
+
+    if (data && ferror(fp))
+    {
+        free(data);
+        data = NULL;
+    }
+
+    return data;
+}
+
+/**
+ * Reads an MTZ file, or an MTZ stream from stdin for "-". The stream is
+ * read into a memory-backed CCP4File, which MtzGet seeks in like a file.
+ * Compressed streams are inflated as for files.
+ * @param[in] file_in The input file.
+ * @param[in] read_refs Whether to read the reflections into memory.
+ * @return The MTZ struct, or NULL on failure.
+ */
+
+MTZ *getMtz(const char *file_in, int read_refs)
+{
+    CCP4File *filein = NULL;
+    unsigned char buffer[65536];
+    size_t nread;
+
+    if (strcmp(file_in, "-") != 0)
+    {
+        return MtzGet(file_in, read_refs);
+    }
+
+    filein = ccp4_file_open_memory(NULL, 0, O_RDWR);
+
+    while (filein && (nread = fread(buffer, 1, sizeof(buffer), stdin)) > 0)
+    {
+        if (ccp4_file_raw_write(filein, (const char *)buffer, nread) != (int)nread)
+        {
+            ccp4_file_close(filein);
+            return NULL;
+        }
+    }
+
+    // gzip-compressed MTZ is inflated in memory
+    if (!filein || ferror(stdin) || ccp4_file_inflate(filein) != 0 || ccp4_file_raw_seek(filein, 0, SEEK_SET) != 0)
+    {
+        filein ? ccp4_file_close(filein) : 0;
+        return NULL;
+    }
+
+    return MtzGetFromFile(filein, read_refs, 0.002);
+}
+
+/**
+ * Writes an MTZ file, or streams it to stdout for "-". The header position
+ * is known from the number of reflections, so on stdout the first record
+ * is written with it and followed by the reflections and the header,
+ * without seeking back.
+ * @param[in] mtz The MTZ struct.
+ * @param[in] file_out The output file.
+ * @return 0 on success, -1 on failure.
+ */
+
+int8_t putMtz(MTZ *mtz, const char *file_out)
+{
+    CCP4File *fileout = NULL;
+    int8_t ret = -1;
+
+    if (strcmp(file_out, "-") != 0)
+    {
+        return MtzPut(mtz, file_out) ? 0 : -1;
+    }
+
+    fileout = ccp4_file_open_file(stdout, O_WRONLY);
+    if (fileout && MtzPutStream(mtz, fileout) && fflush(stdout) == 0 && !ferror(stdout))
+    {
+        ret = 0;
+    }
+
+    fileout ? ccp4_file_close(fileout) : 0;
+
+    return ret;
+}
+
+/**
+ * Trims trailing whitespaces from a string and adds a null terminator.
+ * @param[in] str The string.
+ * @param[in] len The string length (including null terminator).
+ * @return The string
+ */
+
+char *stringtrimn(const char *str, size_t len)
+{
+    char *start = malloc((len + 1) * sizeof(char));
+    char *end = start + len;
+    memset(start, '\0', len + 1);
+
+    strncpy(start, str, len);
+
+    while (*end == '\0' || *end == ' ')
+    {
+        end--;
+    }
+
+    *(end + 1) = '\0';
+
+    return start;
+}
+
+/**
+ * Reads an MTZ struct into a json object and returns a pointer to that object.
+ * @param[in] mtzin The MTZ struct.
+ * @param[in] opts Options struct.
+ * @return Pointer to json_t object.
+ */
+
+json_t *readMtz(const MTZ *mtzin, const options_mtz2json_t *opts)
+{
+    json_t *jsonmtz = json_object();
+    json_t *jsonxtals = json_array();
+    json_t *jsonbatches = json_array();
+    MTZBAT *batch = NULL;
+
+    // Read crystals
+    for (size_t i = 0; i < mtzin->nxtal; i++)
+    {
+        json_array_append_new(jsonxtals, readMtzXtal(mtzin->xtal[i], mtzin->nref_filein, mtzin, opts));
+    }
+
+    // Read batches
+    batch = mtzin->batch;
+    while (TRUE)
+    {
+        if (batch)
+        {
+            json_array_append_new(jsonbatches, readMtzBatch(batch));
+            batch = batch->next;
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    // Populate object
+    json_object_set_new(jsonmtz, "Title", json_string(mtzin->title));
+    json_object_set_new(jsonmtz, "History", readMtzHistory(mtzin));
+    json_object_set_new(jsonmtz, "Crystals", jsonxtals);
+    json_object_set_new(jsonmtz, "Symmetry", readMtzSymmetry(mtzin->mtzsymm));
+    json_object_set_new(jsonmtz, "Batches", jsonbatches);
+    json_object_set_new(jsonmtz, "SortOrder", readMtzSortOrder(mtzin));
+    json_object_set_new(jsonmtz, "UnknownHeaders", readMtzUnknownHeaders(mtzin));
+
+    return jsonmtz;
+}
+
+/**
+ * Reads the history lines of an MTZ struct.
+ * @param[in] mtzin The MTZ struct.
+ * @return Array of strings.
+ */
+
+json_t *readMtzHistory(const MTZ *mtzin)
+{
+    json_t *jhist = json_array();
+
+    for (size_t i = 0; i < mtzin->histlines; i++)
+    {
+        char *line;
+        line = stringtrimn(mtzin->hist + i * MTZRECORDLENGTH, MTZRECORDLENGTH);
+        json_array_append_new(jhist, json_string(line));
+        free(line);
+    }
+
+    return jhist;
+}
+
+/**
+ * Reads the sort order of an MTZ struct.
+ * @param[in] mtzin The MTZ struct.
+ * @return Array of column IDs.
+ */
+
+json_t *readMtzSortOrder(const MTZ *mtzin)
+{
+    json_t *jorder = json_array();
+
+    for (size_t i = 0; i < 5; i++)
+    {
+        if (mtzin->order[i])
+        {
+            json_array_append_new(jorder, json_integer(mtzin->order[i]->source));
+        }
+    }
+
+    return jorder;
+}
+
+/**
+ * Reads the unknown header records of an MTZ struct.
+ * @param[in] mtzin The MTZ struct.
+ * @return Array of strings.
+ */
+
+json_t *readMtzUnknownHeaders(const MTZ *mtzin)
+{
+    json_t *junknown_headers = json_array();
+
+    if (mtzin->n_unknown_headers)
+    {
+        for (size_t i = 0; i < mtzin->n_unknown_headers / 2; i++) // Bug in cmtzlib? Headers duplicate if not divided by 2.
+        {
+            char *line;
+            line = stringtrimn(mtzin->unknown_headers + i * MTZRECORDLENGTH, MTZRECORDLENGTH);
+            json_array_append_new(junknown_headers, json_string(line));
+            free(line);
+        }
+    }
+
+    return junknown_headers;
+}
+
+/**
+ * Reads a SYMGRP struct into a json object and returns a pointer to that object.
+ * @param[in] sym The SYMGRP struct.
+ * @return Pointer to json_t object.
+ */
+
+json_t *readMtzSymmetry(SYMGRP sym)
+{
+    json_t *jsonsym = json_object();
+    json_t *symop = json_array();
+
+    // Read symmetry operations
+    for (size_t i = 0; i < 192; i++)
+    {
+        json_t *symopOuter = json_array();
+        for (size_t j = 0; j < 4; j++)
+        {
+            json_t *symopInner = json_array();
+            for (size_t k = 0; k < 4; k++)
+            {
+                json_array_append_new(symopInner, json_real(sym.sym[i][j][k]));
+            }
+            json_array_append_new(symopOuter, symopInner);
+        }
+        json_array_append_new(symop, symopOuter);
+    }
+
+    // Populate object
+    json_object_set_new(jsonsym, "SpaceGroupNumber", json_integer(sym.spcgrp));
+    json_object_set_new(jsonsym, "SpaceGroupName", json_string(sym.spcgrpname));
+    json_object_set_new(jsonsym, "PointGroupName", json_string(sym.pgname));
+    json_object_set_new(jsonsym, "SpaceGroupConfidence", json_stringn(&(sym.spg_confidence), 1));
+    json_object_set_new(jsonsym, "NumberOfSymmetryOperations", json_integer(sym.nsym));
+    json_object_set_new(jsonsym, "NumberOfPrimitiveSymmetryOperations", json_integer(sym.nsymp));
+    json_object_set_new(jsonsym, "SymmetryOperations", symop);
+    json_object_set_new(jsonsym, "LatticeType", json_stringn(&(sym.symtyp), 1));
+
+    return jsonsym;
+}
+
+/**
+ * Reads an MTZBAT struct into a json object and returns a pointer to that object.
+ * @param[in] batch The MTZBAT struct.
+ * @return Pointer to json_t object.
+ */
+
+json_t *readMtzBatch(const MTZBAT *batch)
+{
+    json_t *jsonbatch = json_object();
+    json_t *cell = json_array();
+    json_t *mosaicity = json_array();
+    json_t *datum = json_array();
+    json_t *detlm = NULL;
+    json_t *vec1 = json_array();
+    json_t *vec2 = json_array();
+    json_t *vec3 = json_array();
+    json_t *axesLabels = json_array();
+    json_t *cellRefineFlags = json_array();
+    json_t *missettingAngles;
+    json_t *rotAxis = json_array();
+    json_t *svec = json_array();
+    json_t *idealsvec = json_array();
+    json_t *umat = json_array();
+
+    // Read cell dimensions
+    for (size_t i = 0; i < 6; i++)
+    {
+        json_array_append_new(cell, json_real(batch->cell[i]));
     }
 
     // Read mosaicity
     for (size_t i = 0; i < 12; i++)
     {
-        json_array_append_new(mosaicity, json_real(batch->crydat[i]));
+        json_array_append_new(mosaicity, json_real(batch->crydat[i]));
+    }
+
+    // Read datum
+    for (size_t i = 0; i < 3; i++)
+    {
+        json_array_append_new(datum, json_real(batch->datum[i]));
+    }
+
+    // Read detector limits
+    detlm =
+        json_pack("[[[f,f],[f,f]],[[f,f],[f,f]]]",
+                  batch->detlm[0][0][0],
+                  batch->detlm[0][0][1],
+                  batch->detlm[0][1][0],
+                  batch->detlm[0][1][1],
+                  batch->detlm[1][0][0],
+                  batch->detlm[1][0][1],
+                  batch->detlm[1][1][0],
+                  batch->detlm[1][1][1]);
+
+    // Read vectors
+    for (size_t i = 0; i < 3; i++)
+    {
+        json_array_append_new(vec1, json_real(batch->e1[i]));
+        json_array_append_new(vec2, json_real(batch->e2[i]));
+        json_array_append_new(vec3, json_real(batch->e3[i]));
+    }
+
+    // Read axes labels
+    for (size_t i = 0; i < 3; i++)
+    {
+        json_array_append_new(axesLabels, json_string(batch->gonlab[i]));
+    }
+
+    // Read refinement flags for cells
+    for (size_t i = 0; i < 6; i++)
+    {
+        json_array_append_new(cellRefineFlags, json_integer(batch->lbcell[i]));
+    }
+
+    // Read missetting angles
+    missettingAngles =
+        json_pack(
+            "[[f,f,f],[f,f,f]]",
+            batch->phixyz[0][0],
+            batch->phixyz[0][1],
+            batch->phixyz[0][2],
+            batch->phixyz[1][0],
+            batch->phixyz[1][1],
+            batch->phixyz[1][2]);
+
+    // Read rotation axis
+    for (size_t i = 0; i < 3; i++)
+    {
+        json_array_append_new(rotAxis, json_real(batch->scanax[i]));
+    }
+
+    // Read source vector
+    for (size_t i = 0; i < 3; i++)
+    {
+        json_array_append_new(svec, json_real(batch->so[i]));
+    }
+
+    // Read idealised source vector
+    for (size_t i = 0; i < 3; i++)
+    {
+        json_array_append_new(idealsvec, json_real(batch->source[i]));
+    }
+
+    // Read orientation matrix
+    for (size_t i = 0; i < 9; i++)
+    {
+        json_array_append_new(umat, json_real(batch->umat[i]));
+    }
+
+    // Populate object
+    json_object_set_new(jsonbatch, "Title", json_string(batch->title));
+    json_object_set_new(jsonbatch, "DatasetID", json_integer(batch->nbsetid));
+    json_object_set_new(jsonbatch, "CrystalNumber", json_integer(batch->ncryst));
+    json_object_set_new(jsonbatch, "BatchNumber", json_integer(batch->num));
+    json_object_set_new(jsonbatch, "Wavelength", json_real(batch->alambd));
+    json_object_set_new(jsonbatch, "CellDimensions", cell);
+    json_object_set_new(jsonbatch, "OrientationMatrix", umat);
+    json_object_set_new(jsonbatch, "TemperatureFactor", json_real(batch->bbfac));
+    json_object_set_new(jsonbatch, "Scale", json_real(batch->bscale));
+    json_object_set_new(jsonbatch, "Mosaicity", mosaicity);
+    json_object_set_new(jsonbatch, "GoniostatDatum", datum);
+    json_object_set_new(jsonbatch, "Dispersion", json_real(batch->delamb));
+    json_object_set_new(jsonbatch, "CorrelatedComponent", json_real(batch->delcor));
+    json_object_set_new(jsonbatch, "DetectorLimits", detlm);
+    json_object_set_new(jsonbatch, "HorizontalBeamDivergence", json_real(batch->divhd));
+    json_object_set_new(jsonbatch, "VerticalBeamDivergence", json_real(batch->divvd));
+    json_object_set_new(jsonbatch, "DetectorDistance", json_pack("[f,f]", batch->dx[0], batch->dx[1]));
+    json_object_set_new(jsonbatch, "Vector1", vec1);
+    json_object_set_new(jsonbatch, "Vector2", vec2);
+    json_object_set_new(jsonbatch, "Vector3", vec3);
+    json_object_set_new(jsonbatch, "AxesLabels", axesLabels);
+    json_object_set_new(jsonbatch, "OrientationBlockType", json_integer(batch->iortyp));
+    json_object_set_new(jsonbatch, "GoniostatScanAxisNumber", json_integer(batch->jsaxs));
+    json_object_set_new(jsonbatch, "JumpAxis", json_integer(batch->jumpax));
+    json_object_set_new(jsonbatch, "CellRefinementFlags", cellRefineFlags);
+    json_object_set_new(jsonbatch, "BeamInfoFlag", json_integer(batch->lbmflg));
+    json_object_set_new(jsonbatch, "MosaicityModelFlag", json_integer(batch->lcrflg));
+    json_object_set_new(jsonbatch, "DataTypeFlag", json_integer(batch->ldtype));
+    json_object_set_new(jsonbatch, "MisFlag", json_integer(batch->misflg));
+    json_object_set_new(jsonbatch, "NumberOfBatchScales", json_integer(batch->nbscal));
+    json_object_set_new(jsonbatch, "NumberOfDetectors", json_integer(batch->ndet));
+    json_object_set_new(jsonbatch, "NumberOfGoniostatAxes", json_integer(batch->ngonax));
+    json_object_set_new(jsonbatch, "EndOfPhi", json_real(batch->phiend));
+    json_object_set_new(jsonbatch, "PhiRange", json_real(batch->phirange));
+    json_object_set_new(jsonbatch, "StartOfPhi", json_real(batch->phistt));
+    json_object_set_new(jsonbatch, "MissettingAngles", missettingAngles);
+    json_object_set_new(jsonbatch, "RotationAxis", rotAxis);
+    json_object_set_new(jsonbatch, "BFactorSD", json_real(batch->sdbfac));
+    json_object_set_new(jsonbatch, "BScaleSD", json_real(batch->sdbscale));
+    json_object_set_new(jsonbatch, "SourceVector", svec);
+    json_object_set_new(jsonbatch, "IdealisedSourceVector", idealsvec);
+    json_object_set_new(jsonbatch, "Theta", json_pack("[f,f]", batch->theta[0], batch->theta[1]));
+    json_object_set_new(jsonbatch, "StartTime", json_real(batch->time1));
+    json_object_set_new(jsonbatch, "StopTime", json_real(batch->time2));
+
+    return jsonbatch;
+}
+
+/**
+ * Reads an MTZXTAL struct into a json object and returns a pointer to that object.
+ * @param[in] xtal The MTZXTAL struct.
+ * @param[in] nref Number of reflections.
+ * @param[in] mtzin The parental MTZ struct.
+ * @param[in] opts Options struct.
+ * @return Pointer to json_t object.
+ */
+
+json_t *readMtzXtal(const MTZXTAL *xtal, size_t nref, const MTZ *mtzin, const options_mtz2json_t *opts)
+{
+    json_t *jsonxtal = json_object();
+    json_t *jsonsets = json_array();
+    json_t *cell = json_array();
+
+    // Read cell constants
+    for (size_t i = 0; i < 6; i++)
+    {
+        json_array_append_new(cell, json_real(xtal->cell[i]));
+    }
+
+    // Read datasets
+    for (size_t i = 0; i < xtal->nset; i++)
+    {
+        json_t *set = readMtzSet(xtal->set[i], nref, mtzin, opts);
+        json_array_append_new(jsonsets, set);
+    }
+
+    // Populate object
+    json_object_set_new(jsonxtal, "CrystalName", json_string(xtal->xname));
+    json_object_set_new(jsonxtal, "CellConstants", cell);
+    json_object_set_new(jsonxtal, "ProjectName", json_string(xtal->pname));
+    json_object_set_new(jsonxtal, "ResolutionMax", json_real(xtal->resmax));
+    json_object_set_new(jsonxtal, "ResolutionMin", json_real(xtal->resmin));
+    json_object_set_new(jsonxtal, "Datasets", jsonsets);
+
+    return jsonxtal;
+}
+
+/**
+ * Reads an MTZSET into a json array and returns a pointer to that array.
+ * @param[in] set The MTZSET to read.
+ * @param[in] nref Number of reflections. 
+ * @param[in] mtzin The parental MTZ struct.
+ * @param[in] opts Options struct.
+ * @return Pointer to json_t array.
+ */
+
+json_t *readMtzSet(const MTZSET *set, size_t nref, const MTZ *mtzin, const options_mtz2json_t *opts)
+{
+    json_t *jset = json_object();
+    json_t *jcols = json_array();
+
+    json_object_set_new(jset, "DatasetName", json_string(set->dname));
+    json_object_set_new(jset, "DatasetID", json_integer(set->setid));
+    json_object_set_new(jset, "Wavelength", json_real(set->wavelength));
+
+    // Read columns
+    for (size_t i = 0; i < set->ncol; i++)
+    {
+        json_array_append_new(jcols, readMtzCol(set->col[i], nref, mtzin, opts));
+    }
+
+    json_object_set_new(jset, "Columns", jcols);
+
+    return jset;
+}
+
+/**
+ * Reads an MTZCOL into a json object and returns a pointer to that object.
+ * @param[in] col The MTZCOL to read.
+ * @param[in] nref Number of reflections.
+ * @param[in] mtzin The parental MTZ struct.
+ * @param[in] opts Options struct.
+ * @return Pointer to json_t object.
+ */
+
+json_t *readMtzCol(const MTZCOL *col, size_t nref, const MTZ *mtzin, const options_mtz2json_t *opts)
+{
+    json_t *column = json_object();
+    column_encoding_t encoding;
+
+    // Populate object
+    json_object_set_new(column, "ColumnSource", json_string(col->colsource));
+    json_object_set_new(column, "GroupName", json_string(col->grpname));
+    json_object_set_new(column, "GroupPosition", json_integer(col->grpposn));
+    json_object_set_new(column, "GroupType", json_string(col->grptype));
+    json_object_set_new(column, "Label", json_string(col->label));
+    json_object_set_new(column, "MaxValue", json_real(col->max));
+    json_object_set_new(column, "MinValue", json_real(col->min));
+    json_object_set_new(column, "ColumnID", json_integer(col->source));
+    json_object_set_new(column, "Type", json_string(col->type));
+
+    // Column data are written separately or not at all
+    if (opts->encoding == ENCODING_NONE || opts->encoding == ENCODING_SIDECAR ||
+        (opts->format != FORMAT_JSON && opts->format != FORMAT_CBOR))
+    {
+        return column;
+    }
+
+    // Read reflection data
+    encoding = chooseColumnEncoding(col, nref, mtzin, opts);
+
+    if (encoding != COLUMN_PLAIN)
+    {
+        json_object_set_new(column, "DataEncoding", json_string(columnEncodingName(encoding)));
+    }
+
+    switch (encoding)
+    {
+    case COLUMN_MISSING_INDEX:
+        json_object_set_new(column, "Data", readMtzColMissingIndex(col, nref, mtzin));
+        break;
+    case COLUMN_RUN_LENGTH:
+        json_object_set_new(column, "Data", readMtzColRunLength(col, nref, mtzin, opts->missing));
+        break;
+    case COLUMN_DICTIONARY:
+        json_object_set_new(column, "Data", readMtzColDictionary(col, nref, mtzin, opts->missing));
+        break;
+    case COLUMN_SPARSE:
+        json_object_set_new(column, "Data", readMtzColSparse(col, nref, mtzin));
+        break;
+    case COLUMN_BASE64_F32LE:
+        json_object_set_new(column, "Data", readMtzColBase64(col, nref, mtzin));
+        break;
+    case COLUMN_F32LE:
+        json_object_set_new(column, "Data", readMtzColF32LE(col, nref, mtzin));
+        break;
+    default:
+        json_object_set_new(column, "Data", readMtzColData(col, nref, mtzin, opts->missing));
+    }
+
+    return column;
+}
+
+/**
+ * Reads the reflection data of an MTZCOL into a json array.
+ * Missing values are all references to a single json value, so they cost no allocation.
+ * @param[in] col The MTZCOL to read.
+ * @param[in] nref Number of reflections.
+ * @param[in] mtzin The parental MTZ struct.
+ * @param[in] missing Representation of missing values.
+ * @return Pointer to json_t array.
+ */
+
+json_t *readMtzColData(const MTZCOL *col, size_t nref, const MTZ *mtzin, missing_format_t missing)
+{
+    json_t *reflections = json_array();
+    json_t *jmissing = makeMissingValue(missing);
+    uint8_t integral = isIntegralColumnType(col->type);
+
+    for (size_t i = 0; i < nref; i++)
+    {
+        float refl = col->ref[i];
+
+        // Check for missing data
+        if (ccp4_ismnf(mtzin, refl))
+        {
+            json_array_append(reflections, jmissing);
+        }
+        else
+        {
+            json_array_append_new(reflections, reflectionToJson(refl, integral));
+        }
+    }
+
+    json_decref(jmissing);
+
+    return reflections;
+}
+
+/**
+ * Reads the reflection data of an MTZCOL into a json object listing
+ * the positions of missing values separately from the present values.
+ * @param[in] col The MTZCOL to read.
+ * @param[in] nref Number of reflections.
+ * @param[in] mtzin The parental MTZ struct.
+ * @return Pointer to json_t object.
+ */
+
+json_t *readMtzColMissingIndex(const MTZCOL *col, size_t nref, const MTZ *mtzin)
+{
+    json_t *jdata = json_object();
+    json_t *jmissing = json_array();
+    json_t *jvalues = json_array();
+    uint8_t integral = isIntegralColumnType(col->type);
+
+    for (size_t i = 0; i < nref; i++)
+    {
+        float refl = col->ref[i];
+
+        if (ccp4_ismnf(mtzin, refl))
+        {
+            json_array_append_new(jmissing, json_integer(i));
+        }
+        else
+        {
+            json_array_append_new(jvalues, reflectionToJson(refl, integral));
+        }
+    }
+
+    json_object_set_new(jdata, "Length", json_integer(nref));
+    json_object_set_new(jdata, "Missing", jmissing);
+    json_object_set_new(jdata, "Values", jvalues);
+
+    return jdata;
+}
+
+/**
+ * Reads the reflection data of an MTZCOL into a run-length encoded json object.
+ * @param[in] col The MTZCOL to read.
+ * @param[in] nref Number of reflections.
+ * @param[in] mtzin The parental MTZ struct.
+ * @param[in] missing Representation of missing values.
+ * @return Pointer to json_t object.
+ */
+
+json_t *readMtzColRunLength(const MTZCOL *col, size_t nref, const MTZ *mtzin, missing_format_t missing)
+{
+    json_t *jdata = json_object();
+    json_t *jvalues = json_array();
+    json_t *jruns = json_array();
+    json_t *jmissing = makeMissingValue(missing);
+    uint8_t integral = isIntegralColumnType(col->type);
+    size_t start = 0;
+
+    for (size_t i = 1; i <= nref; i++)
+    {
+        // Close the run at the end of the column or when the value changes
+        if (i == nref || !sameReflection(col->ref[i], col->ref[start], mtzin))
+        {
+            if (ccp4_ismnf(mtzin, col->ref[start]))
+            {
+                json_array_append(jvalues, jmissing);
+            }
+            else
+            {
+                json_array_append_new(jvalues, reflectionToJson(col->ref[start], integral));
+            }
+            json_array_append_new(jruns, json_integer(i - start));
+            start = i;
+        }
+    }
+
+    json_decref(jmissing);
+
+    json_object_set_new(jdata, "Length", json_integer(nref));
+    json_object_set_new(jdata, "Values", jvalues);
+    json_object_set_new(jdata, "Runs", jruns);
+
+    return jdata;
+}
+
+/**
+ * Reads the reflection data of an MTZCOL into a dictionary encoded json object.
+ * The column must not have more than MAX_DICTIONARY_SIZE distinct values.
+ * @param[in] col The MTZCOL to read.
+ * @param[in] nref Number of reflections.
+ * @param[in] mtzin The parental MTZ struct.
+ * @param[in] missing Representation of missing values.
+ * @return Pointer to json_t object.
+ */
+
+json_t *readMtzColDictionary(const MTZCOL *col, size_t nref, const MTZ *mtzin, missing_format_t missing)
+{
+    json_t *jdata = json_object();
+    json_t *jdictionary = json_array();
+    json_t *jcodes = json_array();
+    json_t *jmissing = makeMissingValue(missing);
+    uint8_t integral = isIntegralColumnType(col->type);
+    float entries[MAX_DICTIONARY_SIZE];
+    size_t nentries = 0;
+
+    for (size_t i = 0; i < nref; i++)
+    {
+        size_t code = 0;
+
+        while (code < nentries && !sameReflection(entries[code], col->ref[i], mtzin))
+        {
+            code++;
+        }
+
+        if (code == nentries)
+        {
+            entries[nentries++] = col->ref[i];
+
+            if (ccp4_ismnf(mtzin, col->ref[i]))
+            {
+                json_array_append(jdictionary, jmissing);
+            }
+            else
+            {
+                json_array_append_new(jdictionary, reflectionToJson(col->ref[i], integral));
+            }
+        }
+
+        json_array_append_new(jcodes, json_integer(code));
+    }
+
+    json_decref(jmissing);
+
+    json_object_set_new(jdata, "Length", json_integer(nref));
+    json_object_set_new(jdata, "Dictionary", jdictionary);
+    json_object_set_new(jdata, "Codes", jcodes);
+
+    return jdata;
+}
+
+/**
+ * Reads the reflection data of an MTZCOL into a sparse json object
+ * listing the positions and values of present reflections.
+ * @param[in] col The MTZCOL to read.
+ * @param[in] nref Number of reflections.
+ * @param[in] mtzin The parental MTZ struct.
+ * @return Pointer to json_t object.
+ */
+
+json_t *readMtzColSparse(const MTZCOL *col, size_t nref, const MTZ *mtzin)
+{
+    json_t *jdata = json_object();
+    json_t *jindices = json_array();
+    json_t *jvalues = json_array();
+    uint8_t integral = isIntegralColumnType(col->type);
+
+    for (size_t i = 0; i < nref; i++)
+    {
+        if (!ccp4_ismnf(mtzin, col->ref[i]))
+        {
+            json_array_append_new(jindices, json_integer(i));
+            json_array_append_new(jvalues, reflectionToJson(col->ref[i], integral));
+        }
+    }
+
+    json_object_set_new(jdata, "Length", json_integer(nref));
+    json_object_set_new(jdata, "Indices", jindices);
+    json_object_set_new(jdata, "Values", jvalues);
+
+    return jdata;
+}
+
+/**
+ * Reads the reflection data of an MTZCOL into a json string holding the
+ * base64 encoded little-endian float32 values. Missing values are written as NaN.
+ * @param[in] col The MTZCOL to read.
+ * @param[in] nref Number of reflections.
+ * @param[in] mtzin The parental MTZ struct.
+ * @return Pointer to json_t string.
+ */
+
+json_t *readMtzColBase64(const MTZCOL *col, size_t nref, const MTZ *mtzin)
+{
+    json_t *jdata = NULL;
+    char *buffer = malloc(base64EncodedLength(4 * nref) + 1);
+    size_t length = 0;
+    unsigned char block[12];
+
+    if (!buffer)
+    {
+        return NULL;
+    }
+
+    // Three floats make 16 base64 characters without padding
+    for (size_t i = 0; i < nref; i += 3)
+    {
+        size_t nblock = nref - i < 3 ? nref - i : 3;
+
+        for (size_t j = 0; j < nblock; j++)
+        {
+            float refl = ccp4_ismnf(mtzin, col->ref[i + j]) ? ccp4_nan().f : col->ref[i + j];
+            packFloat32LE(refl, block + 4 * j);
+        }
+
+        length += base64Encode(block, 4 * nblock, buffer + length);
+    }
+
+    jdata = json_stringn_nocheck(buffer, length);
+    free(buffer);
+
+    return jdata;
+}
+
+/**
+ * Reads the reflection data of an MTZCOL into a raw json string of
+ * little-endian float32 values. Missing values are NaN.
+ * Only used for binary output formats.
+ * @param[in] col The MTZCOL to read.
+ * @param[in] nref Number of reflections.
+ * @param[in] mtzin The parental MTZ struct.
+ * @return Pointer to json_t string.
+ */
+
+json_t *readMtzColF32LE(const MTZCOL *col, size_t nref, const MTZ *mtzin)
+{
+    json_t *jdata = NULL;
+    unsigned char *buffer = malloc(4 * nref + 1);
+
+    if (!buffer)
+    {
+        return NULL;
+    }
+
+    for (size_t i = 0; i < nref; i++)
+    {
+        packFloat32LE(ccp4_ismnf(mtzin, col->ref[i]) ? ccp4_nan().f : col->ref[i], buffer + 4 * i);
+    }
+
+    jdata = json_stringn_nocheck((const char *)buffer, 4 * nref);
+    free(buffer);
+
+    return jdata;
+}
+
+/**
+ * Chooses the encoding of an MTZCOL from the options and, for automatic
+ * encoding, from a single scan counting missing values, runs and distinct values.
+ * The estimated output size is counted in json values. Dictionary codes count
+ * half as they are short integers.
+ * @param[in] col The MTZCOL.
+ * @param[in] nref Number of reflections.
+ * @param[in] mtzin The parental MTZ struct.
+ * @param[in] opts Options struct.
+ * @return The column encoding.
+ */
+
+column_encoding_t chooseColumnEncoding(const MTZCOL *col, size_t nref, const MTZ *mtzin, const options_mtz2json_t *opts)
+{
+    column_encoding_t fallback = opts->missing == MISSING_INDEX ? COLUMN_MISSING_INDEX : COLUMN_PLAIN;
+    column_encoding_t best = fallback;
+    size_t nmissing = 0;
+    size_t nruns = 0;
+    size_t ndistinct = 0;
+    float entries[MAX_DICTIONARY_SIZE];
+    size_t cost;
+
+    if (opts->format == FORMAT_CBOR)
+    {
+        return COLUMN_F32LE;
+    }
+
+    if (opts->encoding == ENCODING_BASE64)
+    {
+        return COLUMN_BASE64_F32LE;
+    }
+
+    if (opts->encoding != ENCODING_AUTO || nref == 0)
+    {
+        return fallback;
+    }
+
+    for (size_t i = 0; i < nref; i++)
+    {
+        float refl = col->ref[i];
+
+        ccp4_ismnf(mtzin, refl) ? nmissing++ : 0;
+        (i == 0 || !sameReflection(refl, col->ref[i - 1], mtzin)) ? nruns++ : 0;
+
+        if (ndistinct <= MAX_DICTIONARY_SIZE)
+        {
+            size_t j = 0;
+
+            while (j < ndistinct && !sameReflection(entries[j], refl, mtzin))
+            {
+                j++;
+            }
+
+            if (j == ndistinct)
+            {
+                ndistinct < MAX_DICTIONARY_SIZE ? entries[j] = refl : 0;
+                ndistinct++;
+            }
+        }
+    }
+
+    // Only switch away from the plain encoding if it saves at least a quarter
+    cost = nref - nref / 4;
+
+    if (2 * nruns < cost)
+    {
+        best = COLUMN_RUN_LENGTH;
+        cost = 2 * nruns;
+    }
+
+    if (ndistinct <= MAX_DICTIONARY_SIZE && !isIntegralColumnType(col->type) && ndistinct + nref / 2 < cost)
+    {
+        best = COLUMN_DICTIONARY;
+        cost = ndistinct + nref / 2;
+    }
+
+    if (2 * (nref - nmissing) < cost)
+    {
+        best = COLUMN_SPARSE;
+    }
+
+    return best;
+}
+
+/**
+ * Checks if two reflection values are equal. All missing values are equal.
+ * @param[in] a The first value.
+ * @param[in] b The second value.
+ * @param[in] mtzin The parental MTZ struct.
+ * @return 1 if true, 0 if false.
+ */
+
+uint8_t sameReflection(float a, float b, const MTZ *mtzin)
+{
+    if (ccp4_ismnf(mtzin, a) || ccp4_ismnf(mtzin, b))
+    {
+        return ccp4_ismnf(mtzin, a) && ccp4_ismnf(mtzin, b);
+    }
+
+    return a == b;
+}
+
+/**
+ * Gets the name of a column encoding as used for the DataEncoding key.
+ * @param[in] encoding The column encoding.
+ * @return The name.
+ */
+
+const char *columnEncodingName(column_encoding_t encoding)
+{
+    switch (encoding)
+    {
+    case COLUMN_MISSING_INDEX:
+        return "missing-index";
+    case COLUMN_RUN_LENGTH:
+        return "run-length";
+    case COLUMN_DICTIONARY:
+        return "dictionary";
+    case COLUMN_SPARSE:
+        return "sparse";
+    case COLUMN_BASE64_F32LE:
+        return "base64-f32le";
+    case COLUMN_SIDECAR_F32LE:
+        return "sidecar-f32le";
+    case COLUMN_F32LE:
+        return "f32le";
+    case COLUMN_NPY:
+        return "npy";
+    case COLUMN_SHARD:
+        return "shard";
+    default:
+        return "plain";
+    }
+}
+
+/**
+ * Gets a column encoding from its name.
+ * @param[in] name The name as used for the DataEncoding key.
+ * @return The column encoding, or COLUMN_UNKNOWN.
+ */
+
+column_encoding_t columnEncodingFromName(const char *name)
+{
+    for (column_encoding_t encoding = COLUMN_PLAIN; encoding < COLUMN_UNKNOWN; encoding++)
+    {
+        if (strcmp(name, columnEncodingName(encoding)) == 0)
+        {
+            return encoding;
+        }
+    }
+
+    return COLUMN_UNKNOWN;
+}
+
+/**
+ * Writes a float as four little-endian bytes.
+ * @param[in] value The float.
+ * @param[out] out The bytes.
+ */
+
+void packFloat32LE(float value, unsigned char *out)
+{
+    uint32_t bits;
+
+    memcpy(&bits, &value, 4);
+    out[0] = bits & 0xff;
+    out[1] = (bits >> 8) & 0xff;
+    out[2] = (bits >> 16) & 0xff;
+    out[3] = (bits >> 24) & 0xff;
+}
+
+/**
+ * Reads a float from four little-endian bytes.
+ * @param[in] in The bytes.
+ * @return The float.
+ */
+
+float unpackFloat32LE(const unsigned char *in)
+{
+    uint32_t bits = (uint32_t)in[0] | (uint32_t)in[1] << 8 | (uint32_t)in[2] << 16 | (uint32_t)in[3] << 24;
+    float value;
+
+    memcpy(&value, &bits, 4);
+    return value;
+}
+
+/**
+ * Gets the number of base64 characters needed for a number of bytes, including padding.
+ * @param[in] len The number of bytes.
+ * @return The number of characters.
+ */
+
+size_t base64EncodedLength(size_t len)
+{
+    return 4 * ((len + 2) / 3);
+}
+
+/**
+ * Encodes bytes as base64 with padding. No null terminator is written.
+ * @param[in] in The bytes.
+ * @param[in] len The number of bytes.
+ * @param[out] out The output buffer. Must hold base64EncodedLength(len) chars.
+ * @return The number of characters written.
+ */
+
+size_t base64Encode(const unsigned char *in, size_t len, char *out)
+{
+    static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    char *start = out;
+    size_t i = 0;
+
+    for (; i + 3 <= len; i += 3)
+    {
+        uint32_t triple = (uint32_t)in[i] << 16 | (uint32_t)in[i + 1] << 8 | in[i + 2];
+
+        *out++ = alphabet[(triple >> 18) & 0x3f];
+        *out++ = alphabet[(triple >> 12) & 0x3f];
+        *out++ = alphabet[(triple >> 6) & 0x3f];
+        *out++ = alphabet[triple & 0x3f];
     }
 
-    // Read datum
-    for (size_t i = 0; i < 3; i++)
+    if (i < len)
     {
-        json_array_append_new(datum, json_real(batch->datum[i]));
+        uint32_t triple = (uint32_t)in[i] << 16 | (i + 1 < len ? (uint32_t)in[i + 1] << 8 : 0);
+
+        *out++ = alphabet[(triple >> 18) & 0x3f];
+        *out++ = alphabet[(triple >> 12) & 0x3f];
+        *out++ = i + 1 < len ? alphabet[(triple >> 6) & 0x3f] : '=';
+        *out++ = '=';
     }
 
-    // Read detector limits
-    detlm =
-        json_pack("[[[f,f],[f,f]],[[f,f],[f,f]]]",
-                  batch->detlm[0][0][0],
-                  batch->detlm[0][0][1],
-                  batch->detlm[0][1][0],
-                  batch->detlm[0][1][1],
-                  batch->detlm[1][0][0],
-                  batch->detlm[1][0][1],
-                  batch->detlm[1][1][0],
-                  batch->detlm[1][1][1]);
+    return out - start;
+}
 
-    // Read vectors
-    for (size_t i = 0; i < 3; i++)
+/**
+ * Gets the number of bytes encoded by a padded base64 string.
+ * @param[in] in The base64 characters.
+ * @param[in] len The number of characters.
+ * @return The number of bytes, or -1 if the length is invalid.
+ */
+
+size_t base64DecodedLength(const char *in, size_t len)
+{
+    size_t padding = 0;
+
+    if (len % 4 != 0)
     {
-        json_array_append_new(vec1, json_real(batch->e1[i]));
-        json_array_append_new(vec2, json_real(batch->e2[i]));
-        json_array_append_new(vec3, json_real(batch->e3[i]));
+        return (size_t)-1;
     }
 
-    // Read axes labels
-    for (size_t i = 0; i < 3; i++)
+    len > 0 && in[len - 1] == '=' ? padding++ : 0;
+    len > 1 && in[len - 2] == '=' ? padding++ : 0;
+
+    return len / 4 * 3 - padding;
+}
+
+/**
+ * Decodes a padded base64 string.
+ * @param[in] in The base64 characters.
+ * @param[in] len The number of characters.
+ * @param[out] out The output buffer. Must hold base64DecodedLength(in, len) bytes.
+ * @return The number of bytes written, or -1 if the input is not valid base64.
+ */
+
+size_t base64Decode(const char *in, size_t len, unsigned char *out)
+{
+    static const int8_t table[256] = {
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 62, -1, -1, -1, 63,
+        52, 53, 54, 55, 56, 57, 58, 59, 60, 61, -1, -1, -1, -1, -1, -1,
+        -1, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14,
+        15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, -1, -1, -1, -1, -1,
+        -1, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40,
+        41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, -1, -1, -1, -1, -1,
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1};
+    size_t nbytes = base64DecodedLength(in, len);
+    size_t written = 0;
+
+    if (nbytes == (size_t)-1)
     {
-        json_array_append_new(axesLabels, json_string(batch->gonlab[i]));
+        return (size_t)-1;
     }
 
-    // Read refinement flags for cells
-    for (size_t i = 0; i < 6; i++)
+    for (size_t i = 0; i < len; i += 4)
     {
-        json_array_append_new(cellRefineFlags, json_integer(batch->lbcell[i]));
+        int8_t a = table[(unsigned char)in[i]];
+        int8_t b = table[(unsigned char)in[i + 1]];
+        int8_t c = in[i + 2] == '=' ? 0 : table[(unsigned char)in[i + 2]];
+        int8_t d = in[i + 3] == '=' ? 0 : table[(unsigned char)in[i + 3]];
+        uint32_t triple;
+
+        if ((a | b | c | d) < 0)
+        {
+            return (size_t)-1;
+        }
+
+        triple = (uint32_t)a << 18 | (uint32_t)b << 12 | (uint32_t)c << 6 | (uint32_t)d;
+
+        out[written++] = (triple >> 16) & 0xff;
+        written < nbytes ? out[written++] = (triple >> 8) & 0xff : 0;
+        written < nbytes ? out[written++] = triple & 0xff : 0;
     }
 
-    // Read missetting angles
-    missettingAngles =
-        json_pack(
-            "[[f,f,f],[f,f,f]]",
-            batch->phixyz[0][0],
-            batch->phixyz[0][1],
-            batch->phixyz[0][2],
-            batch->phixyz[1][0],
-            batch->phixyz[1][1],
-            batch->phixyz[1][2]);
+    return written;
+}
 
-    // Read rotation axis
-    for (size_t i = 0; i < 3; i++)
+/**
+ * Makes the json value used for missing reflections.
+ * @param[in] missing Representation of missing values.
+ * @return New reference to a json value.
+ */
+
+json_t *makeMissingValue(missing_format_t missing)
+{
+    switch (missing)
     {
-        json_array_append_new(rotAxis, json_real(batch->scanax[i]));
+    case MISSING_NULL:
+        return json_null();
+    case MISSING_NAN:
+        return json_nan();
+    default:
+        return json_string("NaN");
     }
+}
 
-    // Read source vector
-    for (size_t i = 0; i < 3; i++)
+/**
+ * Converts a reflection value into a json number.
+ * @param[in] refl The reflection value.
+ * @param[in] integral Write whole numbers as json integers.
+ * @return Pointer to json_t number.
+ */
+
+json_t *reflectionToJson(float refl, uint8_t integral)
+{
+    // Only finite values within the range of json_int_t can be cast
+    if (integral && isfinite(refl) && fabsf(refl) < ldexpf(1.0f, sizeof(json_int_t) * 8 - 1))
     {
-        json_array_append_new(svec, json_real(batch->so[i]));
+        json_int_t irefl = (json_int_t)refl;
+
+        // Non-integral values are kept as reals
+        if ((float)irefl == refl)
+        {
+            return json_integer(irefl);
+        }
     }
 
-    // Read idealised source vector
-    for (size_t i = 0; i < 3; i++)
+    return json_real(refl);
+}
+
+/**
+ * Converts a json value into a reflection value.
+ * Anything but a number is a missing value.
+ * @param[in] value The json value.
+ * @return The reflection value.
+ */
+
+float jsonToReflection(const json_t *value)
+{
+    switch (json_typeof(value))
     {
-        json_array_append_new(idealsvec, json_real(batch->source[i]));
+    case JSON_INTEGER:
+        return (float)json_integer_value(value);
+    case JSON_REAL:
+        // NaN literals are missing values
+        return isnan(json_real_value(value)) ? ccp4_nan().f : json_real_value(value);
+    default:
+        return ccp4_nan().f;
     }
+}
 
-    // Read orientation matrix
-    for (size_t i = 0; i < 9; i++)
+/**
+ * Gets the encoding of a json column object.
+ * @param[in] jcol The json column object.
+ * @return The column encoding. Columns without DataEncoding are plain.
+ */
+
+column_encoding_t columnDataEncoding(const json_t *jcol)
+{
+    json_t *jencoding = NULL;
+
+    jencoding = json_object_get(jcol, "DataEncoding");
+
+    if (!jencoding)
     {
-        json_array_append_new(umat, json_real(batch->umat[i]));
+        return COLUMN_PLAIN;
     }
 
-    // Populate object
-    json_object_set_new(jsonbatch, "Title", json_string(batch->title));
-    json_object_set_new(jsonbatch, "DatasetID", json_integer(batch->nbsetid));
-    json_object_set_new(jsonbatch, "CrystalNumber", json_integer(batch->ncryst));
-    json_object_set_new(jsonbatch, "BatchNumber", json_integer(batch->num));
-    json_object_set_new(jsonbatch, "Wavelength", json_real(batch->alambd));
-    json_object_set_new(jsonbatch, "CellDimensions", cell);
-    json_object_set_new(jsonbatch, "OrientationMatrix", umat);
-    json_object_set_new(jsonbatch, "TemperatureFactor", json_real(batch->bbfac));
-    json_object_set_new(jsonbatch, "Scale", json_real(batch->bscale));
-    json_object_set_new(jsonbatch, "Mosaicity", mosaicity);
-    json_object_set_new(jsonbatch, "GoniostatDatum", datum);
-    json_object_set_new(jsonbatch, "Dispersion", json_real(batch->delamb));
-    json_object_set_new(jsonbatch, "CorrelatedComponent", json_real(batch->delcor));
-    json_object_set_new(jsonbatch, "DetectorLimits", detlm);
-    json_object_set_new(jsonbatch, "HorizontalBeamDivergence", json_real(batch->divhd));
-    json_object_set_new(jsonbatch, "VerticalBeamDivergence", json_real(batch->divvd));
-    json_object_set_new(jsonbatch, "DetectorDistance", json_pack("[f,f]", batch->dx[0], batch->dx[1]));
-    json_object_set_new(jsonbatch, "Vector1", vec1);
-    json_object_set_new(jsonbatch, "Vector2", vec2);
-    json_object_set_new(jsonbatch, "Vector3", vec3);
-    json_object_set_new(jsonbatch, "AxesLabels", axesLabels);
-    json_object_set_new(jsonbatch, "OrientationBlockType", json_integer(batch->iortyp));
-    json_object_set_new(jsonbatch, "GoniostatScanAxisNumber", json_integer(batch->jsaxs));
-    json_object_set_new(jsonbatch, "JumpAxis", json_integer(batch->jumpax));
-    json_object_set_new(jsonbatch, "CellRefinementFlags", cellRefineFlags);
-    json_object_set_new(jsonbatch, "BeamInfoFlag", json_integer(batch->lbmflg));
-    json_object_set_new(jsonbatch, "MosaicityModelFlag", json_integer(batch->lcrflg));
-    json_object_set_new(jsonbatch, "DataTypeFlag", json_integer(batch->ldtype));
-    json_object_set_new(jsonbatch, "MisFlag", json_integer(batch->misflg));
-    json_object_set_new(jsonbatch, "NumberOfBatchScales", json_integer(batch->nbscal));
-    json_object_set_new(jsonbatch, "NumberOfDetectors", json_integer(batch->ndet));
-    json_object_set_new(jsonbatch, "NumberOfGoniostatAxes", json_integer(batch->ngonax));
-    json_object_set_new(jsonbatch, "EndOfPhi", json_real(batch->phiend));
-    json_object_set_new(jsonbatch, "PhiRange", json_real(batch->phirange));
-    json_object_set_new(jsonbatch, "StartOfPhi", json_real(batch->phistt));
-    json_object_set_new(jsonbatch, "MissettingAngles", missettingAngles);
-    json_object_set_new(jsonbatch, "RotationAxis", rotAxis);
-    json_object_set_new(jsonbatch, "BFactorSD", json_real(batch->sdbfac));
-    json_object_set_new(jsonbatch, "BScaleSD", json_real(batch->sdbscale));
-    json_object_set_new(jsonbatch, "SourceVector", svec);
-    json_object_set_new(jsonbatch, "IdealisedSourceVector", idealsvec);
-    json_object_set_new(jsonbatch, "Theta", json_pack("[f,f]", batch->theta[0], batch->theta[1]));
-    json_object_set_new(jsonbatch, "StartTime", json_real(batch->time1));
-    json_object_set_new(jsonbatch, "StopTime", json_real(batch->time2));
-
-    return jsonbatch;
+    return json_is_string(jencoding) ? columnEncodingFromName(json_string_value(jencoding)) : COLUMN_UNKNOWN;
 }
 
 /**
- * Reads an MTZXTAL struct into a json object and returns a pointer to that object.
- * @param[in] xtal The MTZXTAL struct.
- * @param[in] nref Number of reflections.
- * @param[in] mtzin The parental MTZ struct.
- * @return Pointer to json_t object.
+ * Gets the number of reflections in a json column object and checks
+ * that the encoded data are consistent with it.
+ * @param[in] jcol The json column object.
+ * @param[out] nref The number of reflections.
+ * @return 1 on success, 0 if the column data are malformed.
  */
 
-json_t *readMtzXtal(const MTZXTAL *xtal, size_t nref, const MTZ *mtzin)
+uint8_t columnDataLength(const json_t *jcol, size_t *nref)
 {
-    json_t *jsonxtal = json_object();
-    json_t *jsonsets = json_array();
-    json_t *cell = json_array();
+    column_encoding_t encoding = columnDataEncoding(jcol);
+    json_t *jref = NULL;
+    json_t *jlength = NULL;
+    json_t *jfirst = NULL;
+    json_t *jsecond = NULL;
+    json_int_t sum = 0;
+    size_t index;
+    json_t *value = NULL;
 
-    // Read cell constants
-    for (size_t i = 0; i < 6; i++)
+    jref = json_object_get(jcol, "Data");
+
+    if (encoding == COLUMN_PLAIN)
     {
-        json_array_append_new(cell, json_real(xtal->cell[i]));
+        if (jref && json_is_array(jref))
+        {
+            *nref = json_array_size(jref);
+            return 1;
+        }
+        return 0;
+    }
+
+    if (encoding == COLUMN_BASE64_F32LE)
+    {
+        size_t nbytes;
+
+        if (!jref || !json_is_string(jref))
+        {
+            return 0;
+        }
+
+        nbytes = base64DecodedLength(json_string_value(jref), json_string_length(jref));
+
+        if (nbytes == (size_t)-1 || nbytes % 4 != 0)
+        {
+            return 0;
+        }
+
+        *nref = nbytes / 4;
+        return 1;
+    }
+
+    if (encoding == COLUMN_F32LE)
+    {
+        if (!jref || !json_is_string(jref) || json_string_length(jref) % 4 != 0)
+        {
+            return 0;
+        }
+
+        *nref = json_string_length(jref) / 4;
+        return 1;
+    }
+
+    if (encoding == COLUMN_UNKNOWN || !jref || !json_is_object(jref))
+    {
+        return 0;
+    }
+
+    jlength = json_object_get(jref, "Length");
+
+    if (!jlength || !json_is_integer(jlength) || json_integer_value(jlength) < 0)
+    {
+        return 0;
+    }
+
+    *nref = json_integer_value(jlength);
+
+    switch (encoding)
+    {
+    case COLUMN_MISSING_INDEX:
+        jfirst = json_object_get(jref, "Missing");
+        jsecond = json_object_get(jref, "Values");
+
+        return jfirst && json_is_array(jfirst) && json_array_is_homogenous_integer(jfirst) &&
+               jsecond && json_is_array(jsecond) &&
+               json_array_size(jfirst) + json_array_size(jsecond) == *nref;
+
+    case COLUMN_RUN_LENGTH:
+        jfirst = json_object_get(jref, "Values");
+        jsecond = json_object_get(jref, "Runs");
+
+        if (!jfirst || !json_is_array(jfirst) || !jsecond || !json_is_array(jsecond) ||
+            json_array_size(jfirst) != json_array_size(jsecond) || !json_array_is_homogenous_integer(jsecond))
+        {
+            return 0;
+        }
+
+        json_array_foreach(jsecond, index, value)
+        {
+            // The runs may not add up past Length, which also rules out overflow
+            if (json_integer_value(value) < 0 || json_integer_value(value) > (json_int_t)*nref - sum)
+            {
+                return 0;
+            }
+            sum += json_integer_value(value);
+        }
+
+        return sum == (json_int_t)*nref;
+
+    case COLUMN_DICTIONARY:
+        jfirst = json_object_get(jref, "Dictionary");
+        jsecond = json_object_get(jref, "Codes");
+
+        if (!jfirst || !json_is_array(jfirst) || !jsecond || !json_is_array(jsecond) ||
+            json_array_size(jsecond) != *nref || !json_array_is_homogenous_integer(jsecond))
+        {
+            return 0;
+        }
+
+        json_array_foreach(jsecond, index, value)
+        {
+            if (json_integer_value(value) < 0 || json_integer_value(value) >= (json_int_t)json_array_size(jfirst))
+            {
+                return 0;
+            }
+        }
+
+        return 1;
+
+    case COLUMN_SPARSE:
+        jfirst = json_object_get(jref, "Indices");
+        jsecond = json_object_get(jref, "Values");
+
+        return jfirst && json_is_array(jfirst) && json_array_is_homogenous_integer(jfirst) &&
+               jsecond && json_is_array(jsecond) &&
+               json_array_size(jfirst) == json_array_size(jsecond) && json_array_size(jfirst) <= *nref;
+
+    case COLUMN_SIDECAR_F32LE:
+        jfirst = json_object_get(jref, "Offset");
+
+        return jfirst && json_is_integer(jfirst) && json_integer_value(jfirst) >= 0;
+
+    case COLUMN_NPY:
+        jfirst = json_object_get(jref, "Member");
+
+        return jfirst && json_is_string(jfirst);
+
+    case COLUMN_SHARD:
+        return 1;
+
+    default:
+        return 0;
     }
+}
 
-    // Read datasets
-    for (size_t i = 0; i < xtal->nset; i++)
+/**
+ * Checks if an MTZ column type always holds integral values.
+ * Applies to Miller indices (H), batch numbers (B), M/ISYM (Y) and integers (I).
+ * @param[in] type The MTZ column type.
+ * @return 1 if true, 0 if false.
+ */
+
+uint8_t isIntegralColumnType(const char *type)
+{
+    switch (type[0])
     {
-        json_t *set = json_object();
-        set = readMtzSet(xtal->set[i], nref, mtzin);
-        json_array_append_new(jsonsets, set);
+    case 'H':
+    case 'B':
+    case 'Y':
+    case 'I':
+        return 1;
+    default:
+        return 0;
     }
-
-    // Populate object
-    json_object_set_new(jsonxtal, "CrystalName", json_string(xtal->xname));
-    json_object_set_new(jsonxtal, "CellConstants", cell);
-    json_object_set_new(jsonxtal, "ProjectName", json_string(xtal->pname));
-    json_object_set_new(jsonxtal, "ResolutionMax", json_real(xtal->resmax));
-    json_object_set_new(jsonxtal, "ResolutionMin", json_real(xtal->resmin));
-    json_object_set_new(jsonxtal, "Datasets", jsonsets);
-
-    return jsonxtal;
 }
 
 /**
- * Reads an MTZSET into a json array and returns a pointer to that array.
- * @param[in] set The MTZSET to read.
- * @param[in] nref Number of reflections. 
- * @param[in] mtzin The parental MTZ struct.
- * @return Pointer to json_t array.
+ * Checks if a column of an integral type can be stored as int32, i.e. if
+ * all its values are integers in the int32 range. Missing values are
+ * not checked.
+ * @param[in] mtzin The MTZ struct.
+ * @param[in] col The column.
+ * @param[in] nref Number of reflections.
+ * @return 1 if true, 0 if false.
  */
 
-json_t *readMtzSet(const MTZSET *set, size_t nref, const MTZ *mtzin)
+uint8_t isInt32Column(const MTZ *mtzin, const MTZCOL *col, size_t nref)
 {
-    json_t *jset = json_object();
-    json_t *jcols = json_array();
-
-    json_object_set_new(jset, "DatasetName", json_string(set->dname));
-    json_object_set_new(jset, "DatasetID", json_integer(set->setid));
-    json_object_set_new(jset, "Wavelength", json_real(set->wavelength));
+    if (!isIntegralColumnType(col->type))
+    {
+        return 0;
+    }
 
-    // Read columns
-    for (size_t i = 0; i < set->ncol; i++)
+    for (size_t i = 0; i < nref; i++)
     {
-        MTZCOL *col = set->col[i];
-        json_t *column = json_object();
-        json_t *reflections = json_array();
+        float refl = col->ref[i];
 
-        // Read reflection data
-        for (size_t i = 0; i < nref; i++)
+        if (!ccp4_ismnf(mtzin, refl) &&
+            !(refl >= -2147483648.0f && refl < 2147483648.0f && refl == truncf(refl)))
         {
-            float refl = col->ref[i];
-
-            // Check for missing data
-            if (ccp4_ismnf(mtzin, refl))
-            {
-                json_array_append_new(reflections, json_string("NaN"));
-            }
-            else
-            {
-                json_array_append_new(reflections, json_real(refl));
-            }
+            return 0;
         }
-
-        // Populate object
-        json_object_set_new(column, "ColumnSource", json_string(col->colsource));
-        json_object_set_new(column, "GroupName", json_string(col->grpname));
-        json_object_set_new(column, "GroupPosition", json_integer(col->grpposn));
-        json_object_set_new(column, "GroupType", json_string(col->grptype));
-        json_object_set_new(column, "Label", json_string(col->label));
-        json_object_set_new(column, "MaxValue", json_real(col->max));
-        json_object_set_new(column, "MinValue", json_real(col->min));
-        json_object_set_new(column, "ColumnID", json_integer(col->source));
-        json_object_set_new(column, "Type", json_string(col->type));
-        json_object_set_new(column, "Data", reflections);
-
-        json_array_append_new(jcols, column);
     }
 
-    json_object_set_new(jset, "Columns", jcols);
-
-    return jset;
+    return 1;
 }
 
 /**
@@ -824,50 +3087,50 @@ MTZ *setMtzBatches(MTZ *mtzout, const json_t *jbatches)
         size_t thetadimensions[] = {2};
         size_t umatdimensions[] = {9};
 
-        json_unpack(batchvalue, "{s:o}", "Title", &jtitle);
-        json_unpack(batchvalue, "{s:o}", "DatasetID", &jnbsetid);
-        json_unpack(batchvalue, "{s:o}", "CrystalNumber", &jncryst);
-        json_unpack(batchvalue, "{s:o}", "BatchNumber", &jnum);
-        json_unpack(batchvalue, "{s:o}", "Wavelength", &jalambd);
-        json_unpack(batchvalue, "{s:o}", "TemperatureFactor", &jbbfac);
-        json_unpack(batchvalue, "{s:o}", "Scale", &jbscale);
-        json_unpack(batchvalue, "{s:o}", "Dispersion", &jdelamb);
-        json_unpack(batchvalue, "{s:o}", "CorrelatedComponent", &jdelcor);
-        json_unpack(batchvalue, "{s:o}", "HorizontalBeamDivergence", &jdivhd);
-        json_unpack(batchvalue, "{s:o}", "VerticalBeamDivergence", &jdivvd);
-        json_unpack(batchvalue, "{s:o}", "OrientationBlockType", &jiortyp);
-        json_unpack(batchvalue, "{s:o}", "GoniostatScanAxisNumber", &jjsaxs);
-        json_unpack(batchvalue, "{s:o}", "JumpAxis", &jjumpax);
-        json_unpack(batchvalue, "{s:o}", "BeamInfoFlag", &jlbmflg);
-        json_unpack(batchvalue, "{s:o}", "MosaicityModelFlag", &jlcrflg);
-        json_unpack(batchvalue, "{s:o}", "DataTypeFlag", &jldtype);
-        json_unpack(batchvalue, "{s:o}", "MisFlag", &jmisflg);
-        json_unpack(batchvalue, "{s:o}", "NumberOfBatchScales", &jnbscal);
-        json_unpack(batchvalue, "{s:o}", "NumberOfDetectors", &jndet);
-        json_unpack(batchvalue, "{s:o}", "NumberOfGoniostatAxes", &jngonax);
-        json_unpack(batchvalue, "{s:o}", "EndOfPhi", &jphiend);
-        json_unpack(batchvalue, "{s:o}", "PhiRange", &jphirange);
-        json_unpack(batchvalue, "{s:o}", "StartOfPhi", &jphistt);
-        json_unpack(batchvalue, "{s:o}", "BFactorSD", &jsdbfac);
-        json_unpack(batchvalue, "{s:o}", "BScaleSD", &jsdbscale);
-        json_unpack(batchvalue, "{s:o}", "StartTime", &jtime1);
-        json_unpack(batchvalue, "{s:o}", "StopTime", &jtime2);
-        json_unpack(batchvalue, "{s:o}", "CellDimensions", &jcell);
-        json_unpack(batchvalue, "{s:o}", "OrientationMatrix", &jumat);
-        json_unpack(batchvalue, "{s:o}", "Mosaicity", &jcrydat);
-        json_unpack(batchvalue, "{s:o}", "GoniostatDatum", &jdatum);
-        json_unpack(batchvalue, "{s:o}", "DetectorLimits", &jdetlm);
-        json_unpack(batchvalue, "{s:o}", "DetectorDistance", &jdx);
-        json_unpack(batchvalue, "{s:o}", "Vector1", &je1);
-        json_unpack(batchvalue, "{s:o}", "Vector2", &je2);
-        json_unpack(batchvalue, "{s:o}", "Vector3", &je3);
-        json_unpack(batchvalue, "{s:o}", "AxesLabels", &jgonlab);
-        json_unpack(batchvalue, "{s:o}", "CellRefinementFlags", &jlbcell);
-        json_unpack(batchvalue, "{s:o}", "MissettingAngles", &jphixyz);
-        json_unpack(batchvalue, "{s:o}", "RotationAxis", &jscanax);
-        json_unpack(batchvalue, "{s:o}", "SourceVector", &jso);
-        json_unpack(batchvalue, "{s:o}", "IdealisedSourceVector", &jsource);
-        json_unpack(batchvalue, "{s:o}", "Theta", &jtheta);
+        jtitle = json_object_get(batchvalue, "Title");
+        jnbsetid = json_object_get(batchvalue, "DatasetID");
+        jncryst = json_object_get(batchvalue, "CrystalNumber");
+        jnum = json_object_get(batchvalue, "BatchNumber");
+        jalambd = json_object_get(batchvalue, "Wavelength");
+        jbbfac = json_object_get(batchvalue, "TemperatureFactor");
+        jbscale = json_object_get(batchvalue, "Scale");
+        jdelamb = json_object_get(batchvalue, "Dispersion");
+        jdelcor = json_object_get(batchvalue, "CorrelatedComponent");
+        jdivhd = json_object_get(batchvalue, "HorizontalBeamDivergence");
+        jdivvd = json_object_get(batchvalue, "VerticalBeamDivergence");
+        jiortyp = json_object_get(batchvalue, "OrientationBlockType");
+        jjsaxs = json_object_get(batchvalue, "GoniostatScanAxisNumber");
+        jjumpax = json_object_get(batchvalue, "JumpAxis");
+        jlbmflg = json_object_get(batchvalue, "BeamInfoFlag");
+        jlcrflg = json_object_get(batchvalue, "MosaicityModelFlag");
+        jldtype = json_object_get(batchvalue, "DataTypeFlag");
+        jmisflg = json_object_get(batchvalue, "MisFlag");
+        jnbscal = json_object_get(batchvalue, "NumberOfBatchScales");
+        jndet = json_object_get(batchvalue, "NumberOfDetectors");
+        jngonax = json_object_get(batchvalue, "NumberOfGoniostatAxes");
+        jphiend = json_object_get(batchvalue, "EndOfPhi");
+        jphirange = json_object_get(batchvalue, "PhiRange");
+        jphistt = json_object_get(batchvalue, "StartOfPhi");
+        jsdbfac = json_object_get(batchvalue, "BFactorSD");
+        jsdbscale = json_object_get(batchvalue, "BScaleSD");
+        jtime1 = json_object_get(batchvalue, "StartTime");
+        jtime2 = json_object_get(batchvalue, "StopTime");
+        jcell = json_object_get(batchvalue, "CellDimensions");
+        jumat = json_object_get(batchvalue, "OrientationMatrix");
+        jcrydat = json_object_get(batchvalue, "Mosaicity");
+        jdatum = json_object_get(batchvalue, "GoniostatDatum");
+        jdetlm = json_object_get(batchvalue, "DetectorLimits");
+        jdx = json_object_get(batchvalue, "DetectorDistance");
+        je1 = json_object_get(batchvalue, "Vector1");
+        je2 = json_object_get(batchvalue, "Vector2");
+        je3 = json_object_get(batchvalue, "Vector3");
+        jgonlab = json_object_get(batchvalue, "AxesLabels");
+        jlbcell = json_object_get(batchvalue, "CellRefinementFlags");
+        jphixyz = json_object_get(batchvalue, "MissettingAngles");
+        jscanax = json_object_get(batchvalue, "RotationAxis");
+        jso = json_object_get(batchvalue, "SourceVector");
+        jsource = json_object_get(batchvalue, "IdealisedSourceVector");
+        jtheta = json_object_get(batchvalue, "Theta");
 
         jtitle &&json_is_string(jtitle) ? snprintf(currentBatch->title, 71, "%s", json_string_value(jtitle)) : 0;
         jalambd &&json_is_real(jalambd) ? currentBatch->alambd = json_real_value(jalambd) : 0;
@@ -1044,10 +3307,12 @@ MTZ *setMtzBatches(MTZ *mtzout, const json_t *jbatches)
 
 /**
  * Transfer set information from a json object to an MTZSET dataset struct.
+ * Columns are added to the dataset as they are filled, so that MtzFree()
+ * can release a partly built MTZ struct.
  * @param[in] set The MTZSET struct.
  * @param[in] jsets The json object.
- * @param[in] mtzout The parent MTZ struct.
- * @return The MTZSET struct.
+ * @param[in] mtzout The parent MTZ struct. mtzout->nref must be set.
+ * @return The MTZSET struct, or NULL if the columns are malformed.
  */
 
 MTZSET *setMtzSet(MTZSET *set, json_t *jset, MTZ *mtzout)
@@ -1060,98 +3325,257 @@ MTZSET *setMtzSet(MTZSET *set, json_t *jset, MTZ *mtzout)
     json_t *colvalue = NULL;
 
     // Metadata
-    json_unpack(jset, "{s:o}", "DatasetName", &jdname);
-    json_unpack(jset, "{s:o}", "Wavelength", &jwavelength);
-    json_unpack(jset, "{s:o}", "DatasetID", &jsetid);
-    json_unpack(jset, "{s:o}", "Columns", &jcols);
+    jdname = json_object_get(jset, "DatasetName");
+    jwavelength = json_object_get(jset, "Wavelength");
+    jsetid = json_object_get(jset, "DatasetID");
+    jcols = json_object_get(jset, "Columns");
 
     jdname &&json_is_string(jdname) ? snprintf(set->dname, 65, "%s", json_string_value(jdname)) : 0;
     jwavelength &&json_is_real(jwavelength) ? set->wavelength = json_real_value(jwavelength) : 0;
     jsetid &&json_is_integer(jsetid) ? set->setid = json_integer_value(jsetid) : 0;
-    jcols &&json_is_array(jcols) ? set->ncol = json_array_size(jcols) : 0;
+
+    if (!jcols || !json_is_array(jcols) || json_array_size(jcols) == 0)
+    {
+        return NULL;
+    }
 
     // Columns
-    if (jcols && json_is_array(jcols) && json_array_is_homogenous_object(jcols))
-    {
-        json_array_foreach(jcols, colindex, colvalue)
-        {
-            MTZCOL *mtzcol = NULL;
-            json_t *jcolsource = NULL;
-            json_t *jgrpname = NULL;
-            json_t *jlabel = NULL;
-            json_t *jtype = NULL;
-            json_t *jsource = NULL;
-            json_t *jgrpposn = NULL;
-            json_t *jmin = NULL;
-            json_t *jmax = NULL;
-            json_t *jgrptype = NULL;
-            json_t *jref = NULL;
-            int dataindex;
-            json_t *datavalue = NULL;
-
-            mtzcol = MtzMallocCol(mtzout, mtzout->nref);
-
-            if (!mtzcol)
+    json_array_foreach(jcols, colindex, colvalue)
+    {
+        MTZCOL *mtzcol = NULL;
+        json_t *jcolsource = NULL;
+        json_t *jgrpname = NULL;
+        json_t *jlabel = NULL;
+        json_t *jtype = NULL;
+        json_t *jsource = NULL;
+        json_t *jgrpposn = NULL;
+        json_t *jmin = NULL;
+        json_t *jmax = NULL;
+        json_t *jgrptype = NULL;
+
+        if (!json_is_object(colvalue))
+        {
+            return NULL;
+        }
+
+        mtzcol = MtzMallocCol(mtzout, mtzout->nref);
+
+        if (!mtzcol)
+        {
+            return NULL;
+        }
+
+        // The column array grows like in MtzAddColumn()
+        if (++set->ncol > ccp4array_size(set->col))
+        {
+            ccp4array_resize(set->col, set->ncol + 9);
+        }
+        set->col[set->ncol - 1] = mtzcol;
+
+        jcolsource = json_object_get(colvalue, "ColumnSource");
+        jgrpname = json_object_get(colvalue, "GroupName");
+        jlabel = json_object_get(colvalue, "Label");
+        jtype = json_object_get(colvalue, "Type");
+        jsource = json_object_get(colvalue, "ColumnID");
+        jgrpposn = json_object_get(colvalue, "GroupPosition");
+        jmin = json_object_get(colvalue, "MinValue");
+        jmax = json_object_get(colvalue, "MaxValue");
+        jgrptype = json_object_get(colvalue, "GroupType");
+
+        mtzcol->active = 1;
+        jcolsource &&json_is_string(jcolsource) ? snprintf(mtzcol->colsource, 37, "%s", json_string_value(jcolsource)) : 0;
+        jgrpname &&json_is_string(jgrpname) ? snprintf(mtzcol->grpname, 31, "%s", json_string_value(jgrpname)) : 0;
+        jlabel &&json_is_string(jlabel) ? snprintf(mtzcol->label, 31, "%s", json_string_value(jlabel)) : 0;
+        jtype &&json_is_string(jtype) ? snprintf(mtzcol->type, 3, "%s", json_string_value(jtype)) : 0;
+        jsource &&json_is_integer(jsource) ? mtzcol->source = json_integer_value(jsource) : 0;
+        jgrpposn &&json_is_integer(jgrpposn) ? mtzcol->grpposn = json_integer_value(jgrpposn) : 0;
+        jmin &&json_is_real(jmin) ? mtzcol->min = json_real_value(jmin) : 0;
+        jmax &&json_is_real(jmax) ? mtzcol->max = json_real_value(jmax) : 0;
+        jgrptype &&json_is_string(jgrptype) ? snprintf(mtzcol->grptype, 5, "%s", json_string_value(jgrptype)) : 0;
+
+        if (!setMtzColData(mtzcol, colvalue, mtzout->nref))
+        {
+            return NULL;
+        }
+    }
+
+    return set;
+}
+
+/**
+ * Transfer reflection data from a json column object to an MTZCOL struct.
+ * @param[in] mtzcol The MTZCOL struct.
+ * @param[in] jcol The json column object.
+ * @param[in] nref Number of reflections.
+ * @return The MTZCOL struct, or NULL if the data are malformed.
+ */
+
+MTZCOL *setMtzColData(MTZCOL *mtzcol, const json_t *jcol, size_t nref)
+{
+    json_t *jref = NULL;
+    json_t *jfirst = NULL;
+    json_t *jsecond = NULL;
+    size_t dataindex;
+    json_t *datavalue = NULL;
+    size_t position = 0;
+    size_t valueindex = 0;
+
+    if (!columnDataLength(jcol, &dataindex) || dataindex != nref)
+    {
+        return NULL;
+    }
+
+    jref = json_object_get(jcol, "Data");
+
+    switch (columnDataEncoding(jcol))
+    {
+    case COLUMN_PLAIN:
+        json_array_foreach(jref, dataindex, datavalue)
+        {
+            mtzcol->ref[dataindex] = jsonToReflection(datavalue);
+        }
+        break;
+
+    case COLUMN_MISSING_INDEX:
+        // Positions must be ascending
+        jfirst = json_object_get(jref, "Missing");
+        jsecond = json_object_get(jref, "Values");
+
+        for (size_t i = 0; i < nref; i++)
+        {
+            if (position < json_array_size(jfirst) &&
+                json_integer_value(json_array_get(jfirst, position)) == (json_int_t)i)
+            {
+                mtzcol->ref[i] = ccp4_nan().f;
+                position++;
+            }
+            else if (valueindex < json_array_size(jsecond))
+            {
+                mtzcol->ref[i] = jsonToReflection(json_array_get(jsecond, valueindex));
+                valueindex++;
+            }
+            else
             {
                 return NULL;
             }
+        }
+        break;
+
+    case COLUMN_RUN_LENGTH:
+        jfirst = json_object_get(jref, "Values");
+        jsecond = json_object_get(jref, "Runs");
+
+        json_array_foreach(jsecond, dataindex, datavalue)
+        {
+            float refl = jsonToReflection(json_array_get(jfirst, dataindex));
 
-            json_unpack(colvalue, "{s:o}", "ColumnSource", &jcolsource);
-            json_unpack(colvalue, "{s:o}", "GroupName", &jgrpname);
-            json_unpack(colvalue, "{s:o}", "Label", &jlabel);
-            json_unpack(colvalue, "{s:o}", "Type", &jtype);
-            json_unpack(colvalue, "{s:o}", "ColumnID", &jsource);
-            json_unpack(colvalue, "{s:o}", "GroupPosition", &jgrpposn);
-            json_unpack(colvalue, "{s:o}", "MinValue", &jmin);
-            json_unpack(colvalue, "{s:o}", "MaxValue", &jmax);
-            json_unpack(colvalue, "{s:o}", "GroupType", &jgrptype);
-            json_unpack(colvalue, "{s:o}", "Data", &jref);
-
-            mtzcol->active = 1;
-            jcolsource &&json_is_string(jcolsource) ? snprintf(mtzcol->colsource, 37, "%s", json_string_value(jcolsource)) : 0;
-            jgrpname &&json_is_string(jgrpname) ? snprintf(mtzcol->grpname, 31, "%s", json_string_value(jgrpname)) : 0;
-            jlabel &&json_is_string(jlabel) ? snprintf(mtzcol->label, 31, "%s", json_string_value(jlabel)) : 0;
-            jtype &&json_is_string(jtype) ? snprintf(mtzcol->type, 3, "%s", json_string_value(jtype)) : 0;
-            jsource &&json_is_integer(jsource) ? mtzcol->source = json_integer_value(jsource) : 0;
-            jgrpposn &&json_is_integer(jgrpposn) ? mtzcol->grpposn = json_integer_value(jgrpposn) : 0;
-            jmin &&json_is_real(jmin) ? mtzcol->min = json_real_value(jmin) : 0;
-            jmax &&json_is_real(jmax) ? mtzcol->max = json_real_value(jmax) : 0;
-            jgrptype &&json_is_string(jgrptype) ? snprintf(mtzcol->grptype, 5, "%s", json_string_value(jgrptype)) : 0;
-            if (jref && json_is_array(jref))
+            for (json_int_t i = 0; i < json_integer_value(datavalue); i++)
             {
-                json_array_foreach(jref, dataindex, datavalue)
-                {
-                    if (json_typeof(datavalue) == JSON_REAL)
-                    {
-                        mtzcol->ref[dataindex] = json_real_value(datavalue);
-                    }
-                    else 
-                    {
-                        mtzcol->ref[dataindex] = ccp4_nan().f;
-                    }
-                }
+                mtzcol->ref[position++] = refl;
+            }
+        }
+        break;
+
+    case COLUMN_DICTIONARY:
+        jfirst = json_object_get(jref, "Dictionary");
+        jsecond = json_object_get(jref, "Codes");
+
+        json_array_foreach(jsecond, dataindex, datavalue)
+        {
+            mtzcol->ref[dataindex] = jsonToReflection(json_array_get(jfirst, json_integer_value(datavalue)));
+        }
+        break;
+
+    case COLUMN_SPARSE:
+        // Positions must be ascending. Unlisted positions are missing.
+        jfirst = json_object_get(jref, "Indices");
+        jsecond = json_object_get(jref, "Values");
+
+        json_array_foreach(jfirst, dataindex, datavalue)
+        {
+            json_int_t index = json_integer_value(datavalue);
+
+            if (index < (json_int_t)position || index >= (json_int_t)nref)
+            {
+                return NULL;
+            }
+
+            while (position < (size_t)index)
+            {
+                mtzcol->ref[position++] = ccp4_nan().f;
             }
 
-            set->col[colindex] = mtzcol;
+            mtzcol->ref[position++] = jsonToReflection(json_array_get(jsecond, dataindex));
+        }
+
+        while (position < nref)
+        {
+            mtzcol->ref[position++] = ccp4_nan().f;
+        }
+        break;
+
+    case COLUMN_BASE64_F32LE:
+        // Decode in place, then convert from little-endian
+        if (base64Decode(json_string_value(jref), json_string_length(jref), (unsigned char *)mtzcol->ref) != 4 * nref)
+        {
+            return NULL;
+        }
+
+        for (size_t i = 0; i < nref; i++)
+        {
+            mtzcol->ref[i] = unpackFloat32LE((unsigned char *)(mtzcol->ref + i));
+        }
+        break;
+
+    case COLUMN_F32LE:
+        for (size_t i = 0; i < nref; i++)
+        {
+            mtzcol->ref[i] = unpackFloat32LE((const unsigned char *)json_string_value(jref) + 4 * i);
         }
+        break;
+
+    case COLUMN_SIDECAR_F32LE:
+        // Filled in by setMtzSidecar
+        break;
+
+    case COLUMN_NPY:
+        // Filled in by setMtzNpz
+        break;
+
+    case COLUMN_SHARD:
+        // Filled in by setMtzShards
+        break;
+
+    default:
+        return NULL;
     }
-    return set;
+
+    return mtzcol;
 }
 
 /**
- * Transfer crystal information from a json object to an MTZ struct.
- * @param[in] mtzout The MTZ struct.
+ * Adds the crystals of a json array to an MTZ struct, with their datasets
+ * and columns, in a single pass over the array.
+ * @param[in] mtzout The MTZ struct. mtzout->nref must be set.
  * @param[in] jcrystals The crystals json array.
- * @return The MTZ struct.
+ * @return The MTZ struct, or NULL if the crystals or the reflection data are malformed.
  */
 
 MTZ *setMtzXtals(MTZ *mtzout, const json_t *jcrystals)
 {
     json_t *crystalvalue = NULL;
     size_t crystalindex;
+    float zerocell[6] = {0.0f};
+    char dummy_xname[17];
+    int itime[3];
+
+    // The placeholder name of MtzMalloc()
+    ccp4_utils_itime(itime);
+    snprintf(dummy_xname, sizeof(dummy_xname), "NULL_xname%2.2d%2.2d%2.2d", itime[0], itime[1], itime[2]);
 
     json_array_foreach(jcrystals, crystalindex, crystalvalue)
     {
+        MTZXTAL *xtal = NULL;
         json_t *jcell = NULL;
         size_t cellindex;
         json_t *cellvalue = NULL;
@@ -1163,30 +3587,51 @@ MTZ *setMtzXtals(MTZ *mtzout, const json_t *jcrystals)
         json_t *setvalue = NULL;
         size_t setindex;
 
-        json_unpack(crystalvalue, "{s:o}", "CellConstants", &jcell);
-        json_unpack(crystalvalue, "{s:o}", "ResolutionMin", &jresmin);
-        json_unpack(crystalvalue, "{s:o}", "ResolutionMax", &jresmax);
-        json_unpack(crystalvalue, "{s:o}", "CrystalName", &jxname);
-        json_unpack(crystalvalue, "{s:o}", "ProjectName", &jpname);
-        json_unpack(crystalvalue, "{s:o}", "Datasets", &jsets);
+        jsets = json_object_get(crystalvalue, "Datasets");
+
+        if (!json_is_object(crystalvalue) || !jsets || !json_is_array(jsets))
+        {
+            return NULL;
+        }
+
+        xtal = MtzAddXtal(mtzout, dummy_xname, "NULL_pname", zerocell);
+        if (!xtal)
+        {
+            return NULL;
+        }
+
+        jcell = json_object_get(crystalvalue, "CellConstants");
+        jresmin = json_object_get(crystalvalue, "ResolutionMin");
+        jresmax = json_object_get(crystalvalue, "ResolutionMax");
+        jxname = json_object_get(crystalvalue, "CrystalName");
+        jpname = json_object_get(crystalvalue, "ProjectName");
 
         if (jcell && json_is_array(jcell) && json_array_is_homogenous_real(jcell))
         {
             json_array_foreach(jcell, cellindex, cellvalue)
             {
-                mtzout->xtal[crystalindex]->cell[cellindex] = json_real_value(cellvalue);
+                cellindex < 6 ? xtal->cell[cellindex] = json_real_value(cellvalue) : 0;
             }
         }
 
-        jresmin &&json_is_real(jresmin) ? mtzout->xtal[crystalindex]->resmin = json_real_value(jresmin) : 0;
-        jresmax &&json_is_real(jresmax) ? mtzout->xtal[crystalindex]->resmax = json_real_value(jresmax) : 0;
-        jxname &&json_is_string(jxname) ? snprintf(mtzout->xtal[crystalindex]->xname, 65, "%s", json_string_value(jxname)) : 0;
-        jpname &&json_is_string(jpname) ? snprintf(mtzout->xtal[crystalindex]->pname, 65, "%s", json_string_value(jpname)) : 0;
-        if (jsets && json_is_array(jsets) && json_array_is_homogenous_object(jsets))
+        jresmin &&json_is_real(jresmin) ? xtal->resmin = json_real_value(jresmin) : 0;
+        jresmax &&json_is_real(jresmax) ? xtal->resmax = json_real_value(jresmax) : 0;
+        jxname &&json_is_string(jxname) ? snprintf(xtal->xname, 65, "%s", json_string_value(jxname)) : 0;
+        jpname &&json_is_string(jpname) ? snprintf(xtal->pname, 65, "%s", json_string_value(jpname)) : 0;
+
+        json_array_foreach(jsets, setindex, setvalue)
         {
-            json_array_foreach(jsets, setindex, setvalue)
+            MTZSET *set = NULL;
+
+            if (!json_is_object(setvalue))
             {
-                setMtzSet(mtzout->xtal[crystalindex]->set[setindex], setvalue, mtzout);
+                return NULL;
+            }
+
+            set = MtzAddDataset(mtzout, xtal, "NULL_dname", 0.0f);
+            if (!set || !setMtzSet(set, setvalue, mtzout))
+            {
+                return NULL;
             }
         }
     }
@@ -1217,14 +3662,14 @@ MTZ *setMtzSymmetry(MTZ *mtzout, json_t *jsymm)
     size_t symmetryDimensions[] = {192, 4, 4};
     uint8_t (*real_check)(json_t *);
 
-    json_unpack(jsymm, "{s:o}", "SpaceGroupNumber", &jspcgrp);
-    json_unpack(jsymm, "{s:o}", "SpaceGroupName", &jspcgrpname);
-    json_unpack(jsymm, "{s:o}", "PointGroupName", &jpgname);
-    json_unpack(jsymm, "{s:o}", "SpaceGroupConfidence", &jspg_confidence);
-    json_unpack(jsymm, "{s:o}", "NumberOfSymmetryOperations", &jnsym);
-    json_unpack(jsymm, "{s:o}", "NumberOfPrimitiveSymmetryOperations", &jnsymp);
-    json_unpack(jsymm, "{s:o}", "SymmetryOperations", &jsym);
-    json_unpack(jsymm, "{s:o}", "LatticeType", &jsymtyp);
+    jspcgrp = json_object_get(jsymm, "SpaceGroupNumber");
+    jspcgrpname = json_object_get(jsymm, "SpaceGroupName");
+    jpgname = json_object_get(jsymm, "PointGroupName");
+    jspg_confidence = json_object_get(jsymm, "SpaceGroupConfidence");
+    jnsym = json_object_get(jsymm, "NumberOfSymmetryOperations");
+    jnsymp = json_object_get(jsymm, "NumberOfPrimitiveSymmetryOperations");
+    jsym = json_object_get(jsymm, "SymmetryOperations");
+    jsymtyp = json_object_get(jsymm, "LatticeType");
 
     jspcgrp &&json_is_integer(jspcgrp) ? mtzout->mtzsymm.spcgrp = json_integer_value(jspcgrp) : 0;
     jspcgrpname &&json_is_string(jspcgrpname) ? strncpy(mtzout->mtzsymm.spcgrpname, json_string_value(jspcgrpname), 21) : 0;
@@ -1279,232 +3724,108 @@ MTZCOL *findColumnBySource(const MTZ *mtz, size_t source)
 
 /**
  * Converts a json reflection object into a MTZ struct and returns a pointer to that struct.
+ * The crystals, datasets and columns are checked, allocated and filled in a
+ * single pass, with the number of reflections taken from the first column.
  * @param[in] json The json object.
- * @return The MTZ struct.
+ * @return The MTZ struct, or NULL if the json object is malformed.
  */
 
 MTZ *makeMtz(json_t *json)
 {
     MTZ *mtzout = NULL;
-    json_t *jtitle = NULL;
-    json_t *jcrystals = NULL;
-    json_t *jhistory = json_array();
-    json_t *jsymm = NULL;
-    json_t *jbatches = NULL;
-    json_t *jsort = NULL;
-    json_t *junknown_headers = json_array();
-    int ncryst = 0;
-    int *nsets = NULL;
-    size_t **ncols = NULL;
-    size_t ***nrefl = NULL;
+    json_t *jtitle = json_object_get(json, "Title");
+    json_t *jcrystals = json_object_get(json, "Crystals");
+    json_t *jhistory = json_object_get(json, "History");
+    json_t *jsymm = json_object_get(json, "Symmetry");
+    json_t *jbatches = json_object_get(json, "Batches");
+    json_t *jsort = json_object_get(json, "SortOrder");
+    json_t *junknown_headers = json_object_get(json, "UnknownHeaders");
+    json_t *jfirst = NULL;
     size_t crystalindex;
     json_t *crystalvalue = NULL;
     size_t nref = 0;
     size_t orderindex;
     json_t *ordervalue = NULL;
-    uint8_t structure_error = 0;
 
-    json_unpack(json,
-                "{s:o, s:o, s:o, s:o, s:o, s:o, s:o}",
-                "Title", &jtitle,                     // json_string
-                "Crystals", &jcrystals,               // json_array
-                "History", &jhistory,                 // json_array
-                "Symmetry", &jsymm,                   // json_object
-                "Batches", &jbatches,                 // json_array
-                "SortOrder", &jsort,                  //json_array
-                "UnknownHeaders", &junknown_headers); // json_array
-
-    if (jcrystals && json_is_array(jcrystals) && json_array_size(jcrystals) != 0 && json_array_is_homogenous_object(jcrystals))
-    {
-        ;
-    }
-    else
+    if (!jcrystals || !json_is_array(jcrystals) || json_array_size(jcrystals) == 0)
     {
-        structure_error = 1;
+        return NULL;
     }
 
-    if (!structure_error)
+    // The first column of the first dataset sets the number of reflections
+    json_array_foreach(jcrystals, crystalindex, crystalvalue)
     {
-        ncryst = json_array_size(jcrystals);
-        nsets = malloc(ncryst * sizeof(int));
-        ncols = malloc(ncryst * sizeof(size_t *));
-        nrefl = malloc(ncryst * sizeof(size_t *));
+        json_t *jsets = json_object_get(crystalvalue, "Datasets");
 
-        // Count datasets for each crystal
-        json_array_foreach(jcrystals, crystalindex, crystalvalue)
+        if (json_array_size(jsets) > 0)
         {
-            json_t *jsets = NULL;
-            size_t setindex;
-            json_t *setvalue = NULL;
-            size_t *ncol = NULL;
-            size_t **nreflections = NULL;
-
-            json_unpack(crystalvalue, "{s:o}", "Datasets", &jsets);
-
-            if (jsets && json_is_array(jsets) && json_array_is_homogenous_object(jsets))
-            {
-                ;
-            }
-            else
-            {
-                structure_error = 1;
-            }
-
-            if (!structure_error)
-            {
-                nsets[crystalindex] = json_array_size(jsets);
-
-                // Count columns for each dataset
-                ncol = malloc(json_array_size(jsets) * sizeof(size_t));
-                nreflections = malloc(json_array_size(jsets) * sizeof(size_t *));
-
-                json_array_foreach(jsets, setindex, setvalue)
-                {
-                    json_t *jcols = NULL;
-                    size_t colindex;
-                    json_t *colvalue = NULL;
-                    size_t *reflcount = NULL;
-
-                    json_unpack(setvalue, "{s:o}", "Columns", &jcols);
-
-                    if (jcols && json_is_array(jcols) && json_array_size(jcols) != 0 && json_array_is_homogenous_object(jcols))
-                    {
-                        ;
-                    }
-                    else
-                    {
-                        structure_error = 1;
-                    }
-
-                    if (!structure_error)
-                    {
-                        reflcount = malloc(json_array_size(jcols) * sizeof(size_t));
-
-                        ncol[setindex] = json_array_size(jcols);
-
-                        // Count reflections for each column
-                        json_array_foreach(jcols, colindex, colvalue)
-                        {
-                            json_t *dat = NULL;
-
-                            json_unpack(colvalue, "{s:o}", "Data", &dat);
-                            if (dat && json_is_array(dat))
-                            {
-                                ;
-                            }
-                            else
-                            {
-                                structure_error = 1;
-                            }
-
-                            if (!structure_error)
-                            {
-                                reflcount[colindex] = json_array_size(dat);
-                            }
-                        }
-
-                        nreflections[setindex] = reflcount;
-                    }
-
-                    ncols[crystalindex] = ncol;
-                    nrefl[crystalindex] = nreflections;
-                }
-            }
+            jfirst = json_array_get(json_object_get(json_array_get(jsets, 0), "Columns"), 0);
+            break;
         }
+    }
 
-        if (!structure_error)
-        {
-            // Check if columns all have the same length
-            nref = nrefl[0][0][0];
-            for (size_t i = 0; i < ncryst; i++)
-            {
-                for (size_t j = 0; j < nsets[i]; j++)
-                {
-                    for (size_t k = 0; k < ncols[i][j]; k++)
-                    {
-                        if (nref != nrefl[i][j][k]) // Inhomogenous column lengths
-                        {
-                            free(nsets);
-                            free(ncols);
-                            free(nrefl);
-                            return NULL;
-                        }
-                    }
-                }
-            }
-
-            mtzout = MtzMalloc(ncryst, nsets);
-            if (!mtzout)
-            {
-                free(nsets);
-                free(ncols);
-                free(nrefl);
-                return NULL;
-            }
-
-            // Set misc properties. Important to set these first.
-            mtzout->nref = nrefl[0][0][0];
-            mtzout->nxtal = ncryst;
-            mtzout->resmax_out = 0;
-            mtzout->resmin_out = 999;
-            mtzout->refs_in_memory = 1;
+    if (crystalindex < json_array_size(jcrystals) && (!jfirst || !columnDataLength(jfirst, &nref)))
+    {
+        return NULL;
+    }
 
-            // Set title
-            jtitle &&json_is_string(jtitle) ? snprintf(mtzout->title, 71, "%s", json_string_value(jtitle)) : 0;
+    mtzout = MtzMalloc(0, NULL);
+    if (!mtzout)
+    {
+        return NULL;
+    }
 
-            // Set history
-            if (jhistory && json_is_array(jhistory) && json_array_is_homogenous_string(jhistory))
-            {
-                mtzout->histlines = json_array_size(jhistory);
-                mtzout->hist = MtzCallocHist(mtzout->histlines);
+    // Set misc properties. Important to set these first.
+    mtzout->nref = nref;
+    mtzout->resmax_out = 0;
+    mtzout->resmin_out = 999;
+    mtzout->refs_in_memory = 1;
 
-                for (size_t i = 0; i < mtzout->histlines; i++)
-                {
-                    strncpy(mtzout->hist + i * MTZRECORDLENGTH, json_string_value(json_array_get(jhistory, i)), MTZRECORDLENGTH);
-                }
-            }
+    // Set title
+    jtitle &&json_is_string(jtitle) ? snprintf(mtzout->title, 71, "%s", json_string_value(jtitle)) : 0;
 
-            // Set symmetry
-            jsymm &&json_is_object(jsymm) ? mtzout = setMtzSymmetry(mtzout, jsymm) : 0;
+    // Set history
+    if (jhistory && json_is_array(jhistory) && json_array_is_homogenous_string(jhistory))
+    {
+        mtzout->histlines = json_array_size(jhistory);
+        mtzout->hist = MtzCallocHist(mtzout->histlines);
 
-            // Set batches
-            jbatches &&json_is_array(jbatches) && json_array_is_homogenous_object(jbatches) ? mtzout = setMtzBatches(mtzout, jbatches) : 0;
+        for (size_t i = 0; i < mtzout->histlines; i++)
+        {
+            strncpy(mtzout->hist + i * MTZRECORDLENGTH, json_string_value(json_array_get(jhistory, i)), MTZRECORDLENGTH);
+        }
+    }
 
-            // Set crystals
-            jcrystals &&json_is_array(jcrystals) && json_array_is_homogenous_object(jcrystals) ? mtzout = setMtzXtals(mtzout, jcrystals) : 0;
+    // Set symmetry
+    jsymm &&json_is_object(jsymm) ? mtzout = setMtzSymmetry(mtzout, jsymm) : 0;
 
-            // Set sort order
-            if (jsort && json_is_array(jsort) && json_array_is_homogenous_integer(jsort))
-            {
-                json_array_foreach(jsort, orderindex, ordervalue)
-                {
-                    mtzout->order[orderindex] = findColumnBySource(mtzout, json_integer_value(ordervalue));
-                }
-            }
+    // Set batches, then crystals, datasets and columns
+    if ((jbatches && json_is_array(jbatches) && json_array_is_homogenous_object(jbatches) && !setMtzBatches(mtzout, jbatches)) ||
+        !setMtzXtals(mtzout, jcrystals))
+    {
+        MtzFree(mtzout);
+        return NULL;
+    }
 
-            // Set unknown headers
-            if (junknown_headers && json_is_array(junknown_headers) && json_array_is_homogenous_string(junknown_headers))
-            {
-                mtzout->n_unknown_headers = json_array_size(junknown_headers);
-                mtzout->unknown_headers = malloc(mtzout->n_unknown_headers * MTZRECORDLENGTH * sizeof(char));
-                memset(mtzout->unknown_headers, '\0', mtzout->n_unknown_headers * MTZRECORDLENGTH);
+    // Set sort order
+    if (jsort && json_is_array(jsort) && json_array_is_homogenous_integer(jsort))
+    {
+        json_array_foreach(jsort, orderindex, ordervalue)
+        {
+            orderindex < 5 ? mtzout->order[orderindex] = findColumnBySource(mtzout, json_integer_value(ordervalue)) : 0;
+        }
+    }
 
-                for (size_t i = 0; i < mtzout->n_unknown_headers; i++)
-                {
-                    const char *header;
-                    header = json_string_value(json_array_get(junknown_headers, i));
+    // Set unknown headers
+    if (junknown_headers && json_is_array(junknown_headers) && json_array_is_homogenous_string(junknown_headers))
+    {
+        mtzout->n_unknown_headers = json_array_size(junknown_headers);
+        mtzout->unknown_headers = malloc(mtzout->n_unknown_headers * MTZRECORDLENGTH * sizeof(char));
 
-                    for (size_t j = 0; j < MTZRECORDLENGTH; j++)
-                    {
-                        mtzout->unknown_headers[i * MTZRECORDLENGTH + j] = header[j];
-                    }
-                }
-            }
+        for (size_t i = 0; i < mtzout->n_unknown_headers; i++)
+        {
+            strncpy(mtzout->unknown_headers + i * MTZRECORDLENGTH, json_string_value(json_array_get(junknown_headers, i)), MTZRECORDLENGTH);
         }
-
-        free(nsets);
-        free(ncols);
-        free(nrefl);
     }
 
     return mtzout;
@@ -1530,4 +3851,38 @@ char *makeTimestamp(const char *jobstring, const char *timestring, char *timesta
     memset(timestamp + timestring_index + 24, ' ', MTZRECORDLENGTH - 24 - 1 - strlen(jobstring));
 
     return timestamp;
+}
+
+/**
+ * Appends a timestamp to the history of an MTZ struct.
+ * @param[in] mtz The MTZ struct.
+ * @param[in] program The program name.
+ */
+
+void addMtzTimestamp(MTZ *mtz, const char *program)
+{
+    time_t current_time;
+    char timestring[26];
+    char timestamp[80];
+    char jobstring[57];
+    char *hist = NULL;
+
+    snprintf(jobstring, 56, "%s v%d.%d.%d run on", program, VERSION_MAJOR, VERSION_MINOR, VERSION_PATCH);
+    time(&current_time);
+#ifdef _WIN32
+    ctime_s(timestring, sizeof(timestring), &current_time);
+#else
+    ctime_r(&current_time, timestring);
+#endif
+    makeTimestamp(jobstring, timestring, timestamp);
+
+    hist = MtzCallocHist(mtz->histlines + 1);
+    for (size_t i = 0; i < mtz->histlines * MTZRECORDLENGTH; i++)
+    {
+        hist[i] = mtz->hist[i];
+    }
+    strncpy(hist + MTZRECORDLENGTH * mtz->histlines, timestamp, MTZRECORDLENGTH);
+    MtzFreeHist(mtz->hist);
+    mtz->hist = hist;
+    mtz->histlines += 1;
 }
\ No newline at end of file
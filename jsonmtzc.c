@@ -0,0 +1,197 @@
+/*
+ * jsonmtzc.c: Client for the MTZ/JSON conversion server
+ *
+ * Copyright (c) 2017 Frank Buermann <fburmann@mrc-lmb.cam.ac.uk>
+ *
+ * jsonmtz is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ * This software makes use of the jansson library (http://www.digip.org/jansson/)
+ * licensed under the terms of the MIT license,
+ * and the CCP4io library (http://www.ccp4.ac.uk/) licensed under the
+ * Lesser GNU General Public License 3.0.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include "server.h"
+
+int main(int argc, char *argv[])
+{
+    int o;
+    int fd;
+    FILE *in = NULL;
+    long repeat = 1;
+    char *end = NULL;
+    const char *path = SERVER_SOCKET;
+    unsigned char *payload = NULL;
+    size_t length = 0;
+    server_buffer_t response = {NULL, 0, 0};
+    struct timespec start, stop;
+    int status = 0;
+    long micros = 0;
+    long total = 0, roundtrip = 0, slowest = 0;
+    long i;
+    bool help = 0;
+    bool version = 0;
+    opterr = 0;
+
+    while (TRUE)
+    {
+        static struct option long_options[] = {
+            {"help", no_argument, 0, 'h'},
+            {"version", no_argument, 0, 'v'},
+            {"socket", required_argument, 0, 's'},
+            {"repeat", required_argument, 0, 'r'},
+            {0, 0, 0, 0}};
+
+        int option_index = 0;
+
+        // Stop at the command, whose options are passed on
+        o = getopt_long(argc, argv, "+hvs:r:", long_options, &option_index);
+
+        if (o == -1)
+        {
+            break;
+        }
+
+        switch (o)
+        {
+        case 'h':
+            help = 1;
+            break;
+        case 'v':
+            version = 1;
+            break;
+        case 's':
+            path = optarg;
+            break;
+        case 'r':
+            repeat = strtol(optarg, &end, 10);
+            if (*end != '\0' || repeat < 1)
+            {
+                fprintf(stderr, "%s", "jsonmtzc --help\n");
+                return 1;
+            }
+            break;
+        case '?':
+            fprintf(stderr, "%s", "jsonmtzc --help\n");
+            return 1;
+        }
+    }
+
+    if (help)
+    {
+        puts("");
+        puts("~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~");
+        puts("~~ Client for the MTZ/JSON conversion server ~~");
+        puts("");
+        puts("Usage:");
+        puts("    jsonmtzc [options] mtz2json [mtz2json options] in.mtz out.json");
+        puts("    jsonmtzc [options] json2mtz [json2mtz options] in.json out.mtz");
+        puts("");
+        puts("Sends a conversion request to jsonmtzd and reports the conversion");
+        puts("time and the round trip time on stderr. Paths are opened by the");
+        puts("server, relative to its working directory. Use - to send stdin");
+        puts("or receive stdout, which supports JSON and CBOR only.");
+        puts("Command options are given in short form, e.g. -c -m null.");
+        puts("");
+        puts("Options:");
+        puts("    -v --version          Print program version.");
+        puts("    -h --help             Print help.");
+        puts("    -s --socket PATH      Path of the server socket.");
+        puts("                          Defaults to " SERVER_SOCKET ".");
+        puts("    -r --repeat N         Send the request N times and report the");
+        puts("                          mean and maximum times.");
+        puts("");
+        exit(0);
+    }
+
+    if (version)
+    {
+        printf("jsonmtzc v%d.%d.%d\n", VERSION_MAJOR, VERSION_MINOR, VERSION_PATCH);
+        exit(0);
+    }
+
+    if (argc - optind < 3)
+    {
+        fprintf(stderr, "%s", "jsonmtzc --help\n");
+        return 1;
+    }
+
+    if (strcmp(argv[argc - 2], "-") == 0)
+    {
+        payload = readStream(stdin, &length);
+        if (!payload)
+        {
+            fprintf(stderr, "%s", "Unable to read stdin.\n");
+            return 1;
+        }
+    }
+
+    fd = serverConnect(path);
+    in = fd != -1 ? fdopen(fd, "rb") : NULL;
+    if (!in)
+    {
+        fd != -1 ? close(fd) : 0;
+        free(payload);
+        fprintf(stderr, "Unable to connect to %s.\n", path);
+        return 1;
+    }
+
+    for (i = 0; i < repeat; i++)
+    {
+        long elapsed;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        if (serverClientRequest(fd, in, argc - optind, argv + optind, payload, length,
+                                &response, &status, &micros) != 0)
+        {
+            break;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &stop);
+
+        elapsed = (stop.tv_sec - start.tv_sec) * 1000000L + (stop.tv_nsec - start.tv_nsec) / 1000L;
+        total += micros;
+        roundtrip += elapsed;
+        elapsed > slowest ? slowest = elapsed : 0;
+    }
+
+    fclose(in);
+    free(payload);
+
+    if (i < repeat)
+    {
+        free(response.data);
+        fprintf(stderr, "%s", "Request failed.\n");
+        return 1;
+    }
+
+    if (repeat == 1)
+    {
+        fprintf(stderr, "Status %d, conversion %ld us, round trip %ld us.\n", status, micros, roundtrip);
+    }
+    else
+    {
+        fprintf(stderr, "%ld requests, conversion %ld us, round trip %ld us, slowest %ld us.\n",
+                repeat, total / repeat, roundtrip / repeat, slowest);
+    }
+
+    if (status == 0 && strcmp(argv[argc - 1], "-") == 0)
+    {
+        fwrite(response.data, 1, response.length, stdout);
+    }
+    else if (status == 0)
+    {
+        puts(argv[argc - 1]);
+    }
+
+    free(response.data);
+
+    return status == 0 ? 0 : 1;
+}
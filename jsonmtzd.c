@@ -0,0 +1,167 @@
+/*
+ * jsonmtzd.c: MTZ/JSON conversion server
+ *
+ * Copyright (c) 2017 Frank Buermann <fburmann@mrc-lmb.cam.ac.uk>
+ *
+ * jsonmtz is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ * This software makes use of the jansson library (http://www.digip.org/jansson/)
+ * licensed under the terms of the MIT license,
+ * and the CCP4io library (http://www.ccp4.ac.uk/) licensed under the
+ * Lesser GNU General Public License 3.0.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <getopt.h>
+#include "server.h"
+
+// Server stopped by SIGINT and SIGTERM
+server_t *running = NULL;
+
+/**
+ * Signal handler stopping the running server.
+ * @param[in] sig The signal.
+ */
+
+void stopServer(int sig)
+{
+    (void)sig;
+
+    if (running)
+    {
+        serverStop(running);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    int8_t ret;
+    int o;
+    server_t *server = NULL;
+    long threads = 0;
+    char *end = NULL;
+    const char *path = SERVER_SOCKET;
+    bool help = 0;
+    bool version = 0;
+    bool verbose = 1;
+    struct sigaction sa;
+    opterr = 0;
+
+    jsonmtzInit(); // Workers allocate from contexts
+
+    while (TRUE)
+    {
+        static struct option long_options[] = {
+            {"help", no_argument, 0, 'h'},
+            {"version", no_argument, 0, 'v'},
+            {"socket", required_argument, 0, 's'},
+            {"threads", required_argument, 0, 'j'},
+            {"quiet", no_argument, 0, 'q'},
+            {0, 0, 0, 0}};
+
+        int option_index = 0;
+
+        o = getopt_long(argc, argv, "hvs:j:q", long_options, &option_index);
+
+        if (o == -1)
+        {
+            break;
+        }
+
+        switch (o)
+        {
+        case 'h':
+            help = 1;
+            break;
+        case 'v':
+            version = 1;
+            break;
+        case 's':
+            path = optarg;
+            break;
+        case 'j':
+            threads = strtol(optarg, &end, 10);
+            if (*end != '\0' || threads < 0)
+            {
+                fprintf(stderr, "%s", "jsonmtzd --help\n");
+                return 1;
+            }
+            break;
+        case 'q':
+            verbose = 0;
+            break;
+        case '?':
+            fprintf(stderr, "%s", "jsonmtzd --help\n");
+            return 1;
+        }
+    }
+
+    if (help)
+    {
+        puts("");
+        puts("~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~");
+        puts("~~ MTZ/JSON conversion server ~~");
+        puts("");
+        puts("Usage:");
+        puts("    jsonmtzd [options]");
+        puts("");
+        puts("Serves mtz2json and json2mtz requests on a Unix domain socket,");
+        puts("see jsonmtzc. Each request is reported on stderr with its");
+        puts("conversion time. SIGINT and SIGTERM stop the server.");
+        puts("");
+        puts("Options:");
+        puts("    -v --version          Print program version.");
+        puts("    -h --help             Print help.");
+        puts("    -s --socket PATH      Path of the socket.");
+        puts("                          Defaults to " SERVER_SOCKET ".");
+        puts("    -j --threads N        Number of worker threads.");
+        puts("                          Defaults to the number of processors.");
+        puts("    -q --quiet            Do not report requests.");
+        puts("");
+        exit(0);
+    }
+
+    if (version)
+    {
+        printf("jsonmtzd v%d.%d.%d\n", VERSION_MAJOR, VERSION_MINOR, VERSION_PATCH);
+        exit(0);
+    }
+
+    if (argc - optind != 0)
+    {
+        fprintf(stderr, "%s", "jsonmtzd --help\n");
+        return 1;
+    }
+
+    running = serverNew(path, threads, verbose);
+    if (!running)
+    {
+        fprintf(stderr, "Unable to listen on %s.\n", path);
+        return 1;
+    }
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = stopServer;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    verbose ? fprintf(stderr, "Listening on %s with %zu threads.\n", path, running->nthreads) : 0;
+
+    ret = serverRun(running);
+    server = running;
+    running = NULL;
+    serverFree(server);
+
+    if (ret != 0)
+    {
+        fprintf(stderr, "%s", "Failed.\n");
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,154 @@
+/*
+ * mtz2csv.c: MTZ to CSV/TSV exporter
+ *
+ * Copyright (c) 2017 Frank Buermann <fburmann@mrc-lmb.cam.ac.uk>
+ *
+ * jsonmtz is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ * This software makes use of the jansson library (http://www.digip.org/jansson/)
+ * licensed under the terms of the MIT license,
+ * and the CCP4io library (http://www.ccp4.ac.uk/) licensed under the
+ * Lesser GNU General Public License 3.0.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <getopt.h>
+#include "jsonmtz.h"
+
+int main(int argc, char *argv[])
+{
+    int8_t ret;
+    int o;
+    long threads;
+    char *end = NULL;
+    options_mtz2csv_t opts;
+    opterr = 0;
+
+    opts.version = 0;
+    opts.help = 0;
+    opts.force = 0;
+    opts.delimiter = ',';
+    opts.columns = NULL;
+    opts.missing = "";
+    opts.threads = 0;
+
+    while (TRUE)
+    {
+        static struct option long_options[] = {
+            {"help", no_argument, 0, 'h'},
+            {"version", no_argument, 0, 'v'},
+            {"tsv", no_argument, 0, 't'},
+            {"columns", required_argument, 0, 'c'},
+            {"missing", required_argument, 0, 'm'},
+            {"threads", required_argument, 0, 'j'},
+            {"force", no_argument, 0, 'f'},
+            {0, 0, 0, 0}};
+
+        int option_index = 0;
+
+        o = getopt_long(argc, argv, "hvtc:m:j:f", long_options, &option_index);
+
+        if (o == -1)
+        {
+            break;
+        }
+
+        switch (o)
+        {
+        case 'h':
+            opts.help = 1;
+            break;
+        case 'v':
+            opts.version = 1;
+            break;
+        case 't':
+            opts.delimiter = '\t';
+            break;
+        case 'c':
+            opts.columns = optarg;
+            break;
+        case 'm':
+            opts.missing = optarg;
+            break;
+        case 'j':
+            threads = strtol(optarg, &end, 10);
+            if (*end != '\0' || threads < 0)
+            {
+                fprintf(stderr, "%s", "mtz2csv --help\n");
+                return 1;
+            }
+            opts.threads = threads;
+            break;
+        case 'f':
+            opts.force = 1;
+            break;
+        case '?':
+            fprintf(stderr, "%s", "mtz2csv --help\n");
+            return 1;
+        }
+    }
+
+    if (opts.help)
+    {
+        puts("");
+        puts("~~~~~~~~~~~~~~~~~~~~~~~~~");
+        puts("~~ MTZ to CSV exporter ~~");
+        puts("");
+        puts("Usage:");
+        puts("    mtz2csv [options] in.mtz out.csv");
+        puts("");
+        puts("Options:");
+        puts("    -v --version          Print program version.");
+        puts("    -h --help             Print help.");
+        puts("    -t --tsv              Write tab-separated values.");
+        puts("    -c --columns LABELS   Comma-separated list of columns to export.");
+        puts("                          Defaults to all columns.");
+        puts("    -m --missing TOKEN    Write missing values as TOKEN.");
+        puts("                          Defaults to an empty field.");
+        puts("    -j --threads N        Number of formatting threads.");
+        puts("                          Defaults to the number of processors.");
+        puts("    -f --force            Input and output filenames can be the same.");
+        puts("");
+        exit(0);
+    }
+
+    if (opts.version)
+    {
+        printf("mtz2csv v%d.%d.%d\n", VERSION_MAJOR, VERSION_MINOR, VERSION_PATCH);
+        exit(0);
+    }
+
+    if (argc - optind != 2)
+    {
+        fprintf(stderr, "%s", "mtz2csv --help\n");
+        return 1;
+    }
+
+    if (strcmp(argv[optind], argv[optind + 1]) != 0 || opts.force)
+    {
+        ret = mtz2csv(argv[optind], argv[optind + 1], &opts);
+    }
+    else
+    {
+        fprintf(stderr, "%s", "Input and output filenames must be different.\n");
+        return 1;
+    }
+
+    switch (ret)
+    {
+    case 0:
+        puts(argv[optind + 1]);
+        return 0;
+    case 2:
+        fprintf(stderr, "%s", "Unable to read MTZ file.\n");
+        return 1;
+    case 3:
+        fprintf(stderr, "%s", "Unknown column.\n");
+        return 1;
+    default:
+        fprintf(stderr, "%s", "Failed.\n");
+        return 1;
+    }
+}
@@ -24,11 +24,7 @@ int main(int argc, char *argv[])
     options_mtz2json_t opts;
     opterr = 0;
 
-    opts.compact = 0;
-    opts.version = 0;
-    opts.help = 0;
-    opts.timestamp = 1;
-    opts.force = 0;
+    defaultMtz2jsonOptions(&opts);
 
     while (TRUE)
     {
@@ -38,11 +34,19 @@ int main(int argc, char *argv[])
             {"version", no_argument, 0, 'v'},
             {"no-timestamp", no_argument, 0, 'n'},
             {"force", no_argument, 0, 'f'},
+            {"index", no_argument, 0, 'i'},
+            {"missing", required_argument, 0, 'm'},
+            {"encoding", required_argument, 0, 'e'},
+            {"format", required_argument, 0, 'F'},
+            {"compress", required_argument, 0, 'z'},
+            {"window", required_argument, 0, 'w'},
+            {"shards", required_argument, 0, 's'},
+            {"shard", required_argument, 0, 'S'},
             {0, 0, 0, 0}};
 
         int option_index = 0;
 
-        o = getopt_long(argc, argv, "chvnf", long_options, &option_index);
+        o = getopt_long(argc, argv, "chvnfim:e:F:z:w:s:S:", long_options, &option_index);
 
         if (o == -1)
         {
@@ -54,20 +58,27 @@ int main(int argc, char *argv[])
         case 'h':
             opts.help = 1;
             break;
-        case 'c':
-            opts.compact = 1;
-            break;
         case 'v':
             opts.version = 1;
             break;
-        case 'n':
-            opts.timestamp = 0;
+        case 'z':
+            if (setMtz2jsonOption(&opts, o, optarg) != 0)
+            {
+                fprintf(stderr, "%s", "mtz2json --help\n");
+                return 1;
+            }
+            if (!compressionAvailable(opts.compress))
+            {
+                fprintf(stderr, "%s support not compiled in.\n", optarg);
+                return 1;
+            }
             break;
-        case 'f':
-            opts.force = 1;
-        case '?':
-            fprintf(stderr, "%s", "mtz2json --help\n");
-            return 1;
+        default:
+            if (setMtz2jsonOption(&opts, o, optarg) != 0)
+            {
+                fprintf(stderr, "%s", "mtz2json --help\n");
+                return 1;
+            }
         }
     }
 
@@ -80,12 +91,56 @@ int main(int argc, char *argv[])
         puts("Usage:");
         puts("    mtz2json [options] in.mtz out.json");
         puts("");
+        puts("Use - to read from stdin or write to stdout.");
+        puts("npz, sidecar and sharded output cannot be written to stdout.");
+        puts("");
         puts("Options:");
         puts("    -c --compact          Write compact JSON file.");
         puts("    -v --version          Print program version.");
         puts("    -n --no-timestamp     Do not add timestamp to history.");
         puts("    -h --help             Print help.");
         puts("    -f --force            Input and output filenames can be the same.");
+        puts("    -i --index            Write out.idx with the byte offset and length");
+        puts("                          of each top-level section and of the Data of");
+        puts("                          each column, for reading single columns.");
+        puts("    -m --missing FORMAT   Write missing values as \"NaN\" strings (string),");
+        puts("                          null (null), bare NaN literals (nan) or as a list");
+        puts("                          of missing positions per column (index).");
+        puts("    -e --encoding MODE    Write column data as plain arrays (plain) or");
+        puts("                          choose run-length, dictionary or sparse");
+        puts("                          encoding per column (auto), or write");
+        puts("                          base64 encoded float32 data (base64).");
+        puts("                          sidecar writes column data to out.bin as");
+        puts("                          64-byte aligned float32 arrays, and none");
+        puts("                          writes metadata only.");
+        puts("    -F --format FORMAT    Write JSON (json) or CBOR with float32 typed");
+        puts("                          arrays for column data (cbor), or write a");
+        puts("                          header line followed by one JSON array per");
+        puts("                          reflection (ndjson), or write an Arrow IPC");
+        puts("                          stream with one field per column (arrow),");
+        puts("                          or a NumPy archive with one .npy array per");
+        puts("                          column and the metadata as JSON (npz).");
+#if defined(HAVE_ZLIB) && defined(HAVE_ZSTD)
+        puts("    -z --compress METHOD  Compress JSON output with gzip (gzip) or");
+        puts("                          zstd (zstd), using all processors.");
+#elif defined(HAVE_ZLIB)
+        puts("    -z --compress METHOD  Compress JSON output with gzip (gzip),");
+        puts("                          using all processors.");
+#elif defined(HAVE_ZSTD)
+        puts("    -z --compress METHOD  Compress JSON output with zstd (zstd),");
+        puts("                          using all processors.");
+#endif
+        puts("    -w --window MB        Leave the reflections in the MTZ file and read");
+        puts("                          them in windows of at most MB megabytes, one");
+        puts("                          pass per column. Writes compact JSON with");
+        puts("                          plain column data.");
+        puts("    -s --shards N         Split the reflections into N shards written");
+        puts("                          in parallel as out.0.json, out.1.json, ...,");
+        puts("                          with out.json as the manifest read by");
+        puts("                          json2mtz. -w sets the read window size.");
+        puts("    -S --shard K          Write only shard K of N, for dividing the");
+        puts("                          shards between processes. The manifest is");
+        puts("                          written with shard 0.");
         puts("");
         exit(0);
     }
@@ -102,7 +157,8 @@ int main(int argc, char *argv[])
         return 1;
     }
 
-    if (strcmp(argv[optind], argv[optind + 1]) != 0 || opts.force)
+    // "-" is stdin or stdout
+    if (strcmp(argv[optind], argv[optind + 1]) != 0 || strcmp(argv[optind], "-") == 0 || opts.force)
     {
         ret = mtz2json(argv[optind], argv[optind + 1], &opts);
     }
@@ -114,7 +170,7 @@ int main(int argc, char *argv[])
 
     if (ret == 0)
     {
-        printf("%s\n", argv[optind + 1]);
+        strcmp(argv[optind + 1], "-") != 0 ? printf("%s\n", argv[optind + 1]) : 0;
         return 0;
     }
 
@@ -0,0 +1,788 @@
+/*
+ * npz.c: NumPy .npz export and import of MTZ columns
+ *
+ * Copyright (c) 2017 Frank Buermann <fburmann@mrc-lmb.cam.ac.uk>
+ *
+ * jsonmtz is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ * This software makes use of the jansson library (http://www.digip.org/jansson/)
+ * licensed under the terms of the MIT license,
+ * and the CCP4io library (http://www.ccp4.ac.uk/) licensed under the
+ * Lesser GNU General Public License 3.0.
+ */
+
+/*
+ * An npz file is an uncompressed zip archive of .npy members. Every column
+ * is one member, and the member NPZ_METADATA holds the json object produced
+ * by readMtz() with DataEncoding "npy" and the member name and length as
+ * column data. Member payloads start at multiples of 64 bytes, so that the
+ * arrays can be used in place from a mapping of the archive.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "jsonmtz.h"
+
+/**
+ * Writes an MTZ struct as an npz archive. Integral columns without
+ * missing values are int32 arrays if all their values are integers in the
+ * int32 range, all other columns are float32 arrays with missing values
+ * as NaN.
+ * @param[in] mtzin The MTZ struct.
+ * @param[in] file_out The output file.
+ * @param[in] opts Options struct.
+ * @return 0 on success, -1 on failure.
+ */
+
+int8_t writeNpz(const MTZ *mtzin, const char *file_out, const options_mtz2json_t *opts)
+{
+    npz_writer_t zw;
+    json_t *jsonmtz = NULL;
+    json_t *jcrystals = NULL;
+    char *metadata = NULL;
+    size_t nref = mtzin->nref;
+    int8_t ret = 0;
+
+    memset(&zw, 0, sizeof(zw));
+    crc32Table(zw.crctable);
+
+    zw.fp = fopen(file_out, "wb");
+    if (!zw.fp)
+    {
+        return -1;
+    }
+
+    jsonmtz = readMtz(mtzin, opts);
+    json_unpack(jsonmtz, "{s:o}", "Crystals", &jcrystals);
+
+    for (size_t i = 0; i < mtzin->nxtal && ret == 0; i++)
+    {
+        json_t *jsets = json_object_get(json_array_get(jcrystals, i), "Datasets");
+
+        for (size_t j = 0; j < mtzin->xtal[i]->nset && ret == 0; j++)
+        {
+            json_t *jcols = json_object_get(json_array_get(jsets, j), "Columns");
+
+            for (size_t k = 0; k < mtzin->xtal[i]->set[j]->ncol && ret == 0; k++)
+            {
+                const MTZCOL *col = mtzin->xtal[i]->set[j]->col[k];
+                json_t *jcol = json_array_get(jcols, k);
+                char name[64];
+
+                // Member names are the labels, made unique with the ColumnID
+                snprintf(name, sizeof(name), "%s.npy", col->label);
+                for (size_t m = 0; m < zw.nmembers; m++)
+                {
+                    if (strcmp(zw.members[m].name, name) == 0)
+                    {
+                        snprintf(name, sizeof(name), "%s_%d.npy", col->label, col->source);
+                        break;
+                    }
+                }
+
+                ret = writeNpyMember(&zw, name, mtzin, col, nref);
+
+                json_object_set_new(jcol, "DataEncoding", json_string(columnEncodingName(COLUMN_NPY)));
+                json_object_set_new(jcol, "Data", json_pack("{s:s, s:I}", "Member", name, "Length", (json_int_t)nref));
+            }
+        }
+    }
+
+    metadata = json_dumps(jsonmtz, JSON_COMPACT | (opts->compact ? 0 : JSON_INDENT(4)));
+    json_decref(jsonmtz);
+
+    if (ret == 0 && metadata)
+    {
+        ret = npzStartMember(&zw, NPZ_METADATA);
+        ret == 0 ? ret = npzWrite(&zw, metadata, strlen(metadata)) : 0;
+        ret == 0 ? ret = npzEndMember(&zw) : 0;
+    }
+
+    ret == 0 ? ret = npzFinish(&zw) : 0;
+    jsonFree(metadata);
+
+    for (size_t m = 0; m < zw.nmembers; m++)
+    {
+        free(zw.members[m].name);
+    }
+    free(zw.members);
+
+    if (fclose(zw.fp) != 0)
+    {
+        return -1;
+    }
+
+    return ret;
+}
+
+/**
+ * Writes one column as an .npy member.
+ * @param[in] zw The npz writer.
+ * @param[in] name The member name.
+ * @param[in] mtzin The MTZ struct.
+ * @param[in] col The column.
+ * @param[in] nref Number of reflections.
+ * @return 0 on success, -1 on failure.
+ */
+
+int8_t writeNpyMember(npz_writer_t *zw, const char *name, const MTZ *mtzin, const MTZCOL *col, size_t nref)
+{
+    char header[NPY_HEADER_LENGTH];
+    unsigned char buffer[4096];
+    uint8_t integral = isInt32Column(mtzin, col, nref);
+    size_t length;
+
+    // Integer arrays cannot hold missing values
+    for (size_t i = 0; i < nref && integral; i++)
+    {
+        ccp4_ismnf(mtzin, col->ref[i]) ? integral = 0 : 0;
+    }
+
+    length = npyHeader(header, integral ? "<i4" : "<f4", nref);
+
+    if (npzStartMember(zw, name) != 0 || npzWrite(zw, header, length) != 0)
+    {
+        return -1;
+    }
+
+    for (size_t first = 0; first < nref; first += sizeof(buffer) / 4)
+    {
+        size_t nblock = nref - first < sizeof(buffer) / 4 ? nref - first : sizeof(buffer) / 4;
+
+        for (size_t l = 0; l < nblock; l++)
+        {
+            float refl = col->ref[first + l];
+
+            if (integral)
+            {
+                packLE(buffer + 4 * l, (uint32_t)(int32_t)lrintf(refl), 4);
+            }
+            else
+            {
+                packFloat32LE(ccp4_ismnf(mtzin, refl) ? ccp4_nan().f : refl, buffer + 4 * l);
+            }
+        }
+
+        if (npzWrite(zw, buffer, 4 * nblock) != 0)
+        {
+            return -1;
+        }
+    }
+
+    return npzEndMember(zw);
+}
+
+/**
+ * Formats a version 1.0 .npy header for a one-dimensional array.
+ * The header is padded to a multiple of 64 bytes.
+ * @param[out] out Buffer of NPY_HEADER_LENGTH bytes.
+ * @param[in] descr The numpy type descriptor.
+ * @param[in] count The number of elements.
+ * @return The header length.
+ */
+
+size_t npyHeader(char *out, const char *descr, size_t count)
+{
+    size_t length;
+
+    memcpy(out, "\x93NUMPY\x01\x00", 8);
+    length = 10 + snprintf(out + 10, NPY_HEADER_LENGTH - 10, "{'descr': '%s', 'fortran_order': False, 'shape': (%zu,), }", descr, count);
+
+    while ((length + 1) % 64 != 0)
+    {
+        out[length++] = ' ';
+    }
+    out[length++] = '\n';
+
+    packLE((unsigned char *)out + 8, length - 10, 2);
+
+    return length;
+}
+
+/**
+ * Starts a stored zip member. The local header is padded with an extra
+ * field so that the member data start at a multiple of 64 bytes.
+ * The checksum and sizes are filled in by npzEndMember().
+ * @param[in] zw The npz writer.
+ * @param[in] name The member name.
+ * @return 0 on success, -1 on failure.
+ */
+
+int8_t npzStartMember(npz_writer_t *zw, const char *name)
+{
+    unsigned char header[30 + 64 + 4];
+    size_t namelen = strlen(name);
+    long offset = ftell(zw->fp);
+    size_t padding;
+    npz_member_t *member = NULL;
+
+    if (offset < 0 || (uint64_t)offset > 0xffffffff)
+    {
+        return -1;
+    }
+
+    if (zw->nmembers == zw->capacity)
+    {
+        npz_member_t *members = realloc(zw->members, 2 * (zw->capacity + 8) * sizeof(npz_member_t));
+
+        if (!members)
+        {
+            return -1;
+        }
+
+        zw->members = members;
+        zw->capacity = 2 * (zw->capacity + 8);
+    }
+
+    member = zw->members + zw->nmembers++;
+    member->name = malloc(namelen + 1);
+    strcpy(member->name, name);
+    member->offset = offset;
+    member->crc = 0;
+    member->size = 0;
+
+    // Extra fields have at least a four byte header
+    padding = (64 - (offset + 30 + namelen) % 64) % 64;
+    padding > 0 && padding < 4 ? padding += 64 : 0;
+
+    memset(header, 0, sizeof(header));
+    packLE(header, 0x04034b50, 4);
+    packLE(header + 4, 20, 2);  // Version needed
+    packLE(header + 12, 0x21, 2); // 1980-01-01
+    packLE(header + 26, namelen, 2);
+    packLE(header + 28, padding, 2);
+
+    if (padding)
+    {
+        packLE(header + 30, NPZ_PADDING_ID, 2);
+        packLE(header + 32, padding - 4, 2);
+    }
+
+    if (fwrite(header, 1, 30, zw->fp) != 30 || fwrite(name, 1, namelen, zw->fp) != namelen ||
+        fwrite(header + 30, 1, padding, zw->fp) != padding)
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Writes data to the current zip member.
+ * @param[in] zw The npz writer.
+ * @param[in] data The data.
+ * @param[in] length The number of bytes.
+ * @return 0 on success, -1 on failure.
+ */
+
+int8_t npzWrite(npz_writer_t *zw, const void *data, size_t length)
+{
+    npz_member_t *member = zw->members + zw->nmembers - 1;
+
+    if ((uint64_t)member->size + length > 0xffffffff || fwrite(data, 1, length, zw->fp) != length)
+    {
+        return -1;
+    }
+
+    member->crc = crc32Update(zw->crctable, member->crc, data, length);
+    member->size += length;
+
+    return 0;
+}
+
+/**
+ * Ends the current zip member and fills in its local header.
+ * @param[in] zw The npz writer.
+ * @return 0 on success, -1 on failure.
+ */
+
+int8_t npzEndMember(npz_writer_t *zw)
+{
+    npz_member_t *member = zw->members + zw->nmembers - 1;
+    unsigned char fields[12];
+
+    packLE(fields, member->crc, 4);
+    packLE(fields + 4, member->size, 4);
+    packLE(fields + 8, member->size, 4);
+
+    if (fseek(zw->fp, member->offset + 14, SEEK_SET) != 0 || fwrite(fields, 1, 12, zw->fp) != 12 ||
+        fseek(zw->fp, 0, SEEK_END) != 0)
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Writes the zip central directory.
+ * @param[in] zw The npz writer.
+ * @return 0 on success, -1 on failure.
+ */
+
+int8_t npzFinish(npz_writer_t *zw)
+{
+    unsigned char record[46];
+    long start = ftell(zw->fp);
+    long end;
+
+    if (start < 0 || zw->nmembers > 0xffff)
+    {
+        return -1;
+    }
+
+    for (size_t m = 0; m < zw->nmembers; m++)
+    {
+        const npz_member_t *member = zw->members + m;
+        size_t namelen = strlen(member->name);
+
+        memset(record, 0, sizeof(record));
+        packLE(record, 0x02014b50, 4);
+        packLE(record + 4, 20, 2); // Version made by
+        packLE(record + 6, 20, 2); // Version needed
+        packLE(record + 14, 0x21, 2);
+        packLE(record + 16, member->crc, 4);
+        packLE(record + 20, member->size, 4);
+        packLE(record + 24, member->size, 4);
+        packLE(record + 28, namelen, 2);
+        packLE(record + 42, member->offset, 4);
+
+        if (fwrite(record, 1, 46, zw->fp) != 46 || fwrite(member->name, 1, namelen, zw->fp) != namelen)
+        {
+            return -1;
+        }
+    }
+
+    end = ftell(zw->fp);
+    if (end < 0 || (uint64_t)end > 0xffffffff)
+    {
+        return -1;
+    }
+
+    memset(record, 0, 22);
+    packLE(record, 0x06054b50, 4);
+    packLE(record + 8, zw->nmembers, 2);
+    packLE(record + 10, zw->nmembers, 2);
+    packLE(record + 12, end - start, 4);
+    packLE(record + 16, start, 4);
+
+    return fwrite(record, 1, 22, zw->fp) == 22 ? 0 : -1;
+}
+
+/**
+ * Reads the metadata member of an npz archive.
+ * @param[in] file_in The npz file.
+ * @return The json object, or NULL on failure.
+ */
+
+json_t *npzLoadMetadata(const char *file_in)
+{
+    const unsigned char *data = NULL;
+    const unsigned char *member = NULL;
+    size_t size = 0;
+    size_t length = 0;
+    json_t *json = NULL;
+    json_error_t err;
+
+    data = mapFile(file_in, &size);
+    if (!data)
+    {
+        return NULL;
+    }
+
+    member = npzFindMember(data, size, NPZ_METADATA, &length);
+    json = member ? json_loadb((const char *)member, length, JSON_DECODE_NAN, &err) : NULL;
+
+    unmapFile(data, size);
+
+    return json;
+}
+
+/**
+ * Transfer column data from the .npy members of an npz archive to an MTZ struct.
+ * The archive is memory-mapped and the arrays are converted into the column buffers.
+ * @param[in] mtzout The MTZ struct as returned by makeMtz().
+ * @param[in] json The json object the MTZ struct was made from.
+ * @param[in] file_in The npz file.
+ * @return The MTZ struct, or NULL on failure.
+ */
+
+MTZ *setMtzNpz(MTZ *mtzout, const json_t *json, const char *file_in)
+{
+    const unsigned char *data = NULL;
+    size_t size = 0;
+    json_t *jcrystals = json_object_get(json, "Crystals");
+    size_t nref = mtzout->nref;
+
+    data = mapFile(file_in, &size);
+    if (!data)
+    {
+        return NULL;
+    }
+
+    for (size_t i = 0; i < mtzout->nxtal; i++)
+    {
+        json_t *jsets = json_object_get(json_array_get(jcrystals, i), "Datasets");
+
+        for (size_t j = 0; j < mtzout->xtal[i]->nset; j++)
+        {
+            json_t *jcols = json_object_get(json_array_get(jsets, j), "Columns");
+
+            for (size_t k = 0; k < mtzout->xtal[i]->set[j]->ncol; k++)
+            {
+                MTZCOL *col = mtzout->xtal[i]->set[j]->col[k];
+                json_t *jcol = json_array_get(jcols, k);
+                json_t *jmember = NULL;
+                const unsigned char *npy = NULL;
+                const unsigned char *payload = NULL;
+                size_t length = 0;
+                size_t count = 0;
+                char descr[NPY_DESCR_LENGTH];
+
+                if (columnDataEncoding(jcol) != COLUMN_NPY)
+                {
+                    continue;
+                }
+
+                jmember = json_object_get(json_object_get(jcol, "Data"), "Member");
+                npy = npzFindMember(data, size, json_string_value(jmember), &length);
+                payload = npy ? npyPayload(npy, length, descr, &count) : NULL;
+
+                if (!payload || count != nref || !npyToReflections(payload, descr, count, col->ref))
+                {
+                    unmapFile(data, size);
+                    return NULL;
+                }
+            }
+        }
+    }
+
+    unmapFile(data, size);
+
+    return mtzout;
+}
+
+/**
+ * Finds a stored member of a zip archive through the central directory.
+ * @param[in] data The archive.
+ * @param[in] size The archive size.
+ * @param[in] name The member name.
+ * @param[out] length The member length.
+ * @return Pointer to the member data, or NULL if the member does not exist or is compressed.
+ */
+
+const unsigned char *npzFindMember(const unsigned char *data, size_t size, const char *name, size_t *length)
+{
+    size_t eocd = size;
+    size_t entries;
+    size_t pos;
+    size_t namelen = strlen(name);
+
+    if (size < 22)
+    {
+        return NULL;
+    }
+
+    // The end of central directory record may be followed by a comment
+    for (size_t i = size - 22; eocd == size; i--)
+    {
+        unpackLE(data + i, 4) == 0x06054b50 ? eocd = i : 0;
+
+        if (i == 0 || size - i >= 22 + 0xffff)
+        {
+            break;
+        }
+    }
+
+    if (eocd == size)
+    {
+        return NULL;
+    }
+
+    entries = unpackLE(data + eocd + 10, 2);
+    pos = unpackLE(data + eocd + 16, 4);
+
+    for (size_t e = 0; e < entries; e++)
+    {
+        size_t entrynamelen;
+        size_t extralen;
+        size_t commentlen;
+        size_t local;
+        size_t datastart;
+
+        if (pos > size || size - pos < 46 || unpackLE(data + pos, 4) != 0x02014b50)
+        {
+            return NULL;
+        }
+
+        entrynamelen = unpackLE(data + pos + 28, 2);
+        extralen = unpackLE(data + pos + 30, 2);
+        commentlen = unpackLE(data + pos + 32, 2);
+
+        if (size - pos - 46 < entrynamelen)
+        {
+            return NULL;
+        }
+
+        if (entrynamelen == namelen && memcmp(data + pos + 46, name, namelen) == 0)
+        {
+            // Stored members only
+            if (unpackLE(data + pos + 10, 2) != 0)
+            {
+                return NULL;
+            }
+
+            *length = unpackLE(data + pos + 24, 4);
+            local = unpackLE(data + pos + 42, 4);
+
+            if (local > size || size - local < 30 || unpackLE(data + local, 4) != 0x04034b50)
+            {
+                return NULL;
+            }
+
+            datastart = local + 30 + unpackLE(data + local + 26, 2) + unpackLE(data + local + 28, 2);
+
+            if (datastart > size || size - datastart < *length)
+            {
+                return NULL;
+            }
+
+            return data + datastart;
+        }
+
+        pos += 46 + entrynamelen + extralen + commentlen;
+    }
+
+    return NULL;
+}
+
+/**
+ * Parses the header of a one-dimensional, C-ordered .npy array.
+ * @param[in] npy The .npy data.
+ * @param[in] length The .npy length.
+ * @param[out] descr The numpy type descriptor, of NPY_DESCR_LENGTH bytes.
+ * @param[out] count The number of elements.
+ * @return Pointer to the array data, or NULL on failure.
+ */
+
+const unsigned char *npyPayload(const unsigned char *npy, size_t length, char *descr, size_t *count)
+{
+    size_t headerlen;
+    size_t start;
+    char *header = NULL;
+    char *field = NULL;
+    char *end = NULL;
+    size_t itemsize;
+
+    if (length < 10 || memcmp(npy, "\x93NUMPY", 6) != 0)
+    {
+        return NULL;
+    }
+
+    // Version 1.0 has a two byte header length, later versions four
+    if (npy[6] == 1)
+    {
+        headerlen = unpackLE(npy + 8, 2);
+        start = 10;
+    }
+    else if (length >= 12)
+    {
+        headerlen = unpackLE(npy + 8, 4);
+        start = 12;
+    }
+    else
+    {
+        return NULL;
+    }
+
+    if (length - start < headerlen)
+    {
+        return NULL;
+    }
+
+    header = stringtrimn((const char *)npy + start, headerlen);
+
+    field = strstr(header, "'descr':");
+    field ? field = strchr(field + 8, '\'') : 0;
+    end = field ? strchr(field + 1, '\'') : NULL;
+
+    if (!end || end - field - 1 >= NPY_DESCR_LENGTH || !strstr(header, "'fortran_order': False"))
+    {
+        free(header);
+        return NULL;
+    }
+
+    memcpy(descr, field + 1, end - field - 1);
+    descr[end - field - 1] = '\0';
+
+    // One-dimensional shape (n,)
+    field = strstr(header, "'shape':");
+    field ? field = strchr(field, '(') : 0;
+
+    if (!field)
+    {
+        free(header);
+        return NULL;
+    }
+
+    *count = strtoull(field + 1, &end, 10);
+
+    if (end == field + 1 || *end != ',' || end[1 + strspn(end + 1, " ")] != ')')
+    {
+        free(header);
+        return NULL;
+    }
+
+    free(header);
+
+    itemsize = strlen(descr) == 3 ? descr[2] - '0' : 0;
+
+    if (itemsize == 0 || (length - start - headerlen) / itemsize < *count)
+    {
+        return NULL;
+    }
+
+    return npy + start + headerlen;
+}
+
+/**
+ * Converts array data to reflection values. Supports little-endian
+ * floats of four and eight bytes and integers of one to eight bytes.
+ * @param[in] payload The array data.
+ * @param[in] descr The numpy type descriptor.
+ * @param[in] count The number of elements.
+ * @param[out] ref The reflection values.
+ * @return 1 on success, 0 for unsupported types.
+ */
+
+uint8_t npyToReflections(const unsigned char *payload, const char *descr, size_t count, float *ref)
+{
+    char byteorder = descr[0];
+    char kind = descr[1];
+    size_t itemsize = descr[2] - '0';
+
+    // Little-endian, or byte-sized without byte order
+    if (strlen(descr) != 3 || !(byteorder == '<' || (byteorder == '|' && itemsize == 1)))
+    {
+        return 0;
+    }
+
+    if (kind == 'f' && itemsize == 4)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            ref[i] = unpackFloat32LE(payload + 4 * i);
+        }
+        return 1;
+    }
+
+    if (kind == 'f' && itemsize == 8)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            uint64_t bits = unpackLE(payload + 8 * i, 8);
+            double value;
+
+            memcpy(&value, &bits, 8);
+            ref[i] = isnan(value) ? ccp4_nan().f : (float)value;
+        }
+        return 1;
+    }
+
+    if ((kind == 'i' || kind == 'u') && (itemsize == 1 || itemsize == 2 || itemsize == 4 || itemsize == 8))
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            uint64_t bits = unpackLE(payload + itemsize * i, itemsize);
+
+            // Sign extension
+            if (kind == 'i' && itemsize < 8 && bits >> (8 * itemsize - 1))
+            {
+                bits |= ~(uint64_t)0 << (8 * itemsize);
+            }
+
+            ref[i] = kind == 'i' ? (float)(int64_t)bits : (float)bits;
+        }
+        return 1;
+    }
+
+    return 0;
+}
+
+/**
+ * Builds the CRC-32 lookup table of the zip format.
+ * @param[out] table The table of 256 entries.
+ */
+
+void crc32Table(uint32_t *table)
+{
+    for (uint32_t i = 0; i < 256; i++)
+    {
+        uint32_t crc = i;
+
+        for (size_t j = 0; j < 8; j++)
+        {
+            crc = crc & 1 ? 0xedb88320 ^ (crc >> 1) : crc >> 1;
+        }
+
+        table[i] = crc;
+    }
+}
+
+/**
+ * Updates a CRC-32 checksum.
+ * @param[in] table The lookup table from crc32Table().
+ * @param[in] crc The checksum so far, 0 initially.
+ * @param[in] data The data.
+ * @param[in] length The number of bytes.
+ * @return The updated checksum.
+ */
+
+uint32_t crc32Update(const uint32_t *table, uint32_t crc, const void *data, size_t length)
+{
+    const unsigned char *bytes = data;
+
+    crc = ~crc;
+    for (size_t i = 0; i < length; i++)
+    {
+        crc = table[(crc ^ bytes[i]) & 0xff] ^ (crc >> 8);
+    }
+
+    return ~crc;
+}
+
+/**
+ * Writes an unsigned integer as little-endian bytes.
+ * @param[out] out The bytes.
+ * @param[in] value The value.
+ * @param[in] nbytes The number of bytes.
+ */
+
+void packLE(unsigned char *out, uint64_t value, size_t nbytes)
+{
+    for (size_t i = 0; i < nbytes; i++)
+    {
+        out[i] = (value >> (8 * i)) & 0xff;
+    }
+}
+
+/**
+ * Reads an unsigned integer from little-endian bytes.
+ * @param[in] in The bytes.
+ * @param[in] nbytes The number of bytes.
+ * @return The value.
+ */
+
+uint64_t unpackLE(const unsigned char *in, size_t nbytes)
+{
+    uint64_t value = 0;
+
+    for (size_t i = nbytes; i > 0; i--)
+    {
+        value = value << 8 | in[i - 1];
+    }
+
+    return value;
+}
@@ -0,0 +1,411 @@
+/*
+ * pointer.c: Loading selected values of a JSON document
+ *
+ * Copyright (c) 2017 Frank Buermann <fburmann@mrc-lmb.cam.ac.uk>
+ *
+ * jsonmtz is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ * This software makes use of the jansson library (http://www.digip.org/jansson/)
+ * licensed under the terms of the MIT license,
+ * and the CCP4io library (http://www.ccp4.ac.uk/) licensed under the
+ * Lesser GNU General Public License 3.0.
+ */
+
+/*
+ * jsonLoadPointers() loads only the values of a document selected by a list
+ * of JSON Pointers (RFC 6901), for instance "/Symmetry" and "/Title":
+ *
+ *     {"Title":"...","Symmetry":{...}}
+ *
+ * The returned json keeps the structure of the document along the selected
+ * paths. Array elements keep their positions, with null for the elements
+ * before a selected one. As an extension, the token * selects all members
+ * of an object or elements of an array, so that the labels of all columns
+ * are selected by a pointer with the tokens Crystals, *, Datasets, *,
+ * Columns, *, Label.
+ *
+ * The document is walked with the scanner of index.c. All values that are
+ * not selected, the Data arrays in particular, are skipped by counting
+ * brackets without converting numbers, and jansson parses the selected
+ * values only.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "jsonmtz.h"
+
+/**
+ * Loads the values of a JSON file selected by JSON Pointers.
+ * Compressed files are not supported.
+ * @param[in] file_json The JSON file.
+ * @param[in] pointers The JSON Pointers.
+ * @param[in] npointers The number of pointers.
+ * @return The selected values, or NULL on failure, see jsonLoadbPointers().
+ */
+
+json_t *jsonLoadPointers(const char *file_json, const char *const *pointers, size_t npointers)
+{
+    const unsigned char *data = NULL;
+    size_t size = 0;
+    json_t *json = NULL;
+
+    data = mapFile(file_json, &size);
+    if (!data)
+    {
+        return NULL;
+    }
+
+    if (detectCompression(data, size) == COMPRESS_NONE)
+    {
+        json = jsonLoadbPointers((const char *)data, size, pointers, npointers);
+    }
+
+    unmapFile(data, size);
+
+    return json;
+}
+
+/**
+ * Loads the values of a JSON document in memory selected by JSON Pointers.
+ * Values that are not selected are only checked for matching brackets.
+ * @param[in] text The JSON text.
+ * @param[in] length The length of the text in bytes.
+ * @param[in] pointers The JSON Pointers.
+ * @param[in] npointers The number of pointers.
+ * @return The selected values in the structure of the document, an empty
+ * object or array if nothing is selected, or NULL if a pointer or the
+ * document is malformed or memory runs out.
+ */
+
+json_t *jsonLoadbPointers(const char *text, size_t length, const char *const *pointers, size_t npointers)
+{
+    json_pointer_t *parsed = calloc(npointers + 1, sizeof(json_pointer_t));
+    size_t *active = malloc((npointers + 1) * sizeof(size_t));
+    json_span_t value;
+    json_t *json = NULL;
+    void *previous;
+    int8_t ret = 0;
+    size_t i;
+
+    if (!parsed || !active)
+    {
+        free(parsed);
+        free(active);
+        return NULL;
+    }
+
+    previous = useCLocale();
+
+    for (i = 0; i < npointers && ret == 0; i++)
+    {
+        ret = jsonPointerParse(pointers[i], &parsed[i]);
+        active[i] = i;
+    }
+
+    value.offset = jsonScanSpace(text, length, 0);
+    value.length = 0;
+
+    if (ret == 0 && value.offset < length)
+    {
+        ret = jsonPointerScan(text, length, &value, parsed, active, npointers, 0, &json);
+    }
+    else
+    {
+        ret = -1;
+    }
+
+    // Only whitespace may follow the document
+    if (ret == 0 && jsonScanSpace(text, length, value.offset + value.length) != length)
+    {
+        json_decref(json);
+        json = NULL;
+        ret = -1;
+    }
+
+    if (ret == 0 && !json)
+    {
+        json = text[value.offset] == '[' ? json_array() : json_object();
+    }
+
+    for (i = 0; i < npointers; i++)
+    {
+        jsonPointerFree(&parsed[i]);
+    }
+    free(parsed);
+    free(active);
+    restoreLocale(previous);
+
+    return json;
+}
+
+/**
+ * Loads the selected values within a value of a JSON document. Selected
+ * containers are descended into without skipping them first, so the text
+ * is scanned once.
+ * @param[in] text The JSON text.
+ * @param[in] length The length of the text in bytes.
+ * @param[in,out] value The value, with the offset of its first character.
+ * Its length is set by the scan.
+ * @param[in] pointers The parsed JSON Pointers.
+ * @param[in] active The indices of the pointers that lead to the value.
+ * @param[in] nactive The number of active pointers.
+ * @param[in] level The depth of the value, the number of tokens matched.
+ * @param[out] json The selected values, or NULL if nothing is selected.
+ * @return 0 on success, -1 if the document is malformed or memory runs out.
+ */
+
+int8_t jsonPointerScan(const char *text, size_t length, json_span_t *value, const json_pointer_t *pointers,
+                       const size_t *active, size_t nactive, size_t level, json_t **json)
+{
+    json_span_t key, quoted, child;
+    json_t *jkey = NULL;
+    json_t *jchild = NULL;
+    size_t *next = NULL;
+    size_t nnext = 0;
+    size_t pos = value->offset;
+    size_t end = 0;
+    size_t index = 0;
+    char c = text[value->offset];
+    uint8_t whole = 0;
+    int8_t ret = 0;
+    size_t i;
+
+    *json = NULL;
+
+    // A pointer ending here selects the whole value
+    for (i = 0; i < nactive; i++)
+    {
+        pointers[active[i]].ntokens == level ? whole = 1 : 0;
+    }
+
+    if (whole || (c != '{' && c != '['))
+    {
+        end = jsonScanValue(text, length, value->offset);
+        if (end == JSON_SCAN_ERROR)
+        {
+            return -1;
+        }
+
+        value->length = end - value->offset;
+        whole ? *json = jsonSpanLoad(text, *value) : 0;
+
+        return whole && !*json ? -1 : 0;
+    }
+
+    next = malloc((nactive + 1) * sizeof(size_t));
+    if (!next)
+    {
+        return -1;
+    }
+
+    while ((ret = c == '{' ? jsonScanMemberKey(text, length, &pos, &key) : jsonScanElementStart(text, length, &pos)) == 1)
+    {
+        nnext = 0;
+        child.offset = pos;
+
+        if (c == '{')
+        {
+            // Keys with escapes are decoded before matching
+            quoted.offset = key.offset - 1;
+            quoted.length = key.length + 2;
+            jkey = memchr(text + key.offset, '\\', key.length) ? jsonSpanLoad(text, quoted) : NULL;
+
+            for (i = 0; i < nactive; i++)
+            {
+                if (jkey ? jsonPointerMatch(&pointers[active[i]], level, json_string_value(jkey), json_string_length(jkey), 0)
+                         : jsonPointerMatch(&pointers[active[i]], level, text + key.offset, key.length, 0))
+                {
+                    next[nnext++] = active[i];
+                }
+            }
+        }
+        else
+        {
+            for (i = 0; i < nactive; i++)
+            {
+                jsonPointerMatch(&pointers[active[i]], level, NULL, 0, index) ? next[nnext++] = active[i] : 0;
+            }
+        }
+
+        jchild = NULL;
+
+        if (nnext > 0)
+        {
+            ret = jsonPointerScan(text, length, &child, pointers, next, nnext, level + 1, &jchild);
+        }
+        else
+        {
+            end = jsonScanValue(text, length, child.offset);
+            end != JSON_SCAN_ERROR ? child.length = end - child.offset : 0;
+            ret = end != JSON_SCAN_ERROR ? 0 : -1;
+        }
+
+        if (ret != 0)
+        {
+            json_decref(jkey);
+            break;
+        }
+
+        if (jchild && c == '{')
+        {
+            !jkey ? jkey = jsonSpanLoad(text, quoted) : 0;
+            !*json ? *json = json_object() : 0;
+            json_object_set_new(*json, json_string_value(jkey), jchild);
+        }
+        else if (jchild)
+        {
+            !*json ? *json = json_array() : 0;
+            while (json_array_size(*json) < index)
+            {
+                json_array_append_new(*json, json_null());
+            }
+            json_array_append_new(*json, jchild);
+        }
+
+        json_decref(jkey);
+        jkey = NULL;
+        pos = child.offset + child.length;
+        index++;
+    }
+
+    free(next);
+
+    if (ret != 0)
+    {
+        json_decref(*json);
+        *json = NULL;
+        return -1;
+    }
+
+    // The scan stops at the closing bracket
+    value->length = jsonScanSpace(text, length, pos) + 1 - value->offset;
+
+    return 0;
+}
+
+/**
+ * Checks if a token of a JSON Pointer selects an object member or array element.
+ * @param[in] pointer The parsed JSON Pointer.
+ * @param[in] level The index of the token.
+ * @param[in] key The decoded key of the member, or NULL for an array element.
+ * @param[in] keylen The length of the key in bytes.
+ * @param[in] index The index of the array element.
+ * @return 1 if selected, 0 otherwise.
+ */
+
+uint8_t jsonPointerMatch(const json_pointer_t *pointer, size_t level, const char *key, size_t keylen, size_t index)
+{
+    if (level >= pointer->ntokens)
+    {
+        return 0;
+    }
+
+    if (pointer->indices[level] == JSON_POINTER_ANY)
+    {
+        return 1;
+    }
+
+    if (!key)
+    {
+        return pointer->indices[level] == index;
+    }
+
+    return strlen(pointer->tokens[level]) == keylen && memcmp(pointer->tokens[level], key, keylen) == 0;
+}
+
+/**
+ * Parses a JSON Pointer into its unescaped tokens.
+ * @param[in] pointer The JSON Pointer, "" for the whole document.
+ * @param[out] parsed The parsed pointer. Must be freed with jsonPointerFree().
+ * @return 0 on success, -1 if the pointer is malformed or memory runs out.
+ */
+
+int8_t jsonPointerParse(const char *pointer, json_pointer_t *parsed)
+{
+    size_t length = strlen(pointer);
+    size_t ntokens = 0;
+    char *out = NULL;
+    size_t i;
+
+    memset(parsed, 0, sizeof(json_pointer_t));
+
+    if (length == 0)
+    {
+        return 0;
+    }
+
+    if (pointer[0] != '/')
+    {
+        return -1;
+    }
+
+    for (i = 0; i < length; i++)
+    {
+        pointer[i] == '/' ? ntokens++ : 0;
+    }
+
+    // Unescaped tokens are not longer than the pointer
+    parsed->buffer = malloc(length);
+    parsed->tokens = malloc(ntokens * sizeof(char *));
+    parsed->indices = malloc(ntokens * sizeof(size_t));
+    if (!parsed->buffer || !parsed->tokens || !parsed->indices)
+    {
+        jsonPointerFree(parsed);
+        return -1;
+    }
+    out = parsed->buffer;
+
+    for (i = 0; i < length; i++)
+    {
+        if (pointer[i] == '/')
+        {
+            i > 0 ? *out++ = '\0' : 0;
+            parsed->tokens[parsed->ntokens++] = out;
+        }
+        else if (pointer[i] == '~')
+        {
+            if (pointer[i + 1] != '0' && pointer[i + 1] != '1')
+            {
+                jsonPointerFree(parsed);
+                return -1;
+            }
+            *out++ = pointer[++i] == '0' ? '~' : '/';
+        }
+        else
+        {
+            *out++ = pointer[i];
+        }
+    }
+    *out = '\0';
+
+    for (i = 0; i < ntokens; i++)
+    {
+        const char *token = parsed->tokens[i];
+        size_t digits = strspn(token, "0123456789");
+
+        parsed->indices[i] = JSON_POINTER_KEY;
+        strcmp(token, "*") == 0 ? parsed->indices[i] = JSON_POINTER_ANY : 0;
+
+        // Array indices have no leading zeros
+        if (digits > 0 && digits < 19 && token[digits] == '\0' && (token[0] != '0' || digits == 1))
+        {
+            parsed->indices[i] = strtoull(token, NULL, 10);
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Frees a parsed JSON Pointer.
+ * @param[in] parsed The parsed pointer.
+ */
+
+void jsonPointerFree(json_pointer_t *parsed)
+{
+    free(parsed->buffer);
+    free(parsed->tokens);
+    free(parsed->indices);
+    memset(parsed, 0, sizeof(json_pointer_t));
+}
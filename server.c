@@ -0,0 +1,750 @@
+/*
+ * server.c: Conversion server on a Unix domain socket
+ *
+ * Copyright (c) 2017 Frank Buermann <fburmann@mrc-lmb.cam.ac.uk>
+ *
+ * jsonmtz is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ * This software makes use of the jansson library (http://www.digip.org/jansson/)
+ * licensed under the terms of the MIT license,
+ * and the CCP4io library (http://www.ccp4.ac.uk/) licensed under the
+ * Lesser GNU General Public License 3.0.
+ */
+
+/*
+ * A request is a header line followed by a payload:
+ *
+ *     <length> <command> [options] <in> <out>\n<length bytes>
+ *
+ * The command is mtz2json or json2mtz, and the options are the short
+ * options of the command line programs, e.g. "-c -m null". Tokens are
+ * separated by single spaces, so paths cannot contain whitespace. An input
+ * of "-" is read from the payload, and an output of "-" is returned in the
+ * response:
+ *
+ *     <status> <microseconds> <length>\n<length bytes>
+ *
+ * The status is the return value of the conversion, or -2 for malformed
+ * requests, and the time is spent converting, excluding the transfers.
+ * Connections stay open for further requests. Accepted connections are
+ * queued for a fixed pool of workers. Each worker keeps its buffers
+ * between requests and allocates json values from its own jsonmtz_ctx_t.
+ */
+
+#ifndef _WIN32
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "server.h"
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0 // SO_NOSIGPIPE is set on the socket instead
+#endif
+
+/**
+ * Creates a server listening on a Unix domain socket and starts its workers.
+ * A stale socket file at the path is replaced, but not one a running
+ * server accepts connections on.
+ * @param[in] path Path of the socket.
+ * @param[in] nthreads Number of worker threads, or 0 for the number of processors.
+ * @param[in] verbose Report each request on stderr.
+ * @return The server, or NULL on failure. Must be freed with serverFree().
+ */
+
+server_t *serverNew(const char *path, size_t nthreads, bool verbose)
+{
+    server_t *server = NULL;
+    struct sockaddr_un addr;
+    struct stat st;
+
+    if (strlen(path) >= sizeof(addr.sun_path))
+    {
+        return NULL;
+    }
+
+    if (nthreads == 0)
+    {
+        long nproc = sysconf(_SC_NPROCESSORS_ONLN);
+        nthreads = nproc > 0 ? nproc : 1;
+    }
+
+    nthreads > SERVER_MAX_THREADS ? nthreads = SERVER_MAX_THREADS : 0;
+
+    server = calloc(1, sizeof(server_t));
+    if (!server)
+    {
+        return NULL;
+    }
+
+    server->listener = -1;
+    server->verbose = verbose;
+    server->path = strdup(path);
+    server->workers = calloc(nthreads, sizeof(server_worker_t));
+    server->nworkers = server->workers ? nthreads : 0;
+    if (!server->path || !server->workers)
+    {
+        serverFree(server);
+        return NULL;
+    }
+
+    // Replace a socket left behind by a previous server
+    if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+    {
+        int fd = serverConnect(path);
+
+        if (fd != -1)
+        {
+            close(fd);
+            serverFree(server);
+            return NULL;
+        }
+        unlink(path);
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    server->listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server->listener == -1 ||
+        bind(server->listener, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+        listen(server->listener, SERVER_BACKLOG) == -1)
+    {
+        serverFree(server);
+        return NULL;
+    }
+    server->bound = 1;
+
+    // Seed the hashtables once instead of from every thread
+    json_object_seed(0);
+
+    pthread_mutex_init(&server->lock, NULL);
+    pthread_cond_init(&server->ready, NULL);
+    server->initialized = 1;
+
+    for (size_t i = 0; i < nthreads; i++)
+    {
+        server->workers[i].server = server;
+        server->workers[i].fd = -1;
+        server->workers[i].ctx = jsonmtzCtxNew();
+
+        if (!server->workers[i].ctx)
+        {
+            break;
+        }
+
+        if (pthread_create(&server->workers[i].thread, NULL, serverWorker, server->workers + i) != 0)
+        {
+            break;
+        }
+
+        server->nthreads++;
+    }
+
+    if (server->nthreads == 0)
+    {
+        serverFree(server);
+        return NULL;
+    }
+
+    return server;
+}
+
+/**
+ * Accepts connections until serverStop() is called, then waits for the
+ * workers to finish the queued connections.
+ * @param[in] server The server.
+ * @return 0 on success, -1 on failure.
+ */
+
+int8_t serverRun(server_t *server)
+{
+    int8_t ret = 0;
+
+    while (!server->stop)
+    {
+        int fd = accept(server->listener, NULL, NULL);
+
+        if (fd == -1)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+            {
+                continue;
+            }
+
+            !server->stop ? ret = -1 : 0;
+            break;
+        }
+
+#ifdef SO_NOSIGPIPE
+        setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &(int){1}, sizeof(int));
+#endif
+
+        pthread_mutex_lock(&server->lock);
+
+        if (server->count < SERVER_QUEUE)
+        {
+            server->queue[(server->head + server->count) % SERVER_QUEUE] = fd;
+            server->count++;
+            pthread_cond_signal(&server->ready);
+        }
+        else
+        {
+            close(fd); // Too many waiting clients
+        }
+
+        pthread_mutex_unlock(&server->lock);
+    }
+
+    serverJoin(server);
+
+    return ret;
+}
+
+/**
+ * Lets the workers finish the queued connections and waits for them.
+ * @param[in] server The server.
+ */
+
+void serverJoin(server_t *server)
+{
+    pthread_mutex_lock(&server->lock);
+    server->stop = 1;
+    pthread_cond_broadcast(&server->ready);
+    pthread_mutex_unlock(&server->lock);
+
+    for (size_t i = 0; i < server->nthreads; i++)
+    {
+        pthread_join(server->workers[i].thread, NULL);
+    }
+
+    server->nthreads = 0;
+}
+
+/**
+ * Stops a running server. Requests in progress are finished, and open
+ * connections are closed afterwards. Safe to call from a signal handler.
+ * @param[in] server The server.
+ */
+
+void serverStop(server_t *server)
+{
+    server->stop = 1;
+    shutdown(server->listener, SHUT_RDWR); // Wakes accept()
+
+    for (size_t i = 0; i < server->nworkers; i++)
+    {
+        int fd = server->workers[i].fd;
+
+        fd != -1 ? shutdown(fd, SHUT_RD) : 0; // Wakes the worker at the next header
+    }
+}
+
+/**
+ * Frees a server and removes its socket. The server must not be running.
+ * @param[in] server The server.
+ */
+
+void serverFree(server_t *server)
+{
+    if (!server)
+    {
+        return;
+    }
+
+    if (server->nthreads > 0)
+    {
+        serverJoin(server);
+    }
+
+    for (size_t i = 0; i < server->count; i++)
+    {
+        close(server->queue[(server->head + i) % SERVER_QUEUE]);
+    }
+
+    for (size_t i = 0; server->workers && i < server->nworkers; i++)
+    {
+        free(server->workers[i].input.data);
+        free(server->workers[i].output.data);
+        jsonmtzCtxFree(server->workers[i].ctx);
+    }
+
+    if (server->initialized)
+    {
+        pthread_mutex_destroy(&server->lock);
+        pthread_cond_destroy(&server->ready);
+    }
+
+    server->listener != -1 ? close(server->listener) : 0;
+    server->bound ? unlink(server->path) : 0;
+    free(server->workers);
+    free(server->path);
+    free(server);
+}
+
+/**
+ * Worker thread taking connections from the queue.
+ * @param[in] arg The server_worker_t.
+ * @return NULL.
+ */
+
+void *serverWorker(void *arg)
+{
+    server_worker_t *worker = arg;
+    server_t *server = worker->server;
+
+    while (TRUE)
+    {
+        int fd;
+
+        pthread_mutex_lock(&server->lock);
+
+        while (server->count == 0 && !server->stop)
+        {
+            pthread_cond_wait(&server->ready, &server->lock);
+        }
+
+        if (server->count == 0)
+        {
+            pthread_mutex_unlock(&server->lock);
+            break;
+        }
+
+        fd = server->queue[server->head];
+        server->head = (server->head + 1) % SERVER_QUEUE;
+        server->count--;
+
+        pthread_mutex_unlock(&server->lock);
+
+        worker->fd = fd;
+        serverConnection(worker, fd);
+        worker->fd = -1;
+    }
+
+    return NULL;
+}
+
+/**
+ * Serves the requests of one connection until the client disconnects.
+ * @param[in] worker The worker.
+ * @param[in] fd The connection. It is closed.
+ */
+
+void serverConnection(server_worker_t *worker, int fd)
+{
+    FILE *in = fdopen(fd, "rb");
+
+    if (!in)
+    {
+        close(fd);
+        return;
+    }
+
+    while (!worker->server->stop && fgets(worker->header, SERVER_MAX_HEADER, in))
+    {
+        if (serverRequest(worker, in, fd) != 0)
+        {
+            break;
+        }
+    }
+
+    fclose(in);
+}
+
+/**
+ * Reads the payload of a request, runs it and sends the response.
+ * @param[in] worker The worker, holding the header line.
+ * @param[in] in The connection for reading.
+ * @param[in] fd The connection for writing.
+ * @return 0 to continue with the next request, -1 to close the connection.
+ */
+
+int8_t serverRequest(server_worker_t *worker, FILE *in, int fd)
+{
+    char *argv[SERVER_MAX_ARGS];
+    char *saveptr = NULL;
+    char *end = NULL;
+    char response[64];
+    struct timespec start, stop;
+    jsonmtz_ctx_t *previous = NULL;
+    unsigned long long length;
+    int argc = 0;
+    int status;
+    long micros;
+    int n;
+
+    if (!strchr(worker->header, '\n'))
+    {
+        return -1; // Header too long
+    }
+
+    worker->header[strcspn(worker->header, "\r\n")] = '\0';
+
+    for (char *token = strtok_r(worker->header, " ", &saveptr); token; token = strtok_r(NULL, " ", &saveptr))
+    {
+        if (argc == SERVER_MAX_ARGS)
+        {
+            return -1;
+        }
+        argv[argc++] = token;
+    }
+
+    if (argc < 1)
+    {
+        return -1;
+    }
+
+    errno = 0;
+    length = strtoull(argv[0], &end, 10);
+    if (errno || *end != '\0' || argv[0][0] == '-' || length > SERVER_MAX_PAYLOAD ||
+        serverBufferReserve(&worker->input, length) != 0 ||
+        fread(worker->input.data, 1, length, in) != length)
+    {
+        return -1; // The payload cannot be skipped
+    }
+
+    worker->input.length = length;
+    worker->output.length = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    previous = jsonmtzCtxUse(worker->ctx);
+    status = serverExecute(worker, argc - 1, argv + 1);
+    jsonmtzCtxUse(previous);
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+
+    micros = (stop.tv_sec - start.tv_sec) * 1000000L + (stop.tv_nsec - start.tv_nsec) / 1000L;
+    status != 0 ? worker->output.length = 0 : 0;
+
+    if (worker->server->verbose)
+    {
+        fprintf(stderr, "%s %s %s %d %ld us\n", argc > 1 ? argv[1] : "-",
+                argc > 3 ? argv[argc - 2] : "-", argc > 3 ? argv[argc - 1] : "-", status, micros);
+    }
+
+    n = snprintf(response, sizeof(response), "%d %ld %zu\n", status, micros, worker->output.length);
+
+    if (serverWriteAll(fd, response, n) != 0 ||
+        serverWriteAll(fd, worker->output.data, worker->output.length) != 0)
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Runs a conversion request.
+ * @param[in] worker The worker, holding the payload in worker->input.
+ * @param[in] argc The number of arguments.
+ * @param[in] argv The command, options, input and output.
+ * @return The return value of the conversion, or -2 for malformed requests.
+ */
+
+int serverExecute(server_worker_t *worker, int argc, char **argv)
+{
+    options_mtz2json_t mtzopts;
+    options_json2mtz_t jsonopts;
+    const char *file_in, *file_out;
+    const unsigned char *data = NULL;
+    size_t length = 0;
+    uint8_t tomtz;
+    int ret;
+
+    if (argc < 3)
+    {
+        return -2;
+    }
+
+    if (strcmp(argv[0], "mtz2json") == 0)
+    {
+        tomtz = 0;
+    }
+    else if (strcmp(argv[0], "json2mtz") == 0)
+    {
+        tomtz = 1;
+    }
+    else
+    {
+        return -2;
+    }
+
+    defaultMtz2jsonOptions(&mtzopts);
+    defaultJson2mtzOptions(&jsonopts);
+
+    // Options are short flags, with values as separate tokens
+    for (int i = 1; i < argc - 2; i++)
+    {
+        const char *value = NULL;
+        int option;
+
+        if (argv[i][0] != '-' || argv[i][1] == '\0' || argv[i][2] != '\0')
+        {
+            return -2;
+        }
+
+        option = argv[i][1];
+
+        if (strchr(tomtz ? "F" : "meFzwsS", option))
+        {
+            if (++i == argc - 2)
+            {
+                return -2;
+            }
+            value = argv[i];
+        }
+
+        if ((tomtz ? setJson2mtzOption(&jsonopts, option, value) : setMtz2jsonOption(&mtzopts, option, value)) != 0)
+        {
+            return -2;
+        }
+    }
+
+    file_in = argv[argc - 2];
+    file_out = argv[argc - 1];
+
+    // Files on both sides support every format
+    if (strcmp(file_in, "-") != 0 && strcmp(file_out, "-") != 0)
+    {
+        return tomtz ? json2mtz(file_in, file_out, &jsonopts) : mtz2json(file_in, file_out, &mtzopts);
+    }
+
+    if (strcmp(file_in, "-") == 0)
+    {
+        data = worker->input.data;
+        length = worker->input.length;
+    }
+    else
+    {
+        data = mapFile(file_in, &length);
+        if (!data)
+        {
+            return tomtz ? 1 : 2; // Input not readable
+        }
+    }
+
+    if (tomtz)
+    {
+        const void *mtz = NULL;
+        size_t mtzlength = 0;
+
+        ret = json2mtzCtx(worker->ctx, (const char *)data, length, &mtz, &mtzlength, &jsonopts);
+
+        if (ret == 0)
+        {
+            ret = serverCallback(mtz, mtzlength, &worker->output) == 0 ? 0 : 2;
+        }
+    }
+    else
+    {
+        ret = mtz2jsonBuffer(data, length, serverCallback, &worker->output, &mtzopts);
+    }
+
+    data != worker->input.data ? unmapFile(data, length) : 0;
+
+    // Write the converted data to the output file
+    if (ret == 0 && strcmp(file_out, "-") != 0)
+    {
+        FILE *fp = openOutput(file_out);
+
+        if (!fp ||
+            fwrite(worker->output.data, 1, worker->output.length, fp) != worker->output.length)
+        {
+            ret = -1;
+        }
+
+        fp && closeOutput(fp) != 0 ? ret = -1 : 0;
+        worker->output.length = 0;
+    }
+
+    return ret;
+}
+
+/**
+ * Appends data to a server_buffer_t, see json_dump_callback().
+ * @param[in] buffer The data.
+ * @param[in] size The number of bytes.
+ * @param[in] data The server_buffer_t.
+ * @return 0 on success, -1 on failure.
+ */
+
+int serverCallback(const char *buffer, size_t size, void *data)
+{
+    server_buffer_t *out = data;
+
+    if (serverBufferReserve(out, out->length + size) != 0)
+    {
+        return -1;
+    }
+
+    memcpy(out->data + out->length, buffer, size);
+    out->length += size;
+
+    return 0;
+}
+
+/**
+ * Grows a server_buffer_t to hold at least the given number of bytes.
+ * The buffer never shrinks, so it is reused by later requests.
+ * @param[in] buffer The buffer.
+ * @param[in] capacity The required capacity in bytes.
+ * @return 0 on success, -1 on failure.
+ */
+
+int8_t serverBufferReserve(server_buffer_t *buffer, size_t capacity)
+{
+    unsigned char *data = NULL;
+    size_t grown = buffer->capacity ? buffer->capacity : 65536;
+
+    if (capacity <= buffer->capacity)
+    {
+        return 0;
+    }
+
+    while (grown < capacity)
+    {
+        grown *= 2;
+    }
+
+    data = realloc(buffer->data, grown);
+    if (!data)
+    {
+        return -1;
+    }
+
+    buffer->data = data;
+    buffer->capacity = grown;
+
+    return 0;
+}
+
+/**
+ * Writes all data to a socket.
+ * @param[in] fd The socket.
+ * @param[in] data The data.
+ * @param[in] length The number of bytes.
+ * @return 0 on success, -1 on failure.
+ */
+
+int8_t serverWriteAll(int fd, const void *data, size_t length)
+{
+    const unsigned char *pos = data;
+
+    while (length > 0)
+    {
+        ssize_t n = send(fd, pos, length, MSG_NOSIGNAL);
+
+        if (n == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+
+        pos += n;
+        length -= n;
+    }
+
+    return 0;
+}
+
+/**
+ * Connects to a server.
+ * @param[in] path Path of the socket.
+ * @return The connection, or -1 on failure.
+ */
+
+int serverConnect(const char *path)
+{
+    struct sockaddr_un addr;
+    int fd;
+
+    if (strlen(path) >= sizeof(addr.sun_path))
+    {
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1)
+    {
+        return -1;
+    }
+
+#ifdef SO_NOSIGPIPE
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &(int){1}, sizeof(int));
+#endif
+
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1)
+    {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/**
+ * Sends a request to a server and receives the response.
+ * @param[in] fd The connection.
+ * @param[in] in The connection for reading, see fdopen().
+ * @param[in] argc The number of arguments.
+ * @param[in] argv The command, options, input and output. Must not contain whitespace.
+ * @param[in] payload The input data if the input is "-", or NULL.
+ * @param[in] length The length of the payload.
+ * @param[out] response The output data if the output is "-".
+ * @param[out] status The status of the conversion.
+ * @param[out] micros The time spent converting in microseconds.
+ * @return 0 on success, -1 on failure.
+ */
+
+int8_t serverClientRequest(int fd, FILE *in, int argc, char **argv, const void *payload, size_t length,
+                           server_buffer_t *response, int *status, long *micros)
+{
+    char header[SERVER_MAX_HEADER];
+    size_t pos;
+    size_t rlength;
+
+    pos = snprintf(header, sizeof(header), "%zu", length);
+
+    for (int i = 0; i < argc; i++)
+    {
+        if (argv[i][0] == '\0' || strpbrk(argv[i], " \t\r\n") ||
+            pos + strlen(argv[i]) + 2 > sizeof(header))
+        {
+            return -1;
+        }
+        pos += sprintf(header + pos, " %s", argv[i]);
+    }
+    header[pos++] = '\n';
+
+    if (serverWriteAll(fd, header, pos) != 0 || serverWriteAll(fd, payload, length) != 0)
+    {
+        return -1;
+    }
+
+    if (!fgets(header, sizeof(header), in) ||
+        sscanf(header, "%d %ld %zu", status, micros, &rlength) != 3 ||
+        serverBufferReserve(response, rlength) != 0 ||
+        fread(response->data, 1, rlength, in) != rlength)
+    {
+        return -1;
+    }
+
+    response->length = rlength;
+
+    return 0;
+}
+
+#endif
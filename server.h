@@ -0,0 +1,81 @@
+/*
+ * server.h: Conversion server on a Unix domain socket
+ *
+ * Copyright (c) 2017 Frank Buermann <fburmann@mrc-lmb.cam.ac.uk>
+ *
+ * jsonmtz is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ * This software makes use of the jansson library (http://www.digip.org/jansson/)
+ * licensed under the terms of the MIT license,
+ * and the CCP4io library (http://www.ccp4.ac.uk/) licensed under the
+ * Lesser GNU General Public License 3.0.
+ */
+
+/*
+ * Built into jsonmtzd and jsonmtzc only, not into the jsonmtz library.
+ */
+
+#pragma once
+
+#include <signal.h>
+#include "jsonmtz.h"
+
+#define SERVER_SOCKET "/tmp/jsonmtzd.sock"
+#define SERVER_MAX_THREADS 64
+#define SERVER_MAX_HEADER 4096
+#define SERVER_MAX_ARGS 32
+#define SERVER_MAX_PAYLOAD ((size_t)1 << 34)
+#define SERVER_BACKLOG 64
+#define SERVER_QUEUE 256
+
+typedef struct server_buffer_t
+{
+    unsigned char *data;
+    size_t length;
+    size_t capacity;
+} server_buffer_t;
+
+typedef struct server_worker_t
+{
+    struct server_t *server;
+    pthread_t thread;
+    volatile int fd;
+    struct jsonmtz_ctx_t *ctx;
+    server_buffer_t input;
+    server_buffer_t output;
+    char header[SERVER_MAX_HEADER];
+} server_worker_t;
+
+typedef struct server_t
+{
+    char *path;
+    int listener;
+    bool bound;
+    bool initialized;
+    bool verbose;
+    volatile sig_atomic_t stop;
+    server_worker_t *workers;
+    size_t nworkers;
+    size_t nthreads;
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    int queue[SERVER_QUEUE];
+    size_t head;
+    size_t count;
+} server_t;
+
+server_t *serverNew(const char *path, size_t nthreads, bool verbose);
+int8_t serverRun(server_t *server);
+void serverJoin(server_t *server);
+void serverStop(server_t *server);
+void serverFree(server_t *server);
+void *serverWorker(void *arg);
+void serverConnection(server_worker_t *worker, int fd);
+int8_t serverRequest(server_worker_t *worker, FILE *in, int fd);
+int serverExecute(server_worker_t *worker, int argc, char **argv);
+int serverCallback(const char *buffer, size_t size, void *data);
+int8_t serverBufferReserve(server_buffer_t *buffer, size_t capacity);
+int8_t serverWriteAll(int fd, const void *data, size_t length);
+int serverConnect(const char *path);
+int8_t serverClientRequest(int fd, FILE *in, int argc, char **argv, const void *payload, size_t length,
+                           server_buffer_t *response, int *status, long *micros);
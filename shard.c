@@ -0,0 +1,499 @@
+/*
+ * shard.c: Sharded JSON output and its reassembly
+ *
+ * Copyright (c) 2017 Frank Buermann <fburmann@mrc-lmb.cam.ac.uk>
+ *
+ * jsonmtz is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ * This software makes use of the jansson library (http://www.digip.org/jansson/)
+ * licensed under the terms of the MIT license,
+ * and the CCP4io library (http://www.ccp4.ac.uk/) licensed under the
+ * Lesser GNU General Public License 3.0.
+ */
+
+/*
+ * The reflections are split into contiguous ranges of nearly equal length,
+ * and each range is written to its own shard file:
+ *
+ *     {"First":0,"Length":1000,"Rows":[[1,0,0,12.5,...],...]}
+ *
+ * A row holds the values of the columns in document order. The manifest is
+ * the json object produced by readMtz() with DataEncoding "shard" for every
+ * column, and the key Shards listing the file, first reflection and length
+ * of each shard. Shards only depend on the MTZ file, so they can be written
+ * by separate processes, and each writer reads its range of the reflection
+ * block through its own handle. Shards are written and read back by a pool
+ * of threads taking them in turn.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include "jsonmtz.h"
+
+/**
+ * Writes the shards of an MTZ file and their manifest. The manifest is
+ * written together with shard 0, so when shards are written by separate
+ * processes it can exist before the other shards are complete.
+ * @param[in] mtzin The MTZ struct, read without reflections.
+ * @param[in] file_in The MTZ file, opened again by each shard writer.
+ * @param[in] file_out The manifest file. Shards are named by shardFilename().
+ * @param[in] opts Options struct. opts->shards is the number of shards, and
+ * opts->shard selects one of them, or SHARD_ALL.
+ * @return 0 on success, -1 on failure.
+ */
+
+int8_t writeShards(const MTZ *mtzin, const char *file_in, const char *file_out, const options_mtz2json_t *opts)
+{
+    shard_job_t *jobs = calloc(opts->shards, sizeof(shard_job_t));
+    size_t nref = mtzin->nref_filein;
+    size_t length = nref / opts->shards;
+    size_t remainder = nref % opts->shards;
+    size_t first = opts->shard == SHARD_ALL ? 0 : opts->shard;
+    size_t last = opts->shard == SHARD_ALL ? opts->shards : opts->shard + 1;
+    int8_t ret = jobs ? 0 : -1;
+
+    for (size_t i = 0; i < opts->shards && ret == 0; i++)
+    {
+        jobs[i].file_in = file_in;
+        jobs[i].path = shardFilename(file_out, i);
+        // The first shards take one more reflection, without overflowing nref * i
+        jobs[i].first = length * i + (i < remainder ? i : remainder);
+        jobs[i].count = length + (i < remainder ? 1 : 0);
+        jobs[i].opts = opts;
+        !jobs[i].path ? ret = -1 : 0;
+    }
+
+    ret == 0 ? ret = runShardJobs(jobs + first, last - first, writeShard) : 0;
+    ret == 0 && first == 0 ? ret = writeShardManifest(mtzin, jobs, opts->shards, file_out, opts) : 0;
+
+    for (size_t i = 0; jobs && i < opts->shards; i++)
+    {
+        free(jobs[i].path);
+    }
+    free(jobs);
+
+    return ret;
+}
+
+/**
+ * Writes the manifest of a set of shards.
+ * @param[in] mtzin The MTZ struct.
+ * @param[in] jobs The shards.
+ * @param[in] njobs The number of shards.
+ * @param[in] file_out The manifest file.
+ * @param[in] opts Options struct.
+ * @return 0 on success, -1 on failure.
+ */
+
+int8_t writeShardManifest(const MTZ *mtzin, const shard_job_t *jobs, size_t njobs, const char *file_out, const options_mtz2json_t *opts)
+{
+    options_mtz2json_t metadata = *opts;
+    json_t *jsonmtz = NULL;
+    json_t *jcrystals = NULL;
+    json_t *jshards = json_array();
+    size_t format = opts->compact ? 0 : JSON_INDENT(4);
+    int8_t ret;
+
+    metadata.encoding = ENCODING_NONE; // Column data are in the shards
+    jsonmtz = readMtz(mtzin, &metadata);
+    json_unpack(jsonmtz, "{s:o}", "Crystals", &jcrystals);
+
+    for (size_t i = 0; i < mtzin->nxtal; i++)
+    {
+        json_t *jsets = json_object_get(json_array_get(jcrystals, i), "Datasets");
+
+        for (size_t j = 0; j < mtzin->xtal[i]->nset; j++)
+        {
+            json_t *jcols = json_object_get(json_array_get(jsets, j), "Columns");
+
+            for (size_t k = 0; k < mtzin->xtal[i]->set[j]->ncol; k++)
+            {
+                json_t *jcol = json_array_get(jcols, k);
+
+                json_object_set_new(jcol, "DataEncoding", json_string(columnEncodingName(COLUMN_SHARD)));
+                json_object_set_new(jcol, "Data", json_pack("{s:I}", "Length", (json_int_t)mtzin->nref_filein));
+            }
+        }
+    }
+
+    for (size_t i = 0; i < njobs; i++)
+    {
+        json_array_append_new(jshards, json_pack("{s:s, s:I, s:I}", "File", baseName(jobs[i].path),
+                                                 "First", (json_int_t)jobs[i].first, "Length", (json_int_t)jobs[i].count));
+    }
+    json_object_set_new(jsonmtz, "Shards", jshards);
+
+    opts->missing == MISSING_NAN ? format |= JSON_ENCODE_NAN : 0;
+    ret = json_dump_file(jsonmtz, file_out, format | JSON_COMPACT);
+    json_decref(jsonmtz);
+
+    return ret;
+}
+
+/**
+ * Writes one shard. The MTZ file is opened again, and the range of
+ * reflections is read from it in windows of whole records.
+ * @param[in] job The shard.
+ * @return 0 on success, -1 on failure.
+ */
+
+int8_t writeShard(shard_job_t *job)
+{
+    MTZ *mtzin = getMtz(job->file_in, 0);
+    size_t ncol = mtzin ? mtzin->ncol_read : 0;
+    size_t window = job->opts->window ? job->opts->window : JSON_GENERATOR_WINDOW;
+    size_t windowrows = 0;
+    const char *missing = missingToken(job->opts->missing);
+    size_t missinglen = strlen(missing);
+    size_t valuelength = missinglen > MAX_REFLECTION_LENGTH ? missinglen : MAX_REFLECTION_LENGTH;
+    size_t *sources = NULL;
+    uint8_t *integral = NULL;
+    float *records = NULL;
+    char *line = NULL;
+    size_t nsource = 0;
+    FILE *fp = NULL;
+    int8_t ret = 0;
+
+    if (!mtzin || ncol == 0)
+    {
+        mtzin ? MtzFree(mtzin) : 0;
+        return -1;
+    }
+
+    windowrows = window / (ncol * sizeof(float));
+    windowrows == 0 ? windowrows = 1 : 0;
+    windowrows > INT_MAX / ncol ? windowrows = INT_MAX / ncol : 0;
+    windowrows > job->count ? windowrows = job->count : 0;
+
+    // Columns without a source are rejected below
+    sources = malloc(MtzNumSourceCol(mtzin) * sizeof(size_t) + 1);
+    integral = malloc(MtzNumSourceCol(mtzin) + 1);
+    records = malloc(windowrows * ncol * sizeof(float) + 1);
+    line = malloc(MtzNumSourceCol(mtzin) * (valuelength + 1) + 3);
+    fp = sources && integral && records && line ? fopen(job->path, "wb") : NULL;
+    !fp ? ret = -1 : 0;
+
+    // Position of each column in the reflection record
+    for (size_t i = 0; i < mtzin->nxtal && ret == 0; i++)
+    {
+        for (size_t j = 0; j < mtzin->xtal[i]->nset && ret == 0; j++)
+        {
+            for (size_t k = 0; k < mtzin->xtal[i]->set[j]->ncol && ret == 0; k++)
+            {
+                const MTZCOL *col = mtzin->xtal[i]->set[j]->col[k];
+
+                if (col->source < 1 || (size_t)col->source > ncol)
+                {
+                    ret = -1;
+                    break;
+                }
+
+                sources[nsource] = col->source - 1;
+                integral[nsource++] = isIntegralColumnType(col->type);
+            }
+        }
+    }
+
+    ccp4_file_setmode(mtzin->filein, 2);
+    if (ret == 0 && ccp4_file_seek(mtzin->filein, SIZE1 + (off_t)job->first * ncol, SEEK_SET) != 0)
+    {
+        ret = -1;
+    }
+
+    ret == 0 ? fprintf(fp, "{\"First\":%zu,\"Length\":%zu,\"Rows\":[", job->first, job->count) : 0;
+
+    for (size_t first = 0; first < job->count && ret == 0; first += windowrows)
+    {
+        size_t count = job->count - first < windowrows ? job->count - first : windowrows;
+
+        if (ccp4_file_read(mtzin->filein, (uint8 *)records, count * ncol) != (int)(count * ncol))
+        {
+            ret = -1;
+            break;
+        }
+
+        for (size_t i = 0; i < count && ret == 0; i++)
+        {
+            const float *record = records + i * ncol;
+            size_t length = 0;
+
+            first + i > 0 ? line[length++] = ',' : 0;
+            line[length++] = '[';
+
+            for (size_t j = 0; j < nsource; j++)
+            {
+                j > 0 ? line[length++] = ',' : 0;
+
+                if (ccp4_ismnf(mtzin, record[sources[j]]))
+                {
+                    memcpy(line + length, missing, missinglen);
+                    length += missinglen;
+                }
+                else
+                {
+                    length += formatReflection(record[sources[j]], integral[j], line + length);
+                }
+            }
+            line[length++] = ']';
+
+            fwrite(line, 1, length, fp) != length ? ret = -1 : 0;
+        }
+    }
+
+    ret == 0 && fputs("]}\n", fp) == EOF ? ret = -1 : 0;
+    fp && fclose(fp) != 0 ? ret = -1 : 0;
+
+    free(sources);
+    free(integral);
+    free(records);
+    free(line);
+    MtzFree(mtzin);
+
+    return ret;
+}
+
+/**
+ * Transfers column data from the shards listed in a manifest to an MTZ
+ * struct. The shards must cover the reflections in order without gaps.
+ * @param[in] mtzout The MTZ struct as returned by makeMtz().
+ * @param[in] json The manifest the MTZ struct was made from.
+ * @param[in] file_in The manifest file. Shards are resolved relative to it.
+ * @return The MTZ struct, or NULL on failure.
+ */
+
+MTZ *setMtzShards(MTZ *mtzout, const json_t *json, const char *file_in)
+{
+    json_t *jcrystals = json_object_get(json, "Crystals");
+    json_t *jshards = json_object_get(json, "Shards");
+    json_t *jshard = NULL;
+    MTZCOL **cols = NULL;
+    shard_job_t *jobs = calloc(json_array_size(jshards) + 1, sizeof(shard_job_t));
+    size_t ncol = 0;
+    size_t next = 0;
+    size_t index;
+    int8_t ret;
+
+    for (size_t i = 0; i < mtzout->nxtal; i++)
+    {
+        for (size_t j = 0; j < mtzout->xtal[i]->nset; j++)
+        {
+            ncol += mtzout->xtal[i]->set[j]->ncol;
+        }
+    }
+
+    cols = malloc(ncol * sizeof(MTZCOL *) + 1);
+    ncol = 0;
+    ret = cols && jobs && json_is_array(jshards) ? 0 : -1;
+
+    // Columns with data in the shards, in document order
+    for (size_t i = 0; i < mtzout->nxtal && ret == 0; i++)
+    {
+        json_t *jsets = json_object_get(json_array_get(jcrystals, i), "Datasets");
+
+        for (size_t j = 0; j < mtzout->xtal[i]->nset; j++)
+        {
+            json_t *jcols = json_object_get(json_array_get(jsets, j), "Columns");
+
+            for (size_t k = 0; k < mtzout->xtal[i]->set[j]->ncol; k++)
+            {
+                if (columnDataEncoding(json_array_get(jcols, k)) == COLUMN_SHARD)
+                {
+                    cols[ncol++] = mtzout->xtal[i]->set[j]->col[k];
+                }
+            }
+        }
+    }
+
+    json_array_foreach(jshards, index, jshard)
+    {
+        json_t *jfile = json_object_get(jshard, "File");
+        json_t *jfirst = json_object_get(jshard, "First");
+        json_t *jlength = json_object_get(jshard, "Length");
+
+        if (ret != 0 || !json_is_string(jfile) || !json_is_integer(jfirst) || !json_is_integer(jlength) ||
+            json_integer_value(jfirst) != (json_int_t)next || json_integer_value(jlength) < 0 ||
+            (size_t)json_integer_value(jlength) > mtzout->nref - next)
+        {
+            ret = -1;
+            break;
+        }
+
+        jobs[index].path = siblingPath(file_in, json_string_value(jfile));
+        jobs[index].first = next;
+        jobs[index].count = json_integer_value(jlength);
+        jobs[index].cols = cols;
+        jobs[index].ncol = ncol;
+        next += jobs[index].count;
+    }
+
+    ret == 0 && next != (size_t)mtzout->nref ? ret = -1 : 0;
+    ret == 0 ? ret = runShardJobs(jobs, json_array_size(jshards), readShard) : 0;
+
+    for (size_t i = 0; jobs && i < json_array_size(jshards); i++)
+    {
+        free(jobs[i].path);
+    }
+    free(jobs);
+    free(cols);
+
+    return ret == 0 ? mtzout : NULL;
+}
+
+/**
+ * Reads one shard into the columns of an MTZ struct.
+ * @param[in] job The shard.
+ * @return 0 on success, -1 on failure.
+ */
+
+int8_t readShard(shard_job_t *job)
+{
+    json_error_t err;
+    json_t *json = decompressLoadFile(job->path, JSON_DECODE_NAN, &err);
+    json_t *jrows = json_object_get(json, "Rows");
+    json_t *jrow = NULL;
+    size_t index;
+    int8_t ret = 0;
+
+    if (!json_is_array(jrows) || json_array_size(jrows) != job->count ||
+        json_integer_value(json_object_get(json, "First")) != (json_int_t)job->first)
+    {
+        json_decref(json);
+        return -1;
+    }
+
+    json_array_foreach(jrows, index, jrow)
+    {
+        if (!json_is_array(jrow) || json_array_size(jrow) != job->ncol)
+        {
+            ret = -1;
+            break;
+        }
+
+        for (size_t j = 0; j < job->ncol; j++)
+        {
+            job->cols[j]->ref[job->first + index] = jsonToReflection(json_array_get(jrow, j));
+        }
+    }
+
+    json_decref(json);
+
+    return ret;
+}
+
+/**
+ * Runs shard jobs on a pool of threads, one per processor at most.
+ * @param[in] jobs The jobs.
+ * @param[in] njobs The number of jobs.
+ * @param[in] run The function running a job.
+ * @return 0 if every job succeeded, -1 otherwise.
+ */
+
+int8_t runShardJobs(shard_job_t *jobs, size_t njobs, int8_t (*run)(shard_job_t *job))
+{
+    shard_queue_t queue;
+    pthread_t threads[SHARD_MAX_THREADS];
+    long nproc = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t nthreads = nproc > 0 ? nproc : 1;
+    size_t started = 0;
+    int8_t ret = 0;
+
+    nthreads > njobs ? nthreads = njobs : 0;
+    nthreads > SHARD_MAX_THREADS ? nthreads = SHARD_MAX_THREADS : 0;
+
+    // Jobs that are not run count as failed
+    for (size_t i = 0; i < njobs; i++)
+    {
+        jobs[i].ret = -1;
+    }
+
+    queue.jobs = jobs;
+    queue.njobs = njobs;
+    queue.next = 0;
+    queue.run = run;
+    pthread_mutex_init(&queue.mutex, NULL);
+
+    for (size_t t = 0; t < nthreads; t++)
+    {
+        if (pthread_create(threads + t, NULL, shardWorker, &queue) != 0)
+        {
+            break;
+        }
+        started++;
+    }
+
+    // The started threads take all jobs
+    started == 0 ? shardWorker(&queue) : 0;
+
+    for (size_t t = 0; t < started; t++)
+    {
+        pthread_join(threads[t], NULL);
+    }
+
+    pthread_mutex_destroy(&queue.mutex);
+
+    for (size_t i = 0; i < njobs; i++)
+    {
+        jobs[i].ret != 0 ? ret = -1 : 0;
+    }
+
+    return ret;
+}
+
+/**
+ * Worker thread taking shard jobs from a queue until it is empty.
+ * @param[in] arg The shard_queue_t.
+ * @return NULL.
+ */
+
+void *shardWorker(void *arg)
+{
+    shard_queue_t *queue = arg;
+    void *previous = useCLocale(); // Threads start in the global locale
+
+    while (TRUE)
+    {
+        shard_job_t *job = NULL;
+
+        pthread_mutex_lock(&queue->mutex);
+        queue->next < queue->njobs ? job = queue->jobs + queue->next++ : 0;
+        pthread_mutex_unlock(&queue->mutex);
+
+        if (!job)
+        {
+            break;
+        }
+
+        job->ret = queue->run(job);
+    }
+
+    restoreLocale(previous);
+
+    return NULL;
+}
+
+/**
+ * Makes the filename of a shard by inserting its index before the
+ * extension of the manifest file, e.g. out.3.json for out.json.
+ * @param[in] file_out The manifest file.
+ * @param[in] index The index of the shard.
+ * @return The shard filename, or NULL on failure. Must be freed by the caller.
+ */
+
+char *shardFilename(const char *file_out, size_t index)
+{
+    const char *base = baseName(file_out);
+    const char *dot = strrchr(base, '.');
+    size_t stem = dot && dot != base ? (size_t)(dot - file_out) : strlen(file_out);
+    char *shard = malloc(strlen(file_out) + 24);
+
+    if (shard)
+    {
+        memcpy(shard, file_out, stem);
+        sprintf(shard + stem, ".%zu%s", index, file_out + stem);
+    }
+
+    return shard;
+}
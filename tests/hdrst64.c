@@ -0,0 +1,170 @@
+/*
+ * hdrst64.c: MTZ header position beyond 2^31 words
+ *
+ * Copyright (c) 2017 Frank Buermann <fburmann@mrc-lmb.cam.ac.uk>
+ *
+ * jsonmtz is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ * This software makes use of the jansson library (http://www.digip.org/jansson/)
+ * licensed under the terms of the MIT license,
+ * and the CCP4io library (http://www.ccp4.ac.uk/) licensed under the
+ * Lesser GNU General Public License 3.0.
+ */
+
+/*
+ * The file is written in on-disk mode, with only the first and the last
+ * reflection stored and a hole of about 8 GiB between them, so that it is
+ * sparse on file systems supporting it. The header then starts beyond
+ * 2^31 words: word 1 must hold -1 and words HDRST64 and HDRST64 + 1 the
+ * 64-bit position, low word first. MtzGet() must read the header back and
+ * find both reflections.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include "jsonmtz.h"
+
+#define TEST_MTZ "hdrst64.mtz"
+#define TEST_COLUMNS 4
+#define TEST_REFLECTIONS (((int64_t)1 << 29) + 1)
+
+/**
+ * Writes the first and the last reflection of a sparse MTZ file.
+ * @param[in] path The output filename.
+ * @param[in] first The first reflection.
+ * @param[in] last The last reflection.
+ * @return 0 on success, 1 on failure.
+ */
+
+int writeSparseMtz(const char *path, const float *first, const float *last)
+{
+    static float symm[192][4][4] = {{{1.0f, 0.0f, 0.0f, 0.0f}, {0.0f, 1.0f, 0.0f, 0.0f}, {0.0f, 0.0f, 1.0f, 0.0f}, {0.0f, 0.0f, 0.0f, 1.0f}}};
+    float cell[6] = {50.0f, 60.0f, 70.0f, 90.0f, 90.0f, 90.0f};
+    MTZ *mtz = NULL;
+    MTZXTAL *xtal = NULL;
+    MTZSET *set = NULL;
+    MTZCOL *cols[TEST_COLUMNS];
+    int ret = 0;
+
+    mtz = MtzMalloc(0, NULL);
+    if (!mtz)
+    {
+        return 1;
+    }
+
+    mtz->refs_in_memory = 0;
+    strcpy(mtz->title, "hdrst64");
+    ccp4_lwsymm_c(mtz, 1, 1, symm, "P", 1, "P 1", "PG1", "X");
+    xtal = MtzAddXtal(mtz, "xtal", "proj", cell);
+    set = MtzAddDataset(mtz, xtal, "set", 1.0f);
+    cols[0] = MtzAddColumn(mtz, set, "H", "H");
+    cols[1] = MtzAddColumn(mtz, set, "K", "H");
+    cols[2] = MtzAddColumn(mtz, set, "L", "H");
+    cols[3] = MtzAddColumn(mtz, set, "FP", "F");
+
+    mtz->fileout = MtzOpenForWrite(path);
+    if (!mtz->fileout)
+    {
+        MtzFree(mtz);
+        return 1;
+    }
+
+    // Skip to the record of the last reflection
+    if (ccp4_lwrefl(mtz, first, cols, TEST_COLUMNS, 1))
+    {
+        ccp4_file_setmode(mtz->fileout, 2);
+        ccp4_file_seek(mtz->fileout, SIZE1 + (TEST_REFLECTIONS - 1) * TEST_COLUMNS, SEEK_SET);
+        ret = ccp4_lwrefl(mtz, last, cols, TEST_COLUMNS, TEST_REFLECTIONS) && MtzPut(mtz, path);
+    }
+
+    MtzFree(mtz);
+
+    return ret ? 0 : 1;
+}
+
+/**
+ * Checks the header position words of an MTZ file.
+ * @param[in] path The MTZ filename.
+ * @param[in] hdrst The expected header position in words, counted from 1.
+ * @return 0 if the words match, 1 otherwise.
+ */
+
+int checkHeaderWords(const char *path, int64_t hdrst)
+{
+    int32_t words[HDRST64 + 2];
+    FILE *fp = NULL;
+    size_t n = 0;
+
+    fp = fopen(path, "rb");
+    if (!fp)
+    {
+        return 1;
+    }
+    n = fread(words, sizeof(int32_t), HDRST64 + 2, fp);
+    fclose(fp);
+
+    if (n != HDRST64 + 2 || words[1] != -1 ||
+        ((int64_t)(uint32_t)words[HDRST64] | ((int64_t)words[HDRST64 + 1] << 32)) != hdrst)
+    {
+        return 1;
+    }
+
+    return 0;
+}
+
+int main(void)
+{
+    const float first[TEST_COLUMNS] = {1.0f, 2.0f, 3.0f, 100.0f};
+    const float last[TEST_COLUMNS] = {-4.0f, 5.0f, 6.0f, 42.5f};
+    const int64_t hdrst = TEST_REFLECTIONS * TEST_COLUMNS + SIZE1 + 1;
+    float adata[TEST_COLUMNS];
+    int logmss[TEST_COLUMNS];
+    float resol = 0.0f;
+    MTZ *mtz = NULL;
+    int failed = 0;
+
+    if (hdrst <= INT_MAX || writeSparseMtz(TEST_MTZ, first, last) != 0)
+    {
+        fprintf(stderr, "%s", "Could not write " TEST_MTZ "\n");
+        remove(TEST_MTZ);
+        return 1;
+    }
+
+    if (checkHeaderWords(TEST_MTZ, hdrst) != 0)
+    {
+        fprintf(stderr, "%s", "Wrong 64-bit header position\n");
+        failed = 1;
+    }
+
+    mtz = MtzGet(TEST_MTZ, 0);
+    if (!mtz || MtzNref(mtz) != TEST_REFLECTIONS || MtzNumActiveCol(mtz) != TEST_COLUMNS)
+    {
+        fprintf(stderr, "%s", "Could not read the header back\n");
+        mtz ? MtzFree(mtz) : 0;
+        remove(TEST_MTZ);
+        return 1;
+    }
+
+    if (ccp4_lrrefl(mtz, &resol, adata, logmss, 1) != 0 ||
+        memcmp(adata, first, sizeof(first)) != 0)
+    {
+        fprintf(stderr, "%s", "Wrong first reflection\n");
+        failed = 1;
+    }
+
+    ccp4_file_setmode(mtz->filein, 2);
+    ccp4_file_seek(mtz->filein, SIZE1 + (TEST_REFLECTIONS - 1) * TEST_COLUMNS, SEEK_SET);
+    if (ccp4_lrrefl(mtz, &resol, adata, logmss, TEST_REFLECTIONS) != 0 ||
+        memcmp(adata, last, sizeof(last)) != 0)
+    {
+        fprintf(stderr, "%s", "Wrong last reflection\n");
+        failed = 1;
+    }
+
+    MtzFree(mtz);
+    remove(TEST_MTZ);
+
+    return failed;
+}
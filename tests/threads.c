@@ -0,0 +1,236 @@
+/*
+ * threads.c: Concurrent conversions against a single-threaded reference
+ *
+ * Copyright (c) 2017 Frank Buermann <fburmann@mrc-lmb.cam.ac.uk>
+ *
+ * jsonmtz is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ * This software makes use of the jansson library (http://www.digip.org/jansson/)
+ * licensed under the terms of the MIT license,
+ * and the CCP4io library (http://www.ccp4.ac.uk/) licensed under the
+ * Lesser GNU General Public License 3.0.
+ */
+
+/*
+ * A synthetic MTZ file is converted once on the main thread, which gives
+ * the reference outputs of mtz2jsonBuffer(), json2mtzInto() and mtz2json().
+ * The same conversions then run repeatedly from several threads at once,
+ * each writing its own files, and every result must equal the reference.
+ * Configure with -DJSONMTZ_TSAN=ON to run this under ThreadSanitizer.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "../server.h"
+
+#define TEST_THREADS 8
+#define TEST_ITERATIONS 10
+#define TEST_REFLECTIONS 2000
+#define TEST_MTZ "threads.mtz"
+
+typedef struct thread_test_t
+{
+    pthread_t thread;
+    size_t id;
+    const unsigned char *mtz;
+    size_t mtzlength;
+    const server_buffer_t *json;
+    const void *mtzref;
+    size_t mtzreflength;
+    const unsigned char *file;
+    size_t filelength;
+    size_t failures;
+} thread_test_t;
+
+/**
+ * Writes a small MTZ file with missing values.
+ * @param[in] path The output filename.
+ * @return 0 on success, 1 on failure.
+ */
+
+int writeTestMtz(const char *path)
+{
+    static float symm[192][4][4] = {{{1.0f, 0.0f, 0.0f, 0.0f}, {0.0f, 1.0f, 0.0f, 0.0f}, {0.0f, 0.0f, 1.0f, 0.0f}, {0.0f, 0.0f, 0.0f, 1.0f}}};
+    float cell[6] = {50.0f, 60.0f, 70.0f, 90.0f, 90.0f, 90.0f};
+    float adata[5];
+    MTZ *mtz = NULL;
+    MTZXTAL *xtal = NULL;
+    MTZSET *set = NULL;
+    MTZCOL *cols[5];
+    int64_t i = 0;
+    int ret = 0;
+
+    mtz = MtzMalloc(0, NULL);
+    if (!mtz)
+    {
+        return 1;
+    }
+
+    strcpy(mtz->title, "threads");
+    ccp4_lwsymm_c(mtz, 1, 1, symm, "P", 1, "P 1", "PG1", "X");
+    xtal = MtzAddXtal(mtz, "xtal", "proj", cell);
+    set = MtzAddDataset(mtz, xtal, "set", 1.0f);
+    cols[0] = MtzAddColumn(mtz, set, "H", "H");
+    cols[1] = MtzAddColumn(mtz, set, "K", "H");
+    cols[2] = MtzAddColumn(mtz, set, "L", "H");
+    cols[3] = MtzAddColumn(mtz, set, "FP", "F");
+    cols[4] = MtzAddColumn(mtz, set, "SIGFP", "Q");
+
+    for (i = 1; i <= TEST_REFLECTIONS; ++i)
+    {
+        adata[0] = (float)(i % 41 - 20);
+        adata[1] = (float)(i / 41 % 31);
+        adata[2] = (float)(i / 1271);
+        adata[3] = i % 7 == 0 ? NAN : 1000.0f / (float)i;
+        adata[4] = i % 11 == 0 ? NAN : 0.125f * (float)(i % 97);
+        ccp4_lwrefl(mtz, adata, cols, 5, i);
+    }
+
+    ret = MtzPut(mtz, path);
+    MtzFree(mtz);
+
+    return ret ? 0 : 1;
+}
+
+/**
+ * Runs the conversions of one thread and counts the results differing
+ * from the reference.
+ * @param[in] arg The thread_test_t of the thread.
+ * @return NULL.
+ */
+
+void *runThreadTest(void *arg)
+{
+    thread_test_t *test = arg;
+    options_mtz2json_t mtzopts;
+    options_json2mtz_t jsonopts;
+    server_buffer_t json = {NULL, 0, 0};
+    void *mtz = NULL;
+    size_t capacity = 0;
+    size_t mtzlength = 0;
+    const unsigned char *file = NULL;
+    size_t filelength = 0;
+    char path[64];
+    size_t i = 0;
+
+    defaultMtz2jsonOptions(&mtzopts);
+    defaultJson2mtzOptions(&jsonopts);
+    mtzopts.timestamp = 0;
+    jsonopts.timestamp = 0;
+    sprintf(path, "threads.%zu.json", test->id);
+
+    for (i = 0; i < TEST_ITERATIONS; ++i)
+    {
+        json.length = 0;
+        if (mtz2jsonBuffer(test->mtz, test->mtzlength, serverCallback, &json, &mtzopts) != 0 ||
+            json.length != test->json->length || memcmp(json.data, test->json->data, json.length) != 0)
+        {
+            test->failures++;
+            continue;
+        }
+
+        if (json2mtzInto((const char *)json.data, json.length, &mtz, &capacity, &mtzlength, &jsonopts) != 0 ||
+            mtzlength != test->mtzreflength || memcmp(mtz, test->mtzref, mtzlength) != 0)
+        {
+            test->failures++;
+        }
+
+        if (mtz2json(TEST_MTZ, path, &mtzopts) != 0)
+        {
+            test->failures++;
+            continue;
+        }
+
+        file = mapFile(path, &filelength);
+        if (!file || filelength != test->filelength || memcmp(file, test->file, filelength) != 0)
+        {
+            test->failures++;
+        }
+        file ? unmapFile(file, filelength) : (void)0;
+    }
+
+    remove(path);
+    free(json.data);
+    free(mtz);
+
+    return NULL;
+}
+
+int main(void)
+{
+    thread_test_t tests[TEST_THREADS];
+    options_mtz2json_t mtzopts;
+    options_json2mtz_t jsonopts;
+    server_buffer_t json = {NULL, 0, 0};
+    void *mtzref = NULL;
+    size_t capacity = 0;
+    size_t mtzreflength = 0;
+    const unsigned char *mtz = NULL;
+    size_t mtzlength = 0;
+    const unsigned char *file = NULL;
+    size_t filelength = 0;
+    size_t failures = 0;
+    size_t i = 0;
+
+    defaultMtz2jsonOptions(&mtzopts);
+    defaultJson2mtzOptions(&jsonopts);
+    mtzopts.timestamp = 0;
+    jsonopts.timestamp = 0;
+
+    if (writeTestMtz(TEST_MTZ) != 0)
+    {
+        fprintf(stderr, "%s", "Could not write " TEST_MTZ "\n");
+        return 1;
+    }
+
+    // Single-threaded reference outputs
+    mtz = mapFile(TEST_MTZ, &mtzlength);
+    if (!mtz ||
+        mtz2jsonBuffer(mtz, mtzlength, serverCallback, &json, &mtzopts) != 0 ||
+        json2mtzInto((const char *)json.data, json.length, &mtzref, &capacity, &mtzreflength, &jsonopts) != 0 ||
+        mtz2json(TEST_MTZ, "threads.json", &mtzopts) != 0 ||
+        !(file = mapFile("threads.json", &filelength)))
+    {
+        fprintf(stderr, "%s", "Reference conversion failed\n");
+        return 1;
+    }
+
+    for (i = 0; i < TEST_THREADS; ++i)
+    {
+        tests[i].id = i;
+        tests[i].mtz = mtz;
+        tests[i].mtzlength = mtzlength;
+        tests[i].json = &json;
+        tests[i].mtzref = mtzref;
+        tests[i].mtzreflength = mtzreflength;
+        tests[i].file = file;
+        tests[i].filelength = filelength;
+        tests[i].failures = 0;
+        if (pthread_create(&tests[i].thread, NULL, runThreadTest, &tests[i]) != 0)
+        {
+            fprintf(stderr, "%s", "Could not start thread\n");
+            return 1;
+        }
+    }
+
+    for (i = 0; i < TEST_THREADS; ++i)
+    {
+        pthread_join(tests[i].thread, NULL);
+        if (tests[i].failures)
+        {
+            fprintf(stderr, "Thread %zu: %zu of %d conversions differ from the reference\n", i, tests[i].failures, TEST_ITERATIONS);
+        }
+        failures += tests[i].failures;
+    }
+
+    unmapFile(file, filelength);
+    unmapFile(mtz, mtzlength);
+    remove("threads.json");
+    remove(TEST_MTZ);
+    free(json.data);
+    free(mtzref);
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,1365 @@
+/*
+ * validate.c: Streaming validation of JSON reflection files
+ *
+ * Copyright (c) 2017 Frank Buermann <fburmann@mrc-lmb.cam.ac.uk>
+ *
+ * jsonmtz is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ * This software makes use of the jansson library (http://www.digip.org/jansson/)
+ * licensed under the terms of the MIT license,
+ * and the CCP4io library (http://www.ccp4.ac.uk/) licensed under the
+ * Lesser GNU General Public License 3.0.
+ */
+
+/*
+ * The validator reads the JSON text once, in blocks, and checks it against
+ * the layout written by mtz2json without building json values or an MTZ
+ * struct. The known keys of each object are listed in tables with the type
+ * and dimensions of their values; other keys are only checked for syntax.
+ * Column data are checked element by element. Integer arrays of encoded
+ * data are summarised by their count, range, sum and order, so that the
+ * lengths can be checked against the DataEncoding and the other columns
+ * once the column object is complete, whatever the order of its keys.
+ *
+ * The syntax accepted is that of json2mtz: jansson with NaN literals.
+ * Metadata of the wrong type, which json2mtz skips, are reported.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include <math.h>
+#include "jsonmtz.h"
+
+/**
+ * Validates a JSON reflection file. gzip and zstd compressed input is
+ * detected, and - reads from stdin.
+ * @param[in] file_in The input file.
+ * @param[out] error The first error, if any.
+ * @return 0 if valid, 1 if the file is not readable, 2 if invalid.
+ */
+
+int8_t validateJson(const char *file_in, validate_error_t *error)
+{
+    void *previous;
+    decompress_reader_t dr;
+    validator_t v;
+    int8_t ret = 1;
+
+    memset(&dr, 0, sizeof(dr));
+    memset(&v, 0, sizeof(v));
+    memset(error, 0, sizeof(validate_error_t));
+    dr.fp = strcmp(file_in, "-") == 0 ? stdin : fopen(file_in, "rb");
+
+    if (!dr.fp)
+    {
+        return 1;
+    }
+
+    dr.inlen = fread(dr.in, 1, sizeof(dr.in), dr.fp);
+    dr.method = detectCompression(dr.in, dr.inlen);
+
+    if (decompressInit(&dr) == 0)
+    {
+        v.read = decompressCallback;
+        v.data = &dr;
+        v.storage = malloc(VALIDATE_BUFFER);
+        v.buffer = v.storage;
+        v.error = error;
+
+        previous = useCLocale();
+        ret = validateStream(&v) == 0 ? 0 : 2;
+        restoreLocale(previous);
+
+        v.broken ? ret = 1 : 0;
+        free(v.storage);
+    }
+
+    decompressEnd(&dr);
+    dr.fp != stdin ? fclose(dr.fp) : 0;
+
+    return ret;
+}
+
+/**
+ * Validates a JSON reflection document in memory.
+ * @param[in] json The JSON text.
+ * @param[in] length The length of the text in bytes.
+ * @param[out] error The first error, if any.
+ * @return 0 if valid, 2 if invalid.
+ */
+
+int8_t validateJsonBuffer(const char *json, size_t length, validate_error_t *error)
+{
+    void *previous = useCLocale();
+    validator_t v;
+    int8_t ret;
+
+    memset(&v, 0, sizeof(v));
+    memset(error, 0, sizeof(validate_error_t));
+    v.buffer = (const unsigned char *)json;
+    v.length = length;
+    v.error = error;
+
+    ret = validateStream(&v) == 0 ? 0 : 2;
+    restoreLocale(previous);
+
+    return ret;
+}
+
+/**
+ * Validates the document read by a validator.
+ * @param[in] v The validator.
+ * @return 0 if valid, -1 otherwise.
+ */
+
+int8_t validateStream(validator_t *v)
+{
+    static const validate_key_t document = {"Document", VALIDATE_DOCUMENT, 0, {0}, VALIDATE_REQUIRED};
+
+    validateSpace(v);
+
+    if (validateValue(v, &document, 0, NULL, NULL) != 0)
+    {
+        return -1;
+    }
+
+    if (validateSpace(v) != -1)
+    {
+        return validateFail(v, validateOffset(v), "end of input expected");
+    }
+
+    return 0;
+}
+
+/**
+ * Validates a value against a key of the layout.
+ * @param[in] v The validator.
+ * @param[in] spec The key.
+ * @param[in] level The number of array dimensions entered.
+ * @param[in,out] summary Summary of integer or reflection arrays, or NULL.
+ * @param[in,out] column The enclosing column, or NULL.
+ * @return 0 if valid, -1 otherwise.
+ */
+
+int8_t validateValue(validator_t *v, const validate_key_t *spec, size_t level, validate_summary_t *summary, validate_column_t *column)
+{
+    static const validate_key_t reflections = {"Data", VALIDATE_REFLECTION, 1, {0}, 0};
+    uint64_t start = validateOffset(v);
+    validate_token_t token;
+    validate_column_t jcol;
+    size_t count = 0;
+    int c = validatePeek(v);
+
+    if (level < spec->ndims)
+    {
+        if (c != '[')
+        {
+            return validateFail(v, start, "%s: array expected", spec->key);
+        }
+
+        if (++v->depth > VALIDATE_MAX_DEPTH)
+        {
+            return validateFail(v, start, "maximum depth reached");
+        }
+
+        v->pos++;
+        c = validateSpace(v);
+
+        while (c != ']')
+        {
+            if (validateValue(v, spec, level + 1, summary, column) != 0)
+            {
+                return -1;
+            }
+
+            count++;
+            c = validateSpace(v);
+
+            if (c == ',')
+            {
+                v->pos++;
+                validateSpace(v);
+            }
+            else if (c != ']')
+            {
+                return validateFail(v, validateOffset(v), "',' or ']' expected");
+            }
+        }
+
+        v->pos++;
+        v->depth--;
+
+        if (spec->dims[level] != 0 && count != spec->dims[level])
+        {
+            return validateFail(v, start, "%s: %zu elements expected", spec->key, spec->dims[level]);
+        }
+
+        if (spec->flags & VALIDATE_NONEMPTY && count == 0)
+        {
+            return validateFail(v, start, "%s: must not be empty", spec->key);
+        }
+
+        return 0;
+    }
+
+    switch (spec->kind)
+    {
+    case VALIDATE_ANY:
+        return validateAny(v);
+
+    case VALIDATE_STRING:
+        if (c != '"')
+        {
+            return validateFail(v, start, "%s: string expected", spec->key);
+        }
+        return validateString(v, NULL, 0, &count, NULL);
+
+    case VALIDATE_ENCODING:
+        if (c != '"')
+        {
+            return validateFail(v, start, "%s: string expected", spec->key);
+        }
+
+        if (validateString(v, token.text, sizeof(token.text), &count, NULL) != 0)
+        {
+            return -1;
+        }
+
+        column->encoding = count < sizeof(token.text) ? columnEncodingFromName(token.text) : COLUMN_UNKNOWN;
+
+        return column->encoding == COLUMN_UNKNOWN ? validateFail(v, start, "%s: unknown encoding", spec->key) : 0;
+
+    case VALIDATE_INTEGER:
+        if (validateScalar(v, &token) != 0)
+        {
+            return -1;
+        }
+
+        if (token.type != JSON_INTEGER)
+        {
+            return validateFail(v, start, "%s: integer expected", spec->key);
+        }
+
+        summary ? validateSummarise(summary, token.integer) : 0;
+        return 0;
+
+    case VALIDATE_REAL:
+        if (validateScalar(v, &token) != 0)
+        {
+            return -1;
+        }
+
+        return token.type == JSON_REAL ? 0 : validateFail(v, start, "%s: real number expected", spec->key);
+
+    case VALIDATE_REFLECTION:
+        if (validateScalar(v, &token) != 0)
+        {
+            return -1;
+        }
+
+        // Missing values are null, NaN or "NaN"
+        if (token.type != JSON_INTEGER && token.type != JSON_REAL && token.type != JSON_NULL &&
+            !(token.type == JSON_STRING && strcmp(token.text, "NaN") == 0))
+        {
+            return validateFail(v, start, "%s: number, null or NaN expected", spec->key);
+        }
+
+        summary ? summary->count++ : 0;
+        return 0;
+
+    case VALIDATE_DATA:
+        memset(&column->data, 0, sizeof(validate_summary_t));
+        memset(column->member, 0, sizeof(column->member));
+        column->offset = start;
+        column->present = 0;
+        column->type = c == '[' ? JSON_ARRAY : c == '"' ? JSON_STRING : c == '{' ? JSON_OBJECT : JSON_NULL;
+
+        switch (c)
+        {
+        case '[':
+            return validateValue(v, &reflections, 0, &column->data, column);
+        case '"':
+            return validateString(v, NULL, 0, &column->length, column);
+        case '{':
+            return validateObject(v, spec, VALIDATE_DATA, column);
+        default:
+            return validateAny(v);
+        }
+
+    case VALIDATE_COLUMN:
+        memset(&jcol, 0, sizeof(jcol));
+        jcol.encoding = COLUMN_PLAIN;
+        return validateObject(v, spec, VALIDATE_COLUMN, &jcol);
+
+    default:
+        return validateObject(v, spec, spec->kind, column);
+    }
+}
+
+/**
+ * Validates an object of the layout.
+ * @param[in] v The validator.
+ * @param[in] spec The key of the object.
+ * @param[in] kind The kind of object, which selects its keys.
+ * @param[in,out] column The column of column and Data objects.
+ * @return 0 if valid, -1 otherwise.
+ */
+
+int8_t validateObject(validator_t *v, const validate_key_t *spec, validate_kind_t kind, validate_column_t *column)
+{
+    const validate_key_t *keys = NULL;
+    size_t nkeys = 0;
+    uint64_t start = validateOffset(v);
+    uint64_t present = 0;
+    char key[64];
+    size_t keylen;
+    size_t i;
+    int c = validatePeek(v);
+
+    if (c != '{')
+    {
+        return validateFail(v, start, "%s: object expected", spec->key);
+    }
+
+    if (++v->depth > VALIDATE_MAX_DEPTH)
+    {
+        return validateFail(v, start, "maximum depth reached");
+    }
+
+    keys = validateKeys(kind, &nkeys);
+    v->pos++;
+    c = validateSpace(v);
+
+    while (c != '}')
+    {
+        if (c != '"')
+        {
+            return validateFail(v, validateOffset(v), "string or '}' expected");
+        }
+
+        if (validateString(v, key, sizeof(key), &keylen, NULL) != 0)
+        {
+            return -1;
+        }
+
+        for (i = 0; i < nkeys && (keylen >= sizeof(key) || strcmp(keys[i].key, key) != 0); i++)
+        {
+        }
+
+        if (validateSpace(v) != ':')
+        {
+            return validateFail(v, validateOffset(v), "':' expected");
+        }
+
+        v->pos++;
+        validateSpace(v);
+
+        if (i < nkeys)
+        {
+            present |= (uint64_t)1 << i;
+            kind == VALIDATE_DATA ? memset(&column->member[i], 0, sizeof(validate_summary_t)) : 0;
+
+            if (validateValue(v, &keys[i], 0, kind == VALIDATE_DATA ? &column->member[i] : NULL, column) != 0)
+            {
+                return -1;
+            }
+        }
+        else if (validateAny(v) != 0)
+        {
+            return -1;
+        }
+
+        c = validateSpace(v);
+
+        if (c == ',')
+        {
+            v->pos++;
+            c = validateSpace(v);
+            c == '}' ? c = '\0' : 0; // A key must follow
+        }
+        else if (c != '}')
+        {
+            return validateFail(v, validateOffset(v), "',' or '}' expected");
+        }
+    }
+
+    for (i = 0; i < nkeys; i++)
+    {
+        if (keys[i].flags & VALIDATE_REQUIRED && !(present & (uint64_t)1 << i))
+        {
+            return validateFail(v, validateOffset(v), "%s missing", keys[i].key);
+        }
+    }
+
+    v->pos++;
+    v->depth--;
+
+    kind == VALIDATE_DATA ? column->present = present : 0;
+
+    return kind == VALIDATE_COLUMN ? validateColumn(v, column) : 0;
+}
+
+/**
+ * Checks the Data of a complete column object against its DataEncoding
+ * and against the number of reflections of the other columns.
+ * @param[in] v The validator.
+ * @param[in] column The column.
+ * @return 0 if valid, -1 otherwise.
+ */
+
+int8_t validateColumn(validator_t *v, const validate_column_t *column)
+{
+    const validate_summary_t *m = column->member;
+    const char *name = columnEncodingName(column->encoding);
+    json_int_t length = m[VALIDATE_DATA_LENGTH].min;
+    size_t nref = 0;
+
+    switch (column->encoding)
+    {
+    case COLUMN_PLAIN:
+        if (column->type != JSON_ARRAY)
+        {
+            return validateFail(v, column->offset, "Data: array expected for plain encoding");
+        }
+        nref = column->data.count;
+        break;
+
+    case COLUMN_BASE64_F32LE:
+        if (column->type != JSON_STRING || column->base64 == (size_t)-1 || column->base64 % 4 != 0)
+        {
+            return validateFail(v, column->offset, "Data: invalid base64 float32 data");
+        }
+        nref = column->base64 / 4;
+        break;
+
+    case COLUMN_F32LE:
+        if (column->type != JSON_STRING || column->length % 4 != 0)
+        {
+            return validateFail(v, column->offset, "Data: invalid float32 data");
+        }
+        nref = column->length / 4;
+        break;
+
+    default:
+        if (column->type != JSON_OBJECT)
+        {
+            return validateFail(v, column->offset, "Data: object expected for %s encoding", name);
+        }
+
+        if (!(column->present & (uint64_t)1 << VALIDATE_DATA_LENGTH) || length < 0)
+        {
+            return validateFail(v, column->offset, "Data: Length missing or negative");
+        }
+        nref = length;
+    }
+
+    switch (column->encoding)
+    {
+    case COLUMN_MISSING_INDEX:
+        if (!(column->present & (uint64_t)1 << VALIDATE_DATA_MISSING) || !(column->present & (uint64_t)1 << VALIDATE_DATA_VALUES) ||
+            m[VALIDATE_DATA_MISSING].count + m[VALIDATE_DATA_VALUES].count != nref)
+        {
+            return validateFail(v, column->offset, "Data: Missing and Values do not add up to Length");
+        }
+
+        if (m[VALIDATE_DATA_MISSING].count > 0 && (m[VALIDATE_DATA_MISSING].unordered ||
+                                                   m[VALIDATE_DATA_MISSING].min < 0 || m[VALIDATE_DATA_MISSING].max >= length))
+        {
+            return validateFail(v, column->offset, "Data: Missing must ascend within Length");
+        }
+        break;
+
+    case COLUMN_RUN_LENGTH:
+        if (!(column->present & (uint64_t)1 << VALIDATE_DATA_VALUES) || !(column->present & (uint64_t)1 << VALIDATE_DATA_RUNS) ||
+            m[VALIDATE_DATA_VALUES].count != m[VALIDATE_DATA_RUNS].count)
+        {
+            return validateFail(v, column->offset, "Data: Values and Runs differ in length");
+        }
+
+        if ((m[VALIDATE_DATA_RUNS].count > 0 && m[VALIDATE_DATA_RUNS].min < 0) || m[VALIDATE_DATA_RUNS].sum != length)
+        {
+            return validateFail(v, column->offset, "Data: Runs do not add up to Length");
+        }
+        break;
+
+    case COLUMN_DICTIONARY:
+        if (!(column->present & (uint64_t)1 << VALIDATE_DATA_DICTIONARY) || !(column->present & (uint64_t)1 << VALIDATE_DATA_CODES) ||
+            m[VALIDATE_DATA_CODES].count != nref)
+        {
+            return validateFail(v, column->offset, "Data: Codes must have Length elements");
+        }
+
+        if (m[VALIDATE_DATA_CODES].count > 0 && (m[VALIDATE_DATA_CODES].min < 0 ||
+                                                 m[VALIDATE_DATA_CODES].max >= (json_int_t)m[VALIDATE_DATA_DICTIONARY].count))
+        {
+            return validateFail(v, column->offset, "Data: Codes out of range of Dictionary");
+        }
+        break;
+
+    case COLUMN_SPARSE:
+        if (!(column->present & (uint64_t)1 << VALIDATE_DATA_INDICES) || !(column->present & (uint64_t)1 << VALIDATE_DATA_VALUES) ||
+            m[VALIDATE_DATA_INDICES].count != m[VALIDATE_DATA_VALUES].count)
+        {
+            return validateFail(v, column->offset, "Data: Indices and Values differ in length");
+        }
+
+        if (m[VALIDATE_DATA_INDICES].count > 0 && (m[VALIDATE_DATA_INDICES].unordered ||
+                                                   m[VALIDATE_DATA_INDICES].min < 0 || m[VALIDATE_DATA_INDICES].max >= length))
+        {
+            return validateFail(v, column->offset, "Data: Indices must ascend within Length");
+        }
+        break;
+
+    case COLUMN_SIDECAR_F32LE:
+        if (!(column->present & (uint64_t)1 << VALIDATE_DATA_OFFSET) || m[VALIDATE_DATA_OFFSET].min < 0)
+        {
+            return validateFail(v, column->offset, "Data: Offset missing or negative");
+        }
+        break;
+
+    case COLUMN_NPY:
+        if (!(column->present & (uint64_t)1 << VALIDATE_DATA_MEMBER))
+        {
+            return validateFail(v, column->offset, "Data: Member missing");
+        }
+        break;
+
+    default:
+        break;
+    }
+
+    // All columns hold the same reflections
+    if (v->counted && nref != v->nref)
+    {
+        return validateFail(v, column->offset, "Data: %zu reflections, %zu expected", nref, v->nref);
+    }
+
+    v->nref = nref;
+    v->counted = 1;
+
+    return 0;
+}
+
+/**
+ * Checks the syntax of any value.
+ * @param[in] v The validator.
+ * @return 0 if valid, -1 otherwise.
+ */
+
+int8_t validateAny(validator_t *v)
+{
+    validate_token_t token;
+    uint64_t start = validateOffset(v);
+    size_t length;
+    int open = validatePeek(v);
+    int close = open == '{' ? '}' : ']';
+    int c;
+
+    if (open != '{' && open != '[')
+    {
+        return validateScalar(v, &token);
+    }
+
+    if (++v->depth > VALIDATE_MAX_DEPTH)
+    {
+        return validateFail(v, start, "maximum depth reached");
+    }
+
+    v->pos++;
+    c = validateSpace(v);
+
+    while (c != close)
+    {
+        if (open == '{')
+        {
+            if (c != '"')
+            {
+                return validateFail(v, validateOffset(v), "string or '}' expected");
+            }
+
+            if (validateString(v, NULL, 0, &length, NULL) != 0)
+            {
+                return -1;
+            }
+
+            if (validateSpace(v) != ':')
+            {
+                return validateFail(v, validateOffset(v), "':' expected");
+            }
+
+            v->pos++;
+            validateSpace(v);
+        }
+
+        if (validateAny(v) != 0)
+        {
+            return -1;
+        }
+
+        c = validateSpace(v);
+
+        if (c == ',')
+        {
+            v->pos++;
+            c = validateSpace(v);
+            c == close ? c = '\0' : 0; // A value must follow
+        }
+        else if (c != close)
+        {
+            return validateFail(v, validateOffset(v), open == '{' ? "',' or '}' expected" : "',' or ']' expected");
+        }
+    }
+
+    v->pos++;
+    v->depth--;
+
+    return 0;
+}
+
+/**
+ * Reads a string, number or literal.
+ * @param[in] v The validator.
+ * @param[out] token The token. The text of strings is truncated.
+ * @return 0 if valid, -1 otherwise.
+ */
+
+int8_t validateScalar(validator_t *v, validate_token_t *token)
+{
+    uint64_t start = validateOffset(v);
+    size_t length = 0;
+    int c = validatePeek(v);
+
+    memset(token, 0, sizeof(validate_token_t));
+
+    if (c == '"')
+    {
+        token->type = JSON_STRING;
+        return validateString(v, token->text, sizeof(token->text), &token->length, NULL);
+    }
+
+    if (c == '-' || (c >= '0' && c <= '9'))
+    {
+        return validateNumber(v, token);
+    }
+
+    // Literals
+    while ((c = validatePeek(v)) != -1 && ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')) && length < sizeof(token->text) - 1)
+    {
+        token->text[length++] = c;
+        v->pos++;
+    }
+
+    if (strcmp(token->text, "true") == 0)
+    {
+        token->type = JSON_TRUE;
+    }
+    else if (strcmp(token->text, "false") == 0)
+    {
+        token->type = JSON_FALSE;
+    }
+    else if (strcmp(token->text, "null") == 0)
+    {
+        token->type = JSON_NULL;
+    }
+    else if (strcmp(token->text, "NaN") == 0)
+    {
+        token->type = JSON_REAL;
+    }
+    else
+    {
+        return validateFail(v, start, c == -1 && length == 0 ? "premature end of input" : "invalid token");
+    }
+
+    return 0;
+}
+
+/**
+ * Reads a number with the rules of jansson: integers must fit json_int_t
+ * and reals must not overflow.
+ * @param[in] v The validator.
+ * @param[out] token The token, JSON_INTEGER with its value or JSON_REAL.
+ * @return 0 if valid, -1 otherwise.
+ */
+
+int8_t validateNumber(validator_t *v, validate_token_t *token)
+{
+    uint64_t start = validateOffset(v);
+    uint64_t magnitude = 0;
+    uint8_t negative = 0;
+    uint8_t big = 0;
+    uint8_t zero = 1;
+    long intdigits = 0;
+    long leading = 0;
+    long exponent = 0;
+    long e10;
+    size_t length = 0;
+    int c = validatePeek(v);
+
+    // The text is kept for the overflow check of large reals
+    c == '-' ? negative = 1, token->text[length++] = c, v->pos++, c = validatePeek(v) : 0;
+
+    if (c == '0')
+    {
+        token->text[length++] = c;
+        v->pos++;
+        c = validatePeek(v);
+
+        if (c >= '0' && c <= '9')
+        {
+            return validateFail(v, start, "invalid number");
+        }
+    }
+    else if (c >= '1' && c <= '9')
+    {
+        zero = 0;
+        while (c >= '0' && c <= '9')
+        {
+            magnitude > (UINT64_MAX - (c - '0')) / 10 ? big = 1 : 0;
+            magnitude = magnitude * 10 + (c - '0');
+            intdigits++;
+            length < sizeof(token->text) - 1 ? token->text[length++] = c : 0;
+            v->pos++;
+            c = validatePeek(v);
+        }
+    }
+    else
+    {
+        return validateFail(v, start, "invalid number");
+    }
+
+    token->type = JSON_INTEGER;
+
+    if (c == '.')
+    {
+        token->type = JSON_REAL;
+        length < sizeof(token->text) - 1 ? token->text[length++] = c : 0;
+        v->pos++;
+        c = validatePeek(v);
+
+        if (c < '0' || c > '9')
+        {
+            return validateFail(v, start, "invalid number");
+        }
+
+        while (c >= '0' && c <= '9')
+        {
+            // Zeros before the first significant digit of 0.000...
+            zero && c == '0' ? leading++ : 0;
+            c != '0' ? zero = 0 : 0;
+            length < sizeof(token->text) - 1 ? token->text[length++] = c : 0;
+            v->pos++;
+            c = validatePeek(v);
+        }
+    }
+
+    if (c == 'e' || c == 'E')
+    {
+        uint8_t expnegative = 0;
+
+        token->type = JSON_REAL;
+        length < sizeof(token->text) - 1 ? token->text[length++] = c : 0;
+        v->pos++;
+        c = validatePeek(v);
+
+        if (c == '+' || c == '-')
+        {
+            expnegative = c == '-';
+            length < sizeof(token->text) - 1 ? token->text[length++] = c : 0;
+            v->pos++;
+            c = validatePeek(v);
+        }
+
+        if (c < '0' || c > '9')
+        {
+            return validateFail(v, start, "invalid number");
+        }
+
+        while (c >= '0' && c <= '9')
+        {
+            exponent < 100000 ? exponent = exponent * 10 + (c - '0') : 0;
+            length < sizeof(token->text) - 1 ? token->text[length++] = c : 0;
+            v->pos++;
+            c = validatePeek(v);
+        }
+
+        expnegative ? exponent = -exponent : 0;
+    }
+
+    if (token->type == JSON_INTEGER)
+    {
+        if (big || magnitude > (uint64_t)VALIDATE_INTEGER_MAX + negative)
+        {
+            return validateFail(v, start, negative ? "too big negative integer" : "too big integer");
+        }
+
+        token->integer = negative ? (json_int_t)(0 - magnitude) : (json_int_t)magnitude;
+        return 0;
+    }
+
+    // Decimal exponent of the leading significant digit
+    e10 = intdigits > 0 ? intdigits - 1 + exponent : exponent - leading - 1;
+
+    if (!zero && e10 >= 308)
+    {
+        if (e10 > 308 || (length < sizeof(token->text) - 1 && isinf(strtod(token->text, NULL))))
+        {
+            return validateFail(v, start, "real number overflow");
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Reads a string, checking escapes and UTF-8. For the Data of a column, the
+ * decoded string is also checked as base64.
+ * @param[in] v The validator.
+ * @param[out] out Buffer for the decoded string, or NULL. Truncated to outsize - 1 bytes.
+ * @param[in] outsize The size of the buffer.
+ * @param[out] length The length of the decoded string in bytes.
+ * @param[out] column The column whose Data string is read, or NULL.
+ * @return 0 if valid, -1 otherwise.
+ */
+
+int8_t validateString(validator_t *v, char *out, size_t outsize, size_t *length, validate_column_t *column)
+{
+    unsigned char bytes[4];
+    size_t nbytes;
+    size_t n = 0;
+    uint8_t invalid = 0;
+    unsigned char last[2] = {0, 0};
+    int c;
+
+    v->pos++; // Opening quote
+
+    while (TRUE)
+    {
+        uint64_t start = validateOffset(v);
+
+        c = validateNext(v);
+
+        if (c == -1)
+        {
+            return validateFail(v, start, "premature end of input");
+        }
+
+        if (c == '"')
+        {
+            break;
+        }
+
+        if (c < 0x20)
+        {
+            return validateFail(v, start, "control character in string");
+        }
+
+        if (c == '\\')
+        {
+            if (validateEscape(v, start, bytes, &nbytes) != 0)
+            {
+                return -1;
+            }
+        }
+        else if (c >= 0x80)
+        {
+            if (validateUtf8(v, start, c, bytes, &nbytes) != 0)
+            {
+                return -1;
+            }
+        }
+        else
+        {
+            bytes[0] = c;
+            nbytes = 1;
+        }
+
+        for (size_t i = 0; i < nbytes; i++, n++)
+        {
+            out && n < outsize - 1 ? out[n] = bytes[i] : 0;
+
+            // Padding is allowed in the last two characters of a group
+            if (column && !validateBase64(bytes[i]) && !(bytes[i] == '=' && n % 4 >= 2))
+            {
+                invalid = 1;
+            }
+
+            last[0] = last[1];
+            last[1] = bytes[i];
+        }
+    }
+
+    out ? out[n < outsize - 1 ? n : outsize - 1] = '\0' : 0;
+    *length = n;
+
+    if (column)
+    {
+        column->base64 = invalid || n % 4 != 0 ? (size_t)-1 : n / 4 * 3 - (last[1] == '=') - (last[0] == '=' && n > 1);
+    }
+
+    return 0;
+}
+
+/**
+ * Decodes an escape sequence of a string.
+ * @param[in] v The validator, after the backslash.
+ * @param[in] start The offset of the backslash.
+ * @param[out] bytes The UTF-8 bytes of the character.
+ * @param[out] nbytes The number of bytes.
+ * @return 0 if valid, -1 otherwise.
+ */
+
+int8_t validateEscape(validator_t *v, uint64_t start, unsigned char *bytes, size_t *nbytes)
+{
+    uint32_t code = 0;
+    uint32_t low = 0;
+    int c = validateNext(v);
+
+    *nbytes = 1;
+
+    switch (c)
+    {
+    case '"':
+    case '\\':
+    case '/':
+        bytes[0] = c;
+        return 0;
+    case 'b':
+        bytes[0] = '\b';
+        return 0;
+    case 'f':
+        bytes[0] = '\f';
+        return 0;
+    case 'n':
+        bytes[0] = '\n';
+        return 0;
+    case 'r':
+        bytes[0] = '\r';
+        return 0;
+    case 't':
+        bytes[0] = '\t';
+        return 0;
+    case 'u':
+        break;
+    default:
+        return validateFail(v, start, "invalid escape");
+    }
+
+    if (validateHex(v, &code) != 0)
+    {
+        return validateFail(v, start, "invalid escape");
+    }
+
+    if (code >= 0xd800 && code <= 0xdbff)
+    {
+        // Surrogate pair
+        if (validateNext(v) != '\\' || validateNext(v) != 'u' || validateHex(v, &low) != 0 || low < 0xdc00 || low > 0xdfff)
+        {
+            return validateFail(v, start, "invalid Unicode surrogate pair");
+        }
+        code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+    }
+    else if (code >= 0xdc00 && code <= 0xdfff)
+    {
+        return validateFail(v, start, "invalid Unicode surrogate pair");
+    }
+
+    if (code == 0)
+    {
+        return validateFail(v, start, "\\u0000 is not allowed");
+    }
+
+    if (code < 0x80)
+    {
+        bytes[0] = code;
+    }
+    else if (code < 0x800)
+    {
+        bytes[0] = 0xc0 | code >> 6;
+        bytes[1] = 0x80 | (code & 0x3f);
+        *nbytes = 2;
+    }
+    else if (code < 0x10000)
+    {
+        bytes[0] = 0xe0 | code >> 12;
+        bytes[1] = 0x80 | (code >> 6 & 0x3f);
+        bytes[2] = 0x80 | (code & 0x3f);
+        *nbytes = 3;
+    }
+    else
+    {
+        bytes[0] = 0xf0 | code >> 18;
+        bytes[1] = 0x80 | (code >> 12 & 0x3f);
+        bytes[2] = 0x80 | (code >> 6 & 0x3f);
+        bytes[3] = 0x80 | (code & 0x3f);
+        *nbytes = 4;
+    }
+
+    return 0;
+}
+
+/**
+ * Reads the four hexadecimal digits of a \\u escape.
+ * @param[in] v The validator.
+ * @param[out] code The code unit.
+ * @return 0 if valid, -1 otherwise.
+ */
+
+int8_t validateHex(validator_t *v, uint32_t *code)
+{
+    *code = 0;
+
+    for (size_t i = 0; i < 4; i++)
+    {
+        int c = validateNext(v);
+
+        if (c >= '0' && c <= '9')
+        {
+            *code = *code << 4 | (c - '0');
+        }
+        else if ((c | 0x20) >= 'a' && (c | 0x20) <= 'f')
+        {
+            *code = *code << 4 | ((c | 0x20) - 'a' + 10);
+        }
+        else
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Reads the continuation bytes of a UTF-8 sequence. Overlong sequences,
+ * surrogates and code points above U+10FFFF are invalid.
+ * @param[in] v The validator, after the first byte.
+ * @param[in] start The offset of the first byte.
+ * @param[in] first The first byte.
+ * @param[out] bytes The bytes of the sequence.
+ * @param[out] nbytes The number of bytes.
+ * @return 0 if valid, -1 otherwise.
+ */
+
+int8_t validateUtf8(validator_t *v, uint64_t start, int first, unsigned char *bytes, size_t *nbytes)
+{
+    int low = 0x80;
+    int high = 0xbf;
+
+    if (first >= 0xc2 && first <= 0xdf)
+    {
+        *nbytes = 2;
+    }
+    else if (first >= 0xe0 && first <= 0xef)
+    {
+        *nbytes = 3;
+        first == 0xe0 ? low = 0xa0 : 0;
+        first == 0xed ? high = 0x9f : 0;
+    }
+    else if (first >= 0xf0 && first <= 0xf4)
+    {
+        *nbytes = 4;
+        first == 0xf0 ? low = 0x90 : 0;
+        first == 0xf4 ? high = 0x8f : 0;
+    }
+    else
+    {
+        return validateFail(v, start, "invalid UTF-8");
+    }
+
+    bytes[0] = first;
+
+    for (size_t i = 1; i < *nbytes; i++)
+    {
+        int c = validatePeek(v);
+
+        if (c < low || c > high)
+        {
+            return validateFail(v, start, "invalid UTF-8");
+        }
+
+        bytes[i] = c;
+        v->pos++;
+        low = 0x80;
+        high = 0xbf;
+    }
+
+    return 0;
+}
+
+/**
+ * Checks if a character is in the base64 alphabet.
+ * @param[in] c The character.
+ * @return 1 if true, 0 if false.
+ */
+
+uint8_t validateBase64(unsigned char c)
+{
+    return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c == '+' || c == '/';
+}
+
+/**
+ * Adds an integer to the summary of an array.
+ * @param[in,out] summary The summary.
+ * @param[in] value The integer.
+ */
+
+void validateSummarise(validate_summary_t *summary, json_int_t value)
+{
+    if (summary->count == 0)
+    {
+        summary->min = value;
+        summary->max = value;
+    }
+
+    value <= summary->last && summary->count > 0 ? summary->unordered = 1 : 0;
+    value < summary->min ? summary->min = value : 0;
+    value > summary->max ? summary->max = value : 0;
+
+    // Sums beyond the range of json_int_t do not add up to any length
+    summary->sum = value > 0 && summary->sum > VALIDATE_INTEGER_MAX - value ? VALIDATE_INTEGER_MAX : summary->sum + value;
+    summary->last = value;
+    summary->count++;
+}
+
+/**
+ * Gets the keys of an object of the layout.
+ * @param[in] kind The kind of object.
+ * @param[out] nkeys The number of keys.
+ * @return The keys. The order of the Data keys follows validate_data_key_t.
+ */
+
+const validate_key_t *validateKeys(validate_kind_t kind, size_t *nkeys)
+{
+    static const validate_key_t document[] = {
+        {"Title", VALIDATE_STRING, 0, {0}, 0},
+        {"History", VALIDATE_STRING, 1, {0}, 0},
+        {"Crystals", VALIDATE_CRYSTAL, 1, {0}, VALIDATE_REQUIRED | VALIDATE_NONEMPTY},
+        {"Symmetry", VALIDATE_SYMMETRY, 0, {0}, 0},
+        {"Batches", VALIDATE_BATCH, 1, {0}, 0},
+        {"SortOrder", VALIDATE_INTEGER, 1, {0}, 0},
+        {"UnknownHeaders", VALIDATE_STRING, 1, {0}, 0},
+        {"Sidecar", VALIDATE_STRING, 0, {0}, 0}};
+
+    static const validate_key_t symmetry[] = {
+        {"SpaceGroupNumber", VALIDATE_INTEGER, 0, {0}, 0},
+        {"SpaceGroupName", VALIDATE_STRING, 0, {0}, 0},
+        {"PointGroupName", VALIDATE_STRING, 0, {0}, 0},
+        {"SpaceGroupConfidence", VALIDATE_STRING, 0, {0}, 0},
+        {"NumberOfSymmetryOperations", VALIDATE_INTEGER, 0, {0}, 0},
+        {"NumberOfPrimitiveSymmetryOperations", VALIDATE_INTEGER, 0, {0}, 0},
+        {"SymmetryOperations", VALIDATE_REAL, 3, {192, 4, 4}, 0},
+        {"LatticeType", VALIDATE_STRING, 0, {0}, 0}};
+
+    static const validate_key_t batch[] = {
+        {"Title", VALIDATE_STRING, 0, {0}, 0},
+        {"DatasetID", VALIDATE_INTEGER, 0, {0}, 0},
+        {"CrystalNumber", VALIDATE_INTEGER, 0, {0}, 0},
+        {"BatchNumber", VALIDATE_INTEGER, 0, {0}, 0},
+        {"Wavelength", VALIDATE_REAL, 0, {0}, 0},
+        {"CellDimensions", VALIDATE_REAL, 1, {6}, 0},
+        {"OrientationMatrix", VALIDATE_REAL, 1, {9}, 0},
+        {"TemperatureFactor", VALIDATE_REAL, 0, {0}, 0},
+        {"Scale", VALIDATE_REAL, 0, {0}, 0},
+        {"Mosaicity", VALIDATE_REAL, 1, {12}, 0},
+        {"GoniostatDatum", VALIDATE_REAL, 1, {3}, 0},
+        {"Dispersion", VALIDATE_REAL, 0, {0}, 0},
+        {"CorrelatedComponent", VALIDATE_REAL, 0, {0}, 0},
+        {"DetectorLimits", VALIDATE_REAL, 3, {2, 2, 2}, 0},
+        {"HorizontalBeamDivergence", VALIDATE_REAL, 0, {0}, 0},
+        {"VerticalBeamDivergence", VALIDATE_REAL, 0, {0}, 0},
+        {"DetectorDistance", VALIDATE_REAL, 1, {2}, 0},
+        {"Vector1", VALIDATE_REAL, 1, {3}, 0},
+        {"Vector2", VALIDATE_REAL, 1, {3}, 0},
+        {"Vector3", VALIDATE_REAL, 1, {3}, 0},
+        {"AxesLabels", VALIDATE_STRING, 1, {3}, 0},
+        {"OrientationBlockType", VALIDATE_INTEGER, 0, {0}, 0},
+        {"GoniostatScanAxisNumber", VALIDATE_INTEGER, 0, {0}, 0},
+        {"JumpAxis", VALIDATE_INTEGER, 0, {0}, 0},
+        {"CellRefinementFlags", VALIDATE_INTEGER, 1, {6}, 0},
+        {"BeamInfoFlag", VALIDATE_INTEGER, 0, {0}, 0},
+        {"MosaicityModelFlag", VALIDATE_INTEGER, 0, {0}, 0},
+        {"DataTypeFlag", VALIDATE_INTEGER, 0, {0}, 0},
+        {"MisFlag", VALIDATE_INTEGER, 0, {0}, 0},
+        {"NumberOfBatchScales", VALIDATE_INTEGER, 0, {0}, 0},
+        {"NumberOfDetectors", VALIDATE_INTEGER, 0, {0}, 0},
+        {"NumberOfGoniostatAxes", VALIDATE_INTEGER, 0, {0}, 0},
+        {"EndOfPhi", VALIDATE_REAL, 0, {0}, 0},
+        {"PhiRange", VALIDATE_REAL, 0, {0}, 0},
+        {"StartOfPhi", VALIDATE_REAL, 0, {0}, 0},
+        {"MissettingAngles", VALIDATE_REAL, 2, {2, 3}, 0},
+        {"RotationAxis", VALIDATE_REAL, 1, {3}, 0},
+        {"BFactorSD", VALIDATE_REAL, 0, {0}, 0},
+        {"BScaleSD", VALIDATE_REAL, 0, {0}, 0},
+        {"SourceVector", VALIDATE_REAL, 1, {3}, 0},
+        {"IdealisedSourceVector", VALIDATE_REAL, 1, {3}, 0},
+        {"Theta", VALIDATE_REAL, 1, {2}, 0},
+        {"StartTime", VALIDATE_REAL, 0, {0}, 0},
+        {"StopTime", VALIDATE_REAL, 0, {0}, 0}};
+
+    static const validate_key_t crystal[] = {
+        {"CrystalName", VALIDATE_STRING, 0, {0}, 0},
+        {"ProjectName", VALIDATE_STRING, 0, {0}, 0},
+        {"CellConstants", VALIDATE_REAL, 1, {6}, 0},
+        {"ResolutionMax", VALIDATE_REAL, 0, {0}, 0},
+        {"ResolutionMin", VALIDATE_REAL, 0, {0}, 0},
+        {"Datasets", VALIDATE_DATASET, 1, {0}, VALIDATE_REQUIRED}};
+
+    static const validate_key_t dataset[] = {
+        {"DatasetName", VALIDATE_STRING, 0, {0}, 0},
+        {"DatasetID", VALIDATE_INTEGER, 0, {0}, 0},
+        {"Wavelength", VALIDATE_REAL, 0, {0}, 0},
+        {"Columns", VALIDATE_COLUMN, 1, {0}, VALIDATE_REQUIRED | VALIDATE_NONEMPTY}};
+
+    static const validate_key_t column[] = {
+        {"ColumnSource", VALIDATE_STRING, 0, {0}, 0},
+        {"GroupName", VALIDATE_STRING, 0, {0}, 0},
+        {"GroupPosition", VALIDATE_INTEGER, 0, {0}, 0},
+        {"GroupType", VALIDATE_STRING, 0, {0}, 0},
+        {"Label", VALIDATE_STRING, 0, {0}, 0},
+        {"MaxValue", VALIDATE_REAL, 0, {0}, 0},
+        {"MinValue", VALIDATE_REAL, 0, {0}, 0},
+        {"ColumnID", VALIDATE_INTEGER, 0, {0}, 0},
+        {"Type", VALIDATE_STRING, 0, {0}, 0},
+        {"DataEncoding", VALIDATE_ENCODING, 0, {0}, 0},
+        {"Data", VALIDATE_DATA, 0, {0}, VALIDATE_REQUIRED}};
+
+    static const validate_key_t data[VALIDATE_DATA_KEYS] = {
+        {"Length", VALIDATE_INTEGER, 0, {0}, 0},
+        {"Offset", VALIDATE_INTEGER, 0, {0}, 0},
+        {"Member", VALIDATE_STRING, 0, {0}, 0},
+        {"Missing", VALIDATE_INTEGER, 1, {0}, 0},
+        {"Values", VALIDATE_REFLECTION, 1, {0}, 0},
+        {"Runs", VALIDATE_INTEGER, 1, {0}, 0},
+        {"Dictionary", VALIDATE_REFLECTION, 1, {0}, 0},
+        {"Codes", VALIDATE_INTEGER, 1, {0}, 0},
+        {"Indices", VALIDATE_INTEGER, 1, {0}, 0}};
+
+    switch (kind)
+    {
+    case VALIDATE_DOCUMENT:
+        *nkeys = sizeof(document) / sizeof(validate_key_t);
+        return document;
+    case VALIDATE_SYMMETRY:
+        *nkeys = sizeof(symmetry) / sizeof(validate_key_t);
+        return symmetry;
+    case VALIDATE_BATCH:
+        *nkeys = sizeof(batch) / sizeof(validate_key_t);
+        return batch;
+    case VALIDATE_CRYSTAL:
+        *nkeys = sizeof(crystal) / sizeof(validate_key_t);
+        return crystal;
+    case VALIDATE_DATASET:
+        *nkeys = sizeof(dataset) / sizeof(validate_key_t);
+        return dataset;
+    case VALIDATE_COLUMN:
+        *nkeys = sizeof(column) / sizeof(validate_key_t);
+        return column;
+    case VALIDATE_DATA:
+        *nkeys = VALIDATE_DATA_KEYS;
+        return data;
+    default:
+        *nkeys = 0;
+        return NULL;
+    }
+}
+
+/**
+ * Skips whitespace.
+ * @param[in] v The validator.
+ * @return The next character, or -1 at the end of input.
+ */
+
+int validateSpace(validator_t *v)
+{
+    int c;
+
+    while ((c = validatePeek(v)) == ' ' || c == '\n' || c == '\r' || c == '\t')
+    {
+        v->pos++;
+    }
+
+    return c;
+}
+
+/**
+ * Gets the next character without consuming it.
+ * @param[in] v The validator.
+ * @return The character, or -1 at the end of input.
+ */
+
+int validatePeek(validator_t *v)
+{
+    return v->pos < v->length || validateFill(v) ? v->buffer[v->pos] : -1;
+}
+
+/**
+ * Consumes the next character.
+ * @param[in] v The validator.
+ * @return The character, or -1 at the end of input.
+ */
+
+int validateNext(validator_t *v)
+{
+    return v->pos < v->length || validateFill(v) ? v->buffer[v->pos++] : -1;
+}
+
+/**
+ * Reads the next block of input.
+ * @param[in] v The validator.
+ * @return 1 if input was read, 0 at the end of input.
+ */
+
+uint8_t validateFill(validator_t *v)
+{
+    size_t n;
+
+    if (!v->read || v->broken)
+    {
+        return 0;
+    }
+
+    n = v->read(v->storage, VALIDATE_BUFFER, v->data);
+    n == (size_t)-1 ? v->broken = 1, n = 0 : 0;
+
+    v->offset += v->length;
+    v->length = n;
+    v->pos = 0;
+
+    return n > 0;
+}
+
+/**
+ * Gets the input offset of the next character.
+ * @param[in] v The validator.
+ * @return The offset in bytes.
+ */
+
+uint64_t validateOffset(const validator_t *v)
+{
+    return v->offset + v->pos;
+}
+
+/**
+ * Records the first error.
+ * @param[in] v The validator.
+ * @param[in] offset The input offset of the error.
+ * @param[in] format printf format of the message.
+ * @return -1.
+ */
+
+int8_t validateFail(validator_t *v, uint64_t offset, const char *format, ...)
+{
+    va_list args;
+
+    if (v->error->text[0] == '\0')
+    {
+        v->error->offset = offset;
+        va_start(args, format);
+        vsnprintf(v->error->text, sizeof(v->error->text), format, args);
+        va_end(args);
+    }
+
+    return -1;
+}